@@ -11,18 +11,23 @@
 // USART Defines
 #define BAUD_RATE 115200        // Define the baud rate for the USART
                                 // Max BAUD_RATE = F_CPU / S [Min clock period, S = 16 for async]
+#define USART_TX_BUFFER_SIZE 64 // Size of the USART1 transmit queue in bytes (must be a power of 2, max 128)
 
 // ADC Defines
-#define ADC_SAMPLES 16          // Number of samples for ADC burst mode
+#define ADC_SAMPLES 16          // Number of samples for ADC burst mode: 1, 2, 4 ... 1024 (see README, Oversampling)
+#define ADC_DECIMATE_SHIFT 0    // Average 2^n bursts for each measurement (boxcar decimation), 0 = one burst
 #define ADC_GAIN 16             // Gain for PGA operation
 #define ADC_REF 3.300           // ADC reference voltage in V 
+#define ADC_REF_MV 3300         // ADC reference voltage in mV (used by the fixed-point math)
+#define ADC_PRESC_DIV 10        // ADC clock prescaler, f_CLK_ADC = F_CPU / ADC_PRESC_DIV
+#define ADC_SAMPDUR 12          // Sample duration in CLK_ADC cycles (must be >= 12 in burst mode)
 
 // DAC Defines
 #define DAC_REF 3.300           // DAC reference voltage in V 
 #define DAC_OUT 1.000           // DAC output in V
 
 // General Defines
-#define TIMEBASE_VALUE ((uint8_t) ceil(F_CPU * 0.000001))
+#define TIMEBASE_VALUE ((uint8_t) ((F_CPU + 999999UL) / 1000000UL))
                                                          // TIMEBASE_VALUE = number of clock ticks in 1us
 #define WAKEUP_TIME 10          // Wakeup and sample ADC each 10 seconds
 #define R_SENSE 10000           // Sense resistor value in Ohm
@@ -30,29 +35,798 @@
 #define LED_ON                  // Enable blink LED (PB3) on ADC sampling
 #define PGA_ON                  // turn on PGA for ADC
 #define USART_ON                // Enable USART1 output on terminal
+//#define ADC_SLEEP               // Sleep in standby while ADC is converting, wake up on result ready interrupt (see README)
+//#define FIXED_POINT             // Use integer (fixed-point) math for the measurement instead of float (see README)
+//#define BINARY_OUTPUT           // Send compact binary frames on USART1 instead of ASCII text (see README)
+//#define PHASE_TRACE             // Timestamp each phase of a measurement with TCB0 and send the trace (see README)
+#define TRACE_SIZE 12           // Max number of timestamps in one trace
+//#define WINDOW_MONITOR          // PIT event starts conversions, CPU only wakes when result leaves window (see README)
+#define MONITOR_LOW_NA 4000     // Window low threshold in nA (WINDOW_MONITOR)
+#define MONITOR_HIGH_NA 6000    // Window high threshold in nA (WINDOW_MONITOR)
+#define MONITOR_EVGEN RTC_EVGEN0SEL_DIV1024_gc
+                                // PIT event period for conversions, 1024 cycles of 1.024kHz = 1s (WINDOW_MONITOR)
+#define MONITOR_HEARTBEAT 3600  // Report at least every 3600 seconds even if inside window (WINDOW_MONITOR)
+//#define ADAPTIVE_INTERVAL       // Change time between measurements with the rate of change of the signal (see README)
+#define ADAPT_MIN_TIME 1        // Shortest time between measurements in seconds (ADAPTIVE_INTERVAL)
+#define ADAPT_MAX_TIME 160      // Longest time between measurements in seconds, max 255 (ADAPTIVE_INTERVAL)
+#define ADAPT_FAST_NA 200       // Change in nA between two measurements that selects ADAPT_MIN_TIME (ADAPTIVE_INTERVAL)
+#define ADAPT_STABLE_NA 50      // Change in nA below which the signal is stable (ADAPTIVE_INTERVAL)
+#define ADAPT_STABLE_COUNT 4    // Number of stable measurements before the time is doubled (ADAPTIVE_INTERVAL)
+//#define BATCH_OUTPUT            // Store results in SRAM and send them in one USART1 burst (see README)
+#define BATCH_SIZE 256          // Number of results stored before sending, 6 bytes each (BATCH_OUTPUT)
+#define BATCH_MAX_LATENCY 3600  // Send stored results at least every 3600 seconds (BATCH_OUTPUT)
+#define BATCH_LOW_NA 1000       // Send stored results at once if current is below this (BATCH_OUTPUT)
+#define BATCH_HIGH_NA 20000     // Send stored results at once if current is above this (BATCH_OUTPUT)
+//#define WINDOW_STATS            // Send count/min/max/mean/stddev once per window instead of each result (see README)
+#define STATS_WINDOW 60         // Number of measurements in one statistics window, 2 to 65535 (WINDOW_STATS)
+//#define MULTI_CHANNEL           // Measure current and RTD temperature from a channel table (see README)
+#define RTD_PERIOD 30           // Seconds between RTD measurements (MULTI_CHANNEL)
+#define RTD_DAC_OUT 1.800       // DAC output in V when measuring the RTD, also used as VREFA (MULTI_CHANNEL)
+#define DAC_SETTLE_US 10        // Wait after changing the DAC0 output before starting a conversion (MULTI_CHANNEL, RECALIBRATE, AUTO_RANGE)
+//#define RECALIBRATE             // Track ADC0 offset and bias with short conversions between measurements (see README)
+#define RECAL_RATIO 4           // One offset or bias conversion every 4 measurements (RECALIBRATE)
+#define RECAL_EWMA_SHIFT 3      // Each offset/bias conversion moves the estimate 1/8 of the way (RECALIBRATE)
+#define RECAL_DRIFT_NA 100      // Full recalibration when offset + bias drift more than 100 nA (RECALIBRATE)
+//#define CLOCK_SCALING           // Change main clock and ADC prescaler between measurement phases (see README)
+#define CLOCK_POLICY CLOCK_MIN_ENERGY // CLOCK_MIN_ENERGY or CLOCK_MIN_LATENCY (CLOCK_SCALING)
+#define CLOCK_SLOW_DIV 10       // Main clock divider during ADC bursts with CLOCK_MIN_ENERGY, 20 MHz / 10 = 2 MHz
+//#define AUTO_RANGE              // Select PGA gain (bypass, 2x ... 16x) for each measurement (see README)
+#define RANGE_HIGH_PCT 90       // Result above 90% of full scale: lower gain and measure again (AUTO_RANGE)
+#define RANGE_LOW_PCT 40        // Result below 40% of full scale: higher gain next time, max RANGE_HIGH_PCT / 2 (AUTO_RANGE)
+//#define NVM_LOG                 // Store every result in a wear-leveled log at the end of flash, dump with SW0 (see README)
+#define NVM_LOG_PAGES 32        // Number of 128-byte flash pages used for the log, multiple of 4 up to 252: 4 kB at 0xF000 (NVM_LOG)
+//#define PIPELINE                // Process and report the previous result while ADC0 converts the next (see README)
+//#define SETTLE_CAL              // Measure DAC0/PGA settling time at start-up, wait that long before each burst (see README)
+#define SETTLE_MAX_TICKS 32     // Longest settling time that is tried, in RTC ticks of 1/32768 s = 30.5us (SETTLE_CAL)
+#define SETTLE_TOL 2            // Settled when the mean of a 16-sample burst is within 2 LSB of the settled mean (SETTLE_CAL)
+#define SETTLE_OFF_MS 20        // Analog off time before each try, so the circuit discharges (SETTLE_CAL)
+//#define TRANSIENT_CAPTURE       // Free-run ADC0 into a pre/post-trigger buffer and send each triggered block (see README)
+#define CAPTURE_SIZE 1024       // Samples in one block, power of 2 from 128 to 2048, 2 bytes each (TRANSIENT_CAPTURE)
+#define CAPTURE_PRE 256         // Samples before the trigger in each block (TRANSIENT_CAPTURE)
+#define CAPTURE_TRIGGER CAPTURE_TRIGGER_WINDOW
+                                // CAPTURE_TRIGGER_WINDOW (current above CAPTURE_TRIGGER_NA) or CAPTURE_TRIGGER_PIN (PB2 low)
+#define CAPTURE_TRIGGER_NA 20000 // Window trigger threshold in nA (TRANSIENT_CAPTURE)
+#define CAPTURE_PRESC_DIV 2     // ADC clock prescaler while capturing: 2, 4, 8 or 16 (TRANSIENT_CAPTURE)
+//#define RESULT_FILTER           // Median and IIR filter of the adjusted result over measurements (see README)
+#define FILTER_MEDIAN 3         // Median of the last 3 results: 1 (off), 3 or 5 (RESULT_FILTER)
+#define FILTER_IIR_SHIFT 2      // First-order IIR, y = y + (x - y) / 2^2: 0 (off) to 6 (RESULT_FILTER)
+#define FILTER_STEP_NA 2000     // Follow a change of more than 2000 nA at once (RESULT_FILTER)
 
 
 // Inlcudes
 #include <avr/io.h>
-#include <math.h>
 #include <util/delay.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
 
 
+// ADC0 SAMPNUM setting for ADC_SAMPLES. Results of more than 32 samples are scaled
+// down to 32 samples by adc0_wait_result(), so the accumulated result always fits
+// in ADC_RESULT_BITS = 17 bits, and ADC_SCALE_SAMPLES is the number of samples the
+// result represents
+#if ADC_SAMPLES == 1
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_NONE_gc
+#elif ADC_SAMPLES == 2
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC2_gc
+#elif ADC_SAMPLES == 4
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC4_gc
+#elif ADC_SAMPLES == 8
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC8_gc
+#elif ADC_SAMPLES == 16
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC16_gc
+#elif ADC_SAMPLES == 32
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC32_gc
+#elif ADC_SAMPLES == 64
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC64_gc
+#elif ADC_SAMPLES == 128
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC128_gc
+#elif ADC_SAMPLES == 256
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC256_gc
+#elif ADC_SAMPLES == 512
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC512_gc
+#elif ADC_SAMPLES == 1024
+    #define ADC_SAMPNUM_SEL ADC_SAMPNUM_ACC1024_gc
+#else
+    #error "ADC_SAMPLES must be a power of 2 from 1 to 1024"
+#endif
+
+#if ADC_SAMPLES > 32
+    #define ADC_SCALE_SAMPLES 32
+#else
+    #define ADC_SCALE_SAMPLES ADC_SAMPLES
+#endif
+#if ADC_SCALE_SAMPLES > 16
+    #define ADC_RESULT_BITS 17                              // 32 * 2047 needs 17 bits with the sign
+#else
+    #define ADC_RESULT_BITS 16
+#endif
+#if (ADC_SAMPLES > 16) && defined(WINDOW_MONITOR)
+    #error "WINDOW_MONITOR compares the unscaled result with 16-bit limits, ADC_SAMPLES must be 16 or less"
+#endif
+
+
+/**************************************************************
+*
+*   Fixed-point scale factors
+*
+*   The corrected accumulated ADC result is converted to engineering
+*   units with one multiply and one shift: 
+*   value = (sample_acc * FP_SCALE(num, den)) >> FP_SHIFT(num, den)
+*   where num/den is the exact conversion factor. Gain and number of
+*   samples are folded into the factor, so no division is done at runtime.
+*   FP_SHIFT is the largest shift (max 15) that still keeps FP_SCALE
+*   below 2^15, so |sample_acc| < 2^16 can never overflow 32 bits.
+*   Results of up to FP_X_BITS = 17 bits (ADC_SAMPLES 32 or more), or
+*   21 bits (AUTO_RANGE) are multiplied in two parts, the upper 16 bits
+*   and the lower FP_LO_BITS bits, so the factor keeps all of its bits.
+*   Everything below is evaluated by the compiler.
+*
+**************************************************************/
+#ifdef AUTO_RANGE
+    #define FP_X_BITS (ADC_RESULT_BITS + 4)                 // Results at low gain are scaled up to ADC_GAIN (16x)
+#else
+    #define FP_X_BITS ADC_RESULT_BITS
+#endif
+#define FP_LO_BITS (FP_X_BITS - 16)                         // Bits of x below the upper 16 bits
+
+#ifdef PGA_ON
+    #define FP_GAIN ADC_GAIN
+#else
+    #define FP_GAIN 1
+#endif
+
+#define FP_FULL_SCALE (2048ULL * ADC_SCALE_SAMPLES * FP_GAIN) // Accumulated result when V_in = ADC_REF
+
+#define FP_VOLTAGE_NUM (ADC_REF_MV * 1000ULL)               // sample_acc --> voltage in uV
+#define FP_VOLTAGE_DEN (FP_FULL_SCALE)
+#define FP_CURRENT_NUM (ADC_REF_MV * 1000000ULL)            // sample_acc --> current in nA
+#define FP_CURRENT_DEN (FP_FULL_SCALE * R_SENSE)
+
+#define FP_RATIO(num, den, s) ((((uint64_t)(num) << (s)) + (den) / 2) / (den))
+#define FP_FITS(num, den, s) (FP_RATIO(num, den, s) < (1UL << 15))
+#define FP_SHIFT(num, den) \
+    (FP_FITS(num, den, 15) ? 15 : FP_FITS(num, den, 14) ? 14 : FP_FITS(num, den, 13) ? 13 : \
+     FP_FITS(num, den, 12) ? 12 : FP_FITS(num, den, 11) ? 11 : FP_FITS(num, den, 10) ? 10 : \
+     FP_FITS(num, den,  9) ?  9 : FP_FITS(num, den,  8) ?  8 : FP_FITS(num, den,  7) ?  7 : \
+     FP_FITS(num, den,  6) ?  6 : FP_FITS(num, den,  5) ?  5 : FP_FITS(num, den,  4) ?  4 : \
+     FP_FITS(num, den,  3) ?  3 : FP_FITS(num, den,  2) ?  2 : FP_FITS(num, den,  1) ?  1 : 0)
+#define FP_SCALE(num, den) ((int32_t) FP_RATIO(num, den, FP_SHIFT(num, den)))
+
+// Convert accumulated result x to the unit given by num/den (rounded to nearest)
+#if FP_X_BITS > 16
+    // (x >> L) * scale + (((x & (2^L - 1)) * scale) >> L), shifted by FP_SHIFT - L, is the same as
+    // x * scale shifted by FP_SHIFT: the part dropped from the low product is below 1 LSB of the sum
+    #define FP_CONVERT(x, num, den) \
+        (((((int32_t)(x) >> FP_LO_BITS) * FP_SCALE(num, den)) \
+        + ((((int32_t)(x) & ((1L << FP_LO_BITS) - 1)) * FP_SCALE(num, den)) >> FP_LO_BITS) \
+        + ((1L << (FP_SHIFT(num, den) - FP_LO_BITS)) >> 1)) >> (FP_SHIFT(num, den) - FP_LO_BITS))
+#else
+    #define FP_CONVERT(x, num, den) \
+        ((((int32_t)(x) * FP_SCALE(num, den)) + ((1L << FP_SHIFT(num, den)) >> 1)) >> FP_SHIFT(num, den))
+#endif
+
+// Convert a current in nA to an accumulated result (before offset/bias), for constants only
+#define FP_CODE_FROM_NA(na) ((int32_t) (((int64_t)(na) * (int64_t) FP_CURRENT_DEN) / (int64_t) FP_CURRENT_NUM))
+
+
+#if (ADC_DECIMATE_SHIFT < 0) || (ADC_DECIMATE_SHIFT > 8)
+    #error "ADC_DECIMATE_SHIFT must be 0 to 8"
+#endif
+
+// Divide by 2^s with rounding (s may be 0)
+#define ROUND_SHIFT(x, s) (((x) + ((1L << (s)) >> 1)) >> (s))
+
+// Divide by d > 0 with rounding half away from zero, the same for positive and negative x
+// (x is used twice, so it must not have side effects)
+#define ROUND_DIV(x, d) (((x) < 0) ? (((x) - (d) / 2) / (d)) : (((x) + (d) / 2) / (d)))
+
+
+// DAC0.DATA value for an output in V, rounded, evaluated by the compiler (DAC is 10 bit).
+// The voltages are rounded to mV first, so 1.8 V is 1800 mV and not 1799.99 mV
+#define DAC_MV(volt) ((int32_t) ((volt) * 1000.0 + 0.5))
+#define DAC_CODE(volt) ((uint16_t) ROUND_DIV(DAC_MV(volt) * 1024L, DAC_MV(DAC_REF)))
+
+
+/**************************************************************
+*
+*   Configuration checks and register values
+*
+*   All register values that depend on the settings at the top
+*   of the file are calculated here by the compiler, and settings
+*   that the hardware can not run are stopped with an error
+*
+**************************************************************/
+#if ADC_PRESC_DIV == 2
+    #define ADC_PRESC_SEL ADC_PRESC_DIV2_gc
+#elif ADC_PRESC_DIV == 4
+    #define ADC_PRESC_SEL ADC_PRESC_DIV4_gc
+#elif ADC_PRESC_DIV == 6
+    #define ADC_PRESC_SEL ADC_PRESC_DIV6_gc
+#elif ADC_PRESC_DIV == 8
+    #define ADC_PRESC_SEL ADC_PRESC_DIV8_gc
+#elif ADC_PRESC_DIV == 10
+    #define ADC_PRESC_SEL ADC_PRESC_DIV10_gc
+#elif ADC_PRESC_DIV == 12
+    #define ADC_PRESC_SEL ADC_PRESC_DIV12_gc
+#elif ADC_PRESC_DIV == 14
+    #define ADC_PRESC_SEL ADC_PRESC_DIV14_gc
+#elif ADC_PRESC_DIV == 16
+    #define ADC_PRESC_SEL ADC_PRESC_DIV16_gc
+#elif ADC_PRESC_DIV == 20
+    #define ADC_PRESC_SEL ADC_PRESC_DIV20_gc
+#elif ADC_PRESC_DIV == 24
+    #define ADC_PRESC_SEL ADC_PRESC_DIV24_gc
+#elif ADC_PRESC_DIV == 28
+    #define ADC_PRESC_SEL ADC_PRESC_DIV28_gc
+#elif ADC_PRESC_DIV == 32
+    #define ADC_PRESC_SEL ADC_PRESC_DIV32_gc
+#elif ADC_PRESC_DIV == 40
+    #define ADC_PRESC_SEL ADC_PRESC_DIV40_gc
+#elif ADC_PRESC_DIV == 48
+    #define ADC_PRESC_SEL ADC_PRESC_DIV48_gc
+#elif ADC_PRESC_DIV == 56
+    #define ADC_PRESC_SEL ADC_PRESC_DIV56_gc
+#elif ADC_PRESC_DIV == 64
+    #define ADC_PRESC_SEL ADC_PRESC_DIV64_gc
+#else
+    #error "ADC_PRESC_DIV is not a valid ADC0 prescaler setting"
+#endif
+
+#define ADC_CLK_HZ (F_CPU / ADC_PRESC_DIV)                  // f_CLK_ADC in Hz
+#if ADC_CLK_HZ > 6000000UL
+    #error "f_CLK_ADC must be 6 MHz or less with PGA bias 100%, increase ADC_PRESC_DIV"
+#endif
+#if ADC_SAMPDUR < 12
+    #error "ADC_SAMPDUR must be 12 or more in burst mode"
+#endif
+
+#if ADC_GAIN == 1
+    #define ADC_GAIN_SEL ADC_GAIN_1X_gc
+#elif ADC_GAIN == 2
+    #define ADC_GAIN_SEL ADC_GAIN_2X_gc
+#elif ADC_GAIN == 4
+    #define ADC_GAIN_SEL ADC_GAIN_4X_gc
+#elif ADC_GAIN == 8
+    #define ADC_GAIN_SEL ADC_GAIN_8X_gc
+#elif ADC_GAIN == 16
+    #define ADC_GAIN_SEL ADC_GAIN_16X_gc
+#else
+    #error "ADC_GAIN must be 1, 2, 4, 8 or 16"
+#endif
+
+// USART1.BAUD = 64 * F_CPU / (16 * BAUD_RATE), rounded. The baud rate error must be within 2%
+#define USART_BAUD_REG(f_cpu, baud) ((64UL * (f_cpu) + 8UL * (baud)) / (16UL * (baud)))
+#define USART_BAUD_VALUE USART_BAUD_REG(F_CPU, BAUD_RATE)
+#define USART_BAUD_ACTUAL ((64UL * F_CPU) / (16UL * USART_BAUD_VALUE))
+#if USART_BAUD_VALUE < 64
+    #error "BAUD_RATE is too high for F_CPU"
+#endif
+#if (USART_BAUD_ACTUAL * 1000 / BAUD_RATE > 1020) || (USART_BAUD_ACTUAL * 1000 / BAUD_RATE < 980)
+    #error "BAUD_RATE error is more than 2% with this F_CPU"
+#endif
+
+#if (F_CPU + 999999UL) / 1000000UL > 31                 // TIMEBASE_VALUE
+    #error "F_CPU is too high for MCLKTIMEBASE"
+#endif
+
+#ifdef CLOCK_SCALING
+// Clock profiles, see clock_set(). With CLOCK_MIN_ENERGY the ADC burst runs on a slow main
+// clock (CLOCK_SLOW_DIV) with ADC prescaler 2, and the math and formatting on F_CPU. With
+// CLOCK_MIN_LATENCY everything runs on F_CPU, with the fastest ADC clock allowed (6 MHz max)
+#define CLOCK_MIN_ENERGY 0
+#define CLOCK_MIN_LATENCY 1
+#define CLOCK_MEASURE 0                                     // Profile for ADC bursts and sleep
+#define CLOCK_COMPUTE 1                                     // Profile for math, formatting and sending
+
+#define CLOCK_OSC_HZ (2UL * F_CPU)                          // OSCHF frequency, F_CPU is OSCHF / 2 (init_clock)
+#define CLOCK_SLOW_HZ (CLOCK_OSC_HZ / CLOCK_SLOW_DIV)
+
+#if CLOCK_SLOW_DIV == 2
+    #define CLOCK_SLOW_PDIV CLKCTRL_PDIV_DIV2_gc
+#elif CLOCK_SLOW_DIV == 4
+    #define CLOCK_SLOW_PDIV CLKCTRL_PDIV_DIV4_gc
+#elif CLOCK_SLOW_DIV == 6
+    #define CLOCK_SLOW_PDIV CLKCTRL_PDIV_DIV6_gc
+#elif CLOCK_SLOW_DIV == 8
+    #define CLOCK_SLOW_PDIV CLKCTRL_PDIV_DIV8_gc
+#elif CLOCK_SLOW_DIV == 10
+    #define CLOCK_SLOW_PDIV CLKCTRL_PDIV_DIV10_gc
+#elif CLOCK_SLOW_DIV == 16
+    #define CLOCK_SLOW_PDIV CLKCTRL_PDIV_DIV16_gc
+#else
+    #error "CLOCK_SLOW_DIV must be 2, 4, 6, 8, 10 or 16"
+#endif
+
+#if CLOCK_SLOW_HZ / 2 > 6000000UL
+    #error "f_CLK_ADC must be 6 MHz or less with PGA bias 100%, increase CLOCK_SLOW_DIV"
+#endif
+#if (CLOCK_POLICY == CLOCK_MIN_LATENCY) && (F_CPU / 2 > 6000000UL)
+    #error "CLOCK_MIN_LATENCY needs f_CLK_ADC = F_CPU / 2 of 6 MHz or less"
+#endif
+
+// USART1.BAUD on the slow clock, checked like USART_BAUD_VALUE
+#define CLOCK_SLOW_BAUD ((64UL * CLOCK_SLOW_HZ + 8UL * BAUD_RATE) / (16UL * BAUD_RATE))
+#define CLOCK_SLOW_BAUD_ACTUAL ((64UL * CLOCK_SLOW_HZ) / (16UL * CLOCK_SLOW_BAUD))
+#if CLOCK_SLOW_BAUD < 64
+    #error "BAUD_RATE is too high for the slow clock, decrease CLOCK_SLOW_DIV"
+#endif
+#if (CLOCK_SLOW_BAUD_ACTUAL * 1000 / BAUD_RATE > 1020) || (CLOCK_SLOW_BAUD_ACTUAL * 1000 / BAUD_RATE < 980)
+    #error "BAUD_RATE error is more than 2% on the slow clock"
+#endif
+
+#ifdef WINDOW_MONITOR
+    #error "CLOCK_SCALING can not be used with WINDOW_MONITOR"
+#endif
+#endif
+
+// Settings in V can not be checked by the preprocessor, the compiler checks them instead
+_Static_assert(DAC_OUT <= DAC_REF, "DAC_OUT must be less than DAC_REF");
+_Static_assert((int32_t) (ADC_REF * 1000.0 + 0.5) == ADC_REF_MV, "ADC_REF and ADC_REF_MV do not match");
+_Static_assert(R_SENSE > 0, "R_SENSE must be more than 0");
+_Static_assert(FP_SHIFT(FP_VOLTAGE_NUM, FP_VOLTAGE_DEN) >= FP_LO_BITS
+            && FP_SHIFT(FP_CURRENT_NUM, FP_CURRENT_DEN) >= FP_LO_BITS, "Fixed-point factor too large for FP_X_BITS");
+
+
+/**************************************************************
+*
+*   Timing model
+*
+*   Duration of the ADC0 phases of one measurement, calculated by
+*   the compiler from the settings above with the t_conv formula
+*   of the data sheet (see do_ADC0_measurement()). t_init is the
+*   time from enable until ADC0 is ready (trace phase 1 to 2), and
+*   MODEL_T_BURST_NS the burst(s) (trace phase 2 to 3). With
+*   PHASE_TRACE the model is sent with each trace, so it can be
+*   compared with the measured times (see README, Phase tracing).
+*   The model uses ADC_PRESC_DIV, so it does not hold with
+*   CLOCK_SCALING. The formulas take the settings as arguments,
+*   so the energy_sweep tool of the host build evaluates them for
+*   other settings too
+*
+**************************************************************/
+#define MODEL_T_INIT_PGA_NS 20000ULL                        // t_init with PGA
+#define MODEL_T_INIT_ADC_NS 10000ULL                        // t_init without PGA
+#define MODEL_PGA_NS 3000ULL                                // ADCPGASAMPDUR with PGA bias 100%
+// One burst of n samples with PGA: ((SAMPDUR + 2) * SAMPNUM + 14) / f_CLK_ADC + ADCPGASAMPDUR * SAMPNUM
+#define MODEL_CONV_PGA_NS(sampdur, n, clk_hz, pga_ns) (((((sampdur) + 2ULL) * (n) + 14ULL) * 1000000000ULL) \
+                                                      / (clk_hz) + (pga_ns) * (n))
+// One burst of n samples without PGA: ((SAMPDUR + 14) * SAMPNUM + 1.5) / f_CLK_ADC, counted in half ADC clocks
+#define MODEL_CONV_ADC_NS(sampdur, n, clk_hz) (((((sampdur) + 14ULL) * (n) * 2ULL + 3ULL) * 500000000ULL) \
+                                              / (clk_hz))
+#ifdef PGA_ON
+    #define MODEL_T_INIT_NS MODEL_T_INIT_PGA_NS
+    #define MODEL_T_CONV_NS MODEL_CONV_PGA_NS(ADC_SAMPDUR, ADC_SAMPLES, ADC_CLK_HZ, MODEL_PGA_NS)
+#else
+    #define MODEL_T_INIT_NS MODEL_T_INIT_ADC_NS
+    #define MODEL_T_CONV_NS MODEL_CONV_ADC_NS(ADC_SAMPDUR, ADC_SAMPLES, ADC_CLK_HZ)
+#endif
+#define MODEL_T_BURST_NS (MODEL_T_CONV_NS << ADC_DECIMATE_SHIFT)
+
+// Time in PHASE_TRACE ticks (CLK_PER / 2), limited to the 16-bit trace timer
+#define MODEL_TICKS(ns) ((uint16_t) ((((ns) * (F_CPU / 2)) / 1000000000ULL) > 65535ULL ? \
+                        65535ULL : (((ns) * (F_CPU / 2)) / 1000000000ULL)))
+
+// Float conversion factors (without FIXED_POINT), folded by the compiler
+#define FLOAT_VOLTAGE_SCALE (ADC_REF / (2048.0 * ADC_SCALE_SAMPLES * FP_GAIN))  // sample_acc --> V
+#define FLOAT_CURRENT_SCALE (FLOAT_VOLTAGE_SCALE * 1000000.0 / R_SENSE)         // sample_acc --> uA
+
+#ifdef MULTI_CHANNEL
+// RTD circuit constants (same circuit as the analog-voltage-sensing example, on AIN2/AIN3)
+#define RTD_R_FIXED 1800.0                                  // Fixed resistor from DAC0OUT to AIN2 in Ohm
+#define RTD_R0 100.0                                        // RTD resistance at 0 C in Ohm
+#define RTD_ALPHA 0.385                                     // RTD sensitivity in Ohm per degree C
+#define RTD_X_FULL ((uint32_t) (0.992 * 16.0 * 2048.0 * 16.0 + 0.5)) // Accumulated result at V_REF (16x gain, 16 samples)
+#define RTD_R_Q 6                                           // Resistance is in Q6 format (1/64 Ohm)
+#define RTD_R_NUM ((uint32_t) (RTD_R_FIXED * (1L << RTD_R_Q)))
+#define RTD_R0_Q ((int32_t) (RTD_R0 * (1L << RTD_R_Q)))
+#define RTD_T_SHIFT 12                                      // Temperature = ((r - R0) * RTD_T_SCALE) >> RTD_T_SHIFT in 1/100 C
+#define RTD_T_SCALE ((int32_t) (100.0 * (1L << RTD_T_SHIFT) / ((1L << RTD_R_Q) * RTD_ALPHA) + 0.5))
+#endif
+
+
+// ADC0 and DAC0 enable values. With ADC_SLEEP both must keep running in standby sleep (RUNSTDBY)
+#ifdef ADC_SLEEP
+    #define ADC_CTRLA_ON (ADC_ENABLE_bm | ADC_RUNSTDBY_bm)
+    #define DAC_CTRLA_ON (DAC_OUTEN_bm | DAC_ENABLE_bm | DAC_RUNSTDBY_bm)
+#else
+    #define ADC_CTRLA_ON (ADC_ENABLE_bm)
+    #define DAC_CTRLA_ON (DAC_OUTEN_bm | DAC_ENABLE_bm)
+#endif
+
+// ADC0 conversion states, see adc0_start(), adc0_wait_result() and ISR(ADC0_RESRDY_vect)
+#define ADC_STATE_IDLE 0                                  // No conversion in progress
+#define ADC_STATE_BUSY 1                                  // Conversion started, waiting for result ready
+#define ADC_STATE_DONE 2                                  // Result ready, not read yet
+
+
+// Measurement phases recorded with PHASE_TRACE. Each timestamp marks the end of a phase
+#define TRACE_WAKEUP 0                                    // Woken by PIT, trace timer started (always at time 0)
+#define TRACE_ANALOG_ON 1                                 // DAC0 and ADC0 enabled
+#define TRACE_ADC_START 2                                 // ADC0 ready, burst conversion started
+#define TRACE_ADC_DONE 3                                  // Burst conversion done, result read
+#define TRACE_MATH_DONE 4                                 // Result converted to voltage/current
+#define TRACE_REPORT_QUEUED 5                             // Report formatted and queued for USART1
+#define TRACE_LED_OFF 6                                   // LED turned off, CPU goes back to sleep
+#define TRACE_UART_DONE 7                                 // Last byte of the report sent, USART1 powered down
+
+#define TRACE_STATE_OFF 0                                 // Not recording, nothing to send
+#define TRACE_STATE_RECORDING 1                           // Trace timer running, phases are recorded
+#define TRACE_STATE_COMPLETE 2                            // Trace finished, waiting to be sent
+
+#ifdef PHASE_TRACE
+    #define TRACE(phase) trace_mark(phase)
+#else
+    #define TRACE(phase)
+#endif
+
+
+// Reasons for waking up in WINDOW_MONITOR mode (bit mask)
+#define MONITOR_EVENT_WINDOW 0x01                         // Result moved outside or back inside the window
+#define MONITOR_EVENT_HEARTBEAT 0x02                      // MONITOR_HEARTBEAT seconds passed
+
+
 // Global variables
+volatile uint8_t adc_state = ADC_STATE_IDLE;
+#ifdef WINDOW_MONITOR
+volatile uint8_t monitor_event = 0;                       // MONITOR_EVENT_xxx flags, set by interrupts
+volatile uint8_t monitor_outside = 0;                     // Last result was outside the window
+#endif
 int32_t sample_acc = 0;
 int16_t adc_center = 0;
 int16_t adc_offset = 0;
-float sample_acc_mean = 0;
-
-float dac_val = 0;
-float dac_ref = 0;
 uint16_t dac_data = 0;
 
 uint8_t timeout = 0;
+uint8_t wakeup_time = WAKEUP_TIME;                        // Seconds between measurements (changed by ADAPTIVE_INTERVAL)
+volatile uint16_t uptime = 0;                             // Seconds since start (PIT interrupts, heartbeats with WINDOW_MONITOR), wraps after 18 hours
+
+#ifdef CLOCK_SCALING
+// Register values for one clock profile
+struct clock_profile
+{
+    uint8_t mclkctrlb;                                    // CLKCTRL.MCLKCTRLB (main clock prescaler)
+    uint8_t timebase;                                     // CLKCTRL.MCLKTIMEBASE (CLK_PER in MHz, rounded up)
+    uint8_t adc_presc;                                    // ADC0.CTRLB
+    uint16_t baud;                                        // USART1.BAUD
+};
+
+const struct clock_profile clock_profiles[2] =
+{
+    #if CLOCK_POLICY == CLOCK_MIN_ENERGY
+        {   // CLOCK_MEASURE: slow main clock, CLK_ADC = CLOCK_SLOW_HZ / 2
+            CLOCK_SLOW_PDIV | CLKCTRL_PEN_bm, (CLOCK_SLOW_HZ + 999999UL) / 1000000UL,
+            ADC_PRESC_DIV2_gc, CLOCK_SLOW_BAUD
+        },
+        {   // CLOCK_COMPUTE: F_CPU, same settings as without CLOCK_SCALING
+            CLKCTRL_PDIV_DIV2_gc | CLKCTRL_PEN_bm, TIMEBASE_VALUE,
+            ADC_PRESC_SEL, USART_BAUD_VALUE
+        },
+    #elif CLOCK_POLICY == CLOCK_MIN_LATENCY
+        {   // CLOCK_MEASURE: F_CPU, CLK_ADC = F_CPU / 2
+            CLKCTRL_PDIV_DIV2_gc | CLKCTRL_PEN_bm, TIMEBASE_VALUE,
+            ADC_PRESC_DIV2_gc, USART_BAUD_VALUE
+        },
+        {   // CLOCK_COMPUTE: same
+            CLKCTRL_PDIV_DIV2_gc | CLKCTRL_PEN_bm, TIMEBASE_VALUE,
+            ADC_PRESC_DIV2_gc, USART_BAUD_VALUE
+        },
+    #else
+        #error "CLOCK_POLICY must be CLOCK_MIN_ENERGY or CLOCK_MIN_LATENCY"
+    #endif
+};
+uint8_t clock_current = CLOCK_COMPUTE;                    // Active profile, init_clock() selects F_CPU
+#endif
+
+#ifdef BATCH_OUTPUT
+#ifdef WINDOW_MONITOR
+    #error "BATCH_OUTPUT can not be used with WINDOW_MONITOR"
+#endif
+// One stored measurement. With 6 bytes per record, 256 records use 1.5 kB of the 6 kB SRAM
+struct batch_record
+{
+    uint16_t time;                                        // uptime when measured
+    int32_t result;                                       // Raw accumulated ADC result (before offset/bias adjustment)
+};
+struct batch_record batch_buffer[BATCH_SIZE];
+uint16_t batch_count = 0;                                 // Number of records in batch_buffer
+#endif
+
+#ifdef WINDOW_STATS
+#if defined(WINDOW_MONITOR) || defined(BATCH_OUTPUT)
+    #error "WINDOW_STATS can not be used with WINDOW_MONITOR or BATCH_OUTPUT"
+#endif
+#if (STATS_WINDOW < 2) || (STATS_WINDOW > 65535)
+    #error "STATS_WINDOW must be 2 to 65535"
+#endif
+#define STATS_Q 8                                         // Mean and stddev are in Q8 format (1/256 ADC code)
+uint16_t stats_count = 0;                                 // Number of results in the current window
+int32_t stats_min = 0;                                    // Smallest adjusted result in the window
+int32_t stats_max = 0;                                    // Largest adjusted result in the window
+int32_t stats_first = 0;                                  // First result of the window, the sums are relative to it
+int64_t stats_sum = 0;                                    // Sum of the differences from stats_first
+uint64_t stats_sum2 = 0;                                  // Sum of the squared differences from stats_first
+#endif
+
+#ifdef NVM_LOG
+// Log page: magic, page sequence number (uint16), number of records, records, CRC-8 in the last byte.
+// The pages are written in a ring, so every page is erased once for each lap (wear leveling)
+#define NVM_LOG_MAGIC 0x4C
+#define NVM_LOG_RECORD_SIZE 5                             // Time (uint16) + raw accumulated ADC result (int24)
+#define NVM_LOG_RECORDS ((PROGMEM_PAGE_SIZE - 5) / NVM_LOG_RECORD_SIZE)
+#define NVM_LOG_START (PROGMEM_SIZE - (uint32_t) NVM_LOG_PAGES * PROGMEM_PAGE_SIZE) // Flash address of the log
+#define NVM_LOG_PAGE(n) ((uint8_t *) (MAPPED_PROGMEM_START + (NVM_LOG_START & 0x7FFF) + (uint16_t) (n) * PROGMEM_PAGE_SIZE))
+                                                          // Log page n in data space (flash section 1 mapped)
+#if (NVM_LOG_PAGES < 2) || (NVM_LOG_PAGES > 255) || (NVM_LOG_PAGES * PROGMEM_PAGE_SIZE > 0x8000UL)
+    #error "NVM_LOG_PAGES must be 2 to 255, and the log must fit in the last 32 kB of flash (mapped flash section)"
+#endif
+#if ((NVM_LOG_PAGES * PROGMEM_PAGE_SIZE) % 512) != 0
+    #error "The log must start on a 512-byte boundary (BOOTSIZE fuse), change NVM_LOG_PAGES"
+#endif
+
+// Flash can only be written by code in the boot section, and only outside of it. The boot
+// section ends where the log starts, so the program is boot code and the log is application
+// data. The fuses are stored in the .fuse section of the ELF file and programmed with it.
+// The log takes NVM_LOG_PAGES * PROGMEM_PAGE_SIZE bytes, 32 * 128 = 4 kB from 0xF000, so the
+// boot section is 0xF000 / 512 = 0x78 blocks (60 kB). To make a program that grows into the
+// log fail to link, add -Wl,--defsym=__TEXT_REGION_LENGTH__=<NVM_LOG_START> (0xF000) to the
+// linker flags of the project (see README)
+FUSES =
+{
+    .WDTCFG = FUSE_WDTCFG_DEFAULT,
+    .BODCFG = FUSE_BODCFG_DEFAULT,
+    .OSCCFG = FUSE_OSCCFG_DEFAULT,
+    .reserved_1 = {0xFF, 0xFF},                           // Erased value
+    .SYSCFG0 = FUSE_SYSCFG0_DEFAULT,
+    .SYSCFG1 = FUSE_SYSCFG1_DEFAULT,
+    .CODESIZE = FUSE_CODESIZE_DEFAULT,                    // No application code section
+    .BOOTSIZE = NVM_LOG_START / 512,                      // Boot section size in 512-byte blocks
+};
+uint8_t nvm_log_buffer[PROGMEM_PAGE_SIZE];                // Page being filled in SRAM
+uint8_t nvm_log_count = 0;                                // Number of records in nvm_log_buffer
+uint8_t nvm_log_page = 0;                                 // Next page to write
+uint16_t nvm_log_seq = 0;                                 // Sequence number of the next page
+#endif
+
+#ifdef MULTI_CHANNEL
+#if defined(WINDOW_MONITOR) || defined(ADAPTIVE_INTERVAL)
+    #error "MULTI_CHANNEL can not be used with WINDOW_MONITOR or ADAPTIVE_INTERVAL"
+#endif
+#endif
+
+#ifdef RECALIBRATE
+#if defined(WINDOW_MONITOR) || defined(MULTI_CHANNEL)
+    #error "RECALIBRATE can not be used with WINDOW_MONITOR or MULTI_CHANNEL"
+#endif
+#define RECAL_Q 4                                         // Estimates are in Q4 format (1/16 ADC code)
+int32_t recal_offset_est = 0;                             // Filtered adc_offset (Q4)
+int32_t recal_center_est = 0;                             // Filtered adc_center (Q4)
+int32_t recal_bias_ref = 0;                               // adc_offset + adc_center at last full calibration (Q4)
+uint8_t recal_count = 0;                                  // Measurements since last offset/bias conversion
+uint8_t recal_phase = 0;                                  // 0: next conversion is offset, 1: bias
+uint8_t recal_full = 0;                                   // Drift too large, do full calibration
+uint8_t recal_changed = 0;                                // adc_offset/adc_center changed since last report
+#endif
+
+#ifdef AUTO_RANGE
+#if defined(WINDOW_MONITOR) || defined(MULTI_CHANNEL) || defined(RECALIBRATE)
+    #error "AUTO_RANGE can not be used with WINDOW_MONITOR, MULTI_CHANNEL or RECALIBRATE"
+#endif
+#if !defined(PGA_ON) || (ADC_GAIN != 16)
+    #error "AUTO_RANGE needs PGA_ON and ADC_GAIN 16, results are scaled to the highest gain"
+#endif
+#if (RANGE_HIGH_PCT > 100) || (RANGE_LOW_PCT * 2 > RANGE_HIGH_PCT)
+    #error "RANGE_HIGH_PCT must be 100 or less, and RANGE_LOW_PCT half of it or less"
+#endif
+#define RANGE_FULL_SCALE (2048L * ADC_SCALE_SAMPLES)      // Accumulated result at V_REF, any gain
+#define RANGE_HIGH_CODE (RANGE_FULL_SCALE * RANGE_HIGH_PCT / 100)
+#define RANGE_LOW_CODE (RANGE_FULL_SCALE * RANGE_LOW_PCT / 100)
+#define RANGE_LEVELS 5
+
+// PGA setting for each gain. shift scales a result up to the highest gain (16x)
+struct range_setting
+{
+    uint8_t via;                                          // ADC0.MUXPOS/MUXNEG VIA bits
+    uint8_t pgactrl;                                      // ADC0.PGACTRL
+    uint8_t shift;                                        // log2(16 / gain)
+};
+
+const struct range_setting range_table[RANGE_LEVELS] =
+{
+    { 0,              0,                                                        4 }, // PGA off, gain 1
+    { ADC_VIA_PGA_gc, ADC_PGAEN_bm | ADC_GAIN_2X_gc | ADC_PGABIASSEL_100PCT_gc,  3 },
+    { ADC_VIA_PGA_gc, ADC_PGAEN_bm | ADC_GAIN_4X_gc | ADC_PGABIASSEL_100PCT_gc,  2 },
+    { ADC_VIA_PGA_gc, ADC_PGAEN_bm | ADC_GAIN_8X_gc | ADC_PGABIASSEL_100PCT_gc,  1 },
+    { ADC_VIA_PGA_gc, ADC_PGAEN_bm | ADC_GAIN_16X_gc | ADC_PGABIASSEL_100PCT_gc, 0 },
+};
+uint8_t range_level = RANGE_LEVELS - 1;                   // Index in range_table for the next measurement
+int16_t range_offset[RANGE_LEVELS];                       // adc_offset for each gain
+int16_t range_center[RANGE_LEVELS];                       // adc_center for each gain
+#endif
+
+#ifdef SETTLE_CAL
+#if defined(WINDOW_MONITOR) || defined(MULTI_CHANNEL)
+    #error "SETTLE_CAL can not be used with WINDOW_MONITOR or MULTI_CHANNEL"
+#endif
+#define SETTLE_MIN_TICKS 3                                // A CMP write takes up to 2 RTC cycles to synchronize, shorter waits could miss the match
+#if (SETTLE_MAX_TICKS < SETTLE_MIN_TICKS) || (SETTLE_MAX_TICKS > 250)
+    #error "SETTLE_MAX_TICKS must be 3 to 250"
+#endif
+#if (SETTLE_OFF_MS < 1) || (SETTLE_OFF_MS > 1000)
+    #error "SETTLE_OFF_MS must be 1 to 1000"
+#endif
+#define SETTLE_OFF_TICKS ((uint16_t) ((SETTLE_OFF_MS * 32768UL + 500) / 1000))
+uint8_t settle_ticks = 0;                                 // Measured settling time in RTC ticks of 1/32768 s
+volatile uint8_t settle_busy = 0;                         // Waiting for the RTC compare match (settle_wait)
+#endif
+
+#ifdef PIPELINE
+#if defined(WINDOW_MONITOR) || defined(MULTI_CHANNEL) || defined(ADAPTIVE_INTERVAL)
+    #error "PIPELINE can not be used with WINDOW_MONITOR, MULTI_CHANNEL or ADAPTIVE_INTERVAL"
+#endif
+#if defined(AUTO_RANGE) || defined(CLOCK_SCALING) || (ADC_DECIMATE_SHIFT > 0)
+    #error "PIPELINE needs one burst per measurement on a fixed clock (no AUTO_RANGE, CLOCK_SCALING or ADC_DECIMATE_SHIFT)"
+#endif
+int32_t pipe_result = 0;                                  // Result measured at the last wake-up, not processed yet
+uint16_t pipe_time = 0;                                   // uptime when pipe_result was measured
+uint8_t pipe_valid = 0;                                   // pipe_result holds a result
+#endif
+
+#ifdef TRANSIENT_CAPTURE
+#if defined(WINDOW_MONITOR) || defined(MULTI_CHANNEL) || defined(PIPELINE) || defined(AUTO_RANGE) || defined(CLOCK_SCALING)
+    #error "TRANSIENT_CAPTURE replaces the periodic measurement, it can not be used with WINDOW_MONITOR, MULTI_CHANNEL, PIPELINE, AUTO_RANGE or CLOCK_SCALING"
+#endif
+#if defined(ADAPTIVE_INTERVAL) || defined(BATCH_OUTPUT) || defined(WINDOW_STATS) || defined(NVM_LOG) || defined(RECALIBRATE) || defined(SETTLE_CAL)
+    #error "TRANSIENT_CAPTURE can not be used with ADAPTIVE_INTERVAL, BATCH_OUTPUT, WINDOW_STATS, NVM_LOG, RECALIBRATE or SETTLE_CAL"
+#endif
+#ifdef PHASE_TRACE
+    #error "TRANSIENT_CAPTURE times the sample period with TCB0, it can not be used with PHASE_TRACE"
+#endif
+#ifndef USART_ON
+    #error "TRANSIENT_CAPTURE needs USART_ON to send the captured blocks"
+#endif
+#if (CAPTURE_SIZE & (CAPTURE_SIZE - 1)) || (CAPTURE_SIZE < 128) || (CAPTURE_SIZE > 2048)
+    #error "CAPTURE_SIZE must be a power of 2 from 128 to 2048"
+#endif
+#if (CAPTURE_PRE < 0) || (CAPTURE_PRE >= CAPTURE_SIZE)
+    #error "CAPTURE_PRE must be 0 to CAPTURE_SIZE - 1"
+#endif
+
+#if CAPTURE_PRESC_DIV == 2
+    #define CAPTURE_PRESC_SEL ADC_PRESC_DIV2_gc
+#elif CAPTURE_PRESC_DIV == 4
+    #define CAPTURE_PRESC_SEL ADC_PRESC_DIV4_gc
+#elif CAPTURE_PRESC_DIV == 8
+    #define CAPTURE_PRESC_SEL ADC_PRESC_DIV8_gc
+#elif CAPTURE_PRESC_DIV == 16
+    #define CAPTURE_PRESC_SEL ADC_PRESC_DIV16_gc
+#else
+    #error "CAPTURE_PRESC_DIV must be 2, 4, 8 or 16"
+#endif
+#if F_CPU / CAPTURE_PRESC_DIV > 6000000UL
+    #error "f_CLK_ADC must be 6 MHz or less with PGA bias 100%, increase CAPTURE_PRESC_DIV"
+#endif
+
+// Time between two free-running single conversions (see do_ADC0_measurement for the formula,
+// SAMPNUM = 1), and the PGA sample time of 3 us with 100% bias
+#ifdef PGA_ON
+    #define CAPTURE_PGA_NS 3000UL
+#else
+    #define CAPTURE_PGA_NS 0UL
+#endif
+#define CAPTURE_PERIOD_NS ((ADC_SAMPDUR + 16) * CAPTURE_PRESC_DIV * 1000UL / (F_CPU / 1000000UL) + CAPTURE_PGA_NS)
+#define CAPTURE_PERIOD_CYCLES (CAPTURE_PERIOD_NS * (F_CPU / 1000000UL) / 1000UL)
+// Longest pass of the capture loops in CPU cycles. This is an estimate from the instructions
+// of the ring loop with the window trigger, not measured: poll RESRDY 3, read RESULT 4,
+// store 4, wrap test 4, trigger test 5, jump 2 = 22, doubled for margin. If a pass is
+// longer than a conversion, ADC0 sets RESOVR and the block is marked as lossy
+#define CAPTURE_LOOP_CYCLES 48
+#if CAPTURE_PERIOD_CYCLES < CAPTURE_LOOP_CYCLES
+    #error "ADC0 converts faster than the capture loop can store the results, increase CAPTURE_PRESC_DIV"
+#endif
+
+// The sample period that is sent is measured with TCB0 (CLK_PER / 2) over this many
+// conversions before each block, they are not stored and give DAC0 and the PGA time to settle
+#define CAPTURE_TIMING_SAMPLES 64
+#if CAPTURE_PERIOD_CYCLES * CAPTURE_TIMING_SAMPLES / 2 > 60000UL
+    #error "CAPTURE_TIMING_SAMPLES conversions do not fit in the 16-bit TCB0 count, decrease CAPTURE_TIMING_SAMPLES"
+#endif
+
+#define CAPTURE_TRIGGER_WINDOW 0
+#define CAPTURE_TRIGGER_PIN 1
+#if CAPTURE_TRIGGER == CAPTURE_TRIGGER_WINDOW
+    #define CAPTURE_TRIGGERED() (ADC0.INTFLAGS & ADC_WCMP_bm)     // Last result above ADC0.WINHT
+    #define CAPTURE_CLEAR_TRIGGER() (ADC0.INTFLAGS = ADC_WCMP_bm)
+#elif CAPTURE_TRIGGER == CAPTURE_TRIGGER_PIN
+    #define CAPTURE_TRIGGERED() capture_pin_fell()               // Falling edge on PB2 (SW0), polled
+    #define CAPTURE_CLEAR_TRIGGER() (capture_pin = PORTB.IN)
+#else
+    #error "CAPTURE_TRIGGER must be CAPTURE_TRIGGER_WINDOW or CAPTURE_TRIGGER_PIN"
+#endif
+
+#define CAPTURE_MASK (CAPTURE_SIZE - 1)
+#define CAPTURE_FRAME_SAMPLES 128                         // Samples in one capture data frame (payload < 254 bytes)
+int16_t capture_buffer[CAPTURE_SIZE];                     // Raw single conversions, ring while waiting for the trigger
+uint16_t capture_first = 0;                               // Index of the oldest sample in capture_buffer
+uint8_t capture_overrun = 0;                              // ADC0 overwrote a result before it was stored
+uint8_t capture_seq = 0;                                  // Sequence number of the captured block
+uint8_t capture_pin = 0;                                  // PORTB.IN at the last trigger poll (CAPTURE_TRIGGER_PIN)
+uint32_t capture_period_ns = CAPTURE_PERIOD_NS;           // Sample period measured with TCB0 before the last block
+#endif
+
+#ifdef RESULT_FILTER
+#if defined(WINDOW_MONITOR) || defined(TRANSIENT_CAPTURE)
+    #error "RESULT_FILTER can not be used with WINDOW_MONITOR or TRANSIENT_CAPTURE"
+#endif
+#if (FILTER_MEDIAN != 1) && (FILTER_MEDIAN != 3) && (FILTER_MEDIAN != 5)
+    #error "FILTER_MEDIAN must be 1, 3 or 5"
+#endif
+#if (FILTER_IIR_SHIFT < 0) || (FILTER_IIR_SHIFT > 6)
+    #error "FILTER_IIR_SHIFT must be 0 to 6"
+#endif
+#define FILTER_Q 8                                        // IIR state is in Q8 format (1/256 ADC code)
+#define FILTER_STEP_Q (FP_CODE_FROM_NA(FILTER_STEP_NA) << FILTER_Q)
+#if FILTER_MEDIAN > 1
+int32_t filter_history[FILTER_MEDIAN];                    // Last adjusted results (ring)
+uint8_t filter_next = 0;                                  // Next position in filter_history
+uint8_t filter_count = 0;                                 // Number of results in filter_history
+#endif
+#if FILTER_IIR_SHIFT > 0
+int32_t filter_y = 0;                                     // IIR output (Q8)
+uint8_t filter_valid = 0;                                 // filter_y holds a result
+#endif
+#endif
+
+#ifdef ADAPTIVE_INTERVAL
+#ifdef WINDOW_MONITOR
+    #error "ADAPTIVE_INTERVAL can not be used with WINDOW_MONITOR"
+#endif
+int32_t adapt_last = 0;                                   // Previous adjusted result
+uint8_t adapt_stable_count = 0;                           // Number of stable measurements in a row
+#endif
+
+#define USART_TX_BUFFER_MASK (USART_TX_BUFFER_SIZE - 1)
+volatile uint8_t usart1_tx_buffer[USART_TX_BUFFER_SIZE];  // USART1 transmit queue (ring buffer)
+volatile uint8_t usart1_tx_head = 0;                      // Next free position, written by main code only
+volatile uint8_t usart1_tx_tail = 0;                      // Next byte to send, written by DRE interrupt only
+volatile uint8_t usart1_tx_busy = 0;                      // USART1 is powered and transmitting
+volatile uint8_t usart1_tx_overflow = 0;                  // Number of bytes dropped because the queue was full
+uint8_t usart1_tx_hold = 0;                               // Only queue bytes, send them at usart1_tx_release()
+
+#ifdef BINARY_OUTPUT
+// Binary frame types, see send_calibration_frame() and send_measurement_frame()
+#define FRAME_TYPE_CALIBRATION 0x01
+#define FRAME_TYPE_MEASUREMENT 0x02
+#define FRAME_TYPE_TRACE 0x03
+#define FRAME_TYPE_BATCH 0x04
+#define FRAME_TYPE_RTD 0x05
+#define FRAME_TYPE_STATS 0x06
+#define FRAME_TYPE_LOG 0x07
+#define FRAME_TYPE_CAPTURE 0x08
+#define FRAME_TYPE_CAPTURE_DATA 0x09
+#define BATCH_FRAME_RECORDS 48                            // Max records in one batch frame (payload < 254 bytes)
+uint8_t frame_seq = 0;                                    // Sequence number of next measurement frame
+#ifdef MULTI_CHANNEL
+uint8_t rtd_frame_seq = 0;                                // Sequence number of next RTD frame
+#endif
+#endif
+
+#ifdef PHASE_TRACE
+volatile uint8_t trace_state = TRACE_STATE_OFF;
+volatile uint8_t trace_count = 0;                         // Number of timestamps in trace_phase/trace_time
+volatile uint8_t trace_phase[TRACE_SIZE];                 // Phase that ended (TRACE_xxx)
+volatile uint16_t trace_time[TRACE_SIZE];                 // Time since wake-up in TCB0 ticks (2 / F_CPU)
+#endif
+#ifdef FIXED_POINT
+int32_t measured_voltage_uv = 0;    // Measured voltage in uV
+int32_t measured_current_na = 0;    // Measured current in nA
+#else
 float measured_voltage = 0;
 float measured_current = 0;
+#endif
+#ifdef MULTI_CHANNEL
+uint32_t measured_rtd_ohm = 0;      // Measured RTD resistance in 1/64 Ohm (Q6)
+int16_t measured_temp_cdeg = 0;     // Measured temperature in 1/100 C
+#endif
 
 
 /**************************************************************
@@ -60,21 +834,145 @@ float measured_current = 0;
 *   Function definitions
 *
 **************************************************************/
-void usart1_putc(uint8_t data);
+uint8_t usart1_putc(uint8_t data);
+void usart1_tx_start(void);
+void usart1_tx_release(void);
+void usart1_putc_wait(uint8_t data);
 void usart1_sendString(char *strptr);
-void rev_str(char* str, int len);
-int intToStr(int x, char str[], int d);
+void usart1_tx_complete(void);
+void select_sleep_mode(void);
+void adc0_start(uint8_t command);
+int32_t adc0_wait_result(void);
+uint8_t crc8(const uint8_t *data, uint16_t len);
+void usart1_sendFrame(uint8_t *payload, uint8_t len);
+void send_calibration_frame(void);
+void send_measurement_frame(int32_t raw);
 void ftostr(float n, char* res, int decimals);
+void fixtostr(int32_t n, char* res, uint8_t decimals);
 void init_clock(void);
+void clock_set(uint8_t profile);
 void init_PORT(void);
 void init_VREF(void);
 void init_DAC0(void);
 void init_ADC0(void);
 void measure_offset_bias(void);
+void range_select(uint8_t level);
+void range_calibrate(void);
+int32_t range_measure(void);
 void set_DAC0_output(void);
+void settle_wait(uint16_t ticks);
+int32_t settle_sample(void);
+void settle_calibrate(void);
 void init_RTC_PIT(void);
 void init_USART1(void);
 void do_ADC0_measurement(void);
+void pipeline_flush(void);
+uint16_t result_time(void);
+void process_ADC0_result(int32_t result);
+void adapt_wakeup_time(int32_t result);
+int32_t filter_result(int32_t x);
+void recal_reset(void);
+void recal_step(void);
+void recal_apply(void);
+void recal_full_calibration(void);
+void batch_add(int32_t result);
+void batch_send(void);
+void stats_add(int32_t x);
+int32_t stats_mean(void);
+uint64_t stats_variance(void);
+void stats_send(void);
+uint32_t stats_sqrt(uint64_t v);
+uint8_t nvm_log_valid(const uint8_t *page);
+void nvm_log_init(void);
+void nvm_log_add(int32_t result);
+void nvm_log_write(void);
+void nvm_log_dump(void);
+uint8_t sw0_pressed(void);
+void capture_run(void);
+uint8_t capture_pin_fell(void);
+void capture_send(void);
+void init_window_monitor(void);
+uint16_t monitor_uptime(void);
+void trace_start(void);
+void trace_mark(uint8_t phase);
+void trace_stop(uint8_t phase);
+void trace_send(void);
+void process_rtd_result(int32_t result);
+void measure_channel(uint8_t ch);
+uint8_t run_channels(void);
+
+
+#ifdef MULTI_CHANNEL
+/**************************************************************
+*
+*   Channel table
+*
+*   Each entry holds the complete ADC0/DAC0 setup of one channel.
+*   run_channels() measures all channels that are due in one
+*   wake-up, with one ADC0/DAC0 enable. Channels with the same
+*   DAC0 output and ADC reference are measured back to back, so
+*   the DAC0 output only settles once for each group
+*
+**************************************************************/
+#ifdef PGA_ON
+    #define CURRENT_VIA ADC_VIA_PGA_gc
+    #define CURRENT_PGACTRL (ADC_PGAEN_bm | ADC_GAIN_SEL | ADC_PGABIASSEL_100PCT_gc)
+#else
+    #define CURRENT_VIA 0
+    #define CURRENT_PGACTRL 0
+#endif
+
+struct adc_channel
+{
+    uint8_t muxpos;                                       // ADC0.MUXPOS
+    uint8_t muxneg;                                       // ADC0.MUXNEG
+    uint8_t pgactrl;                                      // ADC0.PGACTRL (gain), 0 = PGA off
+    uint8_t refsel;                                       // ADC0.CTRLC (reference)
+    uint16_t dac_data;                                    // DAC0.DATA (10 bit value, not shifted)
+    uint8_t ctrlf;                                        // ADC0.CTRLF (SAMPNUM and chopping)
+    uint8_t period;                                       // Seconds between measurements
+    void (*convert)(int32_t result);                      // Converts and reports the raw accumulated result
+};
+
+// ADC0 inputs of the two circuits. Both hang on DAC0OUT (PD6, AIN6), and VREFA (PD7, AIN7)
+// is connected to it, so DAC0 drives both circuits whichever channel is measured. Each
+// channel must have its own input pins, and no channel may use AIN6 or AIN7
+#define CURRENT_MUXPOS ADC_MUXPOS_AIN1_gc
+#define CURRENT_MUXNEG ADC_MUXNEG_AIN0_gc
+#define RTD_MUXPOS ADC_MUXPOS_AIN2_gc
+#define RTD_MUXNEG ADC_MUXNEG_AIN3_gc
+#define AIN_FREE(ain) (((int) (ain) != ADC_MUXPOS_AIN6_gc) && ((int) (ain) != ADC_MUXPOS_AIN7_gc))
+
+_Static_assert(AIN_FREE(CURRENT_MUXPOS) && AIN_FREE(CURRENT_MUXNEG) && AIN_FREE(RTD_MUXPOS) && AIN_FREE(RTD_MUXNEG),
+               "Channel inputs must not be DAC0OUT (AIN6) or VREFA (AIN7)");
+_Static_assert(((int) RTD_MUXPOS != (int) CURRENT_MUXPOS) && ((int) RTD_MUXPOS != (int) CURRENT_MUXNEG)
+            && ((int) RTD_MUXNEG != (int) CURRENT_MUXPOS) && ((int) RTD_MUXNEG != (int) CURRENT_MUXNEG),
+               "The current and RTD channels must not share an ADC0 input");
+// The groups in run_channels() set DAC0 for each channel, so a channel is never measured
+// with the DAC0 output or reference of the other one. Both outputs must be valid
+_Static_assert((DAC_CODE(DAC_OUT) < 1024) && (DAC_CODE(RTD_DAC_OUT) < 1024), "DAC0 outputs must be less than DAC_REF");
+_Static_assert(DAC_CODE(RTD_DAC_OUT) != 0, "RTD_DAC_OUT is also VREFA, it can not be 0");
+
+const struct adc_channel channel_table[] =
+{
+    {   // Current through R_SENSE, AIN1 - AIN0, DAC0 is the current source
+        CURRENT_VIA | CURRENT_MUXPOS, CURRENT_VIA | CURRENT_MUXNEG, CURRENT_PGACTRL,
+        ADC_REFSEL_VDD_gc, DAC_CODE(DAC_OUT), ADC_CHOPPING_bm | ADC_SAMPNUM_SEL,
+        WAKEUP_TIME, process_ADC0_result
+    },
+    {   // RTD, AIN2 - AIN3, DAC0 drives the RTD and VREFA
+        ADC_VIA_PGA_gc | RTD_MUXPOS, ADC_VIA_PGA_gc | RTD_MUXNEG,
+        ADC_PGAEN_bm | ADC_GAIN_16X_gc | ADC_PGABIASSEL_100PCT_gc,
+        ADC_REFSEL_VREFA_gc, DAC_CODE(RTD_DAC_OUT), ADC_SAMPNUM_ACC16_gc,
+        RTD_PERIOD, process_rtd_result
+    },
+};
+
+#define CHANNEL_COUNT (sizeof(channel_table) / sizeof(channel_table[0]))
+
+uint16_t channel_next[CHANNEL_COUNT];                     // uptime when each channel is due (0 = at first wake-up)
+int32_t channel_result[CHANNEL_COUNT];                    // Raw results of the current wake-up
+#endif
 
 
 
@@ -84,270 +982,691 @@ void do_ADC0_measurement(void);
 *
 *   USART1 send one character/byte
 *
+*   The byte is put in the transmit queue and sent by the Data Register
+*   Empty (DRE) interrupt, so this function never waits for the USART.
+*   If USART1 is idle it is powered up and the DRE interrupt is enabled.
+*   Returns 1 if the byte was queued, 0 if the queue was full (byte dropped)
+*
 **************************************************************************/
-void usart1_putc(uint8_t data)
+uint8_t usart1_putc(uint8_t data)
 {
-    while( !(USART1.STATUS & USART_DREIF_bm) )  // Wait for TX shift register to clear
-        ;
-    USART1.TXDATAL = data;                      // Send byte to TX buffer (shift register)
+    uint8_t next = (usart1_tx_head + 1) & USART_TX_BUFFER_MASK;
+    uint8_t sreg;
+    
+    if (next == usart1_tx_tail)                 // Queue full, drop byte
+    {
+        usart1_tx_overflow++;
+        return 0;
+    }
+    
+    usart1_tx_buffer[usart1_tx_head] = data;    // Put byte in queue
+    
+    sreg = SREG;                                // Save interrupt state
+    cli();                                      // Do not let TXC power down USART1 while starting it
+    usart1_tx_head = next;
+    if (!usart1_tx_hold)
+    {
+        usart1_tx_start();
+    }
+    SREG = sreg;                                // Restore interrupt state
+    
+    return 1;
 }
 
+
 /*************************************************************************
 *
-*   usart1_sendString()
+*   usart1_tx_start()
 *
-*   Send a string to terminal using USART1
-*   Will send string starting at address *strptr and loop until the NULL
-*   character is encountered (C automatically adds this to the end of
-*   any string)
+*   Send the bytes in the transmit queue. If USART1 is idle it is powered
+*   up, then the DRE interrupt is enabled.
+*   Must be called with interrupts disabled
 *
 **************************************************************************/
-void usart1_sendString(char *strptr)
+void usart1_tx_start(void)
 {
-    while (*strptr)
+    if (!usart1_tx_busy)
     {
-        //loop through entire string
-        usart1_putc(*strptr);
-        strptr++;
+        usart1_tx_busy = 1;
+        USART1.CTRLB = USART_TXEN_bm;           // Power up USART1 TX
+        select_sleep_mode();                    // USART1 needs CLK_PER, only sleep in idle mode while sending
     }
-    while(!(USART1.STATUS & USART_TXCIF_bm))    // Wait for TXCIF to be set, indicating writing is done
-        ;
-    
-    USART1.STATUS |= USART_TXCIF_bm;            // Clear TXCIF flag by writing a '1' to it
+    USART1.CTRLA = USART_DREIE_bm;              // Enable DRE interrupt (disables TXC interrupt until queue is empty)
 }
 
 
 /*************************************************************************
 *
-*   rev_str(char* str, int len)
+*   usart1_tx_release()
 *
-*   Reverses a string 'str' of length 'len'
+*   End usart1_tx_hold and send what was queued meanwhile. While the
+*   hold is set, bytes are only put in the queue, so nothing is sent
+*   while ADC0 converts (PIPELINE)
 *
 **************************************************************************/
-void rev_str(char* str, int len)
+void usart1_tx_release(void)
 {
-    int i = 0, j = len - 1, temp;
+    uint8_t sreg = SREG;                        // Save interrupt state
     
-    while (i < j)
+    cli();
+    usart1_tx_hold = 0;
+    if (usart1_tx_head != usart1_tx_tail)
     {
-        temp = str[i];
-        str[i] = str[j];
-        str[j] = temp;
-        i++;
-        j--;
+        usart1_tx_start();
     }
+    SREG = sreg;                                // Restore interrupt state
 }
 
 
 /*************************************************************************
 *
-*   intToStr(int x, char str[], int d)
+*   usart1_putc_wait()
+*
+*   USART1 send one character/byte, waiting for room in the transmit queue
 *
-*   Convert integer x to string str[]
-*   d =  number of digits in the output
-*   if d > number of digits in x, 0s are added at the beginning
+*   If the queue is full, the CPU sleeps (idle) until the DRE interrupt
+*   has moved a byte to the USART. Used for output that can be longer
+*   than the queue. A hold (usart1_tx_hold) ends when the queue is full,
+*   as nothing could make room. Must not be called from an interrupt
 *
 **************************************************************************/
-int intToStr(int x, char str[], int d)
+void usart1_putc_wait(uint8_t data)
 {
-    int i = 0;
-    while (x)
-    {
-        str[i++] = (x % 10) + '0';
-        x = x / 10;
-    }
+    uint8_t sreg = SREG;                        // Save interrupt state
     
-    //if d is bigger than chars in x, add '0's at the beginning
-    while (i < d)
+    cli();
+    while (((usart1_tx_head + 1) & USART_TX_BUFFER_MASK) == usart1_tx_tail)
     {
-        str[i++] = '0';
+        if (usart1_tx_hold)
+        {
+            usart1_tx_release();                // Full while held, send now rather than wait forever
+        }
+        sei();                                  // Queue full, sleep until the DRE interrupt
+        sleep_cpu();                            // (sei() delays interrupts by one instruction)
+        cli();
     }
-    
-    rev_str(str, i);    // to print number correctly, the order must be reversed
-    str[i] = '\0';      // last character is NULL
-    return i;
+    usart1_putc(data);
+    SREG = sreg;                                // Restore interrupt state
 }
 
-
 /*************************************************************************
 *
-*   ftostr(float n, char* res, int decimals)
+*   usart1_sendString()
+*
+*   Send a string to terminal using USART1
+*   Will send string starting at address *strptr and loop until the NULL
+*   character is encountered (C automatically adds this to the end of
+*   any string)
 *
-*   Convert integer x to string str[]
-*   d =  number of digits in the output
-*   if d > number of digits in x, 0s are added at the beginning
+*   The string is only copied into the transmit queue, the function returns
+*   before the string is sent. If the queue is full, it sleeps until there
+*   is room (see usart1_putc_wait)
 *
 **************************************************************************/
-void ftostr(float n, char* res, int decimals)
+void usart1_sendString(char *strptr)
 {
-    // Extract integer part
-    int ipart = (int)n;
-    
-    // Extraxt floating part
-    float fpart = n - (float)ipart;
-    
-    // convert integer part to string
-    int i = intToStr(ipart, res, 0);
-    
-    if(ipart == 0)
-    {
-        res[i++] = '0';     // if integer part zero then add zero to string
-    }
-    
-    // Check for display option after point
-    if (decimals != 0)
+    while (*strptr)
     {
-        res[i] = '.';   // add decimal symbol ('dot')
-        
-        // Get the value of fraction part up to given no. of points after dot.
-        // The third parameter is needed to handle cases like 233.007
-        fpart = fpart * pow (10, decimals);
-        intToStr( (int) fpart, res + i + 1, decimals);
+        //loop through entire string
+        usart1_putc_wait(*strptr);
+        strptr++;
     }
 }
 
 
-
 /*************************************************************************
 *
-*   init_clock(void)
+*   usart1_tx_complete()
 *
-*   Set main clock 
-*   For 3.33 MHz just comment out and do nothing (default) 
+*   Called from the TXC interrupt when the last byte in the queue has
+*   left the shift register. Powers down USART1 TX and allows the device
+*   to go back to power-down sleep.
+*   The TX pin is kept high by the PORT (see init_USART1) so the line
+*   stays idle while USART1 is off
 *
 **************************************************************************/
-void init_clock(void)
+void usart1_tx_complete(void)
 {
-    // Main clock divide by 2 --> CLK_PER = 20 MHz / 2 = 10 MHz
-    _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, (CLKCTRL_PDIV_DIV2_gc | CLKCTRL_PEN_bm));
+    USART1.CTRLA = 0;                           // Disable USART1 interrupts
+    USART1.CTRLB = 0;                           // Power down USART1 TX
+    usart1_tx_busy = 0;
+    select_sleep_mode();                        // Nothing more to send, deeper sleep allowed again
     
-    while(CLKCTRL.MCLKSTATUS & CLKCTRL_SOSC_bm)
-        ; // Wait for clock change to complete
+    #ifdef PHASE_TRACE
+        trace_stop(TRACE_UART_DONE);            // Report is out, measurement trace is complete
+    #endif
 }
 
 
-
 /*************************************************************************
 *
-*   init_PORT(void)
+*   select_sleep_mode()
 *
-*   Init PORT (disable all port pins) 
+*   Select the deepest sleep mode that keeps the active peripherals running:
+*   - USART1 sending: idle (USART1 needs CLK_PER)
+*   - ADC0 converting: standby (ADC0 and DAC0 have RUNSTDBY set)
+*   - SETTLE_CAL wait: standby for the RTC counter, idle if ADC0 is on
+*     without RUNSTDBY
+*   - otherwise: power-down, only the RTC/PIT is running
+*
+*   Must be called with interrupts disabled or from an interrupt
 *
 **************************************************************************/
-void init_PORT(void)
+void select_sleep_mode(void)
 {
-     PORTA.PINCONFIG = PORT_ISC_INPUT_DISABLE_gc;
-     PORTA.PINCTRLUPD = 0xff;
-     PORTB.PINCTRLUPD = 0xff;
-     PORTC.PINCTRLUPD = 0xff;
-     PORTD.PINCTRLUPD = 0xff;
-     PORTE.PINCTRLUPD = 0xff;
-     PORTF.PINCTRLUPD = 0xff;
+    uint8_t mode = SLEEP_MODE_PWR_DOWN;
+    
+    #ifdef WINDOW_MONITOR
+        mode = SLEEP_MODE_STANDBY;              // Event triggered conversions need ADC0, DAC0 and RTC in standby
+    #endif
+    if (adc_state == ADC_STATE_BUSY)
+    {
+        mode = SLEEP_MODE_STANDBY;
+    }
+    #ifdef SETTLE_CAL
+        if (settle_busy)
+        {
+            mode = ((ADC0.CTRLA & (ADC_ENABLE_bm | ADC_RUNSTDBY_bm)) == ADC_ENABLE_bm) ? SLEEP_MODE_IDLE : SLEEP_MODE_STANDBY;
+        }
+    #endif
+    if (usart1_tx_busy)
+    {
+        mode = SLEEP_MODE_IDLE;
+    }
+    
+    SLPCTRL.CTRLA = mode | SLPCTRL_SEN_bm;
 }
 
 
 /*************************************************************************
 *
-*   init_VREF(void)
+*   crc8(const uint8_t *data, uint16_t len)
 *
-*   Init Voltage Reference (VREF)
+*   Calculate CRC-8 of len bytes (polynomial x^8 + x^2 + x + 1 = 0x07,
+*   initial value 0x00, no reflection)
 *
 **************************************************************************/
-void init_VREF(void)
+uint8_t crc8(const uint8_t *data, uint16_t len)
 {
-    // Set DAC0 reference to internal 3.3V
-    VREF.DAC0REF = VREF_REFSEL_VDD_gc;
+    uint8_t crc = 0;
+    uint8_t bit;
+    
+    while (len--)
+    {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+    return crc;
 }
 
 
 /*************************************************************************
 *
-*   init_DAC0(void)
+*   usart1_sendFrame(uint8_t *payload, uint8_t len)
 *
-*   Init Digital to Analog Converter (DAC0)
+*   Send len bytes of payload as one binary frame on USART1:
+*   A CRC-8 of the payload is appended, then the payload and CRC are
+*   COBS (Consistent Overhead Byte Stuffing) encoded so the frame never
+*   contains 0x00, and a 0x00 is sent as frame delimiter (sync byte).
+*   This adds 3 bytes to the payload in total.
+*
+*   payload must have room for len + 1 bytes (the CRC is stored there)
+*   and len must be less than 254
 *
 **************************************************************************/
-void init_DAC0(void)
+void usart1_sendFrame(uint8_t *payload, uint8_t len)
 {
-    DAC0.DATA = 0 << DAC_DATA_gp;                   // Set DAC0 output = 0
-    DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm;      // Enable DAC Output, Enable DAC
+    uint8_t start = 0;
+    uint8_t end;
+    
+    payload[len] = crc8(payload, len);          // Append CRC
+    len++;
+    
+    do
+    {
+        end = start;
+        while ((end < len) && (payload[end] != 0))  // Find next zero (or end of payload)
+        {
+            end++;
+        }
+        
+        usart1_putc_wait(end - start + 1);      // COBS code byte: distance to next zero
+        while (start < end)
+        {
+            usart1_putc_wait(payload[start++]); // Non-zero bytes are sent as they are
+        }
+        start++;                                // Skip the zero, it is replaced by the next code byte
+    } while (start <= len);
     
+    usart1_putc_wait(0x00);                     // Frame delimiter
 }
 
 
 /*************************************************************************
 *
-*   init_ADC0(void)
+*   send_calibration_frame(void)
 *
-*   Init Analog to Digital Converter (ADC0)
+*   Send everything the receiver needs to convert the raw ADC results in 
+*   the measurement frames to voltage and current (little endian):
 *
-*   Prescaler = 10 (ADC Clock is divided by 10)
-*   ADC Reference = V_DD
-*   ADC running in debug mode enabled
-*   Sample Duration (SAMPDUR) is set to 12
-*   Sign chopping enabled
-*   Number of accumulated samples is set to 16
+*   [0]     FRAME_TYPE_CALIBRATION
+*   [1]     Sequence number of the next measurement frame
+*   [2-3]   adc_offset (int16)
+*   [4-5]   adc_center (int16)
+*   [6-7]   ADC reference in mV (uint16)
+*   [8]     PGA gain (1 if PGA is off)
+*   [9-10]  Number of accumulated samples (uint16)
+*   [11-14] R_SENSE in Ohm (uint32)
 *
-*   If PGA is on, the gain is set to 16 and the bias is set to 100%
-*   This bias causes ADCPGASAMPDUR = 3us (or 4 if using int. ref)
-*   See table in data sheet for ADCPGASAMPDUR for other bias settings
+*   adc_offset and adc_center are sent as 0 if BIAS_ADJUST is not defined
 *
 **************************************************************************/
-void init_ADC0(void)
+#ifdef BINARY_OUTPUT
+void send_calibration_frame(void)
 {
-    CLKCTRL.MCLKTIMEBASE = TIMEBASE_VALUE;                  // Set the Timebase in the Main clock (f_CLK_PER)
-    ADC0.CTRLB = ADC_PRESC_DIV10_gc;                        // Set ADC prescaler, f_CLK_ADC = f_CLK_PER/10
-                                                            // CLK_PER = 20MHz --> f_CLK_ADC = 2MHz, CLK_ADC = 0,5us
-                                                            // CLK_PER = 3.33MHz --> f_CLK_ADC = 333kHz, CLK_ADC = 3us (approx)
-                                                            // CLK_PER = 2MHz --> f_CLK_ADC = 200kHz, CLK_ADC = 5us
-    ADC0.CTRLC = ADC_REFSEL_VDD_gc;                         // Select V_DD as ADC reference
-    ADC0.DBGCTRL = ADC_DBGRUN_bm;                           // Enable run in debug
-    ADC0.CTRLE = 12;                                        // In Burst mode, SAMPDUR must be >= 12
-    ADC0.CTRLF = ADC_CHOPPING_bm | ADC_SAMPNUM_ACC16_gc;    // Enable sign chopping (reduce offset), Accumulate 16 samples
+    uint8_t frame[16];
+    int16_t offset = 0;
+    int16_t center = 0;
     
+    #ifdef BIAS_ADJUST
+        offset = adc_offset;
+        center = adc_center;
+    #endif
+    
+    frame[0] = FRAME_TYPE_CALIBRATION;
+    frame[1] = frame_seq;
+    frame[2] = offset;
+    frame[3] = offset >> 8;
+    frame[4] = center;
+    frame[5] = center >> 8;
+    frame[6] = (uint8_t) ADC_REF_MV;
+    frame[7] = (uint8_t) (ADC_REF_MV >> 8);
     #ifdef PGA_ON
-        ADC0.PGACTRL = ADC_PGAEN_bm                         // Turn on PGA
-                     | ADC_GAIN_16X_gc                      // Gain 16x
-                     | ADC_PGABIASSEL_100PCT_gc;            // bias 100% (CLK_ADC <= 6MHz)
+        frame[8] = ADC_GAIN;
+    #else
+        frame[8] = 1;
     #endif
+    frame[9] = (uint8_t) ADC_SCALE_SAMPLES;                 // Results are scaled to this number of samples
+    frame[10] = (uint8_t) (ADC_SCALE_SAMPLES >> 8);
+    frame[11] = (uint8_t) R_SENSE;
+    frame[12] = (uint8_t) (R_SENSE >> 8);
+    frame[13] = (uint8_t) (R_SENSE >> 16);
+    frame[14] = (uint8_t) ((uint32_t) R_SENSE >> 24);
+    
+    usart1_sendFrame(frame, 15);
 }
 
 
-
 /*************************************************************************
 *
-*   measure_offset_bias(void)
+*   send_measurement_frame(int32_t raw)
 *
-*   Measure ADC0 offset and bias level on inputs (AIN0, AIN1)
+*   Send one raw accumulated ADC result (little endian), 8 bytes on the line:
+*
+*   [0]     FRAME_TYPE_MEASUREMENT
+*   [1]     Sequence number, increments by one for each measurement
+*   [2-4]   Raw accumulated ADC result, before offset/bias adjustment (int24)
+*
+*   The receiver can detect lost frames from gaps in the sequence number.
+*   The calibration frame is repeated each time the sequence number wraps
+*   to 0, so a receiver that starts late can still decode the results
 *
 **************************************************************************/
-void measure_offset_bias(void)
+void send_measurement_frame(int32_t raw)
 {
-    ADC0.CTRLA = ADC_ENABLE_bm;                             // Enable ADC0
-    
-    // Measure offset (sample 16 times)
-    #ifdef PGA_ON                                           // If PGA is enabled
-        ADC0.MUXPOS = ADC_VIA_PGA_gc | ADC_MUXPOS_AIN0_gc;  // Sending the same signal to MUXPOS and MUXNEG (PD0)
-        ADC0.MUXNEG = ADC_VIA_PGA_gc | ADC_MUXNEG_AIN0_gc;  // The signals should cancel each other out
-    #else
-        ADC0.MUXPOS = ADC_MUXPOS_AIN0_gc;                   // else PGA is disabled so same but without VIA on
-        ADC0.MUXNEG = ADC_MUXNEG_AIN0_gc; 
-    #endif
-    
-    while(ADC0.STATUS != 0)                                 // Wait for ADC0 to be ready (ADC needs some time
-        ;                                                   // when changing reference or inputs)
-
-    ADC0.COMMAND = ADC_DIFF_bm                              // Differential input mode                
-                 | ADC_MODE_BURST_gc                        // Use Burst mode
-                 | ADC_START_IMMEDIATE_gc;                  // Start immediately
+    uint8_t frame[6];
     
-    while(ADC0.COMMAND & ADC_START_IMMEDIATE_gc)            // Wait for conversion to finish
-        ;
+    if (frame_seq == 0)
+    {
+        send_calibration_frame();
+    }
     
-    adc_offset = ADC0.RESULT;                               // Read result
+    frame[0] = FRAME_TYPE_MEASUREMENT;
+    frame[1] = frame_seq++;
+    frame[2] = raw;
+    frame[3] = raw >> 8;
+    frame[4] = raw >> 16;
+    
+    usart1_sendFrame(frame, 5);
+}
+#endif
+
+
+/*************************************************************************
+*
+*   fixtostr(int32_t n, char* res, uint8_t decimals)
+*
+*   Convert fixed-point value n to string res[] without float or division
+*   n = value * 10^decimals, e.g. n = 476, decimals = 4 --> "0.0476"
+*   Negative values get a leading '-'. decimals must be 9 or less, and
+*   res[] must have room for 13 characters (sign, 10 digits, '.', NULL)
+*
+*   The digits are written front to back. Each digit is found by
+*   subtracting the power of 10 for its position until the rest is
+*   smaller, which is much faster than % and / on a CPU without divider
+*
+**************************************************************************/
+const uint32_t pow10_table[10] =
+{
+    1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+    10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+void fixtostr(int32_t n, char* res, uint8_t decimals)
+{
+    uint32_t u = n;
+    uint32_t p;
+    uint8_t pos;                            // Digits left, including this one
+    char digit;
+    uint8_t started = 0;
+    
+    if (n < 0)
+    {
+        *res++ = '-';                       // add sign and continue with the absolute value
+        u = -u;
+    }
+    
+    for (pos = 10; pos > 0; pos--)
+    {
+        p = pow10_table[10 - pos];
+        digit = '0';
+        while (u >= p)
+        {
+            u -= p;
+            digit++;
+        }
+        
+        if (pos == decimals)
+        {
+            *res++ = '.';                   // add decimal symbol ('dot') before the first decimal
+        }
+        if (started || (digit != '0') || (pos <= decimals + 1))
+        {
+            *res++ = digit;                 // no leading zeros, but at least one digit before the dot
+            started = 1;
+        }
+    }
+    *res = '\0';                            // last character is NULL
+}
+
+
+/*************************************************************************
+*
+*   ftostr(float n, char* res, int decimals)
+*
+*   Convert float n to string res[] with 'decimals' decimals (rounded)
+*   The value is scaled to fixed point and printed with fixtostr(),
+*   so no libm functions are used. decimals must be 9 or less and
+*   n * 10^decimals must fit in 32 bits
+*
+**************************************************************************/
+void ftostr(float n, char* res, int decimals)
+{
+    float scaled = n * (float) pow10_table[9 - decimals];
+    
+    if (scaled < 0)
+    {
+        scaled = scaled - 0.5;              // round away from zero
+    }
+    else
+    {
+        scaled = scaled + 0.5;
+    }
+    fixtostr((int32_t) scaled, res, decimals);
+}
+
+
+
+/*************************************************************************
+*
+*   init_clock(void)
+*
+*   Set main clock 
+*   For 3.33 MHz just comment out and do nothing (default) 
+*
+**************************************************************************/
+void init_clock(void)
+{
+    // Main clock divide by 2 --> CLK_PER = 20 MHz / 2 = 10 MHz
+    _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, (CLKCTRL_PDIV_DIV2_gc | CLKCTRL_PEN_bm));
+    
+    while(CLKCTRL.MCLKSTATUS & CLKCTRL_SOSC_bm)
+        ; // Wait for clock change to complete
+}
+
+
+#ifdef CLOCK_SCALING
+/*************************************************************************
+*
+*   clock_set(uint8_t profile)
+*
+*   Switch main clock prescaler, TIMEBASE, ADC0 prescaler and USART1 BAUD
+*   to the values of clock_profiles[profile] (CLOCK_MEASURE/CLOCK_COMPUTE).
+*   The four values always change together, so the ADC0 clock limit and
+*   the baud rate checked at compile time hold for each profile.
+*   Nothing is changed while USART1 is sending, the profile is then kept
+*   until the next call. ADC0 must not be converting, so it is only called
+*   from the main line between bursts, never from an interrupt.
+*   Interrupts are disabled while the profile changes, so USART1 can not
+*   start sending between the check and the new BAUD value.
+*   Note that _delay_us() assumes F_CPU, so delays are longer on the slow
+*   clock, and PHASE_TRACE ticks are CLK_PER/2 of the active profile
+*
+**************************************************************************/
+void clock_set(uint8_t profile)
+{
+    uint8_t sreg = SREG;                        // Save interrupt state
+    
+    cli();
+    if ((profile != clock_current) && !usart1_tx_busy)
+    {
+        _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, clock_profiles[profile].mclkctrlb);
+        while(CLKCTRL.MCLKSTATUS & CLKCTRL_SOSC_bm)
+            ; // Wait for clock change to complete
+        
+        CLKCTRL.MCLKTIMEBASE = clock_profiles[profile].timebase;
+        ADC0.CTRLB = clock_profiles[profile].adc_presc;
+        USART1.BAUD = clock_profiles[profile].baud;
+        clock_current = profile;
+    }
+    SREG = sreg;                                // Restore interrupt state
+}
+#endif
+
+
+
+/*************************************************************************
+*
+*   init_PORT(void)
+*
+*   Init PORT (disable all port pins) 
+*
+**************************************************************************/
+void init_PORT(void)
+{
+     PORTA.PINCONFIG = PORT_ISC_INPUT_DISABLE_gc;
+     PORTA.PINCTRLUPD = 0xff;
+     PORTB.PINCTRLUPD = 0xff;
+     PORTC.PINCTRLUPD = 0xff;
+     PORTD.PINCTRLUPD = 0xff;
+     PORTE.PINCTRLUPD = 0xff;
+     PORTF.PINCTRLUPD = 0xff;
+}
+
+
+/*************************************************************************
+*
+*   init_VREF(void)
+*
+*   Init Voltage Reference (VREF)
+*
+**************************************************************************/
+void init_VREF(void)
+{
+    // Set DAC0 reference to internal 3.3V
+    VREF.DAC0REF = VREF_REFSEL_VDD_gc;
+}
+
+
+/*************************************************************************
+*
+*   init_DAC0(void)
+*
+*   Init Digital to Analog Converter (DAC0)
+*
+**************************************************************************/
+void init_DAC0(void)
+{
+    DAC0.DATA = 0 << DAC_DATA_gp;                   // Set DAC0 output = 0
+    DAC0.CTRLA = DAC_CTRLA_ON;                      // Enable DAC Output, Enable DAC
+    
+}
+
+
+/*************************************************************************
+*
+*   init_ADC0(void)
+*
+*   Init Analog to Digital Converter (ADC0)
+*
+*   Prescaler = 10 (ADC Clock is divided by 10)
+*   ADC Reference = V_DD
+*   ADC running in debug mode enabled
+*   Sample Duration (SAMPDUR) is set to 12
+*   Sign chopping enabled
+*   Number of accumulated samples is set to 16
+*
+*   If PGA is on, the gain is set to 16 and the bias is set to 100%
+*   This bias causes ADCPGASAMPDUR = 3us (or 4 if using int. ref)
+*   See table in data sheet for ADCPGASAMPDUR for other bias settings
+*
+**************************************************************************/
+void init_ADC0(void)
+{
+    CLKCTRL.MCLKTIMEBASE = TIMEBASE_VALUE;                  // Set the Timebase in the Main clock (f_CLK_PER)
+    ADC0.CTRLB = ADC_PRESC_SEL;                             // Set ADC prescaler, f_CLK_ADC = f_CLK_PER/10
+                                                            // CLK_PER = 20MHz --> f_CLK_ADC = 2MHz, CLK_ADC = 0,5us
+                                                            // CLK_PER = 3.33MHz --> f_CLK_ADC = 333kHz, CLK_ADC = 3us (approx)
+                                                            // CLK_PER = 2MHz --> f_CLK_ADC = 200kHz, CLK_ADC = 5us
+    ADC0.CTRLC = ADC_REFSEL_VDD_gc;                         // Select V_DD as ADC reference
+    ADC0.DBGCTRL = ADC_DBGRUN_bm;                           // Enable run in debug
+    ADC0.CTRLE = ADC_SAMPDUR;                               // In Burst mode, SAMPDUR must be >= 12
+    ADC0.CTRLF = ADC_CHOPPING_bm | ADC_SAMPNUM_SEL;         // Enable sign chopping (reduce offset), Accumulate ADC_SAMPLES samples
+    
+    #ifdef PGA_ON
+        ADC0.PGACTRL = ADC_PGAEN_bm                         // Turn on PGA
+                     | ADC_GAIN_SEL                         // Gain ADC_GAIN (16x)
+                     | ADC_PGABIASSEL_100PCT_gc;            // bias 100% (CLK_ADC <= 6MHz)
+    #endif
+}
+
+
+
+/*************************************************************************
+*
+*   adc0_start(uint8_t command)
+*
+*   Start an ADC0 conversion, command is written to ADC0.COMMAND
+*
+*   With ADC_SLEEP the result ready interrupt is enabled, and the device
+*   may sleep in standby until the conversion is done (see adc0_wait_result)
+*
+**************************************************************************/
+void adc0_start(uint8_t command)
+{
+    ADC0.INTFLAGS = ADC_RESRDY_bm;                          // Clear result ready flag from any earlier conversion
+    
+    #ifdef ADC_SLEEP
+        adc_state = ADC_STATE_BUSY;
+        ADC0.INTCTRL = ADC_RESRDY_bm;                       // Wake up on result ready
+        select_sleep_mode();                                // Standby keeps ADC0/DAC0 running, CPU clock is stopped
+    #endif
+    
+    ADC0.COMMAND = command;                                 // Start conversion
+}
+
+
+/*************************************************************************
+*
+*   adc0_wait_result(void)
+*
+*   Wait for the conversion started by adc0_start() and return the result
+*
+*   With ADC_SLEEP the CPU sleeps until ISR(ADC0_RESRDY_vect) marks the
+*   conversion as done, otherwise the RESRDY flag is polled.
+*   A result of more than 32 accumulated samples (ADC0.CTRLF SAMPNUM) is
+*   scaled down to 32 samples with rounding, so it always fits in 17 bits.
+*   The extra samples reduce noise, the extra bits are fractional LSBs
+*   Must be called with interrupts disabled, returns with interrupts disabled
+*
+**************************************************************************/
+int32_t adc0_wait_result(void)
+{
+    uint8_t shift = (ADC0.CTRLF & ADC_SAMPNUM_gm) >> ADC_SAMPNUM_gp;
+    
+    #ifdef ADC_SLEEP
+        while (adc_state == ADC_STATE_BUSY)
+        {
+            sei();                                          // sei() delays interrupts by one instruction, so
+            sleep_cpu();                                    // an interrupt cannot come in before sleep
+            cli();
+        }
+        adc_state = ADC_STATE_IDLE;
+        select_sleep_mode();                                // Conversion done, deeper sleep allowed again
+    #else
+        while( !(ADC0.INTFLAGS & ADC_RESRDY_bm) )           // wait until RESRDY flag is set
+            ;
+    #endif
+    
+    if (shift > ADC_SAMPNUM_ACC32_gc)                       // More than 32 samples, scale to 32
+    {
+        shift = shift - ADC_SAMPNUM_ACC32_gc;
+        return ROUND_SHIFT((int32_t) ADC0.RESULT, shift);   // Read result (clears RESRDY flag)
+    }
+    return ADC0.RESULT;                                     // Read result (clears RESRDY flag)
+}
+
+
+/*************************************************************************
+*
+*   measure_offset_bias(void)
+*
+*   Measure ADC0 offset and bias level on inputs (AIN0, AIN1)
+*
+**************************************************************************/
+void measure_offset_bias(void)
+{
+    ADC0.CTRLA = ADC_CTRLA_ON;                              // Enable ADC0
+    
+    // Measure offset (sample 16 times)
+    #if defined(AUTO_RANGE)                                 // PGA on or off for the gain set by range_calibrate()
+        ADC0.MUXPOS = range_table[range_level].via | ADC_MUXPOS_AIN0_gc;
+        ADC0.MUXNEG = range_table[range_level].via | ADC_MUXNEG_AIN0_gc;
+    #elif defined(PGA_ON)                                   // If PGA is enabled
+        ADC0.MUXPOS = ADC_VIA_PGA_gc | ADC_MUXPOS_AIN0_gc;  // Sending the same signal to MUXPOS and MUXNEG (PD0)
+        ADC0.MUXNEG = ADC_VIA_PGA_gc | ADC_MUXNEG_AIN0_gc;  // The signals should cancel each other out
+    #else
+        ADC0.MUXPOS = ADC_MUXPOS_AIN0_gc;                   // else PGA is disabled so same but without VIA on
+        ADC0.MUXNEG = ADC_MUXNEG_AIN0_gc; 
+    #endif
+    
+    while(ADC0.STATUS != 0)                                 // Wait for ADC0 to be ready (ADC needs some time
+        ;                                                   // when changing reference or inputs)
+
+    adc0_start(ADC_DIFF_bm                                  // Differential input mode                
+             | ADC_MODE_BURST_gc                            // Use Burst mode
+             | ADC_START_IMMEDIATE_gc);                     // Start immediately
+    
+    adc_offset = adc0_wait_result();                        // Wait for conversion to finish and read result
     
     // Measure the ADC input signal base level (bias)
-    #ifdef PGA_ON                                           // If PGA is enabled
+    #if defined(AUTO_RANGE)
+        ADC0.MUXPOS = range_table[range_level].via | ADC_MUXPOS_AIN1_gc;
+        ADC0.MUXNEG = range_table[range_level].via | ADC_MUXNEG_AIN0_gc;
+    #elif defined(PGA_ON)                                   // If PGA is enabled
         ADC0.MUXPOS = ADC_VIA_PGA_gc | ADC_MUXPOS_AIN1_gc;  // Reconfigure ADC inputs, MUXPOS = AIN1
         ADC0.MUXNEG = ADC_VIA_PGA_gc | ADC_MUXNEG_AIN0_gc;  // MUXNEG = AIN0
     #else
@@ -358,167 +1677,2115 @@ void measure_offset_bias(void)
     while(ADC0.STATUS != 0)
         ;                                                   // Wait for ADC0 to be ready
     
-    ADC0.COMMAND = ADC_DIFF_bm                              // Differential input mode  
-                 | ADC_MODE_BURST_gc                        // Use Burst mode 
-                 | ADC_START_IMMEDIATE_gc;                  // Start immediately
+    adc0_start(ADC_DIFF_bm                                  // Differential input mode  
+             | ADC_MODE_BURST_gc                            // Use Burst mode 
+             | ADC_START_IMMEDIATE_gc);                     // Start immediately
+    
+    sample_acc = adc0_wait_result();                        // Wait for conversion to finish and read result
+    adc_center = sample_acc - adc_offset;                   // Adjust for offset
     
-    while(ADC0.COMMAND & ADC_START_IMMEDIATE_gc)            // Wait for conversion to finish
+    ADC0.CTRLA = 0;                                         // Disable ADC0
+    DAC0.CTRLA = 0;                                         // Disable DAC0
+}
+
+
+
+/*************************************************************************
+*
+*   set_DAC0_output(void)
+*
+*   Set the DAC0 output to value in V defined by DAC_OUT (see #Defines)
+*
+**************************************************************************/
+void set_DAC0_output(void)
+{
+    dac_data = DAC_CODE(DAC_OUT);               // DAC is 10 bit (2^10 = 1024) --> DAC0.DATA = DAC_OUT / (DAC_REF / 1024), rounded
+    DAC0.DATA = dac_data << DAC_DATA_gp;        // Write value to DAC0.DATA register
+}
+
+
+#ifdef SETTLE_CAL
+/*************************************************************************
+*
+*   settle_wait(uint16_t ticks)
+*
+*   Sleep until the RTC counter has counted ticks (1/32768 s each, at least
+*   SETTLE_MIN_TICKS). The counter runs all the time, the wait ends on a
+*   compare match, so it is between ticks - 1 and ticks long.
+*   Must be called with interrupts disabled, returns with interrupts disabled
+*
+**************************************************************************/
+void settle_wait(uint16_t ticks)
+{
+    if (ticks < SETTLE_MIN_TICKS)
+    {
+        ticks = SETTLE_MIN_TICKS;
+    }
+    while (RTC.STATUS & RTC_CMPBUSY_bm)                     // Last CMP write synchronized (done long ago)
         ;
+    RTC.CMP = RTC.CNT + ticks;
+    RTC.INTFLAGS = RTC_CMP_bm;
+    RTC.INTCTRL = RTC_CMP_bm;                               // Wake up on compare match
+    settle_busy = 1;
+    select_sleep_mode();
+    
+    while (settle_busy)
+    {
+        sei();                                              // sei() delays interrupts by one instruction, so
+        sleep_cpu();                                        // an interrupt cannot come in before sleep
+        cli();
+    }
+}
+
+
+/*************************************************************************
+*
+*   ISR(RTC_CNT_vect)
+*
+*   Interrupt Service Routine for RTC compare match, ends settle_wait()
+*
+**************************************************************************/
+ISR(RTC_CNT_vect)
+{
+    RTC.INTFLAGS = RTC_CMP_bm;                  // Clear compare match flag
+    RTC.INTCTRL = 0;
+    settle_busy = 0;
+    select_sleep_mode();
+}
+
+
+/*************************************************************************
+*
+*   settle_sample(void)
+*
+*   Do a burst of 16 12-bit conversions on the measurement inputs and
+*   return the sum. ADC0 must be enabled
+*
+**************************************************************************/
+int32_t settle_sample(void)
+{
+    while(ADC0.STATUS > 0)                                  // wait for ADC ready
+        ;
+    adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+    return adc0_wait_result();
+}
+
+
+/*************************************************************************
+*
+*   settle_calibrate(void)
+*
+*   Measure how long DAC0, the reference and the PGA need to settle after
+*   they are enabled. A settled burst is taken after SETTLE_MAX_TICKS * 4.
+*   Then the analog chain is switched off for SETTLE_OFF_MS and on again
+*   with a one RTC tick longer wait each time, until the mean of a burst
+*   is within SETTLE_TOL LSB of the settled mean. A burst of 16 samples is
+*   used and not a single conversion, so the noise (gained up by the PGA)
+*   does not hide the settling. settle_ticks is set to that time plus one
+*   tick margin, and do_ADC0_measurement() waits that long before each
+*   burst. The CPU sleeps during all waits (settle_wait).
+*   DAC0 output and ADC0 inputs must be set up for the measurement, and
+*   the RTC counter must run (init_RTC_PIT)
+*
+**************************************************************************/
+void settle_calibrate(void)
+{
+    int32_t settled;
+    int32_t diff;
+    uint8_t ticks;
+    
+    ADC0.CTRLF = ADC_CHOPPING_bm | ADC_SAMPNUM_ACC16_gc;     // 16 samples per burst
+    
+    DAC0.CTRLA = DAC_CTRLA_ON;
+    ADC0.CTRLA = ADC_CTRLA_ON;
+    settle_wait(SETTLE_MAX_TICKS * 4);
+    settled = settle_sample();
+    
+    for (ticks = SETTLE_MIN_TICKS; ticks <= SETTLE_MAX_TICKS; ticks++)
+    {
+        ADC0.CTRLA = 0;
+        DAC0.CTRLA = 0;
+        settle_wait(SETTLE_OFF_TICKS);                      // Off like between measurements
+        
+        DAC0.CTRLA = DAC_CTRLA_ON;
+        ADC0.CTRLA = ADC_CTRLA_ON;
+        settle_wait(ticks);
+        diff = settle_sample() - settled;
+        if ((diff <= SETTLE_TOL * 16) && (diff >= -SETTLE_TOL * 16))
+        {
+            break;                                          // Settled after ticks
+        }
+    }
+    
+    settle_ticks = (ticks < SETTLE_MAX_TICKS) ? ticks + 1 : SETTLE_MAX_TICKS;
+    
+    ADC0.CTRLA = 0;
+    DAC0.CTRLA = 0;
+    ADC0.CTRLF = ADC_CHOPPING_bm | ADC_SAMPNUM_SEL;         // Back to burst settings (init_ADC0)
+}
+#endif
+
+
+
+/*************************************************************************
+*
+*   init_RTC_PIT(void)
+*
+*   Enable RTC and PIT
+*
+*   RTC clock is set to 1kHz. PIT is set to trigger each 1s (1024 cycles)
+*
+*   With SETTLE_CAL the RTC clock is 32.768kHz (PIT 32768 cycles), and
+*   the RTC counter runs freely, settle_wait() sleeps until a compare match
+*
+**************************************************************************/
+void init_RTC_PIT(void)
+{
+    
+    while (RTC.STATUS > 0)                      // Wait for RTC to be synchronized
+        ;
+     
+    #ifdef SETTLE_CAL
+        RTC.CLKSEL = RTC_CLKSEL_OSC32K_gc;      // RTC clock is 32.768kHz, one count is one settling tick
+    #else
+        RTC.CLKSEL = RTC_CLKSEL_OSC1K_gc;       // RTC clock is 1.024kHz from OSC32K
+    #endif
+    
+    while(RTC.PITSTATUS > 0)
+        ;                                       // Wait for PIT to be synchronized
+    
+    #ifdef SETTLE_CAL
+        RTC.PITCTRLA = RTC_PITEN_bm             // Enable PIT
+                     | RTC_PERIOD_CYC32768_gc;  // approx. every 1s (32768 cycles on 32kHz clock)
+    #else
+        RTC.PITCTRLA = RTC_PITEN_bm             // Enable PIT 
+                     | RTC_PERIOD_CYC1024_gc;   // approx. every 1s (1024 cycles on 1kHz clock)
+    #endif
+    RTC.PITDBGCTRL = RTC_DBGRUN_bm;             // Allow RTC to run in debug mode
+    
+    while(RTC.PITSTATUS > 0)                    // Wait for PIT sync
+        ;
+    
+    #ifdef SETTLE_CAL
+        RTC.PER = 0xFFFF;                       // Count through all 16 bits, waits are CNT + ticks
+        RTC.CTRLA = RTC_PRESCALER_DIV1_gc       // 32768 counts per second
+                  | RTC_RTCEN_bm
+                  | RTC_RUNSTDBY_bm;            // Count in standby sleep (settle_wait)
+        while (RTC.STATUS > 0)
+            ;
+    #endif
+
+}
+
+
+
+/**********************************************************************************
+*
+*   init_USART1(void)
+*
+*   BAUD = (64 * F_CPU) / (S * BAUD_RATE)
+*   S = no. of samples (16 for async)
+*   Note! Max BAUD_RATE = F_CPU / S (see #Defines), F_CPU = main clock frequency
+*
+**********************************************************************************/
+void init_USART1(void)
+{
+    USART1.BAUD = USART_BAUD_VALUE;             // Calculated and checked at compile time
+    
+    PORTC.OUTSET = PIN0_bm;                     // PC0 high, keeps TxD line idle while USART1 is powered down
+    PORTC.DIRSET = PIN0_bm;                     // set PC0 as output (USART1 TxD)
+                                                // USART1 TX is enabled by usart1_putc() when there is data to send
+}
+
+
+/********************************************************************************
+*
+*   ISR(USART1_DRE_vect)
+*
+*   Interrupt Service Routine for USART1 Data Register Empty
+*   Moves the next byte from the transmit queue to the USART1 TX buffer.
+*   When the queue is empty, switch to the TXC interrupt to detect when 
+*   the last byte is sent
+*
+********************************************************************************/
+ISR(USART1_DRE_vect)
+{
+    uint8_t tail = usart1_tx_tail;
+    
+    if (tail != usart1_tx_head)
+    {
+        USART1.STATUS = USART_TXCIF_bm;                         // Clear TXCIF before writing new data
+        USART1.TXDATAL = usart1_tx_buffer[tail];                // Send next byte
+        tail = (tail + 1) & USART_TX_BUFFER_MASK;
+        usart1_tx_tail = tail;
+    }
+    
+    if (tail == usart1_tx_head)
+    {
+        USART1.CTRLA = USART_TXCIE_bm;                          // Queue empty, disable DRE and wait for TXC
+    }
+}
+
+
+/********************************************************************************
+*
+*   ISR(USART1_TXC_vect)
+*
+*   Interrupt Service Routine for USART1 Transmit Complete
+*
+********************************************************************************/
+ISR(USART1_TXC_vect)
+{
+    USART1.STATUS = USART_TXCIF_bm;             // Clear TXCIF flag by writing a '1' to it
+    
+    if (usart1_tx_tail != usart1_tx_head)
+    {
+        USART1.CTRLA = USART_DREIE_bm;          // New data was queued meanwhile, keep sending
+    }
+    else
+    {
+        usart1_tx_complete();
+    }
+}
+
+
+#ifdef WINDOW_MONITOR
+/***********************************************************************************************
+*
+*   init_window_monitor(void)
+*
+*   Let the hardware do the periodic measurement without waking up the CPU:
+*   - The RTC PIT event generator (period MONITOR_EVGEN) is routed through EVSYS channel 0
+*     to the ADC0 start input, so each PIT event starts one burst conversion
+*   - The ADC0 window comparator checks each accumulated result against MONITOR_LOW_NA and 
+*     MONITOR_HIGH_NA and wakes up the CPU when the result leaves the window (and again 
+*     when it comes back, see ISR(ADC0_SAMPRDY_vect))
+*   - The RTC counter overflows every MONITOR_HEARTBEAT seconds to send a report anyway
+*
+*   ADC0 (with PGA), DAC0 and the RTC stay enabled and run in standby sleep.
+*   Must be called after measure_offset_bias() (thresholds include offset and bias), 
+*   set_DAC0_output() and init_RTC_PIT()
+*
+************************************************************************************************/
+void init_window_monitor(void)
+{
+    int16_t adjust = 0;
+    
+    #ifdef BIAS_ADJUST
+        adjust = adc_offset + adc_center;                           // The comparator sees the raw result
+    #endif
+    
+    RTC.PITEVGENCTRLA = MONITOR_EVGEN;                              // PIT event generator 0 period
+    EVSYS.CHANNEL0 = EVSYS_CHANNEL0_RTC_EVGEN0_gc;                  // PIT event on channel 0
+    EVSYS.USERADC0START = EVSYS_USER_CHANNEL0_gc;                   // Channel 0 starts ADC0 conversions
+    
+    ADC0.WINLT = FP_CODE_FROM_NA(MONITOR_LOW_NA) + adjust;          // Window low threshold
+    ADC0.WINHT = FP_CODE_FROM_NA(MONITOR_HIGH_NA) + adjust;         // Window high threshold
+    ADC0.CTRLD = ADC_WINCM_OUTSIDE_gc;                              // Wake up when result is outside window
+    ADC0.INTFLAGS = ADC_WCMP_bm;
+    ADC0.INTCTRL = ADC_WCMP_bm;                                     // Enable window compare interrupt
+    
+    DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm | DAC_RUNSTDBY_bm;    // DAC must stay on to drive the sensor
+    ADC0.CTRLA = ADC_ENABLE_bm | ADC_RUNSTDBY_bm;                   // ADC runs in standby
+    
+    while(ADC0.STATUS > 0)                                          // wait for ADC ready
+        ;
+    
+    ADC0.COMMAND = ADC_DIFF_bm                                      // Differential input mode
+                 | ADC_MODE_BURST_gc                                // Use Burst mode
+                 | ADC_START_EVENT_TRIGGER_gc;                      // Start on each event
+    
+    while (RTC.STATUS > 0)                                          // Wait for RTC to be synchronized
+        ;
+    RTC.PER = MONITOR_HEARTBEAT - 1;                                // Overflow every MONITOR_HEARTBEAT seconds
+    RTC.INTCTRL = RTC_OVF_bm;                                       // Enable overflow interrupt
+    RTC.CTRLA = RTC_PRESCALER_DIV1024_gc                            // 1.024kHz / 1024 = 1 count per second
+              | RTC_RUNSTDBY_bm                                     // Run in standby
+              | RTC_RTCEN_bm;                                       // Enable RTC counter
+}
+
+
+/********************************************************************************
+*
+*   ISR(ADC0_SAMPRDY_vect)
+*
+*   Interrupt Service Routine for ADC0 window compare (WCMP shares the
+*   SAMPRDY vector). Switch the comparator between outside and inside
+*   window mode, so the CPU wakes up once when the result leaves the window
+*   and once when it comes back, not on every conversion outside
+*
+********************************************************************************/
+ISR(ADC0_SAMPRDY_vect)
+{
+    ADC0.INTFLAGS = ADC_WCMP_bm;                // Clear window compare flag
+    
+    monitor_outside = !monitor_outside;
+    if (monitor_outside)
+    {
+        ADC0.CTRLD = ADC_WINCM_INSIDE_gc;       // Wake up when result is back inside window
+    }
+    else
+    {
+        ADC0.CTRLD = ADC_WINCM_OUTSIDE_gc;      // Wake up when result leaves window
+    }
+    monitor_event |= MONITOR_EVENT_WINDOW;
+}
+
+
+/********************************************************************************
+*
+*   ISR(RTC_CNT_vect)
+*
+*   Interrupt Service Routine for RTC overflow (heartbeat)
+*
+********************************************************************************/
+ISR(RTC_CNT_vect)
+{
+    RTC.INTFLAGS = RTC_OVF_bm;                  // Clear overflow flag
+    uptime += MONITOR_HEARTBEAT;                // No PIT interrupts, count seconds by heartbeats
+    monitor_event |= MONITOR_EVENT_HEARTBEAT;
+}
+
+
+/***********************************************************************************************
+*
+*   monitor_uptime(void)
+*
+*   Seconds since the monitor was started. The PIT interrupt is not used with WINDOW_MONITOR,
+*   so uptime only counts the heartbeats and the RTC counter the seconds since the last one.
+*   An overflow that is not yet counted by ISR(RTC_CNT_vect) is added here.
+*   Must be called with interrupts disabled
+*
+************************************************************************************************/
+uint16_t monitor_uptime(void)
+{
+    uint16_t cnt = RTC.CNT;
+    uint16_t time = uptime;
+    
+    if (RTC.INTFLAGS & RTC_OVF_bm)
+    {
+        cnt = RTC.CNT;                          // Read again, the counter may have wrapped after the first read
+        time = time + MONITOR_HEARTBEAT;
+    }
+    return time + cnt;
+}
+#endif
+
+
+/***********************************************************************************************
+*
+*   do_ADC0_measurement(void)
+*
+*   Perform ADC measurement using burst mode and 16 samples (as set up in init_ADC0)
+*   With PIPELINE, the previous result is processed and reported while sampling. The CPU
+*   then uses the time it would otherwise spend waiting for ADC0 to accumulate samples.
+*   The report is only queued during the burst, USART1 sends it and a full log page is
+*   written to flash when ADC0 is off, so neither adds noise to the result.
+*   Without PIPELINE the result is processed after the burst, when ADC0 and DAC0 are off.
+*
+*   Time required for conversion is:
+*   t_conv = t_init + (((SAMPDUR + 2) * SAMPNUM + 14) / f_CLK_ADC) + ADCPGASAMPDUR * SAMPNUM
+*   2MHz: t_conv = 20us (PGA) + ((12+2)*16 + 14) / 200k + 12us*16 = 20 + 1190 + 192 = 1402 us
+*   20MHz: t_conv = 20us (PGA) + ((12+2)*16 + 14) / 2000000 + 3us*16 = 20 + 119 + 48 = 187 us
+*   20MHz: t_conv = 20us (PGA) + ((12+2)*16 + 14) / 2000000 + 6us*16 = 20 + 119 + 96 = 235 us
+*   
+*   Without PGA the formula is: 
+*   t_init + (((SAMPDUR+14)*SAMPNUM + 1.5) / f_CLK_ADC)
+*   20MHz w/o PGA: t_conv = 10us (ADC) + ( (12 + 14)*16 + 1.5) / 2000000 = 218.75 us
+*
+************************************************************************************************/
+void do_ADC0_measurement(void)
+{
+    int32_t result;
+    #if (ADC_DECIMATE_SHIFT > 0) && !defined(AUTO_RANGE)
+        uint16_t burst;
+    #endif
+    
+    #ifdef CLOCK_SCALING
+        clock_set(CLOCK_MEASURE);                                   // Slowest clock that meets the ADC0 clock limits
+    #endif
+    
+    DAC0.CTRLA = DAC_CTRLA_ON;                                      // DAC Output enable, Enable DAC
+    ADC0.CTRLA = ADC_CTRLA_ON;                                      // Enable ADC
+    #ifdef SETTLE_CAL
+        settle_wait(settle_ticks);                                  // Measured settling time, sleeping (settle_calibrate)
+    #endif
+    TRACE(TRACE_ANALOG_ON);
+    
+    while(ADC0.STATUS > 0)                                          // wait for ADC ready
+        ;
+    
+    #if defined(AUTO_RANGE)
+        TRACE(TRACE_ADC_START);
+        result = range_measure();                                   // Burst(s) at the selected gain, adjusted and scaled to 16x
+    #elif defined(PIPELINE)
+        adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+        TRACE(TRACE_ADC_START);
+        
+        usart1_tx_hold = 1;                                         // Report is queued now, sent after the burst
+        pipeline_flush();                                           // Process the previous result while ADC0 converts
+        #ifdef RECALIBRATE
+            recal_apply();                                          // Values of the last recal_step(), from this burst on
+        #endif
+        result = adc0_wait_result();                                // Sleeps only for the rest of the burst
+    #elif ADC_DECIMATE_SHIFT > 0
+        // Average 2^ADC_DECIMATE_SHIFT bursts (boxcar). Each result fits in 17 bits,
+        // so the sum of up to 256 bursts can not overflow 32 bits
+        TRACE(TRACE_ADC_START);
+        result = 0;
+        for (burst = 0; burst < (1 << ADC_DECIMATE_SHIFT); burst++)
+        {
+            adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+            result += adc0_wait_result();
+        }
+        result = ROUND_SHIFT(result, ADC_DECIMATE_SHIFT);
+    #else
+        // Start differential ADC conversion, burst mode (ADC_SAMPLES)
+        adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+        TRACE(TRACE_ADC_START);
+        
+        result = adc0_wait_result();                                // wait for result ready (sleeping with ADC_SLEEP), read ADC result
+    #endif
+    TRACE(TRACE_ADC_DONE);
+    
+    #ifdef RECALIBRATE
+        recal_step();                                               // Offset or bias conversion every RECAL_RATIO measurements
+        #ifndef PIPELINE
+            recal_apply();                                          // With PIPELINE after the stored result is processed
+        #endif
+    #endif
+    
+    ADC0.CTRLA = 0;                                                 // Disable ADC
+    DAC0.CTRLA = 0;                                                 // Disable DAC
+    
+    #if defined(PIPELINE) && defined(NVM_LOG)
+        if (nvm_log_count >= NVM_LOG_RECORDS)
+        {
+            nvm_log_write();                                        // Page filled during the burst
+        }
+    #endif
+    
+    #ifdef PIPELINE
+        pipe_result = result;                                       // Processed at the next wake-up
+        pipe_time = uptime;
+        pipe_valid = 1;
+    #endif
+    
+    #ifdef RECALIBRATE
+        if (recal_full)
+        {
+            #ifdef PIPELINE
+                pipeline_flush();                                   // Process with the calibration it was measured with
+            #endif
+            recal_full_calibration();                               // Offset + bias drifted more than RECAL_DRIFT_NA
+        }
+        #if defined(USART_ON) && defined(BINARY_OUTPUT)
+            if (recal_changed)
+            {
+                send_calibration_frame();                           // Receiver needs the new adc_offset/adc_center
+            }
+        #endif
+        recal_changed = 0;
+    #endif
+    
+    #ifdef PIPELINE
+        if (sw0_pressed())
+        {
+            pipeline_flush();                                       // SW0 held: this result too, so none is held back
+        }                                                           // when the measurements stop
+        usart1_tx_release();                                        // ADC0 is off, send the report
+    #endif
+    
+    #ifdef CLOCK_SCALING
+        clock_set(CLOCK_COMPUTE);                                   // Fast clock for the math and formatting
+    #endif
+    
+    #ifndef PIPELINE
+        process_ADC0_result(result);
+    #endif
+}
+
+
+#ifdef PIPELINE
+/***********************************************************************************************
+*
+*   pipeline_flush(void)
+*
+*   Process and report the result in the pipeline, if there is one. Called while the next
+*   burst is converting, and before anything that changes how a result is converted
+*   (a full recalibration), so a result is never processed with other settings than it was
+*   measured with. At the first wake-up the pipeline is empty and nothing is done.
+*   Also called after the burst when SW0 is pressed, so the last result is not held back
+*   when the measurements stop
+*
+************************************************************************************************/
+void pipeline_flush(void)
+{
+    if (pipe_valid)
+    {
+        pipe_valid = 0;
+        process_ADC0_result(pipe_result);
+    }
+}
+#endif
+
+
+#if defined(BATCH_OUTPUT) || defined(NVM_LOG)
+/***********************************************************************************************
+*
+*   result_time(void)
+*
+*   uptime when the result that is processed now was measured. With PIPELINE a result is
+*   processed one wake-up later, and with WINDOW_MONITOR uptime only counts the heartbeats
+*   (monitor_uptime)
+*
+************************************************************************************************/
+uint16_t result_time(void)
+{
+    #if defined(PIPELINE)
+        return pipe_time;
+    #elif defined(WINDOW_MONITOR)
+        return monitor_uptime();
+    #else
+        return uptime;
+    #endif
+}
+#endif
+
+
+#ifdef AUTO_RANGE
+/***********************************************************************************************
+*
+*   range_select(uint8_t level)
+*
+*   Set the PGA gain (or PGA off) of range_table[level] for the measurement inputs (AIN1 - AIN0)
+*   and wait for ADC0 to be ready
+*
+************************************************************************************************/
+void range_select(uint8_t level)
+{
+    ADC0.PGACTRL = range_table[level].pgactrl;
+    ADC0.MUXPOS = range_table[level].via | ADC_MUXPOS_AIN1_gc;
+    ADC0.MUXNEG = range_table[level].via | ADC_MUXNEG_AIN0_gc;
+    
+    while(ADC0.STATUS > 0)                                          // wait for ADC ready
+        ;
+}
+
+
+/***********************************************************************************************
+*
+*   range_calibrate(void)
+*
+*   Measure offset and bias (measure_offset_bias) once for each gain in range_table.
+*   adc_offset and adc_center are then set to 0, since range_measure() returns results
+*   that are already adjusted with the values for the gain that was used
+*
+************************************************************************************************/
+void range_calibrate(void)
+{
+    uint8_t level;
+    
+    for (level = 0; level < RANGE_LEVELS; level++)
+    {
+        range_level = level;
+        ADC0.PGACTRL = range_table[level].pgactrl;
+        DAC0.DATA = 0 << DAC_DATA_gp;                               // Same state as at start-up, measure_offset_bias()
+        DAC0.CTRLA = DAC_CTRLA_ON;                                  // disabled DAC0 after the previous level
+        _delay_us(DAC_SETTLE_US);
+        measure_offset_bias();
+        range_offset[level] = adc_offset;
+        range_center[level] = adc_center;
+    }
+    
+    adc_offset = 0;
+    adc_center = 0;
+    range_level = RANGE_LEVELS - 1;                                 // Start with the highest gain
+}
+
+
+/***********************************************************************************************
+*
+*   range_measure(void)
+*
+*   Measure with the gain selected by the previous result. If a burst is above RANGE_HIGH_PCT
+*   of full scale (or saturated), the gain is lowered and the measurement is done again, so
+*   extra bursts are only spent when the current has risen since the last measurement.
+*   A result below RANGE_LOW_PCT of full scale selects a higher gain for the next measurement.
+*   Returns the result adjusted for offset and bias at the gain used, scaled to 16x gain.
+*   ADC0 and DAC0 must be enabled, interrupts disabled
+*
+************************************************************************************************/
+int32_t range_measure(void)
+{
+    int32_t result;
+    int32_t raw;
+    uint16_t burst;
+    uint8_t level;
+    uint8_t out_of_range;
+    
+    do
+    {
+        range_select(range_level);
+        level = range_level;
+        result = 0;
+        out_of_range = 0;
+        for (burst = 0; (burst < (1 << ADC_DECIMATE_SHIFT)) && !out_of_range; burst++)
+        {
+            adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+            raw = adc0_wait_result();
+            if ((level > 0) && ((raw > RANGE_HIGH_CODE) || (raw < -RANGE_HIGH_CODE)))
+            {
+                out_of_range = 1;                                   // Lower the gain and measure again
+                range_level--;
+            }
+            result += raw;
+        }
+    } while (out_of_range);
+    result = ROUND_SHIFT(result, ADC_DECIMATE_SHIFT);
+    
+    // Each step up doubles the result, so step up while it stays below RANGE_LOW_PCT
+    raw = (result < 0) ? -result : result;
+    while ((range_level < RANGE_LEVELS - 1) && (raw < RANGE_LOW_CODE))
+    {
+        range_level++;
+        raw = raw * 2;
+    }
+    
+    #ifdef BIAS_ADJUST
+        result = result - range_offset[level] - range_center[level];
+    #endif
+    return result * (1L << range_table[level].shift);
+}
+#endif
+
+
+#ifdef RECALIBRATE
+/***********************************************************************************************
+*
+*   recal_reset(void)
+*
+*   Start the offset/bias estimates from the values of a full calibration (measure_offset_bias)
+*
+************************************************************************************************/
+void recal_reset(void)
+{
+    recal_offset_est = (int32_t) adc_offset * (1 << RECAL_Q);
+    recal_center_est = (int32_t) adc_center * (1 << RECAL_Q);
+    recal_bias_ref = recal_offset_est + recal_center_est;
+    recal_count = 0;
+    recal_full = 0;
+}
+
+
+/***********************************************************************************************
+*
+*   recal_step(void)
+*
+*   Every RECAL_RATIO measurements, do one short offset (AIN0 - AIN0) or bias (AIN1 - AIN0 with
+*   DAC0 output at 0 V) conversion, alternating between the two. Each conversion moves the
+*   estimate 1/2^RECAL_EWMA_SHIFT of the way (EWMA), rounded half away from zero so that
+*   a positive and a negative drift are tracked alike. adc_offset/adc_center are not changed
+*   here, recal_apply() does that once the results measured before are processed.
+*   If offset + bias has moved more than RECAL_DRIFT_NA since the last full calibration,
+*   recal_full is set. ADC0 and DAC0 must be enabled, interrupts disabled.
+*
+*   The corrected result is raw - adc_offset - adc_center = raw - bias, so the drift limit
+*   is checked on the sum
+*
+************************************************************************************************/
+void recal_step(void)
+{
+    int32_t sample;
+    int32_t diff;
+    int32_t drift;
+    
+    if (++recal_count < RECAL_RATIO)
+    {
+        return;
+    }
+    recal_count = 0;
+    
+    if (recal_phase == 0)
+    {
+        #ifdef PGA_ON
+            ADC0.MUXPOS = ADC_VIA_PGA_gc | ADC_MUXPOS_AIN0_gc;      // Same input on both sides, result is the offset
+            ADC0.MUXNEG = ADC_VIA_PGA_gc | ADC_MUXNEG_AIN0_gc;
+        #else
+            ADC0.MUXPOS = ADC_MUXPOS_AIN0_gc;
+            ADC0.MUXNEG = ADC_MUXNEG_AIN0_gc;
+        #endif
+    }
+    else
+    {
+        DAC0.DATA = 0 << DAC_DATA_gp;                               // No current, result is the bias
+        _delay_us(DAC_SETTLE_US);
+    }
+    
+    while(ADC0.STATUS > 0)                                          // wait for ADC ready
+        ;
+    adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+    sample = adc0_wait_result();
+    
+    if (recal_phase == 0)
+    {
+        diff = sample * (1 << RECAL_Q) - recal_offset_est;
+        recal_offset_est += ROUND_DIV(diff, 1L << RECAL_EWMA_SHIFT);
+        
+        #ifdef PGA_ON
+            ADC0.MUXPOS = ADC_VIA_PGA_gc | ADC_MUXPOS_AIN1_gc;      // Back to measurement inputs
+            ADC0.MUXNEG = ADC_VIA_PGA_gc | ADC_MUXNEG_AIN0_gc;
+        #else
+            ADC0.MUXPOS = ADC_MUXPOS_AIN1_gc;
+            ADC0.MUXNEG = ADC_MUXNEG_AIN0_gc;
+        #endif
+    }
+    else
+    {
+        diff = sample * (1 << RECAL_Q) - recal_offset_est - recal_center_est; // adc_center is measured after offset adjustment
+        recal_center_est += ROUND_DIV(diff, 1L << RECAL_EWMA_SHIFT);
+        
+        DAC0.DATA = dac_data << DAC_DATA_gp;                        // Back to DAC_OUT
+    }
+    recal_phase ^= 1;
+    
+    drift = recal_offset_est + recal_center_est - recal_bias_ref;
+    if (drift < 0)
+    {
+        drift = -drift;
+    }
+    if (drift > (FP_CODE_FROM_NA(RECAL_DRIFT_NA) * (1 << RECAL_Q)))
+    {
+        recal_full = 1;
+    }
+}
+
+
+/***********************************************************************************************
+*
+*   recal_apply(void)
+*
+*   Set adc_offset/adc_center from the offset/bias estimates, and set recal_changed if they
+*   changed. Without PIPELINE it is called right after recal_step(). With PIPELINE it is
+*   called after pipeline_flush(), so the stored result is processed with the values it was
+*   measured with, and the new values are used from the burst that is converting
+*
+************************************************************************************************/
+void recal_apply(void)
+{
+    int16_t offset = adc_offset;
+    int16_t center = adc_center;
+    
+    adc_offset = ROUND_DIV(recal_offset_est, 1L << RECAL_Q);
+    adc_center = ROUND_DIV(recal_center_est, 1L << RECAL_Q);
+    if ((adc_offset != offset) || (adc_center != center))
+    {
+        recal_changed = 1;
+    }
+}
+
+
+/***********************************************************************************************
+*
+*   recal_full_calibration(void)
+*
+*   Measure offset and bias with two full bursts (measure_offset_bias) with DAC0 at 0 V,
+*   like at start-up, and restart the estimates from the new values
+*
+************************************************************************************************/
+void recal_full_calibration(void)
+{
+    DAC0.DATA = 0 << DAC_DATA_gp;                                   // Same state as at start-up
+    DAC0.CTRLA = DAC_CTRLA_ON;
+    _delay_us(DAC_SETTLE_US);
+    
+    measure_offset_bias();                                          // Disables ADC0 and DAC0 when done
+    
+    DAC0.DATA = dac_data << DAC_DATA_gp;                            // Back to DAC_OUT, inputs are left at AIN1 - AIN0
+    
+    recal_reset();
+    recal_changed = 1;
+}
+#endif
+
+
+#ifdef ADAPTIVE_INTERVAL
+/***********************************************************************************************
+*
+*   adapt_wakeup_time(int32_t result)
+*
+*   Select the time to the next measurement from the change since the previous result:
+*   - change > ADAPT_FAST_NA: signal is moving, use ADAPT_MIN_TIME right away
+*   - change < ADAPT_STABLE_NA for ADAPT_STABLE_COUNT measurements: double the time,
+*     up to ADAPT_MAX_TIME
+*   - change in between: keep the time
+*   The gap between the two limits and the stable count give hysteresis, so the time does
+*   not jump back and forth on noise. Limits are converted to ADC codes at compile time
+*
+************************************************************************************************/
+void adapt_wakeup_time(int32_t result)
+{
+    int32_t delta = result - adapt_last;
+    
+    adapt_last = result;
+    if (delta < 0)
+    {
+        delta = -delta;
+    }
+    
+    if (delta > FP_CODE_FROM_NA(ADAPT_FAST_NA))
+    {
+        wakeup_time = ADAPT_MIN_TIME;                               // Fast change, measure often
+        adapt_stable_count = 0;
+    }
+    else if (delta < FP_CODE_FROM_NA(ADAPT_STABLE_NA))
+    {
+        adapt_stable_count++;
+        if (adapt_stable_count >= ADAPT_STABLE_COUNT)               // Stable for a while, back off
+        {
+            adapt_stable_count = 0;
+            if (wakeup_time <= ADAPT_MAX_TIME / 2)
+            {
+                wakeup_time = wakeup_time * 2;
+            }
+            else
+            {
+                wakeup_time = ADAPT_MAX_TIME;
+            }
+        }
+    }
+    else
+    {
+        adapt_stable_count = 0;                                     // Small change, keep time
+    }
+}
+#endif
+
+
+#ifdef RESULT_FILTER
+/***********************************************************************************************
+*
+*   filter_result(int32_t x)
+*
+*   Filter the adjusted result x over measurements and return the filtered result:
+*   - Median of the last FILTER_MEDIAN results, removes single spikes. Until FILTER_MEDIAN
+*     results are stored, the median of the stored results is used
+*   - First-order IIR, y = y + (x - y) / 2^FILTER_IIR_SHIFT, reduces the noise of each result.
+*     y is kept in Q8, so the filter does not stop short of the input by rounding.
+*     A change of more than FILTER_STEP_NA is followed at once (y = x), so a real step
+*     in the current is not smoothed out over many measurements
+*   x is at most 2^FP_X_BITS (21 bits), so x in Q8 and the difference fit in 32 bits
+*
+************************************************************************************************/
+int32_t filter_result(int32_t x)
+{
+    #if FILTER_MEDIAN > 1
+        int32_t sorted[FILTER_MEDIAN];
+        uint8_t i;
+        uint8_t j;
+    #endif
+    #if FILTER_IIR_SHIFT > 0
+        int32_t diff;
+    #endif
+    
+    #if FILTER_MEDIAN > 1
+        filter_history[filter_next] = x;
+        if (++filter_next == FILTER_MEDIAN)
+        {
+            filter_next = 0;
+        }
+        if (filter_count < FILTER_MEDIAN)
+        {
+            filter_count++;
+        }
+        
+        for (i = 0; i < filter_count; i++)                          // Insertion sort, at most 5 values
+        {
+            for (j = i; (j > 0) && (sorted[j - 1] > filter_history[i]); j--)
+            {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = filter_history[i];
+        }
+        x = sorted[(filter_count - 1) / 2];
+    #endif
+    
+    #if FILTER_IIR_SHIFT > 0
+        diff = ((int32_t) x << FILTER_Q) - filter_y;
+        
+        if (!filter_valid || (diff > FILTER_STEP_Q) || (diff < -FILTER_STEP_Q))
+        {
+            filter_y = (int32_t) x << FILTER_Q;                     // First result or a step, start from x
+            filter_valid = 1;
+        }
+        else
+        {
+            filter_y = filter_y + ROUND_SHIFT(diff, FILTER_IIR_SHIFT);
+        }
+        x = ROUND_SHIFT(filter_y, FILTER_Q);
+    #endif
+    
+    return x;
+}
+#endif
+
+
+/***********************************************************************************************
+*
+*   process_ADC0_result(int32_t result)
+*
+*   Adjust the raw accumulated ADC result for offset and bias, calculate voltage and current
+*   and send the measurement to the terminal (if USART_ON)
+*   With RESULT_FILTER the adjusted result is filtered, and result is replaced by the filtered
+*   result plus offset and bias, so binary frames and batches carry the filtered value.
+*   NVM_LOG stores the unfiltered result
+*
+************************************************************************************************/
+void process_ADC0_result(int32_t result)
+{
+    #if defined(USART_ON) && !defined(BINARY_OUTPUT) && !defined(BATCH_OUTPUT) && !defined(WINDOW_STATS)
+        char res[20];                                               // If USART is enabled, define array to convert result to string
+    #endif
+    
+    sample_acc = result;
+    
+    #ifdef NVM_LOG
+        nvm_log_add(result);                                        // Store result before adjustment
+    #endif
+    
+    //Calculate measurement
+    #ifdef BIAS_ADJUST
+        sample_acc = sample_acc - adc_offset - adc_center;          // Adjust for offset and bias
+    #endif
+    
+    #ifdef RESULT_FILTER
+        sample_acc = filter_result(sample_acc);                     // Median and IIR over measurements
+        result = sample_acc;
+        #ifdef BIAS_ADJUST
+            result = result + adc_offset + adc_center;              // Raw form for binary frames and batches
+        #endif
+    #endif
+    
+    #ifdef ADAPTIVE_INTERVAL
+        adapt_wakeup_time(sample_acc);                              // Select time to next measurement
+    #endif
+    
+    #ifdef FIXED_POINT
+        // Gain, number of samples, reference and R_SENSE are all folded into the scale factors
+        measured_voltage_uv = FP_CONVERT(sample_acc, FP_VOLTAGE_NUM, FP_VOLTAGE_DEN);
+        measured_current_na = FP_CONVERT(sample_acc, FP_CURRENT_NUM, FP_CURRENT_DEN);
+    #else
+        // Gain, number of samples, reference and R_SENSE are folded into one constant each
+        measured_voltage = sample_acc * FLOAT_VOLTAGE_SCALE;        // Calculate voltage
+        measured_current = sample_acc * FLOAT_CURRENT_SCALE;        // calculate current in uA
+    #endif
+    TRACE(TRACE_MATH_DONE);
+    
+    #if defined(WINDOW_STATS)                                       // Add to window statistics, send once per window
+        stats_add(sample_acc);
+    #elif defined(USART_ON) && defined(BATCH_OUTPUT)                // Store result, send stored results when needed
+        batch_add(result);
+    #elif defined(USART_ON) && defined(BINARY_OUTPUT)               // Send raw result as binary frame (USART1)
+        send_measurement_frame(result);                             // Result before adjustment
+    #elif defined(USART_ON) && defined(FIXED_POINT)                 // Send measurement to terminal (USART1)
+        fixtostr(ROUND_DIV(measured_voltage_uv, 100), res, 4);      // uV --> 0.1mV (rounded), print with 4 decimals in V
+        usart1_sendString("Measured voltage: ");
+        usart1_sendString(res);
+        usart1_sendString("V\n");
+        
+        fixtostr(ROUND_DIV(measured_current_na, 100), res, 1);      // nA --> 0.1uA (rounded), print in uA
+        usart1_sendString("Measured current: ");
+        usart1_sendString(res);
+        usart1_sendString("uA\n");
+    #elif defined(USART_ON)                                         // Send measurement to terminal (USART1)
+        ftostr(measured_voltage, res, 4);
+        usart1_sendString("Measured voltage: ");
+        usart1_sendString(res);
+        usart1_sendString("V\n");
+        
+        ftostr(measured_current, res, 1);
+        usart1_sendString("Measured current: ");
+        usart1_sendString(res);
+        usart1_sendString("uA\n");
+    #endif
+    TRACE(TRACE_REPORT_QUEUED);
+}
+
+
+#ifdef BATCH_OUTPUT
+/***********************************************************************************************
+*
+*   batch_add(int32_t result)
+*
+*   Store one raw result with its time in batch_buffer. All stored results are sent (batch_send)
+*   when the buffer is full, when the oldest stored result is BATCH_MAX_LATENCY seconds old or
+*   when the adjusted result is outside BATCH_LOW_NA..BATCH_HIGH_NA.
+*   USART1 is then only powered up once per batch instead of once per measurement
+*
+************************************************************************************************/
+void batch_add(int32_t result)
+{
+    int32_t adjusted = result;
+    
+    #ifdef BIAS_ADJUST
+        adjusted = result - adc_offset - adc_center;
+    #endif
+    
+    batch_buffer[batch_count].time = result_time();
+    batch_buffer[batch_count].result = result;
+    batch_count++;
+    
+    if ((batch_count >= BATCH_SIZE)
+        || ((uint16_t) (uptime - batch_buffer[0].time) >= BATCH_MAX_LATENCY)
+        || (adjusted < FP_CODE_FROM_NA(BATCH_LOW_NA))
+        || (adjusted > FP_CODE_FROM_NA(BATCH_HIGH_NA)))
+    {
+        batch_send();
+    }
+}
+
+
+/***********************************************************************************************
+*
+*   batch_send(void)
+*
+*   Send all stored results in one USART1 burst and empty the buffer
+*
+*   Binary: calibration frame, then batch frames of type FRAME_TYPE_BATCH with the number
+*           of records and time (uint16) + raw result (int24) for each record
+*   ASCII:  one line per record, "<time>s <current>uA\n"
+*
+************************************************************************************************/
+void batch_send(void)
+{
+    uint16_t i;
+    
+    #ifdef BINARY_OUTPUT
+        uint8_t frame[3 + 5 * BATCH_FRAME_RECORDS];
+        uint8_t n = 0;
+        
+        send_calibration_frame();                                   // Batch can be decoded on its own
+        
+        for (i = 0; i < batch_count; i++)
+        {
+            frame[2 + 5 * n] = batch_buffer[i].time;
+            frame[3 + 5 * n] = batch_buffer[i].time >> 8;
+            frame[4 + 5 * n] = batch_buffer[i].result;
+            frame[5 + 5 * n] = batch_buffer[i].result >> 8;
+            frame[6 + 5 * n] = batch_buffer[i].result >> 16;
+            n++;
+            
+            if ((n == BATCH_FRAME_RECORDS) || (i == batch_count - 1))
+            {
+                frame[0] = FRAME_TYPE_BATCH;
+                frame[1] = n;
+                usart1_sendFrame(frame, 2 + 5 * n);
+                n = 0;
+            }
+        }
+    #else
+        char res[14];
+        int32_t adjusted;
+        
+        for (i = 0; i < batch_count; i++)
+        {
+            adjusted = batch_buffer[i].result;
+            #ifdef BIAS_ADJUST
+                adjusted = adjusted - adc_offset - adc_center;
+            #endif
+            
+            fixtostr(batch_buffer[i].time, res, 0);
+            usart1_sendString(res);
+            usart1_sendString("s ");
+            fixtostr(ROUND_DIV(FP_CONVERT(adjusted, FP_CURRENT_NUM, FP_CURRENT_DEN), 100), res, 1);
+            usart1_sendString(res);
+            usart1_sendString("uA\n");
+        }
+    #endif
+    
+    batch_count = 0;
+}
+#endif
+
+
+#ifdef WINDOW_STATS
+/***********************************************************************************************
+*
+*   stats_add(int32_t x)
+*
+*   Add one adjusted result (sample_acc) to the statistics of the current window. The sums
+*   of the differences from the first result of the window and of their squares are exact
+*   integers, so the mean and variance (stats_mean, stats_variance) do not lose precision
+*   when the spread is much smaller than the mean, however long the window is. A running
+*   mean rounded to 1/256 code (Welford) stops following small changes in long windows.
+*   No division per result, no float.
+*   After STATS_WINDOW results the statistics are sent (stats_send) and a new window starts
+*
+************************************************************************************************/
+void stats_add(int32_t x)
+{
+    int32_t d;
+    
+    if (stats_count == 0)
+    {
+        stats_min = x;                                              // First result of a new window
+        stats_max = x;
+        stats_first = x;
+        stats_sum = 0;
+        stats_sum2 = 0;
+    }
+    if (x < stats_min)
+    {
+        stats_min = x;
+    }
+    if (x > stats_max)
+    {
+        stats_max = x;
+    }
+    
+    stats_count++;
+    d = x - stats_first;                                            // |d| < 2^22, so 65535 squares fit in 64 bits
+    stats_sum = stats_sum + d;
+    stats_sum2 = stats_sum2 + (uint64_t) ((int64_t) d * d);
+    
+    if (stats_count >= STATS_WINDOW)
+    {
+        #ifdef USART_ON
+            stats_send();
+        #endif
+        stats_count = 0;
+    }
+}
+
+
+/***********************************************************************************************
+*
+*   stats_mean(void)
+*
+*   Mean of the current window in Q8 (1/256 ADC code), rounded
+*
+************************************************************************************************/
+int32_t stats_mean(void)
+{
+    return stats_first * (1L << STATS_Q) + (int32_t) ROUND_DIV(stats_sum * (1L << STATS_Q), (int32_t) stats_count);
+}
+
+
+/***********************************************************************************************
+*
+*   stats_variance(void)
+*
+*   Sample variance of the current window in Q16, M2 / (n - 1), rounded. With
+*   sum = q * n + r, M2 = sum2 - sum^2 / n = sum2 - q * sum - q * r - r^2 / n, where only
+*   the last term has a fraction, so no product needs more than 64 bits
+*
+************************************************************************************************/
+uint64_t stats_variance(void)
+{
+    int32_t n = stats_count;
+    int64_t q;
+    int64_t r;
+    uint64_t m2;
+    int64_t frac;
+    
+    if (n < 2)
+    {
+        return 0;
+    }
+    q = stats_sum / n;
+    r = stats_sum % n;
+    m2 = stats_sum2 - (uint64_t) (q * stats_sum + q * r);           // Integer part of M2
+    frac = (int64_t) (m2 % (n - 1)) * (1L << (2 * STATS_Q)) - ROUND_DIV(r * r * (1L << (2 * STATS_Q)), n);
+    return (m2 / (n - 1)) * (1L << (2 * STATS_Q)) + ROUND_DIV(frac, n - 1);
+}
+
+
+/***********************************************************************************************
+*
+*   stats_sqrt(uint64_t v)
+*
+*   Integer square root, rounded down. Bit by bit, one result bit for each loop
+*
+************************************************************************************************/
+uint32_t stats_sqrt(uint64_t v)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;                                      // Highest power of 4 in 64 bits
+    
+    while (bit > v)
+    {
+        bit = bit >> 2;
+    }
+    while (bit != 0)
+    {
+        if (v >= root + bit)
+        {
+            v = v - (root + bit);
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root = root >> 1;
+        }
+        bit = bit >> 2;
+    }
+    return (uint32_t) root;
+}
+
+
+// Convert a Q8 result (mean or stddev) to nA, like FP_CONVERT but with 64-bit math for the fraction
+#define STATS_TO_NA(q) ((int32_t) (((int64_t) (q) * FP_SCALE(FP_CURRENT_NUM, FP_CURRENT_DEN) \
+    + (1LL << (FP_SHIFT(FP_CURRENT_NUM, FP_CURRENT_DEN) + STATS_Q - 1))) >> (FP_SHIFT(FP_CURRENT_NUM, FP_CURRENT_DEN) + STATS_Q)))
+
+
+/***********************************************************************************************
+*
+*   stats_send(void)
+*
+*   Send the statistics of the current window. The standard deviation is the sample
+*   standard deviation, sqrt(M2 / (n - 1)), rounded down. All values are adjusted for offset and bias
+*
+*   Binary: calibration frame, then a frame of type FRAME_TYPE_STATS (little endian):
+*           [0]     FRAME_TYPE_STATS
+*           [1-2]   Number of results n (uint16)
+*           [3-5]   Min accumulated ADC result (int24)
+*           [6-8]   Max accumulated ADC result (int24)
+*           [9-12]  Mean accumulated ADC result in 1/256 (int32)
+*           [13-16] Standard deviation in 1/256 accumulated ADC result (uint32)
+*   ASCII:  one line for each value, current in uA with 3 decimals
+*
+************************************************************************************************/
+void stats_send(void)
+{
+    int32_t mean = stats_mean();
+    uint32_t stddev = stats_sqrt(stats_variance());                 // Q16 variance --> Q8 stddev
+    #ifdef BINARY_OUTPUT
+        uint8_t frame[18];
+    #else
+        char res[14];
+    #endif
+    
+    #ifdef BINARY_OUTPUT
+        send_calibration_frame();                                   // Statistics can be decoded on their own
+        
+        frame[0] = FRAME_TYPE_STATS;
+        frame[1] = stats_count;
+        frame[2] = stats_count >> 8;
+        frame[3] = stats_min;
+        frame[4] = stats_min >> 8;
+        frame[5] = stats_min >> 16;
+        frame[6] = stats_max;
+        frame[7] = stats_max >> 8;
+        frame[8] = stats_max >> 16;
+        frame[9] = mean;
+        frame[10] = mean >> 8;
+        frame[11] = mean >> 16;
+        frame[12] = mean >> 24;
+        frame[13] = stddev;
+        frame[14] = stddev >> 8;
+        frame[15] = stddev >> 16;
+        frame[16] = stddev >> 24;
+        usart1_sendFrame(frame, 17);
+    #else
+        fixtostr(stats_count, res, 0);
+        usart1_sendString("Results: ");
+        usart1_sendString(res);
+        usart1_sendString("\n");
+        
+        fixtostr(FP_CONVERT(stats_min, FP_CURRENT_NUM, FP_CURRENT_DEN), res, 3);   // nA, print in uA
+        usart1_sendString("Current min: ");
+        usart1_sendString(res);
+        usart1_sendString("uA\n");
+        
+        fixtostr(FP_CONVERT(stats_max, FP_CURRENT_NUM, FP_CURRENT_DEN), res, 3);
+        usart1_sendString("Current max: ");
+        usart1_sendString(res);
+        usart1_sendString("uA\n");
+        
+        fixtostr(STATS_TO_NA(mean), res, 3);
+        usart1_sendString("Current mean: ");
+        usart1_sendString(res);
+        usart1_sendString("uA\n");
+        
+        fixtostr(STATS_TO_NA(stddev), res, 3);
+        usart1_sendString("Current stddev: ");
+        usart1_sendString(res);
+        usart1_sendString("uA\n");
+    #endif
+}
+#endif
+
+
+#ifdef NVM_LOG
+/***********************************************************************************************
+*
+*   nvm_log_valid(const uint8_t *page)
+*
+*   Return 1 if page holds a complete log page (magic and CRC-8 match). A page that was
+*   being erased or written when power was lost fails the CRC and is skipped
+*
+************************************************************************************************/
+uint8_t nvm_log_valid(const uint8_t *page)
+{
+    return (page[0] == NVM_LOG_MAGIC) && (crc8(page, PROGMEM_PAGE_SIZE - 1) == page[PROGMEM_PAGE_SIZE - 1]);
+}
+
+
+/***********************************************************************************************
+*
+*   nvm_log_init(void)
+*
+*   Map the upper 32 kB of flash into data space and find the newest valid log page.
+*   Logging continues after it, so the oldest page is overwritten first
+*
+************************************************************************************************/
+void nvm_log_init(void)
+{
+    uint8_t i;
+    uint8_t found = 0;
+    uint16_t seq;
+    uint16_t newest_seq = 0;
+    uint8_t newest = 0;
+    
+    NVMCTRL.CTRLB = (NVMCTRL.CTRLB & ~NVMCTRL_FLMAP_gm) | NVMCTRL_FLMAP_SECTION1_gc;
+    
+    for (i = 0; i < NVM_LOG_PAGES; i++)
+    {
+        if (nvm_log_valid(NVM_LOG_PAGE(i)))
+        {
+            seq = NVM_LOG_PAGE(i)[1] | (NVM_LOG_PAGE(i)[2] << 8);
+            if (!found || ((int16_t) (seq - newest_seq) > 0))       // Newer, also when seq has wrapped
+            {
+                newest_seq = seq;
+                newest = i;
+                found = 1;
+            }
+        }
+    }
+    
+    if (found)
+    {
+        nvm_log_page = (newest + 1) % NVM_LOG_PAGES;
+        nvm_log_seq = newest_seq + 1;
+    }
+    nvm_log_count = 0;
+}
+
+
+/***********************************************************************************************
+*
+*   nvm_log_add(int32_t result)
+*
+*   Add one raw result with its time to the page in SRAM. The page is written to flash
+*   when it is full, so there is one flash erase/write for every NVM_LOG_RECORDS results.
+*   With PIPELINE the result is added while ADC0 converts, and the page is written after
+*   the burst
+*
+************************************************************************************************/
+void nvm_log_add(int32_t result)
+{
+    uint8_t *record = &nvm_log_buffer[4 + NVM_LOG_RECORD_SIZE * nvm_log_count];
+    uint16_t time = result_time();
+    
+    record[0] = time;
+    record[1] = time >> 8;
+    record[2] = result;
+    record[3] = result >> 8;
+    record[4] = result >> 16;
+    nvm_log_count++;
+    
+    #ifdef PIPELINE
+        if (ADC0.CTRLA & ADC_ENABLE_bm)
+        {
+            return;                                                 // ADC0 converts, written after the burst
+        }                                                           // (do_ADC0_measurement)
+    #endif
+    if (nvm_log_count >= NVM_LOG_RECORDS)
+    {
+        nvm_log_write();
+    }
+}
+
+
+/***********************************************************************************************
+*
+*   nvm_log_write(void)
+*
+*   Add header and CRC to the page in SRAM and write it to the next log page in flash
+*   (erase and write in one command). The CPU is halted while the flash is busy
+*
+************************************************************************************************/
+void nvm_log_write(void)
+{
+    uint8_t *page = NVM_LOG_PAGE(nvm_log_page);
+    uint16_t i;
+    
+    nvm_log_buffer[0] = NVM_LOG_MAGIC;
+    nvm_log_buffer[1] = nvm_log_seq;
+    nvm_log_buffer[2] = nvm_log_seq >> 8;
+    nvm_log_buffer[3] = nvm_log_count;
+    for (i = 4 + NVM_LOG_RECORD_SIZE * nvm_log_count; i < PROGMEM_PAGE_SIZE - 1; i++)
+    {
+        nvm_log_buffer[i] = 0xFF;                                   // Unused bytes as erased flash
+    }
+    nvm_log_buffer[PROGMEM_PAGE_SIZE - 1] = crc8(nvm_log_buffer, PROGMEM_PAGE_SIZE - 1);
+    
+    while (NVMCTRL.STATUS & NVMCTRL_FBUSY_bm)
+        ;
+    _PROTECTED_WRITE_SPM(NVMCTRL.CTRLA, NVMCTRL_CMD_FLPBCLR_gc);   // Clear page buffer
+    while (NVMCTRL.STATUS & NVMCTRL_FBUSY_bm)
+        ;
+    for (i = 0; i < PROGMEM_PAGE_SIZE; i++)
+    {
+        page[i] = nvm_log_buffer[i];                                // Fill page buffer through the mapped flash
+    }
+    _PROTECTED_WRITE_SPM(NVMCTRL.CTRLA, NVMCTRL_CMD_FLPERW_gc);    // Erase page and write page buffer
+    while (NVMCTRL.STATUS & NVMCTRL_FBUSY_bm)
+        ;
+    _PROTECTED_WRITE_SPM(NVMCTRL.CTRLA, NVMCTRL_CMD_NOCMD_gc);
+    
+    nvm_log_page = (nvm_log_page + 1) % NVM_LOG_PAGES;
+    nvm_log_seq++;
+    nvm_log_count = 0;
+}
+
+
+/***********************************************************************************************
+*
+*   nvm_log_dump(void)
+*
+*   Send all valid log pages on USART1, oldest first. USART1 must be initialized
+*
+*   Binary: calibration frame, then frames of type FRAME_TYPE_LOG with page sequence number
+*           (uint16), number of records n (max BATCH_FRAME_RECORDS) and n records as stored,
+*           time (uint16) + raw result (int24). A page may be sent in more than one frame
+*   ASCII:  one line per record, "<page>:<time>s <current>uA\n", converted with the
+*           offset and bias measured at this start-up
+*
+************************************************************************************************/
+void nvm_log_dump(void)
+{
+    uint8_t n;
+    uint8_t i;
+    uint8_t *page;
+    #ifdef BINARY_OUTPUT
+        uint8_t frame[5 + NVM_LOG_RECORD_SIZE * BATCH_FRAME_RECORDS];
+        uint8_t count;
+        uint8_t j;
+    #else
+        char res[14];
+        uint8_t *record;
+        int32_t value;
+    #endif
+    
+    #ifdef BINARY_OUTPUT
+        send_calibration_frame();
+    #endif
+    
+    for (n = 0; n < NVM_LOG_PAGES; n++)
+    {
+        page = NVM_LOG_PAGE((nvm_log_page + n) % NVM_LOG_PAGES);    // Oldest page first
+        if (!nvm_log_valid(page))
+        {
+            continue;
+        }
+        
+        #ifdef BINARY_OUTPUT
+            for (i = 0; i < page[3]; i = i + count)
+            {
+                count = page[3] - i;
+                if (count > BATCH_FRAME_RECORDS)
+                {
+                    count = BATCH_FRAME_RECORDS;                    // Payload must stay below 254 bytes
+                }
+                frame[0] = FRAME_TYPE_LOG;
+                frame[1] = page[1];
+                frame[2] = page[2];
+                frame[3] = count;
+                for (j = 0; j < NVM_LOG_RECORD_SIZE * count; j++)
+                {
+                    frame[4 + j] = page[4 + NVM_LOG_RECORD_SIZE * i + j];
+                }
+                usart1_sendFrame(frame, 4 + NVM_LOG_RECORD_SIZE * count);
+            }
+        #else
+            for (i = 0; i < page[3]; i++)
+            {
+                record = &page[4 + NVM_LOG_RECORD_SIZE * i];
+                value = (int32_t) record[2] | ((int32_t) record[3] << 8) | ((int32_t) (int8_t) record[4] << 16);
+                #ifdef BIAS_ADJUST
+                    value = value - adc_offset - adc_center;
+                #endif
+                
+                fixtostr(page[1] | ((uint16_t) page[2] << 8), res, 0);
+                usart1_sendString(res);
+                usart1_sendString(":");
+                fixtostr(record[0] | ((uint16_t) record[1] << 8), res, 0);
+                usart1_sendString(res);
+                usart1_sendString("s ");
+                fixtostr(ROUND_DIV(FP_CONVERT(value, FP_CURRENT_NUM, FP_CURRENT_DEN), 100), res, 1);
+                usart1_sendString(res);
+                usart1_sendString("uA\n");
+            }
+        #endif
+    }
+}
+#endif
+
+
+#if defined(NVM_LOG) || defined(PIPELINE)
+/***********************************************************************************************
+*
+*   sw0_pressed(void)
+*
+*   Return 1 if button SW0 (PB2, active low) is pressed. The pin is only enabled while read
+*
+************************************************************************************************/
+uint8_t sw0_pressed(void)
+{
+    uint8_t pressed;
     
-    sample_acc = ADC0.RESULT;                               // Read result
-    adc_center = sample_acc - adc_offset;                   // Adjust for offset
+    PORTB.PIN2CTRL = PORT_PULLUPEN_bm;                              // Input with pull-up
+    _delay_us(10);                                                  // Let the pull-up charge the pin
+    pressed = !(PORTB.IN & PIN2_bm);
+    PORTB.PIN2CTRL = PORT_ISC_INPUT_DISABLE_gc;                     // Disable pin again
     
-    ADC0.CTRLA = 0;                                         // Disable ADC0
-    DAC0.CTRLA = 0;                                         // Disable DAC0
+    return pressed;
 }
+#endif
 
 
-
-/*************************************************************************
+#ifdef TRANSIENT_CAPTURE
+#if CAPTURE_TRIGGER == CAPTURE_TRIGGER_PIN
+/***********************************************************************************************
 *
-*   set_DAC0_output(void)
+*   capture_pin_fell(void)
 *
-*   Set the DAC0 output to value in V defined by DAC_OUT (see #Defines)
+*   Poll PB2 for the pin trigger. Returns nonzero if PB2 was high at the last poll and is low
+*   now. The pin interrupt is not used, so no PORTB interrupt handler is needed
 *
-**************************************************************************/
-void set_DAC0_output(void)
+************************************************************************************************/
+uint8_t capture_pin_fell(void)
 {
-    dac_ref = DAC_REF;                          // DAC0 Reference value
-    dac_val = DAC_OUT;                          // Set DAC0 output to DAC_OUT
-    dac_data = dac_val / (dac_ref / 1024);      // DAC is 10 bit (2^10 = 1024) --> DAC0.DATA = dac_val / (dac_ref / 1024)
-    DAC0.DATA = dac_data << DAC_DATA_gp;        // Write value to DAC0.DATA register
+    uint8_t pin = PORTB.IN;
+    uint8_t fell = capture_pin & ~pin & PIN2_bm;
+    
+    capture_pin = pin;
+    return fell;
 }
+#endif
 
 
-
-/*************************************************************************
+/***********************************************************************************************
 *
-*   init_RTC_PIT(void)
+*   capture_run(void)
 *
-*   Enable RTC and PIT
+*   Free-run ADC0 with single 12-bit conversions (no accumulation) into capture_buffer until
+*   CAPTURE_SIZE - CAPTURE_PRE samples after a trigger are stored:
+*   - CAPTURE_TIMING_SAMPLES conversions are timed with TCB0 and not stored, that gives the
+*     sample period that is sent (capture_period_ns)
+*   - CAPTURE_PRE samples are stored first, so the pre-trigger part is always filled
+*   - then the buffer is used as a ring, the oldest sample is overwritten until the
+*     trigger (CAPTURE_TRIGGERED) is seen after a conversion
+*   - then the rest of the block is stored, and ADC0 and DAC0 are switched off
+*   capture_first is the index of the oldest sample, the trigger sample is CAPTURE_PRE later.
 *
-*   RTC clock is set to 1kHz. PIT is set to trigger each 1s (1024 cycles)
+*   Each loop pass must be shorter than one conversion (CAPTURE_LOOP_CYCLES), so nothing is
+*   done in the loops except storing. ADC0 sets RESOVR if a result was overwritten before it
+*   was read. The CPU is active (polling) while armed
+*   Must be called with interrupts disabled
 *
-**************************************************************************/
-void init_RTC_PIT(void)
+************************************************************************************************/
+void capture_run(void)
 {
+    int16_t *p = capture_buffer;
+    int16_t *end = capture_buffer + CAPTURE_SIZE;
+    uint16_t n;
+    uint16_t ticks;
+    int32_t threshold = FP_CODE_FROM_NA(CAPTURE_TRIGGER_NA);
     
-    while (RTC.STATUS > 0)                      // Wait for RTC to be synchronized
-        ;
-     
-    RTC.CLKSEL = RTC_CLKSEL_OSC1K_gc;           // RTC clock is 1.024kHz from OSC32K
+    ADC0.CTRLB = CAPTURE_PRESC_SEL;                                 // Fastest ADC0 clock allowed
+    ADC0.CTRLF = ADC_FREERUN_bm;                                    // One sample per conversion, no chopping,
+                                                                    // next conversion starts when one is done
+    #if CAPTURE_TRIGGER == CAPTURE_TRIGGER_WINDOW
+        #ifdef BIAS_ADJUST
+            threshold = threshold + adc_offset + adc_center;        // The comparator sees the raw result
+        #endif
+        ADC0.WINHT = threshold / ADC_SCALE_SAMPLES;                 // Threshold for one sample
+        ADC0.CTRLD = ADC_WINCM_ABOVE_gc;
+    #else
+        (void) threshold;
+        PORTB.PIN2CTRL = PORT_PULLUPEN_bm | PORT_ISC_INTDISABLE_gc; // SW0 or external trigger, active low, polled
+    #endif
     
-    while(RTC.PITSTATUS > 0)
-        ;                                       // Wait for PIT to be synchronized
+    DAC0.CTRLA = DAC_CTRLA_ON;                                      // DAC Output enable, Enable DAC
+    ADC0.CTRLA = ADC_CTRLA_ON;                                      // Enable ADC
     
-    RTC.PITCTRLA = RTC_PITEN_bm                 // Enable PIT 
-                 | RTC_PERIOD_CYC1024_gc;       // approx. every 1s (1024 cycles on 1kHz clock)
-    RTC.PITDBGCTRL = RTC_DBGRUN_bm;             // Allow RTC to run in debug mode
+    while(ADC0.STATUS > 0)                                          // wait for ADC ready
+        ;
     
-    while(RTC.PITSTATUS > 0)                    // Wait for PIT sync
+    ADC0.INTFLAGS = ADC_RESRDY_bm | ADC_WCMP_bm | ADC_RESOVR_bm;
+    ADC0.COMMAND = ADC_DIFF_bm                                      // Differential input mode
+                 | ADC_MODE_SINGLE_12BIT_gc                         // Single 12-bit conversions
+                 | ADC_START_IMMEDIATE_gc;                          // Start now, then free-running
+    
+    TCB0.CTRLA = 0;
+    TCB0.CNT = 0;
+    TCB0.CCMP = 0xFFFF;                                             // Count through all 16 bits
+    while (!(ADC0.INTFLAGS & ADC_RESRDY_bm))
         ;
-
+    TCB0.CTRLA = TCB_CLKSEL_DIV2_gc | TCB_ENABLE_bm;                // Start timing at the first result
+    *p = ADC0.RESULT;
+    for (n = 0; n < CAPTURE_TIMING_SAMPLES; n++)                    // Same work as storing, but not kept
+    {
+        while (!(ADC0.INTFLAGS & ADC_RESRDY_bm))
+            ;
+        *p = ADC0.RESULT;
+    }
+    ticks = TCB0.CNT;
+    TCB0.CTRLA = 0;
+    capture_period_ns = ROUND_DIV((int32_t) ticks * 2000, (int32_t) (F_CPU / 1000000UL) * CAPTURE_TIMING_SAMPLES);
+    
+    for (n = 0; n < CAPTURE_PRE; n++)                               // Fill the pre-trigger part
+    {
+        while (!(ADC0.INTFLAGS & ADC_RESRDY_bm))
+            ;
+        *p++ = ADC0.RESULT;                                         // Read result (clears RESRDY flag)
+    }
+    
+    CAPTURE_CLEAR_TRIGGER();                                        // Only a trigger after the pre-trigger part counts
+    do                                                              // Keep the last samples until the trigger
+    {
+        while (!(ADC0.INTFLAGS & ADC_RESRDY_bm))
+            ;
+        *p = ADC0.RESULT;
+        if (++p == end)
+        {
+            p = capture_buffer;
+        }
+    } while (!CAPTURE_TRIGGERED());
+    
+    for (n = CAPTURE_SIZE - CAPTURE_PRE - 1; n > 0; n--)            // Post-trigger part
+    {
+        while (!(ADC0.INTFLAGS & ADC_RESRDY_bm))
+            ;
+        *p = ADC0.RESULT;
+        if (++p == end)
+        {
+            p = capture_buffer;
+        }
+    }
+    
+    capture_overrun = (ADC0.INTFLAGS & ADC_RESOVR_bm) ? 1 : 0;
+    
+    ADC0.CTRLA = 0;                                                 // Disable ADC (stops free-running)
+    DAC0.CTRLA = 0;                                                 // Disable DAC
+    ADC0.CTRLD = 0;
+    ADC0.CTRLF = 0;
+    #if CAPTURE_TRIGGER == CAPTURE_TRIGGER_PIN
+        PORTB.PIN2CTRL = PORT_ISC_INPUT_DISABLE_gc;                 // Disable pin until the next capture
+        PORTB.INTFLAGS = PIN2_bm;                                   // No PORTB interrupt handler, clear before sei()
+    #endif
+    
+    capture_first = p - capture_buffer;                             // Oldest sample, the ring is full
 }
 
 
-
-/**********************************************************************************
+/***********************************************************************************************
 *
-*   init_USART1(void)
+*   capture_send(void)
 *
-*   BAUD = (64 * F_CPU) / (S * BAUD_RATE)
-*   S = no. of samples (16 for async)
-*   Note! Max BAUD_RATE = F_CPU / S (see #Defines), F_CPU = main clock frequency
+*   Send the block stored by capture_run(), oldest sample first
+*   ASCII:  a header line with the number of samples, the sample period and the trigger
+*           position, then one line per sample, "<n>: <current>uA". n counts from the
+*           trigger sample (0), pre-trigger samples have negative n
+*   Binary: calibration frame, a capture frame (FRAME_TYPE_CAPTURE, little endian):
+*           [0]     FRAME_TYPE_CAPTURE
+*           [1]     Capture sequence number
+*           [2-3]   Number of samples (uint16)
+*           [4-5]   Index of the trigger sample (uint16)
+*           [6-9]   Sample period in ns (uint32)
+*           [10]    1 if samples were lost (ADC0 RESOVR), else 0
+*           then the samples in frames of type FRAME_TYPE_CAPTURE_DATA:
+*           [0]     FRAME_TYPE_CAPTURE_DATA
+*           [1]     Capture sequence number
+*           [2-3]   Index of the first sample in this frame (uint16)
+*           [4-]    CAPTURE_FRAME_SAMPLES raw samples, 12 bits each, two samples in 3 bytes:
+*                   s0[7:0], s1[3:0] s0[11:8], s1[11:4]
+*   A raw sample is one conversion, so it is multiplied by the number of samples in the
+*   calibration frame before adc_offset and adc_center are subtracted
 *
-**********************************************************************************/
-void init_USART1(void)
+************************************************************************************************/
+void capture_send(void)
 {
-    USART1.BAUD = (64.0 * F_CPU) / (16.0 * BAUD_RATE); 
+    uint16_t i;
+    #ifdef BINARY_OUTPUT
+        uint8_t frame[5 + CAPTURE_FRAME_SAMPLES / 2 * 3];
+        uint8_t n;
+        uint16_t k;
+        int16_t s0;
+        int16_t s1;
+    #else
+        char res[14];
+        int32_t value;
+    #endif
     
-    PORTC.DIRSET = PIN0_bm;                     // set PC0 as output (USART1 TxD)
-    USART1.CTRLB = USART_TXEN_bm;               // enable usart1 TX
+    #ifdef BINARY_OUTPUT
+        send_calibration_frame();
+        
+        frame[0] = FRAME_TYPE_CAPTURE;
+        frame[1] = capture_seq;
+        frame[2] = (uint8_t) CAPTURE_SIZE;
+        frame[3] = (uint8_t) (CAPTURE_SIZE >> 8);
+        frame[4] = (uint8_t) CAPTURE_PRE;
+        frame[5] = (uint8_t) (CAPTURE_PRE >> 8);
+        frame[6] = (uint8_t) capture_period_ns;
+        frame[7] = (uint8_t) (capture_period_ns >> 8);
+        frame[8] = (uint8_t) (capture_period_ns >> 16);
+        frame[9] = (uint8_t) (capture_period_ns >> 24);
+        frame[10] = capture_overrun;
+        usart1_sendFrame(frame, 11);
+        
+        for (i = 0; i < CAPTURE_SIZE; i = i + CAPTURE_FRAME_SAMPLES)
+        {
+            frame[0] = FRAME_TYPE_CAPTURE_DATA;
+            frame[1] = capture_seq;
+            frame[2] = i;
+            frame[3] = i >> 8;
+            n = 4;
+            for (k = i; k < i + CAPTURE_FRAME_SAMPLES; k = k + 2)
+            {
+                s0 = capture_buffer[(capture_first + k) & CAPTURE_MASK];
+                s1 = capture_buffer[(capture_first + k + 1) & CAPTURE_MASK];
+                frame[n++] = s0;
+                frame[n++] = ((s0 >> 8) & 0x0F) | (s1 << 4);
+                frame[n++] = s1 >> 4;
+            }
+            usart1_sendFrame(frame, n);
+        }
+    #else
+        usart1_sendString("Capture: ");
+        fixtostr(CAPTURE_SIZE, res, 0);
+        usart1_sendString(res);
+        usart1_sendString(" samples, ");
+        fixtostr(ROUND_DIV((int32_t) capture_period_ns, 100), res, 1);
+        usart1_sendString(res);
+        usart1_sendString("us apart, trigger at ");
+        fixtostr(CAPTURE_PRE, res, 0);
+        usart1_sendString(res);
+        usart1_sendString("\n");
+        if (capture_overrun)
+        {
+            usart1_sendString("Samples lost, increase CAPTURE_PRESC_DIV\n");
+        }
+        
+        for (i = 0; i < CAPTURE_SIZE; i++)
+        {
+            value = (int32_t) capture_buffer[(capture_first + i) & CAPTURE_MASK] * ADC_SCALE_SAMPLES;
+            #ifdef BIAS_ADJUST
+                value = value - adc_offset - adc_center;
+            #endif
+            
+            fixtostr((int32_t) i - CAPTURE_PRE, res, 0);
+            usart1_sendString(res);
+            usart1_sendString(": ");
+            fixtostr(ROUND_DIV(FP_CONVERT(value, FP_CURRENT_NUM, FP_CURRENT_DEN), 10), res, 2);
+            usart1_sendString(res);
+            usart1_sendString("uA\n");
+        }
+    #endif
+    
+    capture_seq++;
 }
+#endif
 
 
+#ifdef MULTI_CHANNEL
 /***********************************************************************************************
 *
-*   do_ADC0_measurement(void)
-*
-*   Perform ADC measurement using burst mode and 16 samples (as set up in init_ADC0)
-*   While sampling, do calculation based on previous sampling. Typically you will have some
-*   idle time while waiting for ADC to be done since you are accumulating samples.
+*   process_rtd_result(int32_t result)
 *
-*   Time required for conversion is:
-*   t_conv = t_init + (((SAMPDUR + 2) * SAMPNUM + 14) / f_CLK_ADC) + ADCPGASAMPDUR * SAMPNUM
-*   2MHz: t_conv = 20us (PGA) + ((12+2)*16 + 14) / 200k + 12us*16 = 20 + 1190 + 192 = 1402 us
-*   20MHz: t_conv = 20us (PGA) + ((12+2)*16 + 14) / 2000000 + 3us*16 = 20 + 119 + 48 = 187 us
-*   20MHz: t_conv = 20us (PGA) + ((12+2)*16 + 14) / 2000000 + 6us*16 = 20 + 119 + 96 = 235 us
-*   
-*   Without PGA the formula is: 
-*   t_init + (((SAMPDUR+14)*SAMPNUM + 1.5) / f_CLK_ADC)
-*   20MHz w/o PGA: t_conv = 10us (ADC) + ( (12 + 2)*16 + 1.5) / 2000000 = 122.75 us
+*   Convert the raw accumulated RTD result x to resistance and temperature, and send the
+*   temperature to the terminal (if USART_ON). The measurement is ratiometric, VREFA is
+*   the DAC0 output that also drives the RTD, so only R_FIXED and the gain are needed:
+*   R = x * R_FIXED / (x_full - x), T = (R - R0) / alpha (valid from 0 to 100 C)
+*   Integer math only, resistance in 1/64 Ohm and temperature in 1/100 C
 *
 ************************************************************************************************/
-void do_ADC0_measurement(void)
+void process_rtd_result(int32_t result)
 {
-    float adc_samples = 0;
-    float adc_gain = 0;
-    float adc_ref = 0;
-    float r_sense = 0;
-    
-    #ifdef USART_ON                                                 // If USART is enabled, define array to convert result to string
-        char res[20];
+    #if defined(USART_ON) && defined(BINARY_OUTPUT)
+        uint8_t frame[6];
+    #elif defined(USART_ON)
+        char res[14];
     #endif
     
-    DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm;                      // DAC Output enable, Enable DAC
-    ADC0.CTRLA = ADC_ENABLE_bm;                                     // Enable ADC
+    if (result < 0)
+    {
+        result = 0;                                                 // RTD shorted
+    }
+    if (result >= (int32_t) RTD_X_FULL)
+    {
+        result = RTD_X_FULL - 1;                                    // RTD open
+    }
     
-    adc_samples = ADC_SAMPLES;                                      // read defined number of samples
-    adc_gain = ADC_GAIN;                                            // read defined gain (PGA)
-    adc_ref = ADC_REF;                                              // read defined ADC reference
-    r_sense = R_SENSE;                                              // read sense resistor value
+    measured_rtd_ohm = ((uint32_t) result * RTD_R_NUM + (RTD_X_FULL - (uint32_t) result) / 2) / (RTD_X_FULL - (uint32_t) result);
+    measured_temp_cdeg = (((int32_t) measured_rtd_ohm - RTD_R0_Q) * RTD_T_SCALE + (1L << (RTD_T_SHIFT - 1))) >> RTD_T_SHIFT;
     
-    while(ADC0.STATUS > 0)                                          // wait for ADC ready
+    #if defined(USART_ON) && defined(BINARY_OUTPUT)                 // Send raw result, receiver uses the RTD constants
+        frame[0] = FRAME_TYPE_RTD;
+        frame[1] = rtd_frame_seq++;                                 // Lost RTD frames show as gaps
+        frame[2] = result;
+        frame[3] = result >> 8;
+        frame[4] = result >> 16;
+        usart1_sendFrame(frame, 5);
+    #elif defined(USART_ON)
+        fixtostr(measured_temp_cdeg, res, 2);                       // 1/100 C, print with 2 decimals
+        usart1_sendString("Temperature: ");
+        usart1_sendString(res);
+        usart1_sendString("C\n");
+    #endif
+}
+
+
+/***********************************************************************************************
+*
+*   measure_channel(uint8_t ch)
+*
+*   Set up ADC0 inputs, gain and number of samples for channel ch from channel_table,
+*   do one burst conversion and store the raw result in channel_result[ch].
+*   ADC0, DAC0 output and reference must already be set up (see run_channels)
+*
+************************************************************************************************/
+void measure_channel(uint8_t ch)
+{
+    ADC0.MUXPOS = channel_table[ch].muxpos;
+    ADC0.MUXNEG = channel_table[ch].muxneg;
+    ADC0.PGACTRL = channel_table[ch].pgactrl;
+    ADC0.CTRLF = channel_table[ch].ctrlf;
+    
+    while(ADC0.STATUS > 0)                                          // wait for ADC ready (new inputs/gain)
         ;
     
-    // Start differential ADC conversion, burst mode (16x)
-    ADC0.COMMAND = ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc;
+    adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+    TRACE(TRACE_ADC_START);
     
-    while( !(ADC0.INTFLAGS & ADC_RESRDY_bm) )                       // wait until RESRDY flag is set
-        ;
+    channel_result[ch] = adc0_wait_result();                        // wait for result ready, read ADC result
+    TRACE(TRACE_ADC_DONE);
+}
+
+
+/***********************************************************************************************
+*
+*   run_channels(void)
+*
+*   Measure all channels in channel_table that are due, then convert and report the results.
+*   ADC0 and DAC0 are enabled once. The due channels are grouped by DAC0 output and ADC
+*   reference: for each group the DAC0 output is changed and allowed to settle once, and all
+*   channels in the group are measured back to back. ADC0 and DAC0 are disabled before the
+*   results are converted, so the analog part is only on for the conversions.
+*   Returns the number of seconds until the next channel is due.
+*   Must be called with interrupts disabled
+*
+************************************************************************************************/
+uint8_t run_channels(void)
+{
+    uint8_t due[CHANNEL_COUNT];
+    uint8_t i, j;
+    uint16_t now = uptime;
+    uint16_t wait;
+    uint16_t next = 255;
+    
+    for (i = 0; i < CHANNEL_COUNT; i++)
+    {
+        due[i] = ((int16_t) (now - channel_next[i]) >= 0);
+    }
     
-    sample_acc = ADC0.RESULT;                                       // Read ADC result
+    #ifdef CLOCK_SCALING
+        clock_set(CLOCK_MEASURE);                                   // Slowest clock that meets the ADC0 clock limits
+    #endif
+    
+    DAC0.CTRLA = DAC_CTRLA_ON;                                      // DAC Output enable, Enable DAC
+    ADC0.CTRLA = ADC_CTRLA_ON;                                      // Enable ADC
+    TRACE(TRACE_ANALOG_ON);
+    
+    for (i = 0; i < CHANNEL_COUNT; i++)
+    {
+        if (due[i] != 1)
+        {
+            continue;                                               // Not due, or measured with an earlier group
+        }
+        
+        // First channel of a new group, set DAC0 output and ADC reference
+        DAC0.DATA = channel_table[i].dac_data << DAC_DATA_gp;
+        ADC0.CTRLC = channel_table[i].refsel;
+        _delay_us(DAC_SETTLE_US);                                   // Wait for DAC0 output (and VREFA) to settle
+        
+        for (j = i; j < CHANNEL_COUNT; j++)
+        {
+            if ((due[j] == 1)
+                && (channel_table[j].dac_data == channel_table[i].dac_data)
+                && (channel_table[j].refsel == channel_table[i].refsel))
+            {
+                measure_channel(j);
+                due[j] = 2;                                         // Measured, result must be converted
+            }
+        }
+    }
     
     ADC0.CTRLA = 0;                                                 // Disable ADC
     DAC0.CTRLA = 0;                                                 // Disable DAC
     
-    //Calculate measurement
-    #ifdef BIAS_ADJUST
-        sample_acc = sample_acc - adc_offset - adc_center;          // Adjust for offset and bias
+    #ifdef CLOCK_SCALING
+        clock_set(CLOCK_COMPUTE);                                   // Fast clock for the math and formatting
     #endif
     
-    #ifdef PGA_ON
-        sample_acc = sample_acc / adc_gain;                         // remove gain (16x)
-    #endif
+    for (i = 0; i < CHANNEL_COUNT; i++)
+    {
+        if (due[i])
+        {
+            channel_table[i].convert(channel_result[i]);
+            channel_next[i] = now + channel_table[i].period;
+        }
+        
+        wait = channel_next[i] - now;                               // Seconds until this channel is due
+        if (wait < next)
+        {
+            next = wait;
+        }
+    }
     
-    sample_acc_mean = sample_acc / adc_samples;                     // Get mean value
+    return next;
+}
+#endif
+
+
+#ifdef PHASE_TRACE
+/********************************************************************************
+*
+*   trace_start(void)
+*
+*   Start a new phase trace, called right after waking up for a measurement
+*
+*   TCB0 counts CLK_PER/2 from 0, so one tick is 0.2us at 10 MHz and the
+*   counter wraps after 13.1 ms. RUNSTDBY keeps it counting while the CPU
+*   sleeps in standby during the ADC burst (ADC_SLEEP)
+*
+********************************************************************************/
+void trace_start(void)
+{
+    TCB0.CTRLA = 0;                             // Stop timer before clearing it
+    TCB0.CNT = 0;
+    TCB0.CTRLA = TCB_CLKSEL_DIV2_gc             // CLK_PER / 2
+               | TCB_RUNSTDBY_bm                // Keep counting in standby sleep
+               | TCB_ENABLE_bm;
     
-    measured_voltage = (( sample_acc_mean * adc_ref ) / 2048);      // Calculate voltage
-    measured_current = ( measured_voltage / r_sense ) * 1000000;    // calculate current in uA
+    trace_count = 0;
+    trace_state = TRACE_STATE_RECORDING;
+    trace_mark(TRACE_WAKEUP);
+}
+
+
+/********************************************************************************
+*
+*   trace_mark(uint8_t phase)
+*
+*   Store timestamp for the end of a phase (TRACE_xxx)
+*   Does nothing if no trace is recording or the trace buffer is full
+*
+********************************************************************************/
+void trace_mark(uint8_t phase)
+{
+    uint8_t i = trace_count;
     
-    #ifdef USART_ON                                                 // Send measurement to terminal (USART1)
-        ftostr(measured_voltage, res, 4);
-        usart1_sendString("Measured voltage: ");
-        usart1_sendString(res);
-        usart1_sendString("V\n");
+    if ((trace_state == TRACE_STATE_RECORDING) && (i < TRACE_SIZE))
+    {
+        trace_time[i] = TCB0.CNT;
+        trace_phase[i] = phase;
+        trace_count = i + 1;
+    }
+}
+
+
+/********************************************************************************
+*
+*   trace_stop(uint8_t phase)
+*
+*   Store the last timestamp, stop TCB0 and mark the trace as complete so
+*   main() can send it. Called with interrupts disabled or from an interrupt
+*
+********************************************************************************/
+void trace_stop(uint8_t phase)
+{
+    if (trace_state == TRACE_STATE_RECORDING)
+    {
+        trace_mark(phase);
+        TCB0.CTRLA = 0;                         // Stop timer to save power
+        trace_state = TRACE_STATE_COMPLETE;
+    }
+}
+
+
+/********************************************************************************
+*
+*   trace_send(void)
+*
+*   Send a complete trace on USART1 and clear it.
+*   This is done in a separate USART1 burst after the report has been sent, 
+*   so sending the trace is not part of the traced UART time.
+*
+*   ASCII:  "Trace: <phase>:<ticks> <phase>:<ticks> ... model <init>,<burst>\n"
+*   Binary: frame type FRAME_TYPE_TRACE, count, then phase (uint8) and
+*           ticks (uint16) for each timestamp, then the model init and
+*           burst time in ticks (uint16 each)
+*   The model times are the durations of phase 1 to 2 and phase 2 to 3
+*   that the timing model predicts for this build
+*
+********************************************************************************/
+void trace_send(void)
+{
+    uint8_t i;
+    #ifdef BINARY_OUTPUT
+        uint8_t frame[7 + 3 * TRACE_SIZE];
         
-        measured_current = measured_current + 0.05;                 // add 0.05 to fix rounding errors
-        ftostr(measured_current, res, 1);
-        usart1_sendString("Measured current: ");
+        frame[0] = FRAME_TYPE_TRACE;
+        frame[1] = trace_count;
+        for (i = 0; i < trace_count; i++)
+        {
+            frame[2 + 3 * i] = trace_phase[i];
+            frame[3 + 3 * i] = trace_time[i];
+            frame[4 + 3 * i] = trace_time[i] >> 8;
+        }
+        i = 2 + 3 * trace_count;
+        frame[i] = (uint8_t) MODEL_TICKS(MODEL_T_INIT_NS);
+        frame[i + 1] = MODEL_TICKS(MODEL_T_INIT_NS) >> 8;
+        frame[i + 2] = (uint8_t) MODEL_TICKS(MODEL_T_BURST_NS);
+        frame[i + 3] = MODEL_TICKS(MODEL_T_BURST_NS) >> 8;
+        usart1_sendFrame(frame, i + 4);
+    #else
+        char res[12];
+        
+        usart1_sendString("Trace:");
+        for (i = 0; i < trace_count; i++)
+        {
+            res[0] = ' ';
+            res[1] = '0' + trace_phase[i];
+            res[2] = ':';
+            fixtostr(trace_time[i], res + 3, 0);
+            usart1_sendString(res);
+        }
+        usart1_sendString(" model ");
+        fixtostr(MODEL_TICKS(MODEL_T_INIT_NS), res, 0);
         usart1_sendString(res);
-        usart1_sendString("uA\n");
+        usart1_sendString(",");
+        fixtostr(MODEL_TICKS(MODEL_T_BURST_NS), res, 0);
+        usart1_sendString(res);
+        usart1_sendString("\n");
     #endif
+    
+    trace_state = TRACE_STATE_OFF;
 }
+#endif
 
 
 /********************************************************************************
@@ -530,11 +3797,32 @@ void do_ADC0_measurement(void)
 ********************************************************************************/
 ISR(RTC_PIT_vect)
 {
-    timeout--;                                  // Decrement timeout variable
+    if (timeout > 0)                            // Do not wrap if main() is busy for more than a second
+    {
+        timeout--;                              // Decrement timeout variable
+    }
+    uptime++;                                   // Count seconds
     RTC.PITINTFLAGS = RTC_PI_bm;                // Clear PIT interrupt flag
 }
 
 
+/********************************************************************************
+*
+*   ISR(ADC0_RESRDY_vect)
+*
+*   Interrupt Service Routine for ADC0 result ready
+*   Only wakes up the CPU and marks the conversion as done, the result is
+*   read by adc0_wait_result() (which also clears the RESRDY flag)
+*
+********************************************************************************/
+ISR(ADC0_RESRDY_vect)
+{
+    ADC0.INTCTRL = 0;                           // Disable interrupt, RESRDY flag stays set until result is read
+    adc_state = ADC_STATE_DONE;
+    select_sleep_mode();
+}
+
+
 
 /****************************************************************************
 *
@@ -548,56 +3836,179 @@ ISR(RTC_PIT_vect)
 *   The resulting voltage measurement is sent out on USART0 as ASCII text.
 *   Enable terminal to see result, baud rate defined in #define BAUD_RATE.
 *   (standard 8 data bit, no parity bit, 1 stop bit)
+*   The text is queued and sent by USART1 interrupts, the device sleeps in
+*   idle mode while sending and in power-down mode when USART1 is done.
 *
 *   LED blink is determined by #define LED_ON included or not
 *
 *****************************************************************************/
 int main(void)
 {
+    uint8_t measure;                            // A measurement is due at this wake-up
+    
     init_clock();                               // Set main clock (CLK_PER) 
     init_PORT();                                // Disable all port pins to reduce current consumption
     init_VREF();                                // Init Voltage Reference (VREF)
     init_DAC0();                                // Init DAC0
     init_ADC0();                                // Init ADC0
+    #ifdef TRANSIENT_CAPTURE
+        ADC0.CTRLF = ADC_SAMPNUM_SEL;           // No chopping, as in the single conversions of a capture
+    #endif
+    
+    #ifdef CLOCK_SCALING
+        clock_set(CLOCK_MEASURE);               // Calibrate with the same ADC0 clock as the measurements
+    #endif
+    #ifdef AUTO_RANGE
+        range_calibrate();                      // Measure ADC0 offset and bias for each gain
+    #else
+        measure_offset_bias();                  // Measure ADC0 offset and bias on inputs (AIN0 + AIN1)
+    #endif
+    #ifdef CLOCK_SCALING
+        clock_set(CLOCK_COMPUTE);
+    #endif
     
-    measure_offset_bias();                      // Measure ADC0 offset and bias on inputs (AIN0 + AIN1)
+    #ifdef RECALIBRATE
+        recal_reset();                          // Start offset/bias tracking from the start-up calibration
+    #endif
     
     set_DAC0_output();                          // Set DAC output voltage as defined by DAC_OUT (see #defines)
-    init_RTC_PIT();                             // Init RTC and PIT
+    init_RTC_PIT();                             // Init RTC and PIT (and the RTC counter for SETTLE_CAL)
+    #ifdef SETTLE_CAL
+        #ifdef CLOCK_SCALING
+            clock_set(CLOCK_MEASURE);           // Calibrate with the ADC0 clock of the measurements
+        #endif
+        settle_calibrate();                     // Measure how long the analog chain needs to settle
+        #ifdef CLOCK_SCALING
+            clock_set(CLOCK_COMPUTE);
+        #endif
+        RTC.PITINTFLAGS = RTC_PI_bm;            // A PIT period may have passed during the calibration
+    #endif
     
     #ifdef USART_ON
         init_USART1();                          // Init USART
-        usart1_sendString("Let's go! \n");      // Send start message
+        #ifdef BINARY_OUTPUT
+            send_calibration_frame();           // Send calibration constants as start message
+        #else
+            usart1_sendString("Let's go! \n");  // Send start message
+            #ifdef SETTLE_CAL
+                char res[8];
+                fixtostr(((uint32_t) settle_ticks * 1000000UL + 16384) / 32768, res, 0);
+                usart1_sendString("Settling time: ");
+                usart1_sendString(res);
+                usart1_sendString("us\n");
+            #endif
+        #endif
+    #endif
+    
+    #ifdef NVM_LOG
+        nvm_log_init();                         // Continue the log after the newest page
+        if (sw0_pressed())                      // SW0 held at start-up: send the log
+        {
+            #ifndef USART_ON
+                init_USART1();
+            #endif
+            nvm_log_dump();
+        }
+    #endif
+    
+    #ifdef TRANSIENT_CAPTURE
+        while (1)
+        {
+            capture_run();                      // Wait for a trigger and store one block, CPU is active
+            
+            #ifdef LED_ON
+                PORTB.DIRSET = PIN3_bm;         // LED0 on while the block is sent
+                PORTB.OUTCLR = PIN3_bm;
+            #endif
+            
+            capture_send();
+            while (usart1_tx_busy)              // USART1 must be done, the capture loops run with
+            {                                   // interrupts disabled
+                sei();
+                sleep_cpu();
+                cli();
+            }
+            
+            #ifdef LED_ON
+                PORTB.DIRCLR = PIN3_bm;
+                PORTB.PIN3CTRL = PORT_ISC_INPUT_DISABLE_gc;
+            #endif
+        }
     #endif
     
-    SLPCTRL.CTRLA = SLEEP_MODE_PWR_DOWN
-                  | SLPCTRL_SEN_bm;             // Enable the possibility to sleep in power-down mode
+    select_sleep_mode();                        // Enable the possibility to sleep in power-down mode
+                                                // (idle while USART1 is sending)
+    
+    timeout = wakeup_time;                      // Set timeout = number of seconds between measurements
     
-    timeout = WAKEUP_TIME;                      // Set timeout = number of seconds between measurements
-    sei();                                      // Enable global interrupts
-    RTC_PITINTCTRL = RTC_PI_bm;                 // Enable PIT interrupt
+    #ifdef WINDOW_MONITOR
+        init_window_monitor();                  // Conversions are started by PIT events, PIT interrupt not used
+        select_sleep_mode();
+        sei();                                  // Enable global interrupts
+    #else
+        sei();                                  // Enable global interrupts
+        RTC_PITINTCTRL = RTC_PI_bm;             // Enable PIT interrupt
+    #endif
     
     while (1) 
     {
         sleep_cpu();                            // go to sleep
         cli();                                  // so woke, disable interrupts
         
-        if(timeout < 1)                         // are we in timeout now?
+        #ifdef WINDOW_MONITOR
+            measure = monitor_event;            // result left/entered window or heartbeat?
+        #else
+            measure = (timeout < 1);            // are we in timeout now?
+        #endif
+        
+        #if defined(PHASE_TRACE) && defined(USART_ON)
+            if ((trace_state == TRACE_STATE_COMPLETE) && !measure)
+            {
+                trace_send();                   // Send trace of the previous measurement, never while
+            }                                   // the next one is traced
+        #endif
+        
+        if (measure)
         {
+            #ifdef PHASE_TRACE
+                if (trace_state != TRACE_STATE_COMPLETE)
+                {
+                    trace_start();              // Start timing the phases of this measurement, unless
+                }                               // the previous trace is still waiting to be sent
+            #endif
+            
             #ifdef LED_ON                       // should we blink the LED?
                 PORTB.DIRSET = PIN3_bm;         // set PB3 as output (LED0)
                 PORTB.OUTCLR = PIN3_bm;         // turn on LED0 (active low)
             #endif
             
-            // do ADC measurement, send result to terminal if enabled
-            do_ADC0_measurement();
-            
-            timeout = WAKEUP_TIME;                          // Reset timeout
+            #if defined(WINDOW_MONITOR)
+                monitor_event = 0;
+                process_ADC0_result(ADC0.RESULT);           // Use result of the last event triggered conversion
+            #elif defined(MULTI_CHANNEL)
+                timeout = run_channels();                   // Measure all channels that are due, get time to next
+            #else
+                // do ADC measurement, send result to terminal if enabled
+                do_ADC0_measurement();
+                
+                timeout = wakeup_time;                      // Reset timeout (wakeup_time may be changed by ADAPTIVE_INTERVAL)
+            #endif
             
             #ifdef LED_ON
                 PORTB.DIRCLR = PIN3_bm;                     // PD7 input
                 PORTB.PIN3CTRL = PORT_ISC_INPUT_DISABLE_gc; // Turn off LED and disable PB3
             #endif
+            
+            #ifdef PHASE_TRACE
+                if (usart1_tx_busy)
+                {
+                    trace_mark(TRACE_LED_OFF);              // Trace ends when USART1 is done (usart1_tx_complete)
+                }
+                else
+                {
+                    trace_stop(TRACE_LED_OFF);              // Nothing to send, trace ends here
+                }
+            #endif
         }
         sei();                                              // enable global interrupts
     }
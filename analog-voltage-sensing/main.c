@@ -1,11 +1,347 @@
 
 #define F_CPU (10000000UL) // CPU frequency in Hz
-#define TIMEBASE_VALUE ((uint8_t) ceil(F_CPU*0.000001))
+#define TIMEBASE_VALUE ((uint8_t) ((F_CPU + 999999UL)/1000000UL)) // F_CPU in MHz, rounded up
+//#define FIXED_POINT // Use integer (fixed-point) math for resistance and temperature (see README)
+//#define ADC_SLEEP   // Sleep in standby while ADC is converting instead of polling ADCBUSY (see README)
+//#define ADAPTIVE_INTERVAL // Change PIT period with the rate of change of the RTD (see README)
+//#define RTD_CVD_TABLE // Full range Callendar-Van Dusen temperature from a lookup table (see README)
+//#define SETTLE_CAL // Measure DAC/PGA settling time at start-up, wait that long before each burst (see README)
+
+// Adaptive interval settings. One degree C changes x by about 100 (RTD near 100 Ohm, gain 16)
+#define ADAPT_MIN_PERIOD RTC_PERIOD_CYC512_gc   // Shortest time between measurements (0.5 s)
+#define ADAPT_MAX_PERIOD RTC_PERIOD_CYC32768_gc // Longest time between measurements (32 s)
+#define ADAPT_FAST_DELTA (100*RTD_GAIN/16) // Change in x that selects ADAPT_MIN_PERIOD (about 1 C)
+#define ADAPT_STABLE_DELTA (10*RTD_GAIN/16) // Change in x below which the temperature is stable (about 0.1 C)
+#define ADAPT_STABLE_COUNT 4   // Number of stable measurements before the period is doubled
+
+// Settling time calibration settings
+#define SETTLE_MAX_TICKS 32 // Longest settling time that is tried, in RTC ticks of 1/32768 s = 30.5 us
+#define SETTLE_TOL 2       // Settled when the mean of a 16-sample burst is within 2 LSB of the settled mean
+#define SETTLE_OFF_MS 20   // Analog off time before each try, so the RTD circuit discharges
+
+// RTD circuit constants, see comments in main()
+#define RTD_R_FIXED 1800.0 // Fixed resistor from DAC0OUT to AIN0 in Ohm
+#define RTD_R0 100.0       // RTD resistance at 0 C in Ohm
+#define RTD_ALPHA 0.385    // RTD sensitivity in Ohm per degree C
+#ifdef RTD_CVD_TABLE
+#define RTD_GAIN 4         // PGA gain for the full RTD_CVD_TABLE range: 4 (PT100) or 1 (PT1000)
+#else
+#define RTD_GAIN 16        // PGA gain: 1, 2, 4, 8 or 16
+#endif
+#define RTD_X_FULL ((uint32_t) (0.992*RTD_GAIN*2048.0*16.0 + 0.5)) // Accumulated result x at V_REF (16 samples)
+#define VDD_MV 3300        // Supply voltage in mV (DAC reference)
+#define RTD_DAC_MV 1800    // DAC output in mV, drives the RTD and VREFA
+#define RTD_ADC_PRESC 4    // ADC clock prescaler, f_CLK_ADC = F_CPU/RTD_ADC_PRESC
+#define RTD_SAMPDUR 12     // Sample duration in CLK_ADC cycles (must be >= 12 in burst mode)
+#define RTD_SAMPLES 16     // Samples per burst: 16, 32 ... 1024. x is always scaled to 16 samples (see README)
+
+#if RTD_GAIN == 16
+#define RTD_GAIN_gc ADC_GAIN_16X_gc
+#elif RTD_GAIN == 8
+#define RTD_GAIN_gc ADC_GAIN_8X_gc
+#elif RTD_GAIN == 4
+#define RTD_GAIN_gc ADC_GAIN_4X_gc
+#elif RTD_GAIN == 2
+#define RTD_GAIN_gc ADC_GAIN_2X_gc
+#elif RTD_GAIN == 1
+#define RTD_GAIN_gc ADC_GAIN_1X_gc
+#else
+#error "RTD_GAIN must be 1, 2, 4, 8 or 16"
+#endif
+
+// Register values calculated and checked at compile time
+#define RTD_DAC_DATA ((1024UL*RTD_DAC_MV + VDD_MV/2)/VDD_MV) // DAC0.DATA (10 bit) for RTD_DAC_MV
+#if RTD_DAC_DATA > 1023
+#error "RTD_DAC_MV must be less than VDD_MV"
+#endif
+#if RTD_DAC_MV < 1000
+#error "VREFA must be 1.0 V or more, increase RTD_DAC_MV"
+#endif
+#if RTD_ADC_PRESC == 2
+#define RTD_ADC_PRESC_gc ADC_PRESC_DIV2_gc
+#elif RTD_ADC_PRESC == 4
+#define RTD_ADC_PRESC_gc ADC_PRESC_DIV4_gc
+#elif RTD_ADC_PRESC == 8
+#define RTD_ADC_PRESC_gc ADC_PRESC_DIV8_gc
+#elif RTD_ADC_PRESC == 16
+#define RTD_ADC_PRESC_gc ADC_PRESC_DIV16_gc
+#else
+#error "RTD_ADC_PRESC must be 2, 4, 8 or 16"
+#endif
+#if F_CPU/RTD_ADC_PRESC > 6000000UL
+#error "f_CLK_ADC must be 6 MHz or less with PGA bias 100%, increase RTD_ADC_PRESC"
+#endif
+#if RTD_SAMPDUR < 12
+#error "RTD_SAMPDUR must be 12 or more in burst mode"
+#endif
+#if (F_CPU + 999999UL)/1000000UL > 31
+#error "F_CPU is too high for MCLKTIMEBASE"
+#endif
+
+// With SETTLE_CAL the RTC runs from the 32.768 kHz clock, so that one RTC count
+// is one settling tick, and the PIT period is 16384 cycles instead of 512
+#ifdef SETTLE_CAL
+#ifdef ADAPTIVE_INTERVAL
+#error "SETTLE_CAL can not be used with ADAPTIVE_INTERVAL (the longest PIT period is 1 s on the 32.768 kHz clock)"
+#endif
+#define SETTLE_MIN_TICKS 3 // A CMP write takes up to 2 RTC cycles to synchronize, shorter waits could miss the match
+#if (SETTLE_MAX_TICKS < SETTLE_MIN_TICKS) || (SETTLE_MAX_TICKS > 250)
+#error "SETTLE_MAX_TICKS must be 3 to 250"
+#endif
+#if (SETTLE_OFF_MS < 1) || (SETTLE_OFF_MS > 1000)
+#error "SETTLE_OFF_MS must be 1 to 1000"
+#endif
+#define SETTLE_OFF_TICKS ((uint16_t) ((SETTLE_OFF_MS*32768UL + 500)/1000))
+#define RTD_RTC_CLKSEL_gc RTC_CLKSEL_OSC32K_gc
+#define RTD_PIT_PERIOD_gc RTC_PERIOD_CYC16384_gc
+#else
+#define RTD_RTC_CLKSEL_gc RTC_CLKSEL_OSC1K_gc
+#define RTD_PIT_PERIOD_gc RTC_PERIOD_CYC512_gc
+#endif
+
+// SAMPNUM setting for RTD_SAMPLES, and the right shift that scales the result to 16 samples
+#if RTD_SAMPLES == 16
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC16_gc
+#define RTD_SAMPLES_SHIFT 0
+#elif RTD_SAMPLES == 32
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC32_gc
+#define RTD_SAMPLES_SHIFT 1
+#elif RTD_SAMPLES == 64
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC64_gc
+#define RTD_SAMPLES_SHIFT 2
+#elif RTD_SAMPLES == 128
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC128_gc
+#define RTD_SAMPLES_SHIFT 3
+#elif RTD_SAMPLES == 256
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC256_gc
+#define RTD_SAMPLES_SHIFT 4
+#elif RTD_SAMPLES == 512
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC512_gc
+#define RTD_SAMPLES_SHIFT 5
+#elif RTD_SAMPLES == 1024
+#define RTD_SAMPNUM_gc ADC_SAMPNUM_ACC1024_gc
+#define RTD_SAMPLES_SHIFT 6
+#else
+#error "RTD_SAMPLES must be a power of 2 from 16 to 1024"
+#endif
+
+// Fixed-point formats. The constants below are folded by the compiler,
+// so no float code is generated for them.
+#define RTD_R_Q 6          // rOhm is in Q6 format (1/64 Ohm)
+// x is an accumulated differential result of 16 samples, so x <= 16*2047 = 32752,
+// and x * RTD_R_NUM < 2^32 while RTD_R_FIXED is 2048 Ohm or less
+#define RTD_R_NUM ((uint32_t) (RTD_R_FIXED*(1L << RTD_R_Q)))
+#define RTD_R0_Q ((int32_t) (RTD_R0*(1L << RTD_R_Q)))
+#define RTD_T_SHIFT 12     // tempDegC is in 1/100 C, computed as ((rOhm - R0) * RTD_T_SCALE) >> RTD_T_SHIFT
+#define RTD_T_SCALE ((int32_t) (100.0*(1L << RTD_T_SHIFT)/((1L << RTD_R_Q)*RTD_ALPHA) + 0.5))
+
+#ifdef RTD_CVD_TABLE
+#ifndef FIXED_POINT
+#error "RTD_CVD_TABLE needs FIXED_POINT"
+#endif
+// Callendar-Van Dusen equation (IEC 60751), C is only used below 0 C:
+// R(t) = R0*(1 + A*t + B*t^2 + C*(t - 100)*t^3)
+#define CVD_A 3.9083e-3
+#define CVD_B -5.775e-7
+#define CVD_C -4.183e-12
+// The table is indexed directly by x: entry i holds the temperature at
+// x = i*2^RTD_CVD_X_SHIFT, in 1/50 C above RTD_CVD_T_BASE, and a conversion
+// interpolates between entry x >> RTD_CVD_X_SHIFT and the next one. All
+// entries are calculated by the compiler: the resistance from x, the
+// quadratic solution of the equation without C, and for t < 0 one Newton
+// step with the full equation (error below 0.003 C). The table covers all x
+// from 0 to 32768 (2^(15 - RTD_CVD_X_SHIFT) + 1 entries). Entries more than
+// one step outside -200 to 850 C are not needed and are set to the ends of
+// the uint16_t range, and the result is limited to -200 to 850 C
+#define RTD_CVD_X_SHIFT 8  // x step between table entries is 2^8 = 256 (7 to 10)
+#define RTD_CVD_Q 50       // Table entries are in 1/50 C
+#define RTD_CVD_T_BASE -250 // Temperature of table entry value 0 in C (up to 1060 C fits in 16 bits)
+#define RTD_CVD_T_MIN -200 // Lowest temperature in C
+#define RTD_CVD_T_MAX 850  // Highest temperature in C
+#define RTD_CVD_COUNT ((32768L >> RTD_CVD_X_SHIFT) + 1)
+#define RTD_CVD_R(t) (RTD_R0*(1.0 + CVD_A*(t) + CVD_B*(t)*(t) + (((t) < 0) ? CVD_C*((t) - 100.0)*(t)*(t)*(t) : 0.0)))
+#define RTD_CVD_DR(t) (RTD_R0*(CVD_A + 2.0*CVD_B*(t) + (((t) < 0) ? CVD_C*(4.0*(t) - 300.0)*(t)*(t) : 0.0)))
+#define RTD_CVD_XF(t) (RTD_X_FULL*RTD_CVD_R(t)/(RTD_CVD_R(t) + RTD_R_FIXED))
+#define RTD_CVD_RX(x) (RTD_R_FIXED*(x)/(RTD_X_FULL - (x)))
+#define RTD_CVD_T0(r) ((-CVD_A + __builtin_sqrt(CVD_A*CVD_A - 4.0*CVD_B*(1.0 - (r)/RTD_R0)))/(2.0*CVD_B))
+#define RTD_CVD_T1(t0, r) (((t0) < 0) ? (t0) - (RTD_CVD_R(t0) - (r))/RTD_CVD_DR(t0) : (t0))
+#define RTD_CVD_TX(x) RTD_CVD_T1(RTD_CVD_T0(RTD_CVD_RX(x)), RTD_CVD_RX(x))
+#define RTD_CVD_XI(i) ((double) (i)*(1L << RTD_CVD_X_SHIFT))
+#define RTD_CVD_ENTRY(i) ((RTD_CVD_XI((i) + 1) <= RTD_CVD_XF(RTD_CVD_T_MIN)) ? 0 : \
+	(RTD_CVD_XI((i) - 1) >= RTD_CVD_XF(RTD_CVD_T_MAX)) ? 65535 : \
+	(uint16_t) ((RTD_CVD_TX(RTD_CVD_XI(i)) - RTD_CVD_T_BASE)*RTD_CVD_Q + 0.5))
+#define RTD_CVD_ROW8(i) RTD_CVD_ENTRY(i), RTD_CVD_ENTRY((i) + 1), RTD_CVD_ENTRY((i) + 2), RTD_CVD_ENTRY((i) + 3), \
+	RTD_CVD_ENTRY((i) + 4), RTD_CVD_ENTRY((i) + 5), RTD_CVD_ENTRY((i) + 6), RTD_CVD_ENTRY((i) + 7)
+#define RTD_CVD_ROW32(i) RTD_CVD_ROW8(i), RTD_CVD_ROW8((i) + 8), RTD_CVD_ROW8((i) + 16), RTD_CVD_ROW8((i) + 24)
+#if (RTD_CVD_X_SHIFT < 7) || (RTD_CVD_X_SHIFT > 10)
+#error "RTD_CVD_X_SHIFT must be 7 to 10"
+#endif
+#endif
 
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/pgmspace.h>
+
+#ifdef FIXED_POINT
+// Resistance in 1/64 Ohm (Q6) from the accumulated result x (16 samples), rounded.
+// Same equation as the float code in main(), but the average (/16) cancels out
+// when the accumulated result is used directly
+uint32_t rtd_resistance(int32_t x)
+{
+	return ((uint32_t) x*RTD_R_NUM + (RTD_X_FULL - (uint32_t) x)/2)/(RTD_X_FULL - (uint32_t) x);
+}
+
+// Temperature in 1/100 C from the resistance in Q6, only valid from 0 to 100 C
+int16_t rtd_temperature(uint32_t rOhm)
+{
+	return (((int32_t) rOhm - RTD_R0_Q)*RTD_T_SCALE + (1L << (RTD_T_SHIFT - 1))) >> RTD_T_SHIFT;
+}
+#endif
+
+#ifdef RTD_CVD_TABLE
+// Temperature in 1/50 C above RTD_CVD_T_BASE at x = i*2^RTD_CVD_X_SHIFT
+const uint16_t rtdCvdTable[] PROGMEM = {
+	RTD_CVD_ROW32(0),
+#if RTD_CVD_COUNT > 33
+	RTD_CVD_ROW32(32),
+#endif
+#if RTD_CVD_COUNT > 65
+	RTD_CVD_ROW32(64),
+	RTD_CVD_ROW32(96),
+#endif
+#if RTD_CVD_COUNT > 129
+	RTD_CVD_ROW32(128),
+	RTD_CVD_ROW32(160),
+	RTD_CVD_ROW32(192),
+	RTD_CVD_ROW32(224),
+#endif
+	RTD_CVD_ENTRY(RTD_CVD_COUNT - 1)
+};
+
+// With a PT100 and a gain of 16, the ADC saturates above about 55 C
+_Static_assert(RTD_CVD_XF(RTD_CVD_T_MAX) < 2047.0*16, "RTD_GAIN too high, the ADC saturates below RTD_CVD_T_MAX");
+_Static_assert(RTD_CVD_TX(RTD_CVD_XF(RTD_CVD_T_MAX) + (1L << RTD_CVD_X_SHIFT)) < RTD_CVD_T_BASE + 65535.0/RTD_CVD_Q,
+	"RTD_CVD_X_SHIFT too large, the table entry above RTD_CVD_T_MAX does not fit");
+
+// Convert accumulated ADC result x (0 to 32767) to temperature in 1/100 C,
+// limited to RTD_CVD_T_MIN ... RTD_CVD_T_MAX. The upper bits of x select the
+// table entry, the lower bits interpolate to the next entry with one multiply
+int32_t rtd_cvd_temperature(uint16_t x)
+{
+	uint8_t i = x >> RTD_CVD_X_SHIFT;
+	uint16_t t = pgm_read_word(&rtdCvdTable[i]);
+	uint16_t dt = pgm_read_word(&rtdCvdTable[i + 1]) - t;
+	uint32_t q = (uint32_t) t*(1L << RTD_CVD_X_SHIFT) + (uint32_t) dt*(x & ((1 << RTD_CVD_X_SHIFT) - 1));
+	int32_t cdeg;
+	
+	// q is in 1/50 C * 2^RTD_CVD_X_SHIFT, 1/100 C is 2*q >> RTD_CVD_X_SHIFT
+	cdeg = RTD_CVD_T_BASE*100L + ((2*q + (1L << (RTD_CVD_X_SHIFT - 1))) >> RTD_CVD_X_SHIFT);
+	if (cdeg < RTD_CVD_T_MIN*100L) {
+		cdeg = RTD_CVD_T_MIN*100L;
+	} else if (cdeg > RTD_CVD_T_MAX*100L) {
+		cdeg = RTD_CVD_T_MAX*100L;
+	}
+	return cdeg;
+}
+#endif
+
+#ifdef SETTLE_CAL
+volatile uint8_t settleBusy; // Set while settle_wait() sleeps, cleared by the compare match
+volatile uint8_t settleTicks; // Settling time in RTC ticks (settle_calibrate), a global to watch in the debugger
+
+// Sleep until the RTC counter has counted ticks (1/32768 s each, at least
+// SETTLE_MIN_TICKS). The counter runs all the time and the wait ends on a
+// compare match, so it is between ticks - 1 and ticks long. The CPU sleeps
+// in standby, or in idle if ADC0 is on without RUNSTDBY (the PGA would be
+// stopped in standby). The sleep mode is set back before it returns
+void settle_wait(uint16_t ticks)
+{
+	uint8_t sleepMode = SLPCTRL.CTRLA;
+	
+	if (ticks < SETTLE_MIN_TICKS) {
+		ticks = SETTLE_MIN_TICKS;
+	}
+	while(RTC.STATUS & RTC_CMPBUSY_bm){
+		; // Last CMP write synchronized (done long ago)
+	}
+	cli();
+	RTC.CMP = RTC.CNT + ticks;
+	RTC.INTFLAGS = RTC_CMP_bm;
+	RTC.INTCTRL = RTC_CMP_bm; // Wake up on compare match
+	settleBusy = 1;
+	if ((ADC0.CTRLA & (ADC_ENABLE_bm | ADC_RUNSTDBY_bm)) == ADC_ENABLE_bm) {
+		SLPCTRL.CTRLA = SLEEP_MODE_IDLE | SLPCTRL_SEN_bm;
+	} else {
+		SLPCTRL.CTRLA = SLEEP_MODE_STANDBY | SLPCTRL_SEN_bm;
+	}
+	while(settleBusy){
+		sei(); // sei() delays interrupts by one instruction,
+		sleep_cpu(); // so the interrupt cannot come in before sleep
+		cli();
+	}
+	sei();
+	SLPCTRL.CTRLA = sleepMode;
+}
+
+ISR(RTC_CNT_vect)
+{
+	// RTC compare match Interrupt Service Routine, ends settle_wait()
+	RTC.INTFLAGS = RTC_CMP_bm;
+	RTC.INTCTRL = 0;
+	settleBusy = 0;
+}
+
+// Burst of 16 accumulated 12-bit conversions, ADC0 must be enabled
+int32_t settle_sample(void)
+{
+	ADC0.COMMAND = ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc;
+	while(!(ADC0.INTFLAGS & ADC_RESRDY_bm)){
+		; // Wait for the result
+	}
+	return (int32_t) ADC0.RESULT; // Clears RESRDY flag
+}
+
+// Measure the settling time of the analog part in RTC ticks. A settled burst
+// is taken after SETTLE_MAX_TICKS*4, then the DAC and ADC are switched off
+// for SETTLE_OFF_MS and on again with one tick longer wait each time, until
+// the mean of a burst is within SETTLE_TOL LSB of the settled mean. A burst
+// of 16 samples is used and not a single conversion, so the noise (gained up
+// by the PGA) does not hide the settling. Returns that time plus one tick
+// margin. The CPU sleeps during all waits (settle_wait). ADC0 and DAC0 must
+// be set up for the measurement, and the RTC counter must run
+uint8_t settle_calibrate(void)
+{
+	int32_t settled;
+	int32_t diff;
+	uint8_t ticks;
+	
+	ADC0.CTRLF = ADC_SAMPNUM_ACC16_gc; // 16 samples per burst
+	DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm;
+	ADC0.CTRLA = ADC_ENABLE_bm;
+	settle_wait(SETTLE_MAX_TICKS*4);
+	settled = settle_sample();
+	
+	for (ticks = SETTLE_MIN_TICKS; ticks <= SETTLE_MAX_TICKS; ticks++) {
+		ADC0.CTRLA = 0;
+		DAC0.CTRLA = 0;
+		settle_wait(SETTLE_OFF_TICKS); // Off like between measurements
+		DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm;
+		ADC0.CTRLA = ADC_ENABLE_bm;
+		settle_wait(ticks);
+		diff = settle_sample() - settled;
+		if (diff <= SETTLE_TOL*16 && diff >= -SETTLE_TOL*16) {
+			break; // Settled after ticks
+		}
+	}
+	
+	ADC0.CTRLA = 0;
+	DAC0.CTRLA = 0;
+	ADC0.CTRLF = RTD_SAMPNUM_gc; // Back to burst settings
+	return (ticks < SETTLE_MAX_TICKS) ? ticks + 1 : SETTLE_MAX_TICKS;
+}
+#endif
 
 ISR(RTC_PIT_vect)
 {
@@ -15,6 +351,29 @@ ISR(RTC_PIT_vect)
 	// and go back to normal program flow
 }
 
+ISR(ADC0_RESRDY_vect)
+{
+	// ADC0 result ready Interrupt Service Routine
+	// Only used to wake up the CPU, the RESRDY flag is cleared
+	// when the result is read in main()
+	ADC0.INTCTRL = 0; // Disable the interrupt until next conversion
+}
+
+// Results of the last measurement. Nothing in the example reads them, they
+// are globals so they can be watched in the debugger
+#ifdef FIXED_POINT
+volatile uint32_t rOhm;  // Resistance in 1/64 Ohms (Q6)
+#ifdef RTD_CVD_TABLE
+volatile int32_t tempDegC; // Temperature in 1/100 Degrees Celsius (-200 to 850 C)
+#else
+volatile int16_t tempDegC; // Temperature in 1/100 Degrees Celsius
+#endif
+#else
+volatile float xAverage;
+volatile float rOhm;     // Resistance in Ohms
+volatile float tempDegC; // Temperature in Degrees Celsius
+#endif
+
 int main(void)
 {
 	// This code periodically measures the resistance of an RTD
@@ -38,20 +397,23 @@ int main(void)
 	// computed.
 	
 	volatile int32_t x = 0;  // Use for saving raw accumulated ADC result
-	volatile float xAverage;
-	volatile float rOhm;     // Resistance in Ohms
-	volatile float tempDegC; // Temperature in Degrees Celsius
+#ifdef ADAPTIVE_INTERVAL
+	int32_t xLast = 0;       // Previous ADC result
+	int32_t xDelta;          // Change since previous ADC result
+	uint8_t period = ADAPT_MIN_PERIOD; // Current PIT period
+	uint8_t stableCount = 0; // Number of stable measurements in a row
+#endif
 	
 	// Disable digital input buffer on all pins
 	// to reduce power consumption (one test
 	// showed this can reduce consumption by
 	// more than 50 uA)
-    PORTA.PINCONFIG = PORT_ISC_INPUT_DISABLE_gc;
-    PORTA.PINCTRLUPD = 0xff;
-    PORTB.PINCTRLUPD = 0xff;
-    PORTC.PINCTRLUPD = 0xff;
-    PORTD.PINCTRLUPD = 0xff;
-    PORTE.PINCTRLUPD = 0xff;
+    PORTA.PINCONFIG = PORT_ISC_INPUT_DISABLE_gc;
+    PORTA.PINCTRLUPD = 0xff;
+    PORTB.PINCTRLUPD = 0xff;
+    PORTC.PINCTRLUPD = 0xff;
+    PORTD.PINCTRLUPD = 0xff;
+    PORTE.PINCTRLUPD = 0xff;
     PORTF.PINCTRLUPD = 0xff;
 
 	// Change main clock to 10 MHz by dividing by 2 (20MHz/2=10MHz)
@@ -61,19 +423,28 @@ int main(void)
 	}
 	
 	// First step in setting up RTC and PIT is choosing clock source
-	RTC.CLKSEL = RTC_CLKSEL_OSC1K_gc; // Select 1.024 kHz from OSC32K
+	RTC.CLKSEL = RTD_RTC_CLKSEL_gc; // Select 1.024 kHz from OSC32K (32.768 kHz with SETTLE_CAL)
 
 	while(RTC.PITSTATUS & RTC_CTRLBUSY_bm){
 		; // Wait for PITCTRLA sync before writing to PITCTRLA
 	}
 	// Write to PITCTRLA to enable PIT and determine the
 	// number of 1.024 kHz clock cycles between interrupts
-	RTC.PITCTRLA = RTC_PITEN_bm | RTC_PERIOD_CYC512_gc;
+	RTC.PITCTRLA = RTC_PITEN_bm | RTD_PIT_PERIOD_gc;
 	// For example, if PIT period is 512 cycles, there will be an
 	// interrupt every 0.5 seconds
 	while(RTC.PITSTATUS & RTC_CTRLBUSY_bm){
 		; // Wait for PITCTRLA sync before continuing
 	}
+#ifdef SETTLE_CAL
+	// The RTC counter runs freely, also in standby, and settle_wait()
+	// sleeps until a compare match
+	RTC.PER = 0xFFFF; // Count through all 16 bits, waits are CNT + ticks
+	RTC.CTRLA = RTC_PRESCALER_DIV1_gc | RTC_RTCEN_bm | RTC_RUNSTDBY_bm;
+	while(RTC.STATUS > 0){
+		; // Wait for PER and CTRLA sync
+	}
+#endif
 	
 	sei(); // Enable global interrupts
 	
@@ -88,21 +459,24 @@ int main(void)
 	// First, set up reference voltage for DAC
 	VREF.DAC0REF = VREF_ALWAYSON_bm | VREF_REFSEL_VDD_gc; // DAC reference voltage will be VDD
 	// Set up DAC to produce about 1.8V
-	DAC0.DATA = 559 << DAC_DATA_0_bp; // Set output to be (1.8/3.3) of VDD
+	DAC0.DATA = RTD_DAC_DATA << DAC_DATA_0_bp; // Set output to be (1.8/3.3) of VDD (559)
 	
 	// Setup timebase value
 	CLKCTRL.MCLKTIMEBASE = TIMEBASE_VALUE;
-	ADC0.CTRLB = ADC_PRESC_DIV4_gc; // CLK_ADC = 20 MHz/4 = 5 MHz (0.2 us period)
+	ADC0.CTRLB = RTD_ADC_PRESC_gc; // CLK_ADC = 20 MHz/4 = 5 MHz (0.2 us period)
 	ADC0.CTRLC = ADC_REFSEL_VREFA_gc; // Use external reference (VREFA pin must be connected
 	// through external wiring to DAC output pin)
 	ADC0.CTRLD = 0; // No need for window modes
-	ADC0.CTRLE = 12; // In burst mode, SAMPDUR must be >= 12 (when PGA is used)
-	ADC0.CTRLF = ADC_SAMPNUM_ACC16_gc; // Accumulate 16 samples
+	ADC0.CTRLE = RTD_SAMPDUR; // In burst mode, SAMPDUR must be >= 12 (when PGA is used)
+	ADC0.CTRLF = RTD_SAMPNUM_gc; // Accumulate RTD_SAMPLES (16) samples
 	
-	// Enable PGA with 16x gain and 100% bias current
-	ADC0.PGACTRL = ADC_GAIN_16X_gc | ADC_PGABIASSEL_100PCT_gc | ADC_PGAEN_bm;
+	// Enable PGA with RTD_GAIN (16x) gain and 100% bias current
+	ADC0.PGACTRL = RTD_GAIN_gc | ADC_PGABIASSEL_100PCT_gc | ADC_PGAEN_bm;
 	ADC0.MUXPOS = ADC_VIA_PGA_gc | ADC_MUXPOS_AIN0_gc;
 	ADC0.MUXNEG = ADC_VIA_PGA_gc | ADC_MUXNEG_AIN1_gc;
+#ifdef SETTLE_CAL
+	settleTicks = settle_calibrate(); // Measure how long the analog part needs to settle
+#endif
 
 	while(1){
 
@@ -115,8 +489,18 @@ int main(void)
                                       // use this to see it or use oscilloscope on PB3
         
 		// When waking up, first enable the DAC and ADC
+#ifdef ADC_SLEEP
+		// DAC and ADC must keep running while the CPU sleeps in standby
+		DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm | DAC_RUNSTDBY_bm; // Enable DAC and output pin
+		ADC0.CTRLA = ADC_ENABLE_bm | ADC_RUNSTDBY_bm; // Enable ADC
+		ADC0.INTCTRL = ADC_RESRDY_bm; // Wake up when the result is ready
+#else
 		DAC0.CTRLA = DAC_OUTEN_bm | DAC_ENABLE_bm; // Enable DAC and output pin
 		ADC0.CTRLA = ADC_ENABLE_bm; // Enable ADC
+#endif
+#ifdef SETTLE_CAL
+		settle_wait(settleTicks); // Measured settling time (settle_calibrate), sleeping
+#endif
 		
 		// Command the ADC to start a differential conversion immediately
 		ADC0.COMMAND = ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc;
@@ -125,9 +509,18 @@ int main(void)
 		// do math for converting previous ADC result into resistance and
 		// temperature while ADC is busy converting a new result
 		if (x > 0) {
+#ifdef FIXED_POINT
+			rOhm = rtd_resistance(x); // Compute resistor value (rounded)
+#ifdef RTD_CVD_TABLE
+			tempDegC = rtd_cvd_temperature(x); // Direct table lookup, valid from -200 to 850 C
+#else
+			tempDegC = rtd_temperature(rOhm); // Simple temperature calculation only valid for 0 to 100 C
+#endif
+#else
 			xAverage = ((float) x)/16.0; // Determine average ADC result from accumulated result
-			rOhm = (xAverage * 1800.0)/((0.992*16.0*2048.0) - xAverage); // Compute resistor value
+			rOhm = (xAverage * 1800.0)/((0.992*RTD_GAIN*2048.0) - xAverage); // Compute resistor value
 			tempDegC = (rOhm - 100.0)/0.385; // Simple temperature calculation only valid for 0 to 100 C
+#endif
 		}
         
         PORTB.DIRCLR = PIN3_bm;     // Set PB3 as input (save power)
@@ -135,12 +528,59 @@ int main(void)
         
         // computation is complete
 		
+#ifdef ADC_SLEEP
+		// Sleep in standby until the ADC result ready interrupt.
+		// A PIT interrupt may also wake the CPU, so check the flag again
+		// before going back to sleep. sei() delays interrupts by one
+		// instruction, so the interrupt cannot be missed before sleep_cpu()
+		SLPCTRL.CTRLA = SLEEP_MODE_STANDBY | SLPCTRL_SEN_bm;
+		cli();
+		while(!(ADC0.INTFLAGS & ADC_RESRDY_bm)){
+			sei();
+			sleep_cpu();
+			cli();
+		}
+		sei();
+		SLPCTRL.CTRLA = SLEEP_MODE_PWR_DOWN | SLPCTRL_SEN_bm; // Back to power-down between measurements
+#else
 		while(ADC0.STATUS & ADC_ADCBUSY_bm){
 			; // Wait while ADC is busy
 		}
-		x = ADC0.RESULT; // Save new ADC result
+#endif
+		// Save new ADC result (clears RESRDY flag), scaled to 16 samples with rounding
+		x = (ADC0.RESULT + ((1L << RTD_SAMPLES_SHIFT) >> 1)) >> RTD_SAMPLES_SHIFT;
 		ADC0.CTRLA = 0; // Disable ADC
 		DAC0.CTRLA = 0; // Disable DAC and output
+
+#ifdef ADAPTIVE_INTERVAL
+		// Select the PIT period from the change since the previous result.
+		// A fast change selects the shortest period right away, a stable
+		// temperature for ADAPT_STABLE_COUNT measurements doubles the period.
+		// The gap between the two limits gives hysteresis.
+		xDelta = x - xLast;
+		xLast = x;
+		if (xDelta < 0) {
+			xDelta = -xDelta;
+		}
+		if (xDelta > ADAPT_FAST_DELTA) {
+			period = ADAPT_MIN_PERIOD;
+			stableCount = 0;
+		} else if (xDelta < ADAPT_STABLE_DELTA) {
+			stableCount++;
+			if ((stableCount >= ADAPT_STABLE_COUNT) && (period < ADAPT_MAX_PERIOD)) {
+				period += (1 << RTC_PERIOD_gp); // Next PERIOD setting is twice as long
+				stableCount = 0;
+			}
+		} else {
+			stableCount = 0;
+		}
+		if (period != (RTC.PITCTRLA & RTC_PERIOD_gm)) {
+			while(RTC.PITSTATUS & RTC_CTRLBUSY_bm){
+				; // Wait for any earlier PITCTRLA write to be synchronized
+			}
+			RTC.PITCTRLA = RTC_PITEN_bm | period;
+		}
+#endif
 	}
 
 }
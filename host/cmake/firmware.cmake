@@ -0,0 +1,80 @@
+# Host builds of the examples
+#
+# add_firmware(<name> <example> [<option> ...]) builds ../<example>/main.c
+# against the stand-in headers and the simulator as executable <name>.
+# Each option changes one "#define NAME ..." or "//#define NAME ..." line
+# at the top of main.c, in a copy in the build directory:
+#   NAME         #define NAME (enable an option)
+#   NAME=VALUE   #define NAME VALUE
+#   -NAME        //#define NAME (disable an option)
+# The object library <name>_fw holds the firmware, for test programs.
+
+set(FIRMWARE_ROOT ${CMAKE_CURRENT_LIST_DIR}/../..)
+
+function(firmware_source out example)
+    set(src ${FIRMWARE_ROOT}/${example}/main.c)
+    file(READ ${src} text)
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${src})
+
+    foreach(option ${ARGN})
+        if(option MATCHES "^-(.+)$")
+            set(name ${CMAKE_MATCH_1})
+            set(line "//#define ${name}")
+        elseif(option MATCHES "^([A-Za-z0-9_]+)=(.*)$")
+            set(name ${CMAKE_MATCH_1})
+            set(line "#define ${name} ${CMAKE_MATCH_2}")
+        else()
+            set(name ${option})
+            set(line "#define ${name}")
+        endif()
+
+        set(pattern "\n(//)?#define ${name}([ \t][^\n]*)?\n")
+        if(NOT text MATCHES "${pattern}")
+            message(FATAL_ERROR "${example}/main.c has no option ${name}")
+        endif()
+        string(REGEX REPLACE "${pattern}" "\n${line}\n" text "${text}")
+    endforeach()
+
+    file(WRITE ${out}.tmp "${text}")
+    configure_file(${out}.tmp ${out} COPYONLY)
+endfunction()
+
+function(add_firmware name example)
+    set(gen ${CMAKE_CURRENT_BINARY_DIR}/fw/${name}/main.cpp)
+    firmware_source(${gen} ${example} ${ARGN})
+
+    add_library(${name}_fw OBJECT ${gen})
+    target_compile_definitions(${name}_fw PRIVATE main=firmware_main)
+    target_compile_options(${name}_fw PRIVATE -Wno-write-strings)
+    target_link_libraries(${name}_fw PUBLIC avrsim)
+
+    add_executable(${name} sim/sim_main.cpp $<TARGET_OBJECTS:${name}_fw>)
+    target_link_libraries(${name} PRIVATE avrsim)
+endfunction()
+
+# add_firmware_test(<name> <firmware> <source>) builds a test program that
+# calls into the firmware object library of add_firmware() directly
+function(add_firmware_test name firmware source)
+    add_executable(${name} ${source} $<TARGET_OBJECTS:${firmware}_fw>)
+    target_link_libraries(${name} PRIVATE avrsim)
+    add_test(NAME ${name} COMMAND ${name})
+endfunction()
+
+# add_firmware_unit_test(<name> <example> <source> [<option> ...]) builds a
+# test program whose source includes main.c (with the options, as for
+# add_firmware) through FIRMWARE_SOURCE, so it can use the macros and
+# functions of the firmware directly:
+#   #define main firmware_main
+#   #include FIRMWARE_SOURCE
+#   #undef main
+function(add_firmware_unit_test name example source)
+    set(gen ${CMAKE_CURRENT_BINARY_DIR}/fw/${name}/main.cpp)
+    firmware_source(${gen} ${example} ${ARGN})
+
+    add_executable(${name} ${source})
+    target_compile_definitions(${name} PRIVATE FIRMWARE_SOURCE="${gen}")
+    target_compile_options(${name} PRIVATE -Wno-write-strings)
+    target_link_libraries(${name} PRIVATE avrsim)
+    set_property(SOURCE ${source} APPEND PROPERTY OBJECT_DEPENDS ${gen})
+    add_test(NAME ${name} COMMAND ${name})
+endfunction()
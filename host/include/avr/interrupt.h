@@ -0,0 +1,22 @@
+/*
+ * Host stand-in for <avr/interrupt.h>
+ *
+ * An ISR is a plain function that the simulator calls when the interrupt
+ * flag and enable bits are set and global interrupts are enabled.
+ * As on the device, an interrupt is not taken right after sei(), only at
+ * the next register access or sleep_cpu()
+ */
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+void sim_sei(void);
+void sim_cli(void);
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define ISR(vector, ...) extern "C" void vector(void); extern "C" void vector(void)
+
+#endif
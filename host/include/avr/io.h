@@ -0,0 +1,661 @@
+/*
+ * Host stand-in for <avr/io.h> (AVR64EA48)
+ *
+ * Only the registers and bit names used by the examples are defined.
+ * The _gc, _bm, _gp and _gm values follow the AVR64EA48 device header,
+ * so the firmware computes the same register values as on the target.
+ *
+ * Each register is a sim_reg<T> object. Reads and writes go through the
+ * peripheral models in host/sim, so flags that are cleared by writing
+ * a one, RESULT reads that clear RESRDY, COMMAND writes that start a
+ * conversion and so on behave like on the device. Each access also
+ * advances the simulated time by a few CPU cycles and is the point
+ * where pending interrupts are taken.
+ *
+ * The examples are compiled as C++ against this header, without changes.
+ */
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __cplusplus
+#error The host stand-in registers need C++, compile main.c with -x c++
+#endif
+
+#define _Static_assert static_assert
+
+uint32_t sim_bus_read(const void *reg, uint8_t size);
+void sim_bus_write(void *reg, uint32_t value, uint8_t size);
+
+template <typename T> struct sim_reg
+{
+    T raw;                                      // Value seen by the peripheral model
+
+    operator T() { return (T) sim_bus_read(this, sizeof(T)); }
+    sim_reg &operator=(T value) { sim_bus_write(this, value, sizeof(T)); return *this; }
+    sim_reg &operator=(sim_reg &other) { return *this = (T) other; }
+    sim_reg &operator|=(T value) { return *this = (T) (*this | value); }
+    sim_reg &operator&=(T value) { return *this = (T) (*this & value); }
+    sim_reg &operator^=(T value) { return *this = (T) (*this ^ value); }
+};
+
+typedef sim_reg<uint8_t> register8_t;
+typedef sim_reg<uint16_t> register16_t;
+typedef sim_reg<uint32_t> register32_t;
+
+/* Memories */
+#define PROGMEM_START (0x0000)
+#define PROGMEM_SIZE (0x10000)
+#define PROGMEM_PAGE_SIZE (128)
+#define MAPPED_PROGMEM_SIZE (0x8000)
+
+extern uint8_t sim_mapped_progmem[MAPPED_PROGMEM_SIZE];
+#define MAPPED_PROGMEM_START ((uintptr_t) sim_mapped_progmem)
+
+/* CPU */
+extern register8_t sim_SREG;
+#define SREG sim_SREG
+#define CPU_I_bm 0x80
+
+#define _PROTECTED_WRITE(reg, value) ((reg) = (value))
+#define _PROTECTED_WRITE_SPM(reg, value) ((reg) = (value))
+
+/* ADC */
+typedef struct ADC_struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register8_t CTRLD;
+    register8_t CTRLE;
+    register8_t CTRLF;
+    register8_t COMMAND;
+    register8_t PGACTRL;
+    register8_t MUXPOS;
+    register8_t MUXNEG;
+    register8_t reserved_1[1];
+    register8_t DBGCTRL;
+    register8_t INTCTRL;
+    register8_t INTFLAGS;
+    register8_t STATUS;
+    register8_t TEMP;
+    register32_t RESULT;
+    register16_t SAMPLE;
+    register8_t reserved_2[2];
+    register16_t WINLT;
+    register16_t WINHT;
+} ADC_t;
+
+#define ADC_ENABLE_bm 0x01
+#define ADC_LOWLAT_bm 0x20
+#define ADC_RUNSTDBY_bm 0x80
+
+typedef enum ADC_PRESC_enum
+{
+    ADC_PRESC_DIV2_gc = (0x00<<0),
+    ADC_PRESC_DIV4_gc = (0x01<<0),
+    ADC_PRESC_DIV6_gc = (0x02<<0),
+    ADC_PRESC_DIV8_gc = (0x03<<0),
+    ADC_PRESC_DIV10_gc = (0x04<<0),
+    ADC_PRESC_DIV12_gc = (0x05<<0),
+    ADC_PRESC_DIV14_gc = (0x06<<0),
+    ADC_PRESC_DIV16_gc = (0x07<<0),
+    ADC_PRESC_DIV20_gc = (0x08<<0),
+    ADC_PRESC_DIV24_gc = (0x09<<0),
+    ADC_PRESC_DIV28_gc = (0x0A<<0),
+    ADC_PRESC_DIV32_gc = (0x0B<<0),
+    ADC_PRESC_DIV40_gc = (0x0C<<0),
+    ADC_PRESC_DIV48_gc = (0x0D<<0),
+    ADC_PRESC_DIV56_gc = (0x0E<<0),
+    ADC_PRESC_DIV64_gc = (0x0F<<0),
+} ADC_PRESC_t;
+#define ADC_PRESC_gm 0x0F
+
+typedef enum ADC_REFSEL_enum
+{
+    ADC_REFSEL_VDD_gc = (0x00<<0),
+    ADC_REFSEL_VREFA_gc = (0x02<<0),
+    ADC_REFSEL_1V024_gc = (0x04<<0),
+    ADC_REFSEL_2V048_gc = (0x05<<0),
+    ADC_REFSEL_2V500_gc = (0x06<<0),
+    ADC_REFSEL_4V096_gc = (0x07<<0),
+} ADC_REFSEL_t;
+#define ADC_REFSEL_gm 0x07
+
+typedef enum ADC_WINCM_enum
+{
+    ADC_WINCM_NONE_gc = (0x00<<0),
+    ADC_WINCM_BELOW_gc = (0x01<<0),
+    ADC_WINCM_ABOVE_gc = (0x02<<0),
+    ADC_WINCM_INSIDE_gc = (0x03<<0),
+    ADC_WINCM_OUTSIDE_gc = (0x04<<0),
+} ADC_WINCM_t;
+#define ADC_WINCM_gm 0x07
+
+#define ADC_SAMPNUM_gm 0x0F
+#define ADC_SAMPNUM_gp 0
+#define ADC_LEFTADJ_bm 0x10
+#define ADC_FREERUN_bm 0x20
+#define ADC_CHOPPING_bm 0x40
+
+typedef enum ADC_SAMPNUM_enum
+{
+    ADC_SAMPNUM_NONE_gc = (0x00<<0),
+    ADC_SAMPNUM_ACC2_gc = (0x01<<0),
+    ADC_SAMPNUM_ACC4_gc = (0x02<<0),
+    ADC_SAMPNUM_ACC8_gc = (0x03<<0),
+    ADC_SAMPNUM_ACC16_gc = (0x04<<0),
+    ADC_SAMPNUM_ACC32_gc = (0x05<<0),
+    ADC_SAMPNUM_ACC64_gc = (0x06<<0),
+    ADC_SAMPNUM_ACC128_gc = (0x07<<0),
+    ADC_SAMPNUM_ACC256_gc = (0x08<<0),
+    ADC_SAMPNUM_ACC512_gc = (0x09<<0),
+    ADC_SAMPNUM_ACC1024_gc = (0x0A<<0),
+} ADC_SAMPNUM_t;
+
+typedef enum ADC_START_enum
+{
+    ADC_START_STOP_gc = (0x00<<0),
+    ADC_START_IMMEDIATE_gc = (0x01<<0),
+    ADC_START_MUXPOS_WRITE_gc = (0x02<<0),
+    ADC_START_MUXNEG_WRITE_gc = (0x03<<0),
+    ADC_START_EVENT_TRIGGER_gc = (0x04<<0),
+} ADC_START_t;
+#define ADC_START_gm 0x07
+
+typedef enum ADC_MODE_enum
+{
+    ADC_MODE_SINGLE_8BIT_gc = (0x00<<4),
+    ADC_MODE_SINGLE_12BIT_gc = (0x01<<4),
+    ADC_MODE_SERIES_gc = (0x02<<4),
+    ADC_MODE_SERIES_SCALING_gc = (0x03<<4),
+    ADC_MODE_BURST_gc = (0x04<<4),
+    ADC_MODE_BURST_SCALING_gc = (0x05<<4),
+} ADC_MODE_t;
+#define ADC_MODE_gm 0x70
+#define ADC_DIFF_bm 0x80
+
+#define ADC_PGAEN_bm 0x01
+typedef enum ADC_PGABIASSEL_enum
+{
+    ADC_PGABIASSEL_100PCT_gc = (0x00<<1),
+    ADC_PGABIASSEL_75PCT_gc = (0x01<<1),
+    ADC_PGABIASSEL_50PCT_gc = (0x02<<1),
+    ADC_PGABIASSEL_25PCT_gc = (0x03<<1),
+} ADC_PGABIASSEL_t;
+#define ADC_PGABIASSEL_gm 0x06
+
+typedef enum ADC_GAIN_enum
+{
+    ADC_GAIN_1X_gc = (0x00<<5),
+    ADC_GAIN_2X_gc = (0x01<<5),
+    ADC_GAIN_4X_gc = (0x02<<5),
+    ADC_GAIN_8X_gc = (0x03<<5),
+    ADC_GAIN_16X_gc = (0x04<<5),
+} ADC_GAIN_t;
+#define ADC_GAIN_gm 0xE0
+#define ADC_GAIN_gp 5
+
+typedef enum ADC_MUXPOS_enum
+{
+    ADC_MUXPOS_AIN0_gc = (0x00<<0),
+    ADC_MUXPOS_AIN1_gc = (0x01<<0),
+    ADC_MUXPOS_AIN2_gc = (0x02<<0),
+    ADC_MUXPOS_AIN3_gc = (0x03<<0),
+    ADC_MUXPOS_AIN4_gc = (0x04<<0),
+    ADC_MUXPOS_AIN5_gc = (0x05<<0),
+    ADC_MUXPOS_AIN6_gc = (0x06<<0),
+    ADC_MUXPOS_AIN7_gc = (0x07<<0),
+    ADC_MUXPOS_GND_gc = (0x30<<0),
+} ADC_MUXPOS_t;
+#define ADC_MUXPOS_gm 0x3F
+
+typedef enum ADC_MUXNEG_enum
+{
+    ADC_MUXNEG_AIN0_gc = (0x00<<0),
+    ADC_MUXNEG_AIN1_gc = (0x01<<0),
+    ADC_MUXNEG_AIN2_gc = (0x02<<0),
+    ADC_MUXNEG_AIN3_gc = (0x03<<0),
+    ADC_MUXNEG_AIN4_gc = (0x04<<0),
+    ADC_MUXNEG_AIN5_gc = (0x05<<0),
+    ADC_MUXNEG_AIN6_gc = (0x06<<0),
+    ADC_MUXNEG_AIN7_gc = (0x07<<0),
+    ADC_MUXNEG_GND_gc = (0x30<<0),
+} ADC_MUXNEG_t;
+#define ADC_MUXNEG_gm 0x3F
+
+typedef enum ADC_VIA_enum
+{
+    ADC_VIA_ADC_gc = (0x00<<6),
+    ADC_VIA_PGA_gc = (0x01<<6),
+} ADC_VIA_t;
+#define ADC_VIA_gm 0xC0
+
+#define ADC_DBGRUN_bm 0x01
+
+#define ADC_RESRDY_bm 0x01
+#define ADC_SAMPRDY_bm 0x02
+#define ADC_WCMP_bm 0x04
+#define ADC_RESOVR_bm 0x08
+#define ADC_SAMPOVR_bm 0x10
+#define ADC_TRIGOVR_bm 0x20
+
+#define ADC_ADCBUSY_bm 0x01
+
+/* CLKCTRL */
+typedef struct CLKCTRL_struct
+{
+    register8_t MCLKCTRLA;
+    register8_t MCLKCTRLB;
+    register8_t MCLKSTATUS;
+    register8_t MCLKTIMEBASE;
+} CLKCTRL_t;
+
+#define CLKCTRL_PEN_bm 0x01
+typedef enum CLKCTRL_PDIV_enum
+{
+    CLKCTRL_PDIV_DIV2_gc = (0x00<<1),
+    CLKCTRL_PDIV_DIV4_gc = (0x01<<1),
+    CLKCTRL_PDIV_DIV8_gc = (0x02<<1),
+    CLKCTRL_PDIV_DIV16_gc = (0x03<<1),
+    CLKCTRL_PDIV_DIV32_gc = (0x04<<1),
+    CLKCTRL_PDIV_DIV64_gc = (0x05<<1),
+    CLKCTRL_PDIV_DIV6_gc = (0x08<<1),
+    CLKCTRL_PDIV_DIV10_gc = (0x09<<1),
+    CLKCTRL_PDIV_DIV12_gc = (0x0A<<1),
+    CLKCTRL_PDIV_DIV24_gc = (0x0B<<1),
+    CLKCTRL_PDIV_DIV48_gc = (0x0C<<1),
+} CLKCTRL_PDIV_t;
+#define CLKCTRL_PDIV_gm 0x1E
+#define CLKCTRL_SOSC_bm 0x01
+
+/* DAC */
+typedef struct DAC_struct
+{
+    register8_t CTRLA;
+    register8_t reserved_1[1];
+    register16_t DATA;
+} DAC_t;
+
+#define DAC_ENABLE_bm 0x01
+#define DAC_OUTEN_bm 0x40
+#define DAC_RUNSTDBY_bm 0x80
+#define DAC_DATA_gm 0xFFC0
+#define DAC_DATA_gp 6
+#define DAC_DATA_0_bp 6
+
+/* EVSYS */
+typedef struct EVSYS_struct
+{
+    register8_t SWEVENTA;
+    register8_t CHANNEL0;
+    register8_t CHANNEL1;
+    register8_t USERADC0START;
+} EVSYS_t;
+
+typedef enum EVSYS_CHANNEL0_enum
+{
+    EVSYS_CHANNEL0_OFF_gc = (0x00<<0),
+    EVSYS_CHANNEL0_RTC_EVGEN0_gc = (0x08<<0),
+    EVSYS_CHANNEL0_RTC_EVGEN1_gc = (0x09<<0),
+} EVSYS_CHANNEL0_t;
+
+typedef enum EVSYS_USER_enum
+{
+    EVSYS_USER_OFF_gc = (0x00<<0),
+    EVSYS_USER_CHANNEL0_gc = (0x01<<0),
+    EVSYS_USER_CHANNEL1_gc = (0x02<<0),
+} EVSYS_USER_t;
+
+/* NVMCTRL */
+typedef struct NVMCTRL_struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register8_t reserved_1[1];
+    register8_t INTCTRL;
+    register8_t INTFLAGS;
+    register8_t STATUS;
+    register8_t reserved_2[1];
+    register16_t DATA;
+    register8_t reserved_3[2];
+    register32_t ADDR;
+} NVMCTRL_t;
+
+typedef enum NVMCTRL_CMD_enum
+{
+    NVMCTRL_CMD_NOCMD_gc = (0x00<<0),
+    NVMCTRL_CMD_NOOP_gc = (0x01<<0),
+    NVMCTRL_CMD_FLPW_gc = (0x04<<0),
+    NVMCTRL_CMD_FLPERW_gc = (0x05<<0),
+    NVMCTRL_CMD_FLPER_gc = (0x08<<0),
+    NVMCTRL_CMD_FLPBCLR_gc = (0x0F<<0),
+} NVMCTRL_CMD_t;
+#define NVMCTRL_CMD_gm 0x7F
+
+#define NVMCTRL_APPCODEWP_bm 0x01
+#define NVMCTRL_BOOTRP_bm 0x02
+#define NVMCTRL_APPDATAWP_bm 0x04
+typedef enum NVMCTRL_FLMAP_enum
+{
+    NVMCTRL_FLMAP_SECTION0_gc = (0x00<<4),
+    NVMCTRL_FLMAP_SECTION1_gc = (0x01<<4),
+} NVMCTRL_FLMAP_t;
+#define NVMCTRL_FLMAP_gm 0x30
+#define NVMCTRL_FLMAPLOCK_bm 0x80
+
+#define NVMCTRL_FBUSY_bm 0x01
+#define NVMCTRL_EEBUSY_bm 0x02
+#define NVMCTRL_ERROR_gm 0x70
+
+/* PORT */
+typedef struct PORT_struct
+{
+    register8_t DIR;
+    register8_t DIRSET;
+    register8_t DIRCLR;
+    register8_t DIRTGL;
+    register8_t OUT;
+    register8_t OUTSET;
+    register8_t OUTCLR;
+    register8_t OUTTGL;
+    register8_t IN;
+    register8_t INTFLAGS;
+    register8_t PORTCTRL;
+    register8_t PINCONFIG;
+    register8_t PINCTRLUPD;
+    register8_t PINCTRLSET;
+    register8_t PINCTRLCLR;
+    register8_t reserved_1[1];
+    register8_t PIN0CTRL;
+    register8_t PIN1CTRL;
+    register8_t PIN2CTRL;
+    register8_t PIN3CTRL;
+    register8_t PIN4CTRL;
+    register8_t PIN5CTRL;
+    register8_t PIN6CTRL;
+    register8_t PIN7CTRL;
+} PORT_t;
+
+typedef enum PORT_ISC_enum
+{
+    PORT_ISC_INTDISABLE_gc = (0x00<<0),
+    PORT_ISC_BOTHEDGES_gc = (0x01<<0),
+    PORT_ISC_RISING_gc = (0x02<<0),
+    PORT_ISC_FALLING_gc = (0x03<<0),
+    PORT_ISC_INPUT_DISABLE_gc = (0x04<<0),
+    PORT_ISC_LEVEL_gc = (0x05<<0),
+} PORT_ISC_t;
+#define PORT_ISC_gm 0x07
+#define PORT_PULLUPEN_bm 0x08
+#define PORT_INVEN_bm 0x80
+
+#define PIN0_bm 0x01
+#define PIN1_bm 0x02
+#define PIN2_bm 0x04
+#define PIN3_bm 0x08
+#define PIN4_bm 0x10
+#define PIN5_bm 0x20
+#define PIN6_bm 0x40
+#define PIN7_bm 0x80
+
+/* RTC */
+typedef struct RTC_struct
+{
+    register8_t CTRLA;
+    register8_t STATUS;
+    register8_t INTCTRL;
+    register8_t INTFLAGS;
+    register8_t TEMP;
+    register8_t DBGCTRL;
+    register8_t CALIB;
+    register8_t CLKSEL;
+    register16_t CNT;
+    register16_t PER;
+    register16_t CMP;
+    register8_t reserved_1[2];
+    register8_t PITCTRLA;
+    register8_t PITSTATUS;
+    register8_t PITINTCTRL;
+    register8_t PITINTFLAGS;
+    register8_t reserved_2[1];
+    register8_t PITDBGCTRL;
+    register8_t PITEVGENCTRLA;
+} RTC_t;
+
+#define RTC_RTCEN_bm 0x01
+#define RTC_CORREN_bm 0x04
+typedef enum RTC_PRESCALER_enum
+{
+    RTC_PRESCALER_DIV1_gc = (0x00<<3),
+    RTC_PRESCALER_DIV2_gc = (0x01<<3),
+    RTC_PRESCALER_DIV4_gc = (0x02<<3),
+    RTC_PRESCALER_DIV8_gc = (0x03<<3),
+    RTC_PRESCALER_DIV16_gc = (0x04<<3),
+    RTC_PRESCALER_DIV32_gc = (0x05<<3),
+    RTC_PRESCALER_DIV64_gc = (0x06<<3),
+    RTC_PRESCALER_DIV128_gc = (0x07<<3),
+    RTC_PRESCALER_DIV256_gc = (0x08<<3),
+    RTC_PRESCALER_DIV512_gc = (0x09<<3),
+    RTC_PRESCALER_DIV1024_gc = (0x0A<<3),
+    RTC_PRESCALER_DIV2048_gc = (0x0B<<3),
+    RTC_PRESCALER_DIV4096_gc = (0x0C<<3),
+    RTC_PRESCALER_DIV8192_gc = (0x0D<<3),
+    RTC_PRESCALER_DIV16384_gc = (0x0E<<3),
+    RTC_PRESCALER_DIV32768_gc = (0x0F<<3),
+} RTC_PRESCALER_t;
+#define RTC_PRESCALER_gm 0x78
+#define RTC_PRESCALER_gp 3
+#define RTC_RUNSTDBY_bm 0x80
+
+#define RTC_CTRLABUSY_bm 0x01
+#define RTC_CNTBUSY_bm 0x02
+#define RTC_PERBUSY_bm 0x04
+#define RTC_CMPBUSY_bm 0x08
+
+#define RTC_OVF_bm 0x01
+#define RTC_CMP_bm 0x02
+
+#define RTC_DBGRUN_bm 0x01
+
+typedef enum RTC_CLKSEL_enum
+{
+    RTC_CLKSEL_OSC32K_gc = (0x00<<0),
+    RTC_CLKSEL_OSC1K_gc = (0x01<<0),
+    RTC_CLKSEL_XOSC32K_gc = (0x02<<0),
+    RTC_CLKSEL_EXTCLK_gc = (0x03<<0),
+} RTC_CLKSEL_t;
+#define RTC_CLKSEL_gm 0x03
+
+#define RTC_PITEN_bm 0x01
+typedef enum RTC_PERIOD_enum
+{
+    RTC_PERIOD_OFF_gc = (0x00<<3),
+    RTC_PERIOD_CYC4_gc = (0x01<<3),
+    RTC_PERIOD_CYC8_gc = (0x02<<3),
+    RTC_PERIOD_CYC16_gc = (0x03<<3),
+    RTC_PERIOD_CYC32_gc = (0x04<<3),
+    RTC_PERIOD_CYC64_gc = (0x05<<3),
+    RTC_PERIOD_CYC128_gc = (0x06<<3),
+    RTC_PERIOD_CYC256_gc = (0x07<<3),
+    RTC_PERIOD_CYC512_gc = (0x08<<3),
+    RTC_PERIOD_CYC1024_gc = (0x09<<3),
+    RTC_PERIOD_CYC2048_gc = (0x0A<<3),
+    RTC_PERIOD_CYC4096_gc = (0x0B<<3),
+    RTC_PERIOD_CYC8192_gc = (0x0C<<3),
+    RTC_PERIOD_CYC16384_gc = (0x0D<<3),
+    RTC_PERIOD_CYC32768_gc = (0x0E<<3),
+} RTC_PERIOD_t;
+#define RTC_PERIOD_gm 0x78
+#define RTC_PERIOD_gp 3
+
+#define RTC_CTRLBUSY_bm 0x01
+#define RTC_PI_bm 0x01
+
+typedef enum RTC_EVGEN0SEL_enum
+{
+    RTC_EVGEN0SEL_OFF_gc = (0x00<<0),
+    RTC_EVGEN0SEL_DIV4_gc = (0x01<<0),
+    RTC_EVGEN0SEL_DIV8_gc = (0x02<<0),
+    RTC_EVGEN0SEL_DIV16_gc = (0x03<<0),
+    RTC_EVGEN0SEL_DIV32_gc = (0x04<<0),
+    RTC_EVGEN0SEL_DIV64_gc = (0x05<<0),
+    RTC_EVGEN0SEL_DIV128_gc = (0x06<<0),
+    RTC_EVGEN0SEL_DIV256_gc = (0x07<<0),
+    RTC_EVGEN0SEL_DIV512_gc = (0x08<<0),
+    RTC_EVGEN0SEL_DIV1024_gc = (0x09<<0),
+    RTC_EVGEN0SEL_DIV2048_gc = (0x0A<<0),
+    RTC_EVGEN0SEL_DIV4096_gc = (0x0B<<0),
+    RTC_EVGEN0SEL_DIV8192_gc = (0x0C<<0),
+} RTC_EVGEN0SEL_t;
+#define RTC_EVGEN0SEL_gm 0x0F
+
+/* SLPCTRL */
+typedef struct SLPCTRL_struct
+{
+    register8_t CTRLA;
+    register8_t VREGCTRL;
+} SLPCTRL_t;
+
+#define SLPCTRL_SEN_bm 0x01
+typedef enum SLPCTRL_SMODE_enum
+{
+    SLPCTRL_SMODE_IDLE_gc = (0x00<<1),
+    SLPCTRL_SMODE_STDBY_gc = (0x01<<1),
+    SLPCTRL_SMODE_PDOWN_gc = (0x02<<1),
+} SLPCTRL_SMODE_t;
+#define SLPCTRL_SMODE_gm 0x06
+
+/* TCB */
+typedef struct TCB_struct
+{
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t reserved_1[2];
+    register8_t EVCTRL;
+    register8_t INTCTRL;
+    register8_t INTFLAGS;
+    register8_t STATUS;
+    register8_t DBGCTRL;
+    register8_t TEMP;
+    register16_t CNT;
+    register16_t CCMP;
+} TCB_t;
+
+#define TCB_ENABLE_bm 0x01
+typedef enum TCB_CLKSEL_enum
+{
+    TCB_CLKSEL_DIV1_gc = (0x00<<1),
+    TCB_CLKSEL_DIV2_gc = (0x01<<1),
+} TCB_CLKSEL_t;
+#define TCB_CLKSEL_gm 0x0E
+#define TCB_RUNSTDBY_bm 0x40
+
+/* USART */
+typedef struct USART_struct
+{
+    register8_t RXDATAL;
+    register8_t RXDATAH;
+    register8_t TXDATAL;
+    register8_t TXDATAH;
+    register8_t STATUS;
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register16_t BAUD;
+} USART_t;
+
+#define USART_DREIF_bm 0x20
+#define USART_TXCIF_bm 0x40
+#define USART_RXCIF_bm 0x80
+#define USART_DREIE_bm 0x20
+#define USART_TXCIE_bm 0x40
+#define USART_RXCIE_bm 0x80
+#define USART_TXEN_bm 0x40
+#define USART_RXEN_bm 0x80
+
+/* VREF */
+typedef struct VREF_struct
+{
+    register8_t ADC0REF;
+    register8_t reserved_1[1];
+    register8_t DAC0REF;
+} VREF_t;
+
+typedef enum VREF_REFSEL_enum
+{
+    VREF_REFSEL_1V024_gc = (0x00<<0),
+    VREF_REFSEL_2V048_gc = (0x01<<0),
+    VREF_REFSEL_4V096_gc = (0x02<<0),
+    VREF_REFSEL_2V500_gc = (0x03<<0),
+    VREF_REFSEL_VDD_gc = (0x05<<0),
+    VREF_REFSEL_VREFA_gc = (0x06<<0),
+} VREF_REFSEL_t;
+#define VREF_REFSEL_gm 0x07
+#define VREF_ALWAYSON_bm 0x80
+
+/* Peripheral instances (models in host/sim) */
+extern ADC_t sim_ADC0;
+extern CLKCTRL_t sim_CLKCTRL;
+extern DAC_t sim_DAC0;
+extern EVSYS_t sim_EVSYS;
+extern NVMCTRL_t sim_NVMCTRL;
+extern PORT_t sim_PORTA;
+extern PORT_t sim_PORTB;
+extern PORT_t sim_PORTC;
+extern PORT_t sim_PORTD;
+extern PORT_t sim_PORTE;
+extern PORT_t sim_PORTF;
+extern RTC_t sim_RTC;
+extern SLPCTRL_t sim_SLPCTRL;
+extern TCB_t sim_TCB0;
+extern USART_t sim_USART1;
+extern VREF_t sim_VREF;
+
+#define ADC0 sim_ADC0
+#define CLKCTRL sim_CLKCTRL
+#define DAC0 sim_DAC0
+#define EVSYS sim_EVSYS
+#define NVMCTRL sim_NVMCTRL
+#define PORTA sim_PORTA
+#define PORTB sim_PORTB
+#define PORTC sim_PORTC
+#define PORTD sim_PORTD
+#define PORTE sim_PORTE
+#define PORTF sim_PORTF
+#define RTC sim_RTC
+#define SLPCTRL sim_SLPCTRL
+#define TCB0 sim_TCB0
+#define USART1 sim_USART1
+#define VREF sim_VREF
+
+#define RTC_PITINTCTRL RTC.PITINTCTRL
+
+/* Fuses (only stored, the simulator does not use them) */
+typedef struct NVM_FUSES_struct
+{
+    uint8_t WDTCFG;
+    uint8_t BODCFG;
+    uint8_t OSCCFG;
+    uint8_t reserved_1[2];
+    uint8_t SYSCFG0;
+    uint8_t SYSCFG1;
+    uint8_t CODESIZE;
+    uint8_t BOOTSIZE;
+} NVM_FUSES_t;
+
+#define FUSE_WDTCFG_DEFAULT (0x00)
+#define FUSE_BODCFG_DEFAULT (0x00)
+#define FUSE_OSCCFG_DEFAULT (0x00)
+#define FUSE_SYSCFG0_DEFAULT (0xC0)
+#define FUSE_SYSCFG1_DEFAULT (0x00)
+#define FUSE_CODESIZE_DEFAULT (0x00)
+#define FUSE_BOOTSIZE_DEFAULT (0x00)
+
+#define FUSEMEM __attribute__((unused))
+#define FUSES NVM_FUSES_t __fuse FUSEMEM
+
+#endif
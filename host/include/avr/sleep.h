@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for <avr/sleep.h>
+ *
+ * sleep_cpu() lets the simulated time run until an enabled interrupt
+ * wakes the CPU, in the sleep mode set in SLPCTRL.CTRLA
+ */
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE SLPCTRL_SMODE_IDLE_gc
+#define SLEEP_MODE_STANDBY SLPCTRL_SMODE_STDBY_gc
+#define SLEEP_MODE_PWR_DOWN SLPCTRL_SMODE_PDOWN_gc
+
+void sim_sleep_cpu(void);
+
+#define sleep_cpu() sim_sleep_cpu()
+
+#endif
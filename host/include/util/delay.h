@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for <util/delay.h>
+ *
+ * Like the avr-libc version, the number of CPU cycles is computed from
+ * F_CPU, so a delay is longer when the CPU runs slower than F_CPU
+ */
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#ifndef F_CPU
+#error F_CPU must be defined before <util/delay.h>
+#endif
+
+void sim_delay_cycles(double cycles);
+
+#define _delay_us(us) sim_delay_cycles((double) (us) * ((double) F_CPU / 1e6))
+#define _delay_ms(ms) sim_delay_cycles((double) (ms) * ((double) F_CPU / 1e3))
+
+#endif
@@ -0,0 +1,1725 @@
+/*
+ * AVR64EA48 peripheral simulator, see sim.h
+ *
+ * Models: CPU (SREG, sleep, interrupts), CLKCTRL, SLPCTRL, RTC/PIT with
+ * event generator, EVSYS (channel 0 only), ADC0 with PGA, DAC0, VREF,
+ * TCB0 (count only), USART1 (TX only), NVMCTRL (page erase-write through
+ * the mapped flash section) and the PORTs. Only the behaviour that the
+ * examples use is modelled.
+ */
+#include "sim.h"
+
+#include <avr/io.h>
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+
+// Register instances
+ADC_t sim_ADC0;
+CLKCTRL_t sim_CLKCTRL;
+DAC_t sim_DAC0;
+EVSYS_t sim_EVSYS;
+NVMCTRL_t sim_NVMCTRL;
+PORT_t sim_PORTA;
+PORT_t sim_PORTB;
+PORT_t sim_PORTC;
+PORT_t sim_PORTD;
+PORT_t sim_PORTE;
+PORT_t sim_PORTF;
+RTC_t sim_RTC;
+SLPCTRL_t sim_SLPCTRL;
+TCB_t sim_TCB0;
+USART_t sim_USART1;
+VREF_t sim_VREF;
+register8_t sim_SREG;
+uint8_t sim_mapped_progmem[MAPPED_PROGMEM_SIZE];
+
+// Interrupt handlers defined by the firmware (ISR macro), null if not defined
+extern "C" {
+void RTC_CNT_vect(void) __attribute__((weak));
+void RTC_PIT_vect(void) __attribute__((weak));
+void ADC0_RESRDY_vect(void) __attribute__((weak));
+void ADC0_SAMPRDY_vect(void) __attribute__((weak));
+void USART1_DRE_vect(void) __attribute__((weak));
+void USART1_TXC_vect(void) __attribute__((weak));
+}
+
+namespace {
+
+enum cpu_state
+{
+    CPU_ACTIVE,
+    CPU_IDLE,
+    CPU_STANDBY,
+    CPU_POWER_DOWN,
+};
+
+const double OSCHF_HZ = 20e6;
+const double NVM_PAGE_WRITE_S = 10e-3;          // Page erase-write time, CPU keeps running
+
+sim_config cfg;
+sim_stats stats;
+uint64_t now_ps;                                // Simulated time
+uint64_t accounted_ps;                          // Time up to which the stats and counters are updated
+uint64_t end_ps;
+cpu_state state;
+bool sreg_i;
+bool in_isr;
+std::mt19937 rng;
+std::normal_distribution<double> gauss(0.0, 1.0);
+std::vector<sim_uart_byte> uart_bytes;
+std::vector<sim_adc_result> adc_results;
+uint8_t flash[PROGMEM_SIZE];
+long flash_write_count;
+long flash_erases[PROGMEM_SIZE / PROGMEM_PAGE_SIZE];      // Erase/writes of each page
+const char *stop_reason;
+
+uint64_t ps(double seconds)
+{
+    return (uint64_t) llround(seconds * 1e12);
+}
+
+double seconds(uint64_t t)
+{
+    return t * 1e-12;
+}
+
+bool cpu_clock_running(void)
+{
+    return (state == CPU_ACTIVE) || (state == CPU_IDLE);
+}
+
+// Runs in the current sleep mode: always in active and idle, in standby only with RUNSTDBY
+bool runs_in_state(bool runstdby)
+{
+    return cpu_clock_running() || ((state == CPU_STANDBY) && runstdby);
+}
+
+double clk_per(void)
+{
+    static const int pdiv[16] = {2, 4, 8, 16, 32, 64, 0, 0, 6, 10, 12, 24, 48, 0, 0, 0};
+    uint8_t b = sim_CLKCTRL.MCLKCTRLB.raw;
+
+    if (!(b & CLKCTRL_PEN_bm))
+    {
+        return OSCHF_HZ;
+    }
+    int div = pdiv[(b & CLKCTRL_PDIV_gm) >> 1];
+    return div ? OSCHF_HZ / div : OSCHF_HZ;
+}
+
+void stop(const char *reason)
+{
+    stop_reason = reason;
+    throw sim_stop{reason};
+}
+
+
+/*
+ * Analog board
+ */
+double rtd_ohm(double t)
+{
+    const double a = 3.9083e-3;
+    const double b = -5.775e-7;
+    const double c = -4.183e-12;
+    double r = 1.0 + a * t + b * t * t;
+
+    if (t < 0)
+    {
+        r += c * (t - 100.0) * t * t * t;
+    }
+    return cfg.rtd_r0 * r;
+}
+
+double dac_voltage(uint64_t t);
+
+// Voltage on ADC input AINn (PDn) at time t
+double pin_voltage(int ain, uint64_t t)
+{
+    double vdac = dac_voltage(t);
+    double temp = cfg.temp_c.empty() ? 25.0 : cfg.temp_c.value(seconds(t));
+    double rrtd = rtd_ohm(temp);
+    double rtd_v = vdac * rrtd / (cfg.rtd_fixed + rrtd);
+
+    if ((ain == 6) || (ain == 7))               // DAC0OUT and VREFA (wired together on both boards)
+    {
+        return vdac;
+    }
+    if (cfg.board == SIM_BOARD_RTD)
+    {
+        return (ain == 0) ? rtd_v : 0.0;
+    }
+
+    double i;
+    if (!cfg.current_na.empty())
+    {
+        i = cfg.current_na.value(seconds(t)) * 1e-9;
+    }
+    else
+    {
+        i = vdac / (cfg.r1 + cfg.r_sense + cfg.r2);
+    }
+    switch (ain)
+    {
+        case 0: return i * cfg.r2;
+        case 1: return i * (cfg.r2 + cfg.r_sense);
+        case 2: return rtd_v;
+        default: return 0.0;
+    }
+}
+
+double mux_voltage(int mux, uint64_t t)
+{
+    mux &= 0x3F;
+    if (mux < 8)
+    {
+        return pin_voltage(mux, t);
+    }
+    return 0.0;                                 // GND and the inputs that are not connected
+}
+
+
+/*
+ * Peripheral base: register block and default register behaviour
+ */
+struct periph
+{
+    void *base;
+    size_t size;
+
+    periph(void *b, size_t s) : base(b), size(s) {}
+    virtual ~periph() {}
+
+    uint8_t *reg(unsigned off) { return (uint8_t *) base + off; }
+
+    virtual uint32_t read(unsigned off, unsigned n)
+    {
+        uint32_t v = 0;
+        memcpy(&v, reg(off), n);
+        return v;
+    }
+    virtual void write(unsigned off, uint32_t v, unsigned n)
+    {
+        memcpy(reg(off), &v, n);
+    }
+    virtual void reset() { memset(base, 0, size); }
+    virtual uint64_t next_event() { return SIM_NEVER; }
+    virtual void event() {}
+    virtual void state_changed() {}
+    virtual void account(double) {}
+};
+
+#define OFF(type, field) offsetof(type, field)
+
+
+/*
+ * CPU status register
+ */
+struct cpu_model : periph
+{
+    cpu_model() : periph(&sim_SREG, sizeof(sim_SREG)) {}
+
+    uint32_t read(unsigned, unsigned) override { return sreg_i ? CPU_I_bm : 0; }
+    void write(unsigned, uint32_t v, unsigned) override { sreg_i = (v & CPU_I_bm) != 0; }
+} cpu;
+
+
+/*
+ * CLKCTRL: the main clock is OSCHF 20 MHz with the MCLKCTRLB prescaler,
+ * a change takes effect at once
+ */
+struct clkctrl_model : periph
+{
+    clkctrl_model() : periph(&sim_CLKCTRL, sizeof(sim_CLKCTRL)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        sim_CLKCTRL.MCLKCTRLB.raw = CLKCTRL_PDIV_DIV6_gc | CLKCTRL_PEN_bm;
+    }
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        if (off == OFF(CLKCTRL_t, MCLKSTATUS))
+        {
+            return 0;                           // Clock switch is done at once
+        }
+        return periph::read(off, n);
+    }
+} clkctrl;
+
+
+struct plain_model : periph
+{
+    plain_model(void *b, size_t s) : periph(b, s) {}
+};
+
+plain_model slpctrl(&sim_SLPCTRL, sizeof(sim_SLPCTRL));
+plain_model vref(&sim_VREF, sizeof(sim_VREF));
+plain_model evsys(&sim_EVSYS, sizeof(sim_EVSYS));
+
+
+/*
+ * DAC0: 10-bit output, settles exponentially to each new value
+ */
+struct dac_model : periph
+{
+    double v_from;
+    double target;
+    uint64_t t_change;
+
+    dac_model() : periph(&sim_DAC0, sizeof(sim_DAC0)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        v_from = 0;
+        target = 0;
+        t_change = 0;
+    }
+    bool output_on()
+    {
+        uint8_t a = sim_DAC0.CTRLA.raw;
+        return (a & DAC_ENABLE_bm) && (a & DAC_OUTEN_bm) && runs_in_state(a & DAC_RUNSTDBY_bm);
+    }
+    double vref_v()
+    {
+        switch (sim_VREF.DAC0REF.raw & VREF_REFSEL_gm)
+        {
+            case VREF_REFSEL_1V024_gc: return 1.024;
+            case VREF_REFSEL_2V048_gc: return 2.048;
+            case VREF_REFSEL_4V096_gc: return 4.096;
+            case VREF_REFSEL_2V500_gc: return 2.5;
+            case VREF_REFSEL_VDD_gc: return cfg.vdd;
+            default: return 0.0;
+        }
+    }
+    double voltage(uint64_t t)
+    {
+        double dt = (t > t_change) ? seconds(t - t_change) : 0.0;
+        return target + (v_from - target) * exp(-dt / (cfg.dac_tau_us * 1e-6));
+    }
+    void update()
+    {
+        double v = output_on() ? (sim_DAC0.DATA.raw >> DAC_DATA_gp) * vref_v() / 1024.0 : 0.0;
+        if (v != target)
+        {
+            v_from = voltage(now_ps);
+            t_change = now_ps;
+            target = v;
+        }
+    }
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        periph::write(off, v, n);
+        update();
+    }
+    void state_changed() override { update(); }
+    void account(double dt) override
+    {
+        if (output_on())
+        {
+            stats.t_dac_on += dt;
+        }
+    }
+} dac;
+
+double dac_voltage(uint64_t t)
+{
+    return dac.voltage(t);
+}
+
+
+/*
+ * ADC0 with PGA
+ *
+ * After ENABLE, ADC0 is busy for t_init (20 us with the PGA enabled, 10 us
+ * without). A conversion of n samples takes
+ *   PGA:    ((SAMPDUR + 2) * n + 14) / f_CLK_ADC + ADCPGASAMPDUR * n
+ *   no PGA: ((SAMPDUR + 14) * n + 1.5) / f_CLK_ADC
+ * Each sample is taken from the board at its time in the conversion
+ */
+struct adc_model : periph
+{
+    bool enabled;
+    bool converting;
+    bool paused;
+    bool armed;                                 // Event trigger start
+    uint64_t ready;                             // End of t_init
+    uint64_t conv_start;
+    uint64_t conv_end;
+    uint64_t conv_time_ps;
+    uint64_t pause_left;                        // Time left of the conversion and of t_init when paused
+    uint64_t pause_ready;
+    uint64_t pga_change;                        // Time the PGA was enabled or its input or gain changed
+    uint8_t command;
+    int samples;
+
+    adc_model() : periph(&sim_ADC0, sizeof(sim_ADC0)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        enabled = converting = paused = armed = false;
+        ready = conv_start = conv_end = conv_time_ps = pause_left = pause_ready = pga_change = 0;
+        command = 0;
+        samples = 0;
+    }
+    bool running() { return enabled && runs_in_state(sim_ADC0.CTRLA.raw & ADC_RUNSTDBY_bm); }
+    bool conversions_overlap(uint64_t t0, uint64_t t1)      // The last conversion overlaps t0 to t1
+    {
+        return (conv_end > t0) && (conv_start < t1);
+    }
+    bool pga_used() { return (sim_ADC0.MUXPOS.raw & ADC_VIA_gm) == ADC_VIA_PGA_gc; }
+    int pga_gain() { return pga_used() ? 1 << ((sim_ADC0.PGACTRL.raw & ADC_GAIN_gm) >> ADC_GAIN_gp) : 1; }
+    double f_adc()
+    {
+        static const int div[16] = {2, 4, 6, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 56, 64};
+        return clk_per() / div[sim_ADC0.CTRLB.raw & ADC_PRESC_gm];
+    }
+    double pga_sample_time()
+    {
+        static const double t[4] = {3e-6, 4e-6, 6e-6, 12e-6};   // ADCPGASAMPDUR for bias 100%, 75%, 50%, 25%
+        return t[(sim_ADC0.PGACTRL.raw & ADC_PGABIASSEL_gm) >> 1];
+    }
+    int sample_count(uint8_t cmd)
+    {
+        uint8_t mode = cmd & ADC_MODE_gm;
+        if ((mode == ADC_MODE_BURST_gc) || (mode == ADC_MODE_BURST_SCALING_gc)
+            || (mode == ADC_MODE_SERIES_gc) || (mode == ADC_MODE_SERIES_SCALING_gc))
+        {
+            return 1 << (sim_ADC0.CTRLF.raw & ADC_SAMPNUM_gm);
+        }
+        return 1;
+    }
+    double conversion_time(int n)
+    {
+        double sampdur = sim_ADC0.CTRLE.raw;
+        if (pga_used())
+        {
+            return ((sampdur + 2) * n + 14) / f_adc() + pga_sample_time() * n;
+        }
+        return ((sampdur + 14) * n + 1.5) / f_adc();
+    }
+    double ref_v(uint64_t t)
+    {
+        switch (sim_ADC0.CTRLC.raw & ADC_REFSEL_gm)
+        {
+            case ADC_REFSEL_VDD_gc: return cfg.vdd;
+            case ADC_REFSEL_VREFA_gc: return pin_voltage(7, t);
+            case ADC_REFSEL_1V024_gc: return 1.024;
+            case ADC_REFSEL_2V048_gc: return 2.048;
+            case ADC_REFSEL_2V500_gc: return 2.5;
+            case ADC_REFSEL_4V096_gc: return 4.096;
+            default: return cfg.vdd;
+        }
+    }
+
+    void start(uint64_t t)
+    {
+        if (converting)
+        {
+            sim_ADC0.INTFLAGS.raw |= ADC_TRIGOVR_bm;
+            return;
+        }
+        command = sim_ADC0.COMMAND.raw;
+        samples = sample_count(command);
+        conv_start = (t > ready) ? t : ready;
+        conv_time_ps = ps(conversion_time(samples));
+        conv_end = conv_start + conv_time_ps;
+        converting = true;
+        if (pga_used() && !(sim_ADC0.PGACTRL.raw & ADC_PGAEN_bm))
+        {
+            sim_error("ADC0 conversion via the PGA with the PGA disabled");
+        }
+    }
+
+    int32_t sample(uint64_t t, int i)
+    {
+        bool diff = command & ADC_DIFF_bm;
+        double gain = pga_gain();
+        double v = mux_voltage(sim_ADC0.MUXPOS.raw, t);
+
+        if (diff)
+        {
+            v -= mux_voltage(sim_ADC0.MUXNEG.raw, t);
+        }
+        if (pga_used())
+        {
+            double dt = (t > pga_change) ? seconds(t - pga_change) : 0.0;
+            v += cfg.pga_error_v * exp(-dt / (cfg.pga_tau_us * 1e-6));
+        }
+
+        double ref = ref_v(t);
+        double x = (ref > 1e-3) ? v * gain / ref * (diff ? 2048.0 : 4096.0) : (v > 0 ? 1e9 : -1e9);
+        double offset = cfg.offset_lsb;
+        if ((sim_ADC0.CTRLF.raw & ADC_CHOPPING_bm) && (i & 1))
+        {
+            offset = -offset;                   // Sign chopping: the offset changes sign every sample
+        }
+        x += offset + cfg.residual_lsb + cfg.noise_lsb * gauss(rng);
+
+        double lo = diff ? -2048 : 0;
+        double hi = diff ? 2047 : 4095;
+        x = floor(x + 0.5);
+        x = (x < lo) ? lo : ((x > hi) ? hi : x);
+        if ((command & ADC_MODE_gm) == ADC_MODE_SINGLE_8BIT_gc)
+        {
+            x = floor(x / 16);
+        }
+        return (int32_t) x;
+    }
+
+    void complete()
+    {
+        int32_t sum = 0;
+        int32_t last = 0;
+        for (int i = 0; i < samples; i++)
+        {
+            last = sample(conv_start + conv_time_ps * (2 * i + 1) / (2 * samples), i);
+            sum += last;
+        }
+        converting = false;
+        stats.conversions++;
+        stats.samples += samples;
+
+        sim_ADC0.RESULT.raw = (uint32_t) sum;
+        if (cfg.adc_log)
+        {
+            adc_results.push_back({now_ps, sum, pga_gain()});
+        }
+        sim_ADC0.SAMPLE.raw = (uint16_t) last;
+        if (sim_ADC0.INTFLAGS.raw & ADC_RESRDY_bm)
+        {
+            sim_ADC0.INTFLAGS.raw |= ADC_RESOVR_bm;
+        }
+        sim_ADC0.INTFLAGS.raw |= ADC_RESRDY_bm | ADC_SAMPRDY_bm;
+
+        // Window comparator on RESULT, signed in differential mode
+        int32_t lt = (command & ADC_DIFF_bm) ? (int16_t) sim_ADC0.WINLT.raw : sim_ADC0.WINLT.raw;
+        int32_t ht = (command & ADC_DIFF_bm) ? (int16_t) sim_ADC0.WINHT.raw : sim_ADC0.WINHT.raw;
+        bool hit = false;
+        switch (sim_ADC0.CTRLD.raw & ADC_WINCM_gm)
+        {
+            case ADC_WINCM_BELOW_gc: hit = sum < lt; break;
+            case ADC_WINCM_ABOVE_gc: hit = sum > ht; break;
+            case ADC_WINCM_INSIDE_gc: hit = (sum > lt) && (sum < ht); break;
+            case ADC_WINCM_OUTSIDE_gc: hit = (sum < lt) || (sum > ht); break;
+            default: break;
+        }
+        if (hit)
+        {
+            sim_ADC0.INTFLAGS.raw |= ADC_WCMP_bm;
+        }
+
+        if (sim_ADC0.CTRLF.raw & ADC_FREERUN_bm)
+        {
+            start(now_ps);
+        }
+    }
+
+    void event_trigger()
+    {
+        if (enabled && armed)
+        {
+            start(now_ps);
+        }
+    }
+
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        switch (off)
+        {
+            case OFF(ADC_t, STATUS):
+                return (enabled && ((now_ps < ready) || converting || paused)) ? ADC_ADCBUSY_bm : 0;
+            case OFF(ADC_t, RESULT):
+                sim_ADC0.INTFLAGS.raw &= ~ADC_RESRDY_bm;
+                return periph::read(off, n);
+            default:
+                return periph::read(off, n);
+        }
+    }
+
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        uint8_t old = *reg(off);
+
+        switch (off)
+        {
+            case OFF(ADC_t, CTRLA):
+                periph::write(off, v, n);
+                if (!(old & ADC_ENABLE_bm) && (v & ADC_ENABLE_bm))
+                {
+                    enabled = true;
+                    ready = now_ps + ps((sim_ADC0.PGACTRL.raw & ADC_PGAEN_bm) ? 20e-6 : 10e-6);
+                    pga_change = now_ps;
+                }
+                else if ((old & ADC_ENABLE_bm) && !(v & ADC_ENABLE_bm))
+                {
+                    enabled = converting = paused = armed = false;
+                }
+                state_changed();
+                break;
+            case OFF(ADC_t, COMMAND):
+                periph::write(off, v, n);
+                if (!enabled)
+                {
+                    sim_error("ADC0.COMMAND written while ADC0 is disabled");
+                    break;
+                }
+                switch (v & ADC_START_gm)
+                {
+                    case ADC_START_STOP_gc:
+                        converting = paused = armed = false;
+                        break;
+                    case ADC_START_IMMEDIATE_gc:
+                        armed = false;
+                        start(now_ps);
+                        break;
+                    case ADC_START_EVENT_TRIGGER_gc:
+                        armed = true;
+                        break;
+                    default:
+                        sim_error("ADC0 start mode 0x%02x is not modelled", v & ADC_START_gm);
+                        break;
+                }
+                break;
+            case OFF(ADC_t, INTFLAGS):
+                sim_ADC0.INTFLAGS.raw &= ~v;
+                break;
+            case OFF(ADC_t, STATUS):
+            case OFF(ADC_t, RESULT):
+                break;
+            case OFF(ADC_t, PGACTRL):
+            case OFF(ADC_t, MUXPOS):
+            case OFF(ADC_t, MUXNEG):
+                periph::write(off, v, n);
+                if (old != (uint8_t) v)
+                {
+                    pga_change = now_ps;
+                }
+                break;
+            default:
+                periph::write(off, v, n);
+                break;
+        }
+    }
+
+    uint64_t next_event() override
+    {
+        return (converting && !paused) ? conv_end : SIM_NEVER;
+    }
+    void event() override
+    {
+        if (converting && !paused && (conv_end <= now_ps))
+        {
+            complete();
+        }
+    }
+
+    // ADC0 stops when CLK_PER stops, unless RUNSTDBY is set in standby
+    void state_changed() override
+    {
+        bool run = !enabled || running();
+
+        if (!run && !paused)
+        {
+            paused = true;
+            pause_ready = (ready > now_ps) ? ready - now_ps : 0;
+            pause_left = converting ? conv_end - now_ps : 0;
+            if (converting)
+            {
+                sim_error("ADC0 stopped by the sleep mode during a conversion");
+            }
+        }
+        else if (run && paused)
+        {
+            paused = false;
+            ready = now_ps + pause_ready;
+            if (converting)
+            {
+                conv_end = now_ps + pause_left;
+                conv_start = conv_end - conv_time_ps;
+            }
+        }
+    }
+
+    void account(double dt) override
+    {
+        if (enabled)
+        {
+            stats.t_adc_on += dt;
+            if (sim_ADC0.PGACTRL.raw & ADC_PGAEN_bm)
+            {
+                stats.t_pga_on += dt;
+            }
+        }
+        if (converting && !paused)
+        {
+            stats.t_adc_conv += dt;
+        }
+    }
+} adc;
+
+
+/*
+ * RTC: PIT, PIT event generator 0 and the counter (overflow and compare match)
+ */
+struct rtc_model : periph
+{
+    uint64_t pit_next;                          // In RTC clock ticks, 0 = off
+    uint64_t evg_next;
+    uint64_t ovf_next;
+    uint64_t cmp_next;
+    uint64_t cnt_start;
+
+    rtc_model() : periph(&sim_RTC, sizeof(sim_RTC)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        pit_next = evg_next = ovf_next = cmp_next = cnt_start = 0;
+    }
+    double hz() { return ((sim_RTC.CLKSEL.raw & RTC_CLKSEL_gm) == RTC_CLKSEL_OSC1K_gc) ? 1024.0 : 32768.0; }
+    uint64_t tick_now() { return (uint64_t) floor(seconds(now_ps) * hz() + 1e-6); }
+    uint64_t tick_time(uint64_t tick) { return ps(tick / hz()); }
+
+    // First multiple of period after the current tick
+    uint64_t next_multiple(uint64_t period)
+    {
+        return (tick_now() / period + 1) * period;
+    }
+    uint64_t pit_period()
+    {
+        uint8_t p = (sim_RTC.PITCTRLA.raw & RTC_PERIOD_gm) >> RTC_PERIOD_gp;
+        return ((sim_RTC.PITCTRLA.raw & RTC_PITEN_bm) && p) ? (1ULL << (p + 1)) : 0;
+    }
+    uint64_t evg_period()
+    {
+        uint8_t p = sim_RTC.PITEVGENCTRLA.raw & RTC_EVGEN0SEL_gm;
+        return ((sim_RTC.PITCTRLA.raw & RTC_PITEN_bm) && p) ? (1ULL << (p + 1)) : 0;
+    }
+    uint64_t ovf_period()
+    {
+        uint8_t p = (sim_RTC.CTRLA.raw & RTC_PRESCALER_gm) >> RTC_PRESCALER_gp;
+        return (sim_RTC.CTRLA.raw & RTC_RTCEN_bm) ? ((uint64_t) sim_RTC.PER.raw + 1) << p : 0;
+    }
+    void schedule()
+    {
+        pit_next = pit_period() ? next_multiple(pit_period()) : 0;
+        evg_next = evg_period() ? next_multiple(evg_period()) : 0;
+    }
+    // First tick after the current one where the counter becomes CMP
+    void schedule_counter()
+    {
+        uint64_t period = ovf_period();
+        uint8_t p = (sim_RTC.CTRLA.raw & RTC_PRESCALER_gm) >> RTC_PRESCALER_gp;
+
+        ovf_next = period ? cnt_start + period : 0;
+        cmp_next = 0;
+        if (period && (sim_RTC.CMP.raw <= sim_RTC.PER.raw))
+        {
+            uint64_t offset = (uint64_t) sim_RTC.CMP.raw << p;
+            uint64_t now = tick_now();
+            cmp_next = cnt_start + offset;
+            if (cmp_next <= now)
+            {
+                cmp_next += ((now - cmp_next) / period + 1) * period;
+            }
+        }
+    }
+
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        switch (off)
+        {
+            case OFF(RTC_t, STATUS):
+            case OFF(RTC_t, PITSTATUS):
+                return 0;                       // Synchronization is not modelled
+            case OFF(RTC_t, CNT):
+                if (ovf_period())
+                {
+                    uint8_t p = (sim_RTC.CTRLA.raw & RTC_PRESCALER_gm) >> RTC_PRESCALER_gp;
+                    return (uint16_t) (((tick_now() - cnt_start) >> p) % ((uint64_t) sim_RTC.PER.raw + 1));
+                }
+                return periph::read(off, n);
+            default:
+                return periph::read(off, n);
+        }
+    }
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        uint8_t old = *reg(off);
+
+        switch (off)
+        {
+            case OFF(RTC_t, INTFLAGS):
+            case OFF(RTC_t, PITINTFLAGS):
+                *reg(off) &= ~v;
+                break;
+            case OFF(RTC_t, CTRLA):
+                periph::write(off, v, n);
+                if (!(old & RTC_RTCEN_bm) && (v & RTC_RTCEN_bm))
+                {
+                    cnt_start = tick_now();
+                }
+                schedule_counter();
+                break;
+            case OFF(RTC_t, PER):
+            case OFF(RTC_t, CMP):
+                periph::write(off, v, n);
+                schedule_counter();
+                break;
+            default:
+                periph::write(off, v, n);
+                schedule();
+                break;
+        }
+    }
+
+    uint64_t next_event() override
+    {
+        uint64_t t = SIM_NEVER;
+        if (pit_next)
+        {
+            t = tick_time(pit_next);
+        }
+        if (evg_next && (tick_time(evg_next) < t))
+        {
+            t = tick_time(evg_next);
+        }
+        if (ovf_next && (tick_time(ovf_next) < t))
+        {
+            t = tick_time(ovf_next);
+        }
+        if (cmp_next && (tick_time(cmp_next) < t))
+        {
+            t = tick_time(cmp_next);
+        }
+        return t;
+    }
+    void event() override
+    {
+        if (pit_next && (tick_time(pit_next) <= now_ps))
+        {
+            sim_RTC.PITINTFLAGS.raw |= RTC_PI_bm;
+            pit_next += pit_period();
+        }
+        if (evg_next && (tick_time(evg_next) <= now_ps))
+        {
+            evg_next += evg_period();
+            if ((sim_EVSYS.CHANNEL0.raw == EVSYS_CHANNEL0_RTC_EVGEN0_gc)
+                && (sim_EVSYS.USERADC0START.raw == EVSYS_USER_CHANNEL0_gc))
+            {
+                adc.event_trigger();
+            }
+        }
+        if (ovf_next && (tick_time(ovf_next) <= now_ps))
+        {
+            if ((sim_RTC.INTCTRL.raw & RTC_OVF_bm) && !runs_in_state(sim_RTC.CTRLA.raw & RTC_RUNSTDBY_bm))
+            {
+                sim_error("RTC counter overflow while the RTC counter is stopped by the sleep mode");
+            }
+            sim_RTC.INTFLAGS.raw |= RTC_OVF_bm;
+            ovf_next += ovf_period();
+        }
+        if (cmp_next && (tick_time(cmp_next) <= now_ps))
+        {
+            if ((sim_RTC.INTCTRL.raw & RTC_CMP_bm) && !runs_in_state(sim_RTC.CTRLA.raw & RTC_RUNSTDBY_bm))
+            {
+                sim_error("RTC compare match while the RTC counter is stopped by the sleep mode");
+            }
+            sim_RTC.INTFLAGS.raw |= RTC_CMP_bm;
+            cmp_next += ovf_period();
+        }
+    }
+} rtc;
+
+
+/*
+ * TCB0: counts CLK_PER or CLK_PER / 2, only the counter is modelled
+ */
+struct tcb_model : periph
+{
+    double count;
+
+    tcb_model() : periph(&sim_TCB0, sizeof(sim_TCB0)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        count = 0;
+    }
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        if (off == OFF(TCB_t, CNT))
+        {
+            return (uint16_t) count;
+        }
+        return periph::read(off, n);
+    }
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        if (off == OFF(TCB_t, CNT))
+        {
+            count = (uint16_t) v;
+            return;
+        }
+        periph::write(off, v, n);
+    }
+    void account(double dt) override
+    {
+        uint8_t a = sim_TCB0.CTRLA.raw;
+        if ((a & TCB_ENABLE_bm) && runs_in_state(a & TCB_RUNSTDBY_bm))
+        {
+            double div = ((a & TCB_CLKSEL_gm) == TCB_CLKSEL_DIV2_gc) ? 2.0 : 1.0;
+            count = fmod(count + dt * clk_per() / div, 65536.0);
+        }
+    }
+} tcb;
+
+
+/*
+ * USART1 transmitter: TXDATAL buffer, shift register, DREIF and TXCIF
+ */
+struct usart_model : periph
+{
+    bool shifting;
+    bool buffered;
+    bool paused;
+    uint8_t shift_byte;
+    uint8_t buffer_byte;
+    uint64_t shift_start;
+    uint64_t shift_end;
+    uint64_t pause_left;
+
+    usart_model() : periph(&sim_USART1, sizeof(sim_USART1)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        shifting = buffered = paused = false;
+        shift_byte = buffer_byte = 0;
+        shift_start = shift_end = pause_left = 0;
+    }
+    bool tx_on() { return sim_USART1.CTRLB.raw & USART_TXEN_bm; }
+    double byte_time()
+    {
+        uint16_t baud = sim_USART1.BAUD.raw;
+        if (baud < 64)
+        {
+            sim_error("USART1.BAUD %u is below 64", baud);
+            baud = 64;
+        }
+        return 10.0 * 16.0 * baud / (64.0 * clk_per());     // Start, 8 data and stop bit
+    }
+    void start_shift(uint8_t data)
+    {
+        shifting = true;
+        shift_byte = data;
+        shift_start = now_ps;
+        shift_end = now_ps + ps(byte_time());
+    }
+
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        if (off == OFF(USART_t, STATUS))
+        {
+            return (sim_USART1.STATUS.raw & ~USART_DREIF_bm) | (buffered ? 0 : USART_DREIF_bm);
+        }
+        return periph::read(off, n);
+    }
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        switch (off)
+        {
+            case OFF(USART_t, TXDATAL):
+                if (!tx_on())
+                {
+                    sim_error("USART1.TXDATAL written with TX disabled, byte 0x%02x lost", v & 0xFF);
+                }
+                else if (!shifting)
+                {
+                    start_shift(v);
+                }
+                else if (!buffered)
+                {
+                    buffered = true;
+                    buffer_byte = v;
+                }
+                else
+                {
+                    sim_error("USART1.TXDATAL written while DREIF is clear, byte 0x%02x lost", v & 0xFF);
+                }
+                break;
+            case OFF(USART_t, STATUS):
+                sim_USART1.STATUS.raw &= ~(v & USART_TXCIF_bm);
+                break;
+            case OFF(USART_t, CTRLB):
+                periph::write(off, v, n);
+                if (!tx_on() && (shifting || buffered))
+                {
+                    sim_error("USART1 TX disabled while a byte is being sent");
+                    shifting = buffered = paused = false;
+                }
+                break;
+            default:
+                periph::write(off, v, n);
+                break;
+        }
+    }
+
+    uint64_t next_event() override { return (shifting && !paused) ? shift_end : SIM_NEVER; }
+    void event() override
+    {
+        if (!shifting || paused || (shift_end > now_ps))
+        {
+            return;
+        }
+        sim_uart_byte b = {now_ps, shift_byte};
+        uart_bytes.push_back(b);
+        stats.uart_bytes++;
+        if (adc.conversions_overlap(shift_start, now_ps))
+        {
+            stats.uart_bytes_converting++;
+        }
+        if (cfg.uart_out)
+        {
+            fputc(shift_byte, cfg.uart_out);
+        }
+        if (cfg.uart_times)
+        {
+            fprintf(cfg.uart_times, "%.9f %u\n", seconds(now_ps), shift_byte);
+        }
+        shifting = false;
+        if (buffered)
+        {
+            buffered = false;
+            start_shift(buffer_byte);
+        }
+        else
+        {
+            sim_USART1.STATUS.raw |= USART_TXCIF_bm;
+        }
+    }
+    void state_changed() override
+    {
+        if (!cpu_clock_running() && shifting && !paused)
+        {
+            paused = true;
+            pause_left = shift_end - now_ps;
+            sim_error("USART1 stopped by the sleep mode while sending");
+        }
+        else if (cpu_clock_running() && paused)
+        {
+            paused = false;
+            shift_end = now_ps + pause_left;
+        }
+    }
+    void account(double dt) override
+    {
+        if (tx_on())
+        {
+            stats.t_usart_on += dt;
+        }
+    }
+} usart;
+
+
+/*
+ * NVMCTRL: flash page erase-write of the page buffer
+ *
+ * The firmware writes the page buffer through the mapped flash section
+ * (MAPPED_PROGMEM_START). Here these writes go straight to the mapped copy,
+ * and FLPERW programs the page of the mapped section that differs from the
+ * flash image. Power loss during a write leaves the second half of the page
+ * erased (0xFF)
+ */
+struct nvm_model : periph
+{
+    uint64_t busy_end;
+
+    nvm_model() : periph(&sim_NVMCTRL, sizeof(sim_NVMCTRL)) {}
+
+    void reset() override
+    {
+        periph::reset();
+        busy_end = 0;
+    }
+    unsigned section_base() { return ((sim_NVMCTRL.CTRLB.raw & NVMCTRL_FLMAP_gm) >> 4) * MAPPED_PROGMEM_SIZE; }
+    void sync_window() { memcpy(sim_mapped_progmem, flash + section_base(), MAPPED_PROGMEM_SIZE); }
+
+    void erase_write()
+    {
+        unsigned base = section_base();
+        int page = -1;
+
+        for (unsigned p = 0; p < MAPPED_PROGMEM_SIZE / PROGMEM_PAGE_SIZE; p++)
+        {
+            unsigned a = p * PROGMEM_PAGE_SIZE;
+            if (memcmp(sim_mapped_progmem + a, flash + base + a, PROGMEM_PAGE_SIZE))
+            {
+                if (page >= 0)
+                {
+                    sim_error("page buffer writes to more than one flash page");
+                }
+                page = p;
+            }
+        }
+        busy_end = now_ps + ps(NVM_PAGE_WRITE_S);
+        if (page < 0)
+        {
+            return;                             // Same data as in flash
+        }
+
+        unsigned a = page * PROGMEM_PAGE_SIZE;
+        flash_write_count++;
+        flash_erases[(base + a) / PROGMEM_PAGE_SIZE]++;
+        stats.flash_writes++;
+        if (adc.conversions_overlap(now_ps, busy_end))
+        {
+            stats.flash_writes_converting++;
+        }
+        if (flash_write_count == cfg.power_fail_write)
+        {
+            memcpy(flash + base + a, sim_mapped_progmem + a, PROGMEM_PAGE_SIZE / 2);
+            memset(flash + base + a + PROGMEM_PAGE_SIZE / 2, 0xFF, PROGMEM_PAGE_SIZE / 2);
+            stop("power fail during flash write");
+        }
+        memcpy(flash + base + a, sim_mapped_progmem + a, PROGMEM_PAGE_SIZE);
+    }
+
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        if (off == OFF(NVMCTRL_t, STATUS))
+        {
+            return (now_ps < busy_end) ? NVMCTRL_FBUSY_bm : 0;
+        }
+        return periph::read(off, n);
+    }
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        periph::write(off, v, n);
+        if (off == OFF(NVMCTRL_t, CTRLA))
+        {
+            switch (v & NVMCTRL_CMD_gm)
+            {
+                case NVMCTRL_CMD_NOCMD_gc:
+                case NVMCTRL_CMD_NOOP_gc:
+                case NVMCTRL_CMD_FLPBCLR_gc:
+                    break;
+                case NVMCTRL_CMD_FLPERW_gc:
+                    if (now_ps < busy_end)
+                    {
+                        sim_error("flash command while NVMCTRL is busy");
+                    }
+                    erase_write();
+                    break;
+                default:
+                    sim_error("NVMCTRL command 0x%02x is not modelled", v);
+                    break;
+            }
+        }
+        else if (off == OFF(NVMCTRL_t, CTRLB))
+        {
+            sync_window();
+        }
+    }
+} nvm;
+
+
+/*
+ * PORTs: direction, output, input (SW0 on PB2) and pin configuration
+ */
+uint8_t pinconfig;                              // PINCONFIG is shared by all ports
+
+struct port_model : periph
+{
+    PORT_t *port;
+
+    port_model(PORT_t *p) : periph(p, sizeof(*p)), port(p) {}
+
+    uint8_t pinctrl(int pin) { return *reg(OFF(PORT_t, PIN0CTRL) + pin); }
+
+    uint8_t input()
+    {
+        uint8_t in = 0;
+        for (int pin = 0; pin < 8; pin++)
+        {
+            uint8_t ctrl = pinctrl(pin);
+            bool level = (ctrl & PORT_PULLUPEN_bm) != 0;
+
+            if ((ctrl & PORT_ISC_gm) == PORT_ISC_INPUT_DISABLE_gc)
+            {
+                continue;
+            }
+            if (port->DIR.raw & (1 << pin))
+            {
+                level = port->OUT.raw & (1 << pin);
+            }
+            else if ((port == &sim_PORTB) && (pin == 2) && !cfg.sw0.empty())
+            {
+                level = level && (cfg.sw0.value(seconds(now_ps)) < 0.5);   // SW0 pulls PB2 low
+            }
+            in |= level ? (1 << pin) : 0;
+        }
+        return in;
+    }
+
+    uint32_t read(unsigned off, unsigned n) override
+    {
+        switch (off)
+        {
+            case OFF(PORT_t, IN):
+                return input();
+            case OFF(PORT_t, PINCONFIG):
+                return pinconfig;
+            default:
+                return periph::read(off, n);
+        }
+    }
+    void write(unsigned off, uint32_t v, unsigned n) override
+    {
+        uint8_t b = v;
+
+        switch (off)
+        {
+            case OFF(PORT_t, DIRSET): port->DIR.raw |= b; break;
+            case OFF(PORT_t, DIRCLR): port->DIR.raw &= ~b; break;
+            case OFF(PORT_t, DIRTGL): port->DIR.raw ^= b; break;
+            case OFF(PORT_t, OUTSET): port->OUT.raw |= b; break;
+            case OFF(PORT_t, OUTCLR): port->OUT.raw &= ~b; break;
+            case OFF(PORT_t, OUTTGL): port->OUT.raw ^= b; break;
+            case OFF(PORT_t, IN): port->OUT.raw ^= b; break;
+            case OFF(PORT_t, INTFLAGS): port->INTFLAGS.raw &= ~b; break;
+            case OFF(PORT_t, PINCONFIG): pinconfig = b; break;
+            case OFF(PORT_t, PINCTRLUPD):
+            case OFF(PORT_t, PINCTRLSET):
+            case OFF(PORT_t, PINCTRLCLR):
+                for (int pin = 0; pin < 8; pin++)
+                {
+                    uint8_t *ctrl = reg(OFF(PORT_t, PIN0CTRL) + pin);
+                    if (!(b & (1 << pin)))
+                    {
+                        continue;
+                    }
+                    if (off == OFF(PORT_t, PINCTRLUPD))
+                    {
+                        *ctrl = pinconfig;
+                    }
+                    else if (off == OFF(PORT_t, PINCTRLSET))
+                    {
+                        *ctrl |= pinconfig;
+                    }
+                    else
+                    {
+                        *ctrl &= ~pinconfig;
+                    }
+                }
+                break;
+            default:
+                periph::write(off, v, n);
+                break;
+        }
+    }
+    void account(double dt) override
+    {
+        if ((port == &sim_PORTB) && (port->DIR.raw & PIN3_bm) && !(port->OUT.raw & PIN3_bm))
+        {
+            stats.t_led_on += dt;                   // LED0 on PB3 is active low
+        }
+    }
+};
+
+port_model porta(&sim_PORTA);
+port_model portb(&sim_PORTB);
+port_model portc(&sim_PORTC);
+port_model portd(&sim_PORTD);
+port_model porte(&sim_PORTE);
+port_model portf(&sim_PORTF);
+
+periph *const periphs[] = {
+    &cpu, &clkctrl, &slpctrl, &vref, &evsys, &dac, &adc, &rtc, &tcb, &usart, &nvm,
+    &porta, &portb, &portc, &portd, &porte, &portf,
+};
+
+periph *find_periph(const void *reg)
+{
+    for (periph *p : periphs)
+    {
+        if (((const uint8_t *) reg >= (uint8_t *) p->base) && ((const uint8_t *) reg < (uint8_t *) p->base + p->size))
+        {
+            return p;
+        }
+    }
+    fprintf(stderr, "sim: access to unknown register %p\n", reg);
+    abort();
+}
+
+
+/*
+ * Interrupts, in vector table order (lowest vector number first)
+ */
+struct vector
+{
+    const char *name;
+    void (*handler)(void);
+    bool (*pending)(void);
+};
+
+const vector vectors[] = {
+    {"RTC_CNT_vect", RTC_CNT_vect,
+        [] { return (sim_RTC.INTFLAGS.raw & sim_RTC.INTCTRL.raw & (RTC_OVF_bm | RTC_CMP_bm)) != 0; }},
+    {"RTC_PIT_vect", RTC_PIT_vect,
+        [] { return (sim_RTC.PITINTFLAGS.raw & sim_RTC.PITINTCTRL.raw & RTC_PI_bm) != 0; }},
+    {"ADC0_RESRDY_vect", ADC0_RESRDY_vect,
+        [] { return (sim_ADC0.INTFLAGS.raw & sim_ADC0.INTCTRL.raw & ADC_RESRDY_bm) != 0; }},
+    {"ADC0_SAMPRDY_vect", ADC0_SAMPRDY_vect,
+        [] { return (sim_ADC0.INTFLAGS.raw & sim_ADC0.INTCTRL.raw & (ADC_SAMPRDY_bm | ADC_WCMP_bm)) != 0; }},
+    {"USART1_DRE_vect", USART1_DRE_vect,
+        [] { return !usart.buffered && (sim_USART1.CTRLA.raw & USART_DREIE_bm); }},
+    {"USART1_TXC_vect", USART1_TXC_vect,
+        [] { return (sim_USART1.STATUS.raw & sim_USART1.CTRLA.raw & USART_TXCIF_bm) != 0; }},
+};
+
+bool any_pending(void)
+{
+    for (const vector &v : vectors)
+    {
+        if (v.pending())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*
+ * Time
+ */
+void account(uint64_t t)
+{
+    if (t <= accounted_ps)
+    {
+        return;
+    }
+    double dt = seconds(t - accounted_ps);
+    switch (state)
+    {
+        case CPU_ACTIVE: stats.t_active += dt; break;
+        case CPU_IDLE: stats.t_idle += dt; break;
+        case CPU_STANDBY: stats.t_standby += dt; break;
+        case CPU_POWER_DOWN: stats.t_power_down += dt; break;
+    }
+    for (periph *p : periphs)
+    {
+        p->account(dt);
+    }
+    accounted_ps = t;
+}
+
+uint64_t next_event(void)
+{
+    uint64_t t = SIM_NEVER;
+    for (periph *p : periphs)
+    {
+        uint64_t e = p->next_event();
+        t = (e < t) ? e : t;
+    }
+    return t;
+}
+
+bool dispatch(void);
+
+// Let the time run to target, processing the peripheral events on the way.
+// With take_irq, interrupts are taken at the event that makes them pending
+void run_until(uint64_t target, bool take_irq)
+{
+    for (;;)
+    {
+        uint64_t t = next_event();
+        if (t > target)
+        {
+            break;
+        }
+        if (t > end_ps)
+        {
+            account(end_ps);
+            now_ps = end_ps;
+            stop("end of simulated time");
+        }
+        if (t > now_ps)
+        {
+            account(t);
+            now_ps = t;
+        }
+        for (periph *p : periphs)
+        {
+            p->event();
+        }
+        if (take_irq)
+        {
+            dispatch();
+        }
+    }
+    if (target > end_ps)
+    {
+        account(end_ps);
+        now_ps = end_ps;
+        stop("end of simulated time");
+    }
+    if (target > now_ps)
+    {
+        account(target);
+        now_ps = target;
+    }
+}
+
+void cpu_cycles(double cycles, bool take_irq)
+{
+    run_until(now_ps + ps(cycles / clk_per()), take_irq);
+    if (take_irq)
+    {
+        dispatch();
+    }
+}
+
+// Take the pending interrupt with the lowest vector number, if interrupts are enabled
+bool dispatch(void)
+{
+    if (!sreg_i || in_isr)
+    {
+        return false;
+    }
+    for (const vector &v : vectors)
+    {
+        if (v.pending())
+        {
+            if (!v.handler)
+            {
+                sim_error("%s is enabled but the firmware has no ISR for it", v.name);
+                stop("interrupt without ISR");
+            }
+            in_isr = true;
+            sreg_i = false;
+            cpu_cycles(SIM_ISR_CYCLES / 2, false);
+            v.handler();
+            cpu_cycles(SIM_ISR_CYCLES / 2, false);
+            sreg_i = true;
+            in_isr = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+void set_state(cpu_state s)
+{
+    account(now_ps);
+    state = s;
+    for (periph *p : periphs)
+    {
+        p->state_changed();
+    }
+}
+
+} // namespace
+
+
+/*
+ * Interface for the stand-in headers
+ */
+uint32_t sim_bus_read(const void *reg, uint8_t size)
+{
+    periph *p = find_periph(reg);
+    cpu_cycles(SIM_ACCESS_CYCLES, true);
+    return p->read((const uint8_t *) reg - (uint8_t *) p->base, size);
+}
+
+void sim_bus_write(void *reg, uint32_t value, uint8_t size)
+{
+    periph *p = find_periph(reg);
+    cpu_cycles(SIM_ACCESS_CYCLES, true);
+    p->write((uint8_t *) reg - (uint8_t *) p->base, value, size);
+}
+
+void sim_sei(void)
+{
+    cpu_cycles(1, true);
+    sreg_i = true;                              // Taken at the next access, after one more instruction
+}
+
+void sim_cli(void)
+{
+    cpu_cycles(1, true);
+    sreg_i = false;
+}
+
+void sim_delay_cycles(double cycles)
+{
+    cpu_cycles(cycles, true);
+}
+
+void sim_sleep_cpu(void)
+{
+    cpu_cycles(1, true);
+    if (!(sim_SLPCTRL.CTRLA.raw & SLPCTRL_SEN_bm))
+    {
+        return;
+    }
+    if (in_isr)
+    {
+        sim_error("sleep_cpu() in an interrupt");
+        return;
+    }
+    if (dispatch())
+    {
+        return;                                 // Interrupt pending, the CPU wakes up at once
+    }
+    if (!sreg_i)
+    {
+        sim_error("sleep_cpu() with interrupts disabled, the CPU never wakes up");
+        stop("sleep with interrupts disabled");
+    }
+
+    switch (sim_SLPCTRL.CTRLA.raw & SLPCTRL_SMODE_gm)
+    {
+        case SLPCTRL_SMODE_IDLE_gc: set_state(CPU_IDLE); break;
+        case SLPCTRL_SMODE_STDBY_gc: set_state(CPU_STANDBY); break;
+        default: set_state(CPU_POWER_DOWN); break;
+    }
+    while (!any_pending())
+    {
+        if (next_event() == SIM_NEVER)
+        {
+            sim_error("sleep_cpu() with no wake-up source");
+            stop("sleep without wake-up source");
+        }
+        run_until(next_event(), false);
+    }
+    set_state(CPU_ACTIVE);
+    stats.wakeups++;
+    dispatch();
+}
+
+
+/*
+ * Simulator control
+ */
+double sim_signal::value(double t) const
+{
+    if (points.empty())
+    {
+        return 0.0;
+    }
+    if (t <= points.front().first)
+    {
+        return points.front().second;
+    }
+    for (size_t i = 1; i < points.size(); i++)
+    {
+        if (t < points[i].first)
+        {
+            const std::pair<double, double> &a = points[i - 1];
+            const std::pair<double, double> &b = points[i];
+            return a.second + (b.second - a.second) * (t - a.first) / (b.first - a.first);
+        }
+    }
+    return points.back().second;
+}
+
+bool sim_signal::load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    double t;
+    double v;
+
+    if (!f)
+    {
+        return false;
+    }
+    points.clear();
+    while (fgets(line, sizeof(line), f))
+    {
+        if ((line[0] != '#') && (sscanf(line, "%lf %lf", &t, &v) == 2))
+        {
+            add(t, v);
+        }
+    }
+    fclose(f);
+    return !points.empty();
+}
+
+void sim_init(const sim_config &config)
+{
+    cfg = config;
+    stats = sim_stats();
+    now_ps = accounted_ps = 0;
+    end_ps = (cfg.end_time > 0) ? ps(cfg.end_time) : SIM_NEVER - 1;
+    state = CPU_ACTIVE;
+    sreg_i = false;
+    in_isr = false;
+    rng.seed(cfg.seed);
+    gauss.reset();
+    uart_bytes.clear();
+    adc_results.clear();
+    flash_write_count = 0;
+    memset(flash_erases, 0, sizeof(flash_erases));
+    stop_reason = "";
+    pinconfig = 0;
+
+    for (periph *p : periphs)
+    {
+        p->reset();
+    }
+
+    memset(flash, 0xFF, sizeof(flash));
+    if (!cfg.flash_file.empty())
+    {
+        FILE *f = fopen(cfg.flash_file.c_str(), "rb");
+        if (f)
+        {
+            if (fread(flash, 1, sizeof(flash), f) != sizeof(flash))
+            {
+                fprintf(stderr, "sim: %s is not a 64 kB flash image\n", cfg.flash_file.c_str());
+            }
+            fclose(f);
+        }
+    }
+    nvm.sync_window();
+}
+
+double sim_time(void)
+{
+    return seconds(now_ps);
+}
+
+uint64_t sim_time_ps(void)
+{
+    return now_ps;
+}
+
+double sim_clk_per(void)
+{
+    return clk_per();
+}
+
+void sim_advance(double s)
+{
+    run_until(now_ps + ps(s), true);
+    dispatch();
+}
+
+int sim_run(int (*firmware_main)(void))
+{
+    try
+    {
+        firmware_main();
+        sim_error("main() returned");
+    }
+    catch (const sim_stop &)
+    {
+    }
+    sim_flash_save();
+    return (int) stats.errors;
+}
+
+void sim_finish(void)
+{
+    stop("finished");
+}
+
+const sim_stats &sim_get_stats(void)
+{
+    return stats;
+}
+
+void sim_print_stats(FILE *f)
+{
+    fprintf(f, "sim: stopped at %.6f s (%s)\n", sim_time(), stop_reason);
+    fprintf(f, "sim: CPU active %.6f s, idle %.6f s, standby %.6f s, power-down %.6f s\n",
+            stats.t_active, stats.t_idle, stats.t_standby, stats.t_power_down);
+    fprintf(f, "sim: ADC0 on %.6f s (PGA on %.6f s, converting %.6f s), DAC0 on %.6f s, USART1 on %.6f s, LED on %.6f s\n",
+            stats.t_adc_on, stats.t_pga_on, stats.t_adc_conv, stats.t_dac_on, stats.t_usart_on, stats.t_led_on);
+    fprintf(f, "sim: %ld wake-ups, %ld conversions (%ld samples), %ld bytes sent, %ld flash writes, %ld errors\n",
+            stats.wakeups, stats.conversions, stats.samples, stats.uart_bytes, stats.flash_writes, stats.errors);
+    fprintf(f, "sim: %ld bytes sent and %ld flash writes while ADC0 converts\n", stats.uart_bytes_converting,
+            stats.flash_writes_converting);
+}
+
+void sim_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    stats.errors++;
+    fprintf(stderr, "sim: %.6f s: ", sim_time());
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+const std::vector<sim_uart_byte> &sim_uart(void)
+{
+    return uart_bytes;
+}
+
+std::string sim_uart_text(void)
+{
+    std::string s;
+    for (const sim_uart_byte &b : uart_bytes)
+    {
+        s += (char) b.data;
+    }
+    return s;
+}
+
+void sim_uart_clear(void)
+{
+    uart_bytes.clear();
+}
+
+uint8_t *sim_flash(void)
+{
+    return flash;
+}
+
+const std::vector<sim_adc_result> &sim_adc_log(void)
+{
+    return adc_results;
+}
+
+long sim_flash_erases(uint32_t address)
+{
+    return (address < PROGMEM_SIZE) ? flash_erases[address / PROGMEM_PAGE_SIZE] : 0;
+}
+
+void sim_flash_save(void)
+{
+    if (cfg.flash_file.empty())
+    {
+        return;
+    }
+    FILE *f = fopen(cfg.flash_file.c_str(), "wb");
+    if (f)
+    {
+        fwrite(flash, 1, sizeof(flash), f);
+        fclose(f);
+    }
+}
+
+double sim_board_voltage(int muxpos, int muxneg)
+{
+    return mux_voltage(muxpos, now_ps) - mux_voltage(muxneg, now_ps);
+}
+
+double sim_rtd_ohm(double temp_c)
+{
+    return rtd_ohm(temp_c);
+}
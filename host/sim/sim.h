@@ -0,0 +1,147 @@
+/*
+ * AVR64EA48 peripheral simulator for the host builds of the examples
+ *
+ * The firmware (main.c, compiled as C++ against host/include) runs as
+ * ordinary host code. Its register accesses go to the peripheral models
+ * in sim.cpp, which keep a simulated time:
+ *
+ * - Each register access takes SIM_ACCESS_CYCLES CPU cycles, interrupts
+ *   are taken between accesses. Other CPU work takes no time, so phase
+ *   times that are spent computing are too short (see host/README.md)
+ * - sleep_cpu() lets the time run until an enabled interrupt is pending,
+ *   and the peripherals only run in the sleep modes they support
+ * - ADC0 conversion times follow the t_conv formulas of the data sheet,
+ *   the results come from the analog board model below, with Gaussian
+ *   noise, an offset that sign chopping removes and one that it does not
+ * - DAC0 and the PGA settle exponentially after they are enabled
+ *
+ * Time is counted in picoseconds.
+ */
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SIM_ACCESS_CYCLES 2                     // CPU cycles of one register access
+#define SIM_ISR_CYCLES 20                       // CPU cycles to enter and leave an interrupt
+#define SIM_PS_PER_S 1000000000000ULL
+#define SIM_NEVER UINT64_MAX
+
+// Piecewise linear value over time, from "<seconds> <value>" points
+struct sim_signal
+{
+    std::vector<std::pair<double, double> > points;
+
+    double value(double t) const;
+    bool empty() const { return points.empty(); }
+    void set(double v) { points.assign(1, std::make_pair(0.0, v)); }
+    void add(double t, double v) { points.push_back(std::make_pair(t, v)); }
+    bool load(const char *path);
+};
+
+enum sim_board
+{
+    SIM_BOARD_CURRENT,                          // analog-current-sensing: DAC0 - R1 - AIN1 - R_SENSE - AIN0 - R2 - GND,
+                                                // and DAC0 - 1.8k - AIN2 - RTD - AIN3/GND for MULTI_CHANNEL
+    SIM_BOARD_RTD,                              // analog-voltage-sensing: DAC0 - 1.8k - AIN0 - RTD - GND, AIN1 = GND
+};
+
+struct sim_config
+{
+    sim_board board = SIM_BOARD_CURRENT;
+    double end_time = 60.0;                     // Simulated seconds, the run stops when they are used
+    double vdd = 3.3;
+    double noise_lsb = 0.5;                     // RMS noise of one ADC0 sample, in 12-bit LSB at the ADC
+    double offset_lsb = 3.0;                    // ADC0 offset in LSB, cancelled by sign chopping
+    double residual_lsb = 0.3;                  // ADC0 offset in LSB that sign chopping does not cancel
+    uint32_t seed = 1;
+    double dac_tau_us = 1.0;                    // DAC0 output and resistor network time constant
+    double pga_tau_us = 3.0;                    // PGA settling time constant after it is enabled or changed
+    double pga_error_v = 0.002;                 // Input-referred PGA error right after it is enabled
+    double r1 = 100e3;                          // SIM_BOARD_CURRENT resistor chain
+    double r_sense = 10e3;
+    double r2 = 100e3;
+    double rtd_fixed = 1800.0;                  // Resistor from DAC0OUT to the RTD
+    double rtd_r0 = 100.0;                      // RTD resistance at 0 C
+    sim_signal current_na;                      // If set: current through R_SENSE from a current source, in nA
+    sim_signal temp_c;                          // RTD temperature in C (default 25)
+    sim_signal sw0;                             // SW0 (PB2) pressed when > 0.5
+    FILE *uart_out = nullptr;                   // USART1 TX bytes are written here as they are sent
+    FILE *uart_times = nullptr;                 // "<seconds> <byte>" for each byte sent
+    std::string flash_file;                     // Flash contents are loaded from and saved to this file
+    long power_fail_write = 0;                  // Stop (power loss) during this flash page write, 1 = first
+    bool adc_log = false;                       // Keep the time and RESULT of each conversion (sim_adc_log)
+};
+
+struct sim_stats
+{
+    double t_active = 0;                        // CPU state times in seconds
+    double t_idle = 0;
+    double t_standby = 0;
+    double t_power_down = 0;
+    double t_adc_on = 0;                        // ADC0 enabled
+    double t_adc_conv = 0;                      // ADC0 converting
+    double t_dac_on = 0;                        // DAC0 output enabled and running
+    double t_pga_on = 0;                        // ADC0 enabled with the PGA on
+    double t_usart_on = 0;                      // USART1 TX enabled
+    double t_led_on = 0;
+    long wakeups = 0;
+    long conversions = 0;                       // Completed ADC0 conversions (bursts count once)
+    long samples = 0;                           // ADC0 samples
+    long uart_bytes = 0;
+    long flash_writes = 0;
+    long uart_bytes_converting = 0;             // Bytes on the TX line while ADC0 converts
+    long flash_writes_converting = 0;           // Flash page writes while ADC0 converts
+    long errors = 0;                            // Things the device would not do as the firmware expects
+};
+
+struct sim_stop                                 // Thrown when the run ends
+{
+    const char *reason;
+};
+
+// Simulator control
+void sim_init(const sim_config &config);
+double sim_time(void);                          // Simulated time in seconds
+uint64_t sim_time_ps(void);
+void sim_advance(double seconds);               // CPU busy for this time, interrupts are taken
+int sim_run(int (*firmware_main)(void));        // Run until the end time (or power fail), returns errors
+void sim_finish(void);                          // End the run now, for test code run by sim_run()
+const sim_stats &sim_get_stats(void);
+void sim_print_stats(FILE *f);
+void sim_error(const char *fmt, ...);           // Count and report a simulator error
+double sim_clk_per(void);                       // Current CLK_PER in Hz
+
+// USART1 output
+struct sim_uart_byte
+{
+    uint64_t time_ps;                           // End of the stop bit
+    uint8_t data;
+};
+const std::vector<sim_uart_byte> &sim_uart(void);
+std::string sim_uart_text(void);
+void sim_uart_clear(void);
+
+// ADC0 conversions, with sim_config::adc_log
+struct sim_adc_result
+{
+    uint64_t time_ps;                           // End of the conversion
+    int32_t result;                             // RESULT, signed in differential mode
+    int gain;                                   // PGA gain, 1 without the PGA
+};
+const std::vector<sim_adc_result> &sim_adc_log(void);
+
+// Flash
+uint8_t *sim_flash(void);                       // 64 kB flash image
+long sim_flash_erases(uint32_t address);        // Erase/writes of the page at this flash address since sim_init()
+void sim_flash_save(void);
+
+// Analog board, for tests: differential voltage AIN1 - AIN0 that the board applies now
+double sim_board_voltage(int muxpos, int muxneg);
+double sim_rtd_ohm(double temp_c);              // Callendar-Van Dusen, IEC 60751
+
+#endif
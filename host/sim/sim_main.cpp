@@ -0,0 +1,181 @@
+/*
+ * Command line runner for a host build of an example
+ *
+ * Runs the firmware for the given simulated time. USART1 output goes to
+ * stdout (or --out), statistics and simulator errors to stderr.
+ * The exit code is 1 if the simulator found an error, else 0
+ */
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int firmware_main(void);
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --time S              simulated time in seconds (default 60)\n"
+            "  --board current|rtd   analog board (default current)\n"
+            "  --current-na N        current source through R_SENSE in nA, instead of the DAC0 circuit\n"
+            "  --current-file F      same, piecewise linear from \"<seconds> <nA>\" lines\n"
+            "  --temp-c T            RTD temperature (default 25)\n"
+            "  --temp-file F         same, piecewise linear from \"<seconds> <C>\" lines\n"
+            "  --sw0 T0:T1           SW0 pressed from T0 to T1 seconds\n"
+            "  --noise L             ADC0 noise in LSB rms (default 0.5)\n"
+            "  --offset L            ADC0 offset in LSB, removed by chopping (default 3)\n"
+            "  --residual L          ADC0 offset in LSB, not removed by chopping (default 0.3)\n"
+            "  --seed N              noise seed\n"
+            "  --dac-tau US          DAC0 settling time constant (default 1)\n"
+            "  --pga-tau US          PGA settling time constant (default 3)\n"
+            "  --pga-error MV        PGA error right after it is enabled (default 2)\n"
+            "  --flash F             load and save the flash image\n"
+            "  --power-fail N        stop (power loss) during flash page write N\n"
+            "  --out F               write USART1 output to F instead of stdout\n"
+            "  --uart-times F        write \"<seconds> <byte>\" for each byte sent\n"
+            "  --stats               print time and activity statistics\n"
+            "  --help                show this\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    sim_config cfg;
+    bool print_stats = false;
+    double t0;
+    double t1;
+
+    cfg.uart_out = stdout;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i];
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+        if (!strcmp(opt, "--stats"))
+        {
+            print_stats = true;
+            continue;
+        }
+        if (!strcmp(opt, "--help") || !arg)
+        {
+            usage(argv[0]);
+        }
+        i++;
+        if (!strcmp(opt, "--time"))
+        {
+            cfg.end_time = atof(arg);
+        }
+        else if (!strcmp(opt, "--board"))
+        {
+            cfg.board = strcmp(arg, "rtd") ? SIM_BOARD_CURRENT : SIM_BOARD_RTD;
+        }
+        else if (!strcmp(opt, "--current-na"))
+        {
+            cfg.current_na.set(atof(arg));
+        }
+        else if (!strcmp(opt, "--current-file"))
+        {
+            if (!cfg.current_na.load(arg))
+            {
+                fprintf(stderr, "%s: can not read %s\n", argv[0], arg);
+                return 2;
+            }
+        }
+        else if (!strcmp(opt, "--temp-c"))
+        {
+            cfg.temp_c.set(atof(arg));
+        }
+        else if (!strcmp(opt, "--temp-file"))
+        {
+            if (!cfg.temp_c.load(arg))
+            {
+                fprintf(stderr, "%s: can not read %s\n", argv[0], arg);
+                return 2;
+            }
+        }
+        else if (!strcmp(opt, "--sw0") && (sscanf(arg, "%lf:%lf", &t0, &t1) == 2))
+        {
+            if (cfg.sw0.empty())
+            {
+                cfg.sw0.add(0, 0);
+            }
+            cfg.sw0.add(t0, 0);
+            cfg.sw0.add(t0, 1);
+            cfg.sw0.add(t1, 1);
+            cfg.sw0.add(t1, 0);
+        }
+        else if (!strcmp(opt, "--noise"))
+        {
+            cfg.noise_lsb = atof(arg);
+        }
+        else if (!strcmp(opt, "--offset"))
+        {
+            cfg.offset_lsb = atof(arg);
+        }
+        else if (!strcmp(opt, "--residual"))
+        {
+            cfg.residual_lsb = atof(arg);
+        }
+        else if (!strcmp(opt, "--seed"))
+        {
+            cfg.seed = strtoul(arg, nullptr, 0);
+        }
+        else if (!strcmp(opt, "--dac-tau"))
+        {
+            cfg.dac_tau_us = atof(arg);
+        }
+        else if (!strcmp(opt, "--pga-tau"))
+        {
+            cfg.pga_tau_us = atof(arg);
+        }
+        else if (!strcmp(opt, "--pga-error"))
+        {
+            cfg.pga_error_v = atof(arg) * 1e-3;
+        }
+        else if (!strcmp(opt, "--flash"))
+        {
+            cfg.flash_file = arg;
+        }
+        else if (!strcmp(opt, "--power-fail"))
+        {
+            cfg.power_fail_write = atol(arg);
+        }
+        else if (!strcmp(opt, "--out"))
+        {
+            cfg.uart_out = fopen(arg, "wb");
+            if (!cfg.uart_out)
+            {
+                fprintf(stderr, "%s: can not write %s\n", argv[0], arg);
+                return 2;
+            }
+        }
+        else if (!strcmp(opt, "--uart-times"))
+        {
+            cfg.uart_times = fopen(arg, "w");
+            if (!cfg.uart_times)
+            {
+                fprintf(stderr, "%s: can not write %s\n", argv[0], arg);
+                return 2;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    fflush(cfg.uart_out);
+    if (cfg.uart_times)
+    {
+        fclose(cfg.uart_times);
+    }
+    if (print_stats || errors)
+    {
+        sim_print_stats(stderr);
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * ADAPTIVE_INTERVAL of analog-current-sensing on the simulator, replaying
+ * a current trace: stable, a step, stable, a ramp, stable. The measurement
+ * times come from the ADC0 conversion log, and each segment is compared
+ * with measurements every WAKEUP_TIME from the same first measurement:
+ * - fewer than half the wake-ups of WAKEUP_TIME over the trace, and not
+ *   more than ADAPT_MAX_TIME between two measurements
+ * - the step is measured within ADAPT_MAX_TIME (WAKEUP_TIME when fixed),
+ *   and the interval after it is ADAPT_MIN_TIME
+ * - the worst-case tracking error on the ramp is below that of
+ *   WAKEUP_TIME, and over the trace it is not above that of WAKEUP_TIME
+ *   plus the change of the signal in ADAPT_MAX_TIME (the step)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+#include "tracking.h"
+
+#include <algorithm>
+
+#define STEP_T 600.5
+#define RAMP_T 800.5
+#define RAMP_S 100.0
+#define END_T 3600.0
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = END_T;
+    cfg.adc_log = true;
+    cfg.current_na.add(0, 5000);
+    cfg.current_na.add(STEP_T, 5000);
+    cfg.current_na.add(STEP_T + 0.001, 8000);                  // Step of 3 uA
+    cfg.current_na.add(RAMP_T, 8000);
+    cfg.current_na.add(RAMP_T + RAMP_S, 3000);                 // Ramp of -50 nA/s
+    cfg.current_na.add(END_T, 3000);
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    // Conversions of the start-up calibration come before the first PIT interrupt
+    std::vector<double> adaptive = tracking_measurements(0.5, 0.1);
+    CHECK(!adaptive.empty(), "no measurements");
+    if (adaptive.empty())
+    {
+        return TEST_RESULT();
+    }
+    std::vector<double> fixed = tracking_fixed(adaptive[0], WAKEUP_TIME, END_T);
+
+    const struct
+    {
+        const char *name;
+        double from;
+        double to;
+    } segments[] =
+    {
+        {"stable", 0, STEP_T},
+        {"step", STEP_T, RAMP_T},
+        {"ramp", RAMP_T, RAMP_T + RAMP_S},
+        {"stable", RAMP_T + RAMP_S, END_T},
+        {"all", 0, END_T},
+    };
+    double worst_adaptive[5];
+    double worst_fixed[5];
+
+    printf("segment        time      wake-ups            worst error\n");
+    printf("                         adaptive  fixed     adaptive  fixed\n");
+    for (int i = 0; i < 5; i++)
+    {
+        worst_adaptive[i] = tracking_worst(cfg.current_na, adaptive, segments[i].from, segments[i].to);
+        worst_fixed[i] = tracking_worst(cfg.current_na, fixed, segments[i].from, segments[i].to);
+        printf("%-8s %6.1f-%6.1f s  %5ld     %5ld     %5.0f nA  %5.0f nA\n", segments[i].name, segments[i].from,
+               segments[i].to, tracking_count(adaptive, segments[i].from, segments[i].to),
+               tracking_count(fixed, segments[i].from, segments[i].to), worst_adaptive[i], worst_fixed[i]);
+    }
+
+    long n_adaptive = tracking_count(adaptive, 0, END_T);
+    long n_fixed = tracking_count(fixed, 0, END_T);
+    CHECK(2 * n_adaptive < n_fixed, "%ld wake-ups, %ld with WAKEUP_TIME", n_adaptive, n_fixed);
+    double longest = 0;
+    double step_delay = 0;
+    double after_step = 0;
+    for (size_t i = 1; i < adaptive.size(); i++)
+    {
+        double interval = adaptive[i] - adaptive[i - 1];
+
+        longest = (interval > longest) ? interval : longest;
+        if ((adaptive[i] > STEP_T) && (step_delay == 0))
+        {
+            step_delay = adaptive[i] - STEP_T;
+        }
+        if ((adaptive[i - 1] > STEP_T) && (after_step == 0))
+        {
+            after_step = interval;
+        }
+    }
+    printf("step measured after %.1f s, %.1f s with WAKEUP_TIME\n", step_delay,
+           *std::upper_bound(fixed.begin(), fixed.end(), STEP_T) - STEP_T);
+    CHECK(longest < ADAPT_MAX_TIME + 1.5, "%.1f s between two measurements", longest);
+    CHECK(step_delay < ADAPT_MAX_TIME + 1.5, "step measured after %.1f s", step_delay);
+    CHECK(fabs(after_step - ADAPT_MIN_TIME) < 0.5, "%.1f s after the step was measured", after_step);
+    CHECK(worst_adaptive[2] < worst_fixed[2], "ramp: worst error %.0f nA, %.0f nA with WAKEUP_TIME",
+          worst_adaptive[2], worst_fixed[2]);
+    CHECK(worst_adaptive[4] <= worst_fixed[4] + 3000, "worst error %.0f nA, %.0f nA with WAKEUP_TIME",
+          worst_adaptive[4], worst_fixed[4]);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,115 @@
+/*
+ * ADAPTIVE_INTERVAL of analog-voltage-sensing on the simulator, replaying
+ * an RTD temperature trace: stable, a step, stable, a ramp, stable. The
+ * measurement times come from the ADC0 conversion log, and each segment
+ * is compared with measurements every 0.5 s, the fixed PIT period:
+ * - fewer than a tenth of the wake-ups of the fixed period over the
+ *   trace, and not more than 32 s (ADAPT_MAX_PERIOD) between two
+ * - the step is measured within 32 s, and the interval after it is 0.5 s
+ * - the worst-case tracking error on the ramp is not above that of the
+ *   fixed period plus the ramp in 32 s: the ramp may start in the longest
+ *   interval. Over the trace it is not above that of the fixed period
+ *   plus the change of the signal in 32 s (the step)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+#include "tracking.h"
+
+#include <algorithm>
+
+#define STEP_T 300.25
+#define RAMP_T 400.25
+#define RAMP_S 100.0
+#define RAMP_C_PER_S 0.1
+#define END_T 1800.0
+#define FIXED_S 0.5                                             // RTC_PERIOD_CYC512_gc on the 1.024 kHz clock
+#define LONGEST_S 32.0                                          // ADAPT_MAX_PERIOD
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.board = SIM_BOARD_RTD;
+    cfg.end_time = END_T;
+    cfg.adc_log = true;
+    cfg.temp_c.add(0, 25);
+    cfg.temp_c.add(STEP_T, 25);
+    cfg.temp_c.add(STEP_T + 0.001, 35);                        // Step of 10 C
+    cfg.temp_c.add(RAMP_T, 35);
+    cfg.temp_c.add(RAMP_T + RAMP_S, 35 - RAMP_C_PER_S * RAMP_S);
+    cfg.temp_c.add(END_T, 35 - RAMP_C_PER_S * RAMP_S);
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    std::vector<double> adaptive = tracking_measurements(0, 0.1);
+    CHECK(!adaptive.empty(), "no measurements");
+    if (adaptive.empty())
+    {
+        return TEST_RESULT();
+    }
+    std::vector<double> fixed = tracking_fixed(adaptive[0], FIXED_S, END_T);
+
+    const struct
+    {
+        const char *name;
+        double from;
+        double to;
+    } segments[] =
+    {
+        {"stable", 0, STEP_T},
+        {"step", STEP_T, RAMP_T},
+        {"ramp", RAMP_T, RAMP_T + RAMP_S},
+        {"stable", RAMP_T + RAMP_S, END_T},
+        {"all", 0, END_T},
+    };
+    double worst_adaptive[5];
+    double worst_fixed[5];
+
+    printf("segment        time      wake-ups            worst error\n");
+    printf("                         adaptive  fixed     adaptive  fixed\n");
+    for (int i = 0; i < 5; i++)
+    {
+        worst_adaptive[i] = tracking_worst(cfg.temp_c, adaptive, segments[i].from, segments[i].to);
+        worst_fixed[i] = tracking_worst(cfg.temp_c, fixed, segments[i].from, segments[i].to);
+        printf("%-8s %6.1f-%6.1f s  %5ld     %5ld     %5.2f C   %5.2f C\n", segments[i].name, segments[i].from,
+               segments[i].to, tracking_count(adaptive, segments[i].from, segments[i].to),
+               tracking_count(fixed, segments[i].from, segments[i].to), worst_adaptive[i], worst_fixed[i]);
+    }
+
+    long n_adaptive = tracking_count(adaptive, 0, END_T);
+    long n_fixed = tracking_count(fixed, 0, END_T);
+    CHECK(10 * n_adaptive < n_fixed, "%ld wake-ups, %ld with the fixed period", n_adaptive, n_fixed);
+    double longest = 0;
+    double step_delay = 0;
+    double after_step = 0;
+    for (size_t i = 1; i < adaptive.size(); i++)
+    {
+        double interval = adaptive[i] - adaptive[i - 1];
+
+        longest = (interval > longest) ? interval : longest;
+        if ((adaptive[i] > STEP_T) && (step_delay == 0))
+        {
+            step_delay = adaptive[i] - STEP_T;
+        }
+        if ((adaptive[i - 1] > STEP_T) && (after_step == 0))
+        {
+            after_step = interval;
+        }
+    }
+    printf("step measured after %.1f s, %.1f s with the fixed period\n", step_delay,
+           *std::upper_bound(fixed.begin(), fixed.end(), STEP_T) - STEP_T);
+    CHECK(longest < LONGEST_S + 0.1, "%.1f s between two measurements", longest);
+    CHECK(step_delay < LONGEST_S + 0.1, "step measured after %.1f s", step_delay);
+    CHECK(fabs(after_step - FIXED_S) < 0.05, "%.2f s after the step was measured", after_step);
+    CHECK(worst_adaptive[2] <= worst_fixed[2] + RAMP_C_PER_S * (LONGEST_S - FIXED_S), "ramp: worst error %.2f C, %.2f C with the fixed period",
+          worst_adaptive[2], worst_fixed[2]);
+    CHECK(worst_adaptive[4] <= worst_fixed[4] + 10, "worst error %.2f C, %.2f C with the fixed period",
+          worst_adaptive[4], worst_fixed[4]);
+
+    return TEST_RESULT();
+}
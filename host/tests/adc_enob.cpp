@@ -0,0 +1,111 @@
+/*
+ * Oversampling benchmark of analog-current-sensing on the simulator: for
+ * each ADC0 SAMPNUM setting from 1 to 1024 samples, a series of bursts on
+ * a constant input with the simulator noise (0.5 LSB rms per sample).
+ * Prints the effective number of bits (ENOB), the burst time and the
+ * charge per result, and checks the ENOB against the value expected from
+ * the noise, the number of samples and the scaling of adc0_wait_result().
+ *
+ * ENOB = log2(full scale / (sqrt(12) * noise)), where the full scale is
+ * the differential range of the scaled result (2 * 2048 * scale samples)
+ * and the noise is the rms noise of the results. The expected noise of a
+ * sample is the simulator noise plus the 12-bit rounding (1/12 LSB^2), and
+ * a result scaled down by adc0_wait_result() adds its own rounding. The
+ * charge assumes AWAKE_MA for the whole burst
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+#define NOISE_LSB 0.5
+#define AWAKE_MA 3.5                // Supply current with CPU, ADC0, PGA and DAC0 on (README, Conclusion)
+
+static double enob(double full_scale, double noise)
+{
+    return log2(full_scale / (sqrt(12.0) * noise));
+}
+
+// Expected rms noise of a result of n samples, scaled to scale samples
+static double expected_noise(int n, int scale)
+{
+    double sample = sqrt(NOISE_LSB * NOISE_LSB + 1.0 / 12.0);
+    double result = sample * sqrt((double) n) * scale / n;
+
+    return (n > scale) ? sqrt(result * result + 1.0 / 12.0) : result;
+}
+
+static int test_main(void)
+{
+    init_clock();
+    init_PORT();
+    init_VREF();
+    init_DAC0();
+    init_ADC0();
+    measure_offset_bias();                                  // Leaves the measurement inputs selected
+    set_DAC0_output();
+    DAC0.CTRLA = DAC_CTRLA_ON;
+    ADC0.CTRLA = ADC_CTRLA_ON;
+    _delay_us(1000);
+
+    double last_enob = 0;
+    double mean16 = 0;
+    printf("samples  scale  ENOB  expected  burst time  charge/result\n");
+    for (uint8_t sampnum = ADC_SAMPNUM_NONE_gc; sampnum <= ADC_SAMPNUM_ACC1024_gc; sampnum++)
+    {
+        const int samples = 1 << sampnum;
+        const int scale = (samples > 32) ? 32 : samples;
+        const int bursts = (samples >= 256) ? 60 : 200;
+        double sum = 0;
+        double sum2 = 0;
+
+        ADC0.CTRLF = ((samples > 1) ? ADC_CHOPPING_bm : 0) | sampnum;
+        while (ADC0.STATUS > 0)
+            ;
+        double t0 = sim_time();
+        for (int i = 0; i < bursts; i++)
+        {
+            adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+            int32_t result = adc0_wait_result();
+            sum += result;
+            sum2 += (double) result * result;
+        }
+        double t_burst = (sim_time() - t0) / bursts;
+        double mean = sum / bursts;
+        double sigma = sqrt(fmax(sum2 / bursts - mean * mean, 0.0));
+        double full_scale = 2.0 * 2048.0 * scale;
+        double measured = enob(full_scale, sigma);
+        double expected = enob(full_scale, expected_noise(samples, scale));
+
+        printf("%7d  %5d  %4.1f  %8.1f  %7.3f ms  %8.3f uA*s\n", samples, scale, measured, expected, t_burst * 1e3,
+               t_burst * AWAKE_MA * 1e3);
+        CHECK(fabs(measured - expected) < 0.4, "%d samples: ENOB %.2f, expected %.2f", samples, measured, expected);
+        CHECK(measured > last_enob - 0.2, "%d samples: ENOB %.2f, less than %.2f", samples, measured, last_enob);
+        last_enob = measured;
+        mean16 = (samples == 16) ? mean : mean16;
+        if (samples > 32)
+        {
+            CHECK(fabs(mean / mean16 - 2.0) < 0.01, "%d samples: mean %.1f, not scaled to 32 samples (16: %.1f)",
+                  samples, mean, mean16);
+        }
+    }
+
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.noise_lsb = NOISE_LSB;
+    cfg.end_time = 100.0;
+    sim_init(cfg);
+    int errors = sim_run(test_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    return TEST_RESULT();
+}
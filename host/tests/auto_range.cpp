@@ -0,0 +1,152 @@
+/*
+ * AUTO_RANGE of analog-current-sensing on the simulator: the current
+ * sweeps up from SWEEP_LOW_NA through all gains to SWEEP_HIGH_NA and back
+ * down, exponentially, once in an hour. The gain of each measurement and
+ * its extra bursts come from the ADC0 conversion log, the results from the
+ * measurement frames:
+ * - the gain goes through all five levels up and down, with one extra
+ *   burst for each of the 4 steps down on the way up and none on the way
+ *   down (the README figure)
+ * - the scaled results are continuous across each gain change: the error
+ *   against the current changes by less than one ADC0 LSB at the lower
+ *   gain. The noise of the two results and of their offset and bias
+ *   calibrations is about 0.25 LSB RMS, a wrong scale would be 50% or more
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "frames.h"
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+#define START_T 0.5                                             // After the calibration of all gains
+#define SWEEP_LOW_NA 2000.0                                     // 16x, below RANGE_LOW_PCT at 8x
+#define SWEEP_HIGH_NA 200000.0                                  // PGA off, above RANGE_HIGH_PCT at 2x
+#define TOP_T 1800.5
+#define END_T 3600.5
+#define SWEEP_POINTS 360                                        // Linear pieces of each half
+
+// Current of one ADC0 LSB (one sample) at gain 1
+#define LSB_NA (ADC_REF * 1e9 / (2048.0 * R_SENSE))
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = END_T;
+    cfg.adc_log = true;
+    // The bias of each gain is measured at start-up with the current, so it is 0 until then
+    cfg.current_na.add(0, 0);
+    cfg.current_na.add(START_T - 0.001, 0);
+    for (int i = 0; i <= 2 * SWEEP_POINTS; i++)
+    {
+        int up = (i <= SWEEP_POINTS) ? i : 2 * SWEEP_POINTS - i;
+
+        cfg.current_na.add(START_T + (END_T - START_T) * i / (2 * SWEEP_POINTS),
+                           SWEEP_LOW_NA * pow(SWEEP_HIGH_NA / SWEEP_LOW_NA, (double) up / SWEEP_POINTS));
+    }
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    std::vector<double> results_ua;
+    frame_decoder decoder([&](const uint8_t *p, size_t, const frame_calibration &cal) {
+        if ((p[0] == FRAME_TYPE_MEASUREMENT) && cal.valid)
+        {
+            results_ua.push_back(cal.microamp(frame_i24(p + 2)));
+        }
+    });
+    for (const sim_uart_byte &b : sim_uart())
+    {
+        decoder.feed(&b.data, 1);
+    }
+
+    // Conversions of one measurement, the last one gives the result
+    struct measurement
+    {
+        double time;
+        int gain;
+        int bursts;
+    };
+    std::vector<measurement> measurements;
+    for (const sim_adc_result &r : sim_adc_log())
+    {
+        double t = r.time_ps * 1e-12;
+
+        if (t < START_T)
+        {
+            continue;
+        }
+        if (!measurements.empty() && (t - measurements.back().time < 0.1))
+        {
+            measurements.back().time = t;
+            measurements.back().gain = r.gain;
+            measurements.back().bursts++;
+        }
+        else
+        {
+            measurements.push_back({t, r.gain, 1});
+        }
+    }
+    CHECK(results_ua.size() == measurements.size(), "%zu results, %zu measurements", results_ua.size(),
+          measurements.size());
+    if (results_ua.size() != measurements.size())
+    {
+        return TEST_RESULT();
+    }
+
+    long extra_up = 0;
+    long extra_down = 0;
+    int changes_up = 0;
+    int changes_down = 0;
+    int lowest = 16;
+    for (size_t i = 0; i < measurements.size(); i++)
+    {
+        const measurement &m = measurements[i];
+        double error_na = results_ua[i] * 1e3 - cfg.current_na.value(m.time);
+
+        lowest = (m.gain < lowest) ? m.gain : lowest;
+        if (m.time < TOP_T)
+        {
+            extra_up += m.bursts - 1;
+        }
+        else
+        {
+            extra_down += m.bursts - 1;
+        }
+        if ((i == 0) || (m.gain == measurements[i - 1].gain))
+        {
+            continue;
+        }
+
+        double before_na = results_ua[i - 1] * 1e3 - cfg.current_na.value(measurements[i - 1].time);
+        int lower = (m.gain < measurements[i - 1].gain) ? m.gain : measurements[i - 1].gain;
+        double bound_na = LSB_NA / lower;
+        printf("%7.1f s: gain %2d --> %2d at %6.1f uA, %d bursts, error %+6.1f --> %+6.1f nA (%.1f nA)\n", m.time,
+               measurements[i - 1].gain, m.gain, results_ua[i], m.bursts, before_na, error_na, bound_na);
+        CHECK(fabs(error_na - before_na) <= bound_na, "%.1f s: error %+.1f nA at gain %d, %+.1f nA at gain %d",
+              m.time, error_na, m.gain, before_na, measurements[i - 1].gain);
+        if (m.time < TOP_T)
+        {
+            changes_up++;
+        }
+        else
+        {
+            changes_down++;
+        }
+    }
+
+    long n = (long) measurements.size();
+    printf("%ld measurements in %.0f s: %ld extra bursts up, %ld down, %.2f%%\n", n, END_T - START_T, extra_up,
+           extra_down, 100.0 * (extra_up + extra_down) / n);
+    CHECK(lowest == 1, "lowest gain %d", lowest);
+    CHECK((changes_up == RANGE_LEVELS - 1) && (changes_down == RANGE_LEVELS - 1), "%d gain changes up, %d down",
+          changes_up, changes_down);
+    CHECK((extra_up == RANGE_LEVELS - 1) && (extra_down == 0), "%ld extra bursts up, %ld down", extra_up,
+          extra_down);
+
+    return TEST_RESULT();
+}
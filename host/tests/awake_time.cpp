@@ -0,0 +1,40 @@
+/*
+ * CPU awake time per ADC0 conversion with and without ADC_SLEEP, built for
+ * each example and setting (AWAKE_BOARD, AWAKE_ADC_SLEEP). Polling keeps
+ * the CPU active for the whole conversion, with ADC_SLEEP the CPU is in
+ * standby for it. Only register accesses take CPU time in the simulator,
+ * so the active times are those of the polling loops and the peripheral
+ * set-up, not of the calculations (see README)
+ */
+#include "sim.h"
+#include "test.h"
+
+int firmware_main(void);
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.board = AWAKE_BOARD;
+    cfg.end_time = 600.0;
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    const sim_stats &s = sim_get_stats();
+    double n = s.conversions;
+
+    printf("%ld conversions in %.0f s, per conversion: converting %.1f us, CPU active %.1f us, "
+           "idle %.1f us, standby %.1f us\n", s.conversions, cfg.end_time, s.t_adc_conv / n * 1e6,
+           s.t_active / n * 1e6, s.t_idle / n * 1e6, s.t_standby / n * 1e6);
+
+    CHECK(errors == 0, "%d simulator errors", errors);
+    CHECK(s.conversions > 0, "no conversions");
+    // The conversions are the only thing that runs in standby. The remaining
+    // active time is mostly the USART1 queue and its interrupts (idle sleep)
+#if AWAKE_ADC_SLEEP
+    CHECK(s.t_standby > 0.95 * s.t_adc_conv, "standby %.6f s, converting %.6f s", s.t_standby, s.t_adc_conv);
+#else
+    CHECK(s.t_standby == 0, "standby %.6f s without ADC_SLEEP", s.t_standby);
+    CHECK(s.t_active > s.t_adc_conv, "CPU active %.6f s, converting %.6f s", s.t_active, s.t_adc_conv);
+#endif
+    return TEST_RESULT();
+}
@@ -0,0 +1,230 @@
+/*
+ * BATCH_OUTPUT of analog-current-sensing on the simulator, 13 hours at
+ * 5 uA with one result below BATCH_LOW_NA and one above BATCH_HIGH_NA in
+ * the first hour. The USART1 output is split into bursts at pauses, and
+ * the records of each burst are read back (ASCII lines or batch frames):
+ * - the records sent and the ones still in batch_buffer are all the
+ *   measurements, every WAKEUP_TIME seconds without a gap or a repeat
+ * - each batch was sent for a reason: it is full, its last result is out
+ *   of range, or its oldest result is BATCH_MAX_LATENCY seconds old
+ * - with BATCH_SIZE * WAKEUP_TIME above BATCH_MAX_LATENCY the latency
+ *   trigger is used, else the full buffer, and both out-of-range results
+ *   are sent at once
+ * Built without BATCH_OUTPUT, each burst must be one measurement. Bytes,
+ * USART1 on-time and bursts per hour are measured from hour 3 to 13 (the
+ * README table)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "frames.h"
+#include "sim.h"
+#include "test.h"
+#include "tracking.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOW_T 600.5                                             // Result below BATCH_LOW_NA
+#define HIGH_T 1200.5                                           // Result above BATCH_HIGH_NA
+#define TABLE_FROM 3 * 3600.0
+#define END_T 13 * 3600.0
+#define PAUSE_S 0.5                                             // Pause between two bursts
+#define BYTE_S (10.0 / BAUD_RATE)
+
+struct burst
+{
+    double start;                                               // Start of the first byte
+    double end;                                                 // End of the last byte
+    std::vector<uint8_t> bytes;
+};
+
+struct record
+{
+    long time;
+    double current_ua;
+};
+
+static std::vector<burst> split_bursts(void)
+{
+    std::vector<burst> bursts;
+
+    for (const sim_uart_byte &b : sim_uart())
+    {
+        double t = b.time_ps * 1e-12;
+
+        if (bursts.empty() || (t - BYTE_S - bursts.back().end > PAUSE_S))
+        {
+            bursts.push_back({t - BYTE_S, t, {}});
+        }
+        bursts.back().end = t;
+        bursts.back().bytes.push_back(b.data);
+    }
+    return bursts;
+}
+
+#ifdef BATCH_OUTPUT
+// Records of one batch, "<time>s <current>uA" lines or batch frames
+static std::vector<record> batch_records(const burst &b)
+{
+    std::vector<record> records;
+
+#ifdef BINARY_OUTPUT
+    frame_decoder decoder([&](const uint8_t *p, size_t, const frame_calibration &cal) {
+        for (int i = 0; (p[0] == FRAME_TYPE_BATCH) && (i < p[1]); i++)
+        {
+            records.push_back({frame_u16(p + 2 + 5 * i), cal.microamp(frame_i24(p + 4 + 5 * i))});
+        }
+    });
+    decoder.feed(b.bytes.data(), b.bytes.size());
+    CHECK((decoder.counts().corrupt == 0) && (decoder.counts().lost == 0), "batch at %.1f s: %ld corrupt frames",
+          b.start, decoder.counts().corrupt);
+#else
+    std::string text(b.bytes.begin(), b.bytes.end());
+    for (size_t at = 0; at < text.size();)
+    {
+        size_t end = text.find('\n', at);
+        long time;
+        double current;
+
+        end = (end == std::string::npos) ? text.size() : end;
+        if (text.compare(at, end - at, "Let's go! ") == 0)
+        {
+            at = end + 1;
+            continue;
+        }
+        CHECK(sscanf(text.substr(at, end - at).c_str(), "%lds %lfuA", &time, &current) == 2, "line \"%s\"",
+              text.substr(at, end - at).c_str());
+        records.push_back({time, current});
+        at = end + 1;
+    }
+#endif
+    return records;
+}
+#endif
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = END_T;
+    cfg.adc_log = true;
+    // The bias measured at start-up includes the current, so it is 0 until then
+    cfg.current_na.add(0, 0);
+    cfg.current_na.add(0.499, 0);
+    cfg.current_na.add(0.5, 5000);
+    cfg.current_na.add(LOW_T - 5, 5000);
+    cfg.current_na.add(LOW_T - 4.999, BATCH_LOW_NA / 2);
+    cfg.current_na.add(LOW_T + 4, BATCH_LOW_NA / 2);
+    cfg.current_na.add(LOW_T + 4.001, 5000);
+    cfg.current_na.add(HIGH_T - 5, 5000);
+    cfg.current_na.add(HIGH_T - 4.999, BATCH_HIGH_NA * 2);
+    cfg.current_na.add(HIGH_T + 4, BATCH_HIGH_NA * 2);
+    cfg.current_na.add(HIGH_T + 4.001, 5000);
+    cfg.current_na.add(END_T, 5000);
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    // Start-up conversions come before the first PIT interrupt
+    std::vector<double> measurements = tracking_measurements(0.5, 0.1);
+    std::vector<burst> bursts = split_bursts();
+    const char *name = "ASCII";
+#ifdef BINARY_OUTPUT
+    name = "Binary";
+#endif
+
+#ifdef BATCH_OUTPUT
+    std::vector<record> all;
+    long full = 0;
+    long range = 0;
+    long latency = 0;
+    long low_sent = 0;
+    long high_sent = 0;
+
+    for (size_t i = 0; i < bursts.size(); i++)
+    {
+        std::vector<record> records = batch_records(bursts[i]);
+
+        if (records.empty())
+        {
+            continue;                                           // Start message or calibration frame only
+        }
+        const record &last = records.back();
+        bool out_of_range = (last.current_ua < BATCH_LOW_NA * 1e-3) || (last.current_ua > BATCH_HIGH_NA * 1e-3);
+        if (records.size() == BATCH_SIZE)
+        {
+            full++;
+        }
+        else if (out_of_range)
+        {
+            range++;
+            low_sent += last.current_ua < BATCH_LOW_NA * 1e-3;
+            high_sent += last.current_ua > BATCH_HIGH_NA * 1e-3;
+            CHECK(bursts[i].start - last.time < 1.5, "out-of-range result of %ld s sent at %.1f s", last.time,
+                  bursts[i].start);
+        }
+        else if (last.time - records[0].time >= BATCH_MAX_LATENCY)
+        {
+            latency++;
+        }
+        else
+        {
+            CHECK(false, "batch of %zu records at %.1f s, %ld to %ld s", records.size(), bursts[i].start,
+                  records[0].time, last.time);
+        }
+        all.insert(all.end(), records.begin(), records.end());
+    }
+    long sent = all.size();
+    for (unsigned i = 0; i < batch_count; i++)
+    {
+        all.push_back({batch_buffer[i].time, 0});
+    }
+
+    long gaps = 0;
+    for (size_t i = 1; i < all.size(); i++)
+    {
+        gaps += all[i].time - all[i - 1].time != WAKEUP_TIME;
+    }
+    printf("%ld measurements: %ld records sent, %u buffered; batches: %ld full, %ld out of range, %ld latency\n",
+           (long) measurements.size(), sent, batch_count, full, range, latency);
+    CHECK(all.size() == measurements.size(), "%zu records, %zu measurements", all.size(), measurements.size());
+    CHECK(gaps == 0, "%ld records not WAKEUP_TIME after the one before", gaps);
+    CHECK((low_sent == 1) && (high_sent == 1), "%ld low and %ld high results sent at once", low_sent, high_sent);
+    if (BATCH_SIZE * WAKEUP_TIME > BATCH_MAX_LATENCY)
+    {
+        CHECK((latency > 0) && (full == 0), "%ld batches full, %ld by latency", full, latency);
+    }
+    else
+    {
+        CHECK((full > 0) && (latency == 0), "%ld batches full, %ld by latency", full, latency);
+    }
+#else
+    CHECK(bursts.size() == measurements.size() + 1, "%zu bursts, %zu measurements and the start message",
+          bursts.size(), measurements.size());
+#endif
+
+    // Per hour from TABLE_FROM to the end
+    long bytes = 0;
+    long count = 0;
+    double on = 0;
+    for (const burst &b : bursts)
+    {
+        if (b.start >= TABLE_FROM)
+        {
+            bytes += b.bytes.size();
+            count++;
+            on += b.end - b.start;
+        }
+    }
+    double hours = (END_T - TABLE_FROM) / 3600;
+#ifdef BATCH_OUTPUT
+    printf("table: %s, batched (BATCH_SIZE %d) | %.0f | %.2f s | %.1f\n", name, BATCH_SIZE, bytes / hours,
+           on / hours, count / hours);
+#else
+    printf("table: %s | %.0f | %.2f s | %.1f\n", name, bytes / hours, on / hours, count / hours);
+#endif
+
+    return TEST_RESULT();
+}
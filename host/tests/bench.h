@@ -0,0 +1,36 @@
+/*
+ * Host time of a piece of code, for relative cost comparisons only
+ */
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <chrono>
+
+// Average time in ns of one call of f(i) for i = first ... last, repeated
+// until at least 50 ms were used
+template <typename F> double bench_ns(long first, long last, F f)
+{
+    typedef std::chrono::steady_clock clock;
+    long calls = 0;
+    clock::time_point start = clock::now();
+    clock::duration used;
+
+    do
+    {
+        for (long i = first; i <= last; i++)
+        {
+            f(i);
+        }
+        calls += last - first + 1;
+        used = clock::now() - start;
+    } while (used < std::chrono::milliseconds(50));
+    return std::chrono::duration<double, std::nano>(used).count() / calls;
+}
+
+// Keeps the compiler from removing a result: the empty asm reads it
+template <typename T> void bench_keep(T value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
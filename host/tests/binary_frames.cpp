@@ -0,0 +1,103 @@
+/*
+ * BINARY_OUTPUT of analog-current-sensing with MULTI_CHANNEL, decoded with
+ * the frame decoder of frame_decode: every frame must be valid, none lost,
+ * and the current and temperature must match the simulated board. Then a
+ * corrupted and a removed frame must be found
+ */
+#include "frames.h"
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+int firmware_main(void);
+
+struct decoded
+{
+    std::vector<double> current_ua;
+    std::vector<double> temp_c;
+    frame_counts counts;
+};
+
+static decoded decode(const std::vector<uint8_t> &stream)
+{
+    decoded d;
+    frame_rtd rtd;
+    frame_decoder decoder([&](const uint8_t *p, size_t, const frame_calibration &cal) {
+        if ((p[0] == FRAME_TYPE_MEASUREMENT) && cal.valid)
+        {
+            d.current_ua.push_back(cal.microamp(frame_i24(p + 2)));
+        }
+        else if (p[0] == FRAME_TYPE_RTD)
+        {
+            d.temp_c.push_back(rtd.celsius(frame_i24(p + 2)));
+        }
+    });
+
+    decoder.feed(stream.data(), stream.size());
+    d.counts = decoder.counts();
+    return d;
+}
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = 75.0;
+    cfg.temp_c.set(25.0);
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    std::vector<uint8_t> stream;
+    for (const sim_uart_byte &b : sim_uart())
+    {
+        stream.push_back(b.data);
+    }
+
+    // Measurements at 10, 20 ... 70 s, RTD at 10, 40 and 70 s. DAC0 at 1.0 V
+    // drives 210 kOhm. The RTD channel has no chopping, so its result x holds
+    // the ADC0 offset, and the conversion uses the PGA gain factor 0.992 of
+    // the firmware, where the simulated PGA has none. The expected temperature
+    // is what the firmware's equation gives for that x
+    decoded d = decode(stream);
+    double expected_ua = 1.0 / (cfg.r1 + cfg.r_sense + cfg.r2) * 1e6;
+    double r = sim_rtd_ohm(25.0);
+    frame_rtd rtd;
+    double expected_c = rtd.celsius(lround(16 * (16 * 2048.0 * r / (r + cfg.rtd_fixed) + cfg.offset_lsb + cfg.residual_lsb)));
+    CHECK(d.counts.corrupt == 0 && d.counts.lost == 0, "%ld corrupt, %ld lost", d.counts.corrupt, d.counts.lost);
+    CHECK(d.current_ua.size() == 7, "%zu measurement frames", d.current_ua.size());
+    CHECK(d.temp_c.size() == 3, "%zu RTD frames", d.temp_c.size());
+    for (double ua : d.current_ua)
+    {
+        CHECK(fabs(ua - expected_ua) < 0.02, "%.4f uA, expected %.4f uA", ua, expected_ua);
+    }
+    for (double c : d.temp_c)
+    {
+        CHECK(fabs(c - expected_c) < 0.2, "%.2f C, expected %.2f C", c, expected_c);
+    }
+    CHECK(stream.size() < 15 * d.current_ua.size() + 30 * d.temp_c.size() + 40, "%zu bytes sent", stream.size());
+
+    // Flip a bit in the third measurement frame and remove the fifth. The
+    // frames end at the 0x00 bytes, measurement frames are 8 bytes long
+    std::vector<size_t> ends;
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        if ((stream[i] == 0) && (i >= 7) && (stream[i - 6] == FRAME_TYPE_MEASUREMENT))
+        {
+            ends.push_back(i);
+        }
+    }
+    CHECK(ends.size() == 7, "%zu measurement frames found in the stream", ends.size());
+    if (ends.size() == 7)
+    {
+        std::vector<uint8_t> damaged(stream);
+        damaged[ends[2] - 3] ^= 0x10;
+        damaged.erase(damaged.begin() + ends[4] - 7, damaged.begin() + ends[4] + 1);
+        decoded e = decode(damaged);
+        CHECK(e.counts.corrupt == 1, "%ld corrupt frames found, expected 1", e.counts.corrupt);
+        CHECK(e.counts.lost == 2, "%ld lost frames found, expected 2", e.counts.lost);
+        CHECK(e.current_ua.size() == 5, "%zu measurements decoded", e.current_ua.size());
+    }
+    return TEST_RESULT();
+}
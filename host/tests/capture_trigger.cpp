@@ -0,0 +1,89 @@
+/*
+ * TRANSIENT_CAPTURE on the simulator with the window trigger: a 1 ms
+ * spike above CAPTURE_TRIGGER_NA is captured. ADC0 free-runs (FREERUN in
+ * CTRLF), no sample is lost, the trigger sample is at CAPTURE_PRE, the
+ * spike covers 1 ms of samples, and the sample period measured with TCB0
+ * is the conversion time of the simulated ADC0
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+#define SPIKE_TIME 0.2
+#define SPIKE_LENGTH 0.001
+
+static bool done = false;
+
+static int test_main(void)
+{
+    init_clock();
+    init_PORT();
+    init_VREF();
+    init_DAC0();
+    init_ADC0();
+    ADC0.CTRLF = ADC_SAMPNUM_SEL;                           // As in main(), no chopping
+    measure_offset_bias();
+    set_DAC0_output();
+
+    capture_run();
+    done = true;
+
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = 1.0;
+    // The bias measured at start-up includes the current, so it is 0 until the capture runs
+    cfg.current_na.add(0, 0);
+    cfg.current_na.add(0.049, 0);
+    cfg.current_na.add(0.05, 5000);
+    cfg.current_na.add(SPIKE_TIME - 1e-9, 5000);
+    cfg.current_na.add(SPIKE_TIME, 30000);
+    cfg.current_na.add(SPIKE_TIME + SPIKE_LENGTH - 1e-9, 30000);
+    cfg.current_na.add(SPIKE_TIME + SPIKE_LENGTH, 5000);
+    sim_init(cfg);
+    int errors = sim_run(test_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    CHECK(done, "capture_run() did not return, ADC0 does not free-run");
+    if (!done)
+    {
+        return TEST_RESULT();
+    }
+
+    // Conversion time of the simulator: (SAMPDUR + 2 + 14) / f_CLK_ADC + PGA sample time of 3 us
+    double period_ns = (ADC_SAMPDUR + 16) * 1e9 * CAPTURE_PRESC_DIV / F_CPU + (CAPTURE_PGA_NS ? 3000 : 0);
+    printf("sample period %lu ns measured, %.1f ns simulated, %lu ns from CAPTURE_PERIOD_NS\n",
+           (unsigned long) capture_period_ns, period_ns, (unsigned long) CAPTURE_PERIOD_NS);
+    CHECK(fabs(capture_period_ns - period_ns) <= 5, "sample period %lu ns, simulated %.1f ns",
+          (unsigned long) capture_period_ns, period_ns);
+    CHECK(!capture_overrun, "samples lost");
+
+    // Raw single conversions above the window threshold
+    int32_t threshold = (FP_CODE_FROM_NA(CAPTURE_TRIGGER_NA) + adc_offset + adc_center) / ADC_SCALE_SAMPLES;
+    int above = 0;
+    int first_above = -1;
+    for (int i = 0; i < CAPTURE_SIZE; i++)
+    {
+        if (capture_buffer[(capture_first + i) & CAPTURE_MASK] > threshold)
+        {
+            above++;
+            first_above = (first_above < 0) ? i : first_above;
+        }
+    }
+    int expected = (int) lround(SPIKE_LENGTH * 1e9 / period_ns);
+    printf("trigger sample %d, %d samples in the spike, %d expected\n", first_above, above, expected);
+    CHECK(first_above == CAPTURE_PRE, "first sample above the threshold at %d, trigger at %d", first_above,
+          CAPTURE_PRE);
+    CHECK(abs(above - expected) <= 1, "%d samples in the spike, %d expected", above, expected);
+
+    return TEST_RESULT();
+}
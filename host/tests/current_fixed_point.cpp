@@ -0,0 +1,96 @@
+/*
+ * FIXED_POINT voltage and current of analog-current-sensing against the
+ * float code and a double reference, for every accumulated result of 16
+ * samples (-32768 to 32767). The fixed-point error must stay within the
+ * rounding of the result plus the rounding of the scale factor. Also
+ * counts the results the two builds print differently, and prints the
+ * host time of both conversions (a relative cost only, the AVR has no
+ * FPU and no divider, see PHASE_TRACE in the README for device times)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "bench.h"
+#include "test.h"
+
+#include <math.h>
+#include <string.h>
+
+struct error_stats
+{
+    double max = 0;
+    double sum = 0;
+    long count = 0;
+
+    void add(double error)
+    {
+        error = fabs(error);
+        max = (error > max) ? error : max;
+        sum += error;
+        count++;
+    }
+    double mean() const { return sum / count; }
+};
+
+int main(void)
+{
+    const double uv_per_code = ADC_REF * 1e6 / (2048.0 * ADC_SCALE_SAMPLES * FP_GAIN);
+    const double na_per_code = uv_per_code * 1000.0 / R_SENSE;
+    const int v_shift = FP_SHIFT(FP_VOLTAGE_NUM, FP_VOLTAGE_DEN);
+    const int i_shift = FP_SHIFT(FP_CURRENT_NUM, FP_CURRENT_DEN);
+    error_stats v_fix, i_fix, v_float, i_float;
+    long text_differs = 0;
+    char fix_text[16];
+    char float_text[16];
+
+    for (int32_t x = -32768; x <= 32767; x++)
+    {
+        v_fix.add(FP_CONVERT(x, FP_VOLTAGE_NUM, FP_VOLTAGE_DEN) - x * uv_per_code);
+        i_fix.add(FP_CONVERT(x, FP_CURRENT_NUM, FP_CURRENT_DEN) - x * na_per_code);
+        float v = x * (float) FLOAT_VOLTAGE_SCALE;                  // Float build, 32-bit float as on the AVR
+        float i = x * (float) FLOAT_CURRENT_SCALE;
+        v_float.add(v * 1e6 - x * uv_per_code);
+        i_float.add(i * 1e3 - x * na_per_code);
+
+        fixtostr(ROUND_DIV(FP_CONVERT(x, FP_CURRENT_NUM, FP_CURRENT_DEN), 100), fix_text, 1);
+        ftostr(i, float_text, 1);
+        text_differs += strcmp(fix_text, float_text) != 0;
+    }
+
+    printf("accumulated result -32768 ... 32767, %.3f uV and %.4f nA per code\n", uv_per_code, na_per_code);
+    printf("              max error  mean error\n");
+    printf("fixed   uV  %11.3f %11.3f   (Q%d scale)\n", v_fix.max, v_fix.mean(), v_shift);
+    printf("fixed   nA  %11.3f %11.3f   (Q%d scale)\n", i_fix.max, i_fix.mean(), i_shift);
+    printf("float   uV  %11.3f %11.3f\n", v_float.max, v_float.mean());
+    printf("float   nA  %11.3f %11.3f\n", i_float.max, i_float.mean());
+    printf("printed current (0.1 uA) differs for %ld of 65536 results\n", text_differs);
+
+    double v_ns = bench_ns(-32768, 32767, [](long x) {
+        bench_keep(FP_CONVERT(x, FP_VOLTAGE_NUM, FP_VOLTAGE_DEN) + FP_CONVERT(x, FP_CURRENT_NUM, FP_CURRENT_DEN));
+    });
+    double f_ns = bench_ns(-32768, 32767, [](long x) {
+        bench_keep((int32_t) x * (float) FLOAT_VOLTAGE_SCALE + (int32_t) x * (float) FLOAT_CURRENT_SCALE);
+    });
+    double fix_fmt_ns = bench_ns(-32768, 32767, [](long x) {
+        char text[16];
+        fixtostr(ROUND_DIV((int32_t) x * 5, 100), text, 1);
+        bench_keep(text[0]);
+    });
+    double float_fmt_ns = bench_ns(-32768, 32767, [](long x) {
+        char text[16];
+        ftostr(x * 0.05f, text, 1);
+        bench_keep(text[0]);
+    });
+    printf("host time per result: convert fixed %.2f ns, float %.2f ns; format fixed %.1f ns, float %.1f ns\n",
+           v_ns, f_ns, fix_fmt_ns, float_fmt_ns);
+
+    // Result rounding (0.5) plus scale factor rounding (0.5 / 2^shift per code)
+    double v_bound = 0.5 + 32768 * 0.5 / (1L << v_shift);
+    double i_bound = 0.5 + 32768 * 0.5 / (1L << i_shift);
+    CHECK(v_fix.max <= v_bound, "voltage error %.3f uV, bound %.3f uV", v_fix.max, v_bound);
+    CHECK(i_fix.max <= i_bound, "current error %.3f nA, bound %.3f nA", i_fix.max, i_bound);
+    // The printed 0.1 uA values can only differ where the two builds round to different sides
+    CHECK(text_differs < 65536 / 100, "%ld printed results differ", text_differs);
+    return TEST_RESULT();
+}
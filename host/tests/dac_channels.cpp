@@ -0,0 +1,51 @@
+/*
+ * DAC0 codes and the MULTI_CHANNEL channel table of analog-current-sensing.
+ * DAC_CODE() must round to the nearest code for every output in mV, and
+ * the current and RTD channels, which share DAC0, must not share an ADC0
+ * input or use the DAC0OUT (AIN6) and VREFA (AIN7) pins
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "test.h"
+
+#include <math.h>
+
+int main(void)
+{
+    CHECK(DAC_CODE(1.8) == 559, "DAC_CODE(1.8) %u, expected 559", DAC_CODE(1.8));
+    CHECK(DAC_CODE(1.0) == 310, "DAC_CODE(1.0) %u, expected 310", DAC_CODE(1.0));
+
+    double max_error = 0;
+    for (int mv = 0; mv < 3300; mv++)
+    {
+        double exact = mv * 1024.0 / 3300.0;
+        double error = fabs(DAC_CODE(mv / 1000.0) - exact);
+        max_error = (error > max_error) ? error : max_error;
+    }
+    printf("DAC_CODE max error %.3f LSB\n", max_error);
+    CHECK(max_error <= 0.5, "DAC_CODE is not rounded to the nearest code");
+
+    for (unsigned i = 0; i < CHANNEL_COUNT; i++)
+    {
+        const adc_channel &a = channel_table[i];
+        int pos = a.muxpos & ADC_MUXPOS_gm;
+        int neg = a.muxneg & ADC_MUXNEG_gm;
+
+        CHECK(pos != neg, "channel %u measures AIN%d against itself", i, pos);
+        CHECK(pos < 6 && neg < 6, "channel %u uses AIN6 (DAC0OUT) or AIN7 (VREFA)", i);
+        CHECK(a.dac_data > 0 && a.dac_data < 1024, "channel %u DAC0.DATA %u", i, a.dac_data);
+        for (unsigned j = i + 1; j < CHANNEL_COUNT; j++)
+        {
+            const adc_channel &b = channel_table[j];
+            int bpos = b.muxpos & ADC_MUXPOS_gm;
+            int bneg = b.muxneg & ADC_MUXNEG_gm;
+
+            CHECK(pos != bpos && pos != bneg && neg != bpos && neg != bneg,
+                  "channels %u and %u share an ADC0 input", i, j);
+        }
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,135 @@
+/*
+ * RESULT_FILTER noise floor against energy per result on the simulator:
+ * for bursts of 4, 8 and 16 samples (ACC4, ACC8, ACC16), measurements as
+ * in do_ADC0_measurement() on a constant input with FILTER_NOISE_LSB rms
+ * noise per sample, each result passed through filter_result(). Built
+ * once for each FILTER_MEDIAN and FILTER_IIR_SHIFT setting of the README
+ * table. Prints the rms noise of the filtered results in single-sample
+ * LSB, the ADC0 on time and the energy per result, and checks the noise:
+ * - without a filter: the sample noise (with the 12-bit rounding) divided
+ *   by the square root of the number of samples
+ * - IIR: that noise times sqrt(a / (2 - a)), a = 2^-FILTER_IIR_SHIFT, plus
+ *   the rounding of the output to a whole result code
+ * - median only: that noise times the rms factor of the median of 3 or 5
+ *   Gaussian values (0.670 or 0.536)
+ * - median and IIR: not more than the IIR alone
+ * The energy assumes AWAKE_MA for the ADC0 on time at 3.3 V, as adc_enob.
+ * The test runs at ADC_SAMPLES 16 and sets the number of samples in
+ * ADC0.CTRLF. Results of 32 samples or less are not scaled, so they are
+ * the results of an ADC_SAMPLES 4 or 8 build. Only FILTER_STEP_NA is
+ * then 2 or 4 times higher, which a constant input never reaches
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+#define FILTER_NOISE_LSB 1.0
+#define RESULTS 20000
+#define AWAKE_MA 3.5                // Supply current with CPU, ADC0, PGA and DAC0 on (README, Conclusion)
+#define VDD 3.3
+
+static double expected_noise(int samples)
+{
+    double sample = sqrt(FILTER_NOISE_LSB * FILTER_NOISE_LSB + 1.0 / 12.0);
+    double noise = sample / sqrt((double) samples);
+
+    #if FILTER_IIR_SHIFT > 0
+        double a = 1.0 / (1 << FILTER_IIR_SHIFT);
+        double rounding = 1.0 / (12.0 * samples * samples); // Output rounded to a result code
+        return sqrt(noise * noise * a / (2.0 - a) + rounding);
+    #elif FILTER_MEDIAN == 3
+        return noise * 0.670;
+    #elif FILTER_MEDIAN == 5
+        return noise * 0.536;
+    #else
+        return noise;
+    #endif
+}
+
+static void filter_reset(void)
+{
+    #if FILTER_MEDIAN > 1
+        filter_next = 0;
+        filter_count = 0;
+    #endif
+    #if FILTER_IIR_SHIFT > 0
+        filter_valid = 0;
+    #endif
+}
+
+static int test_main(void)
+{
+    static const uint8_t sampnums[] = { ADC_SAMPNUM_ACC16_gc, ADC_SAMPNUM_ACC8_gc, ADC_SAMPNUM_ACC4_gc };
+
+    init_clock();
+    init_PORT();
+    init_VREF();
+    init_DAC0();
+    init_ADC0();
+    measure_offset_bias();                                  // Leaves the measurement inputs selected
+    set_DAC0_output();
+
+    printf("FILTER_MEDIAN %d, FILTER_IIR_SHIFT %d, %.1f LSB rms per sample, %d results\n", FILTER_MEDIAN,
+           FILTER_IIR_SHIFT, FILTER_NOISE_LSB, RESULTS);
+    printf("samples  ADC on time  energy/result  noise (LSB)  expected\n");
+    for (uint8_t sampnum : sampnums)
+    {
+        const int samples = 1 << sampnum;
+        double sum = 0;
+        double sum2 = 0;
+
+        ADC0.CTRLF = ADC_CHOPPING_bm | sampnum;
+        filter_reset();
+        sim_stats before = sim_get_stats();
+        for (int i = 0; i < RESULTS; i++)
+        {
+            DAC0.CTRLA = DAC_CTRLA_ON;                      // As do_ADC0_measurement()
+            ADC0.CTRLA = ADC_CTRLA_ON;
+            while (ADC0.STATUS > 0)
+                ;
+            adc0_start(ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc);
+            int32_t result = adc0_wait_result();
+            ADC0.CTRLA = 0;
+            DAC0.CTRLA = 0;
+
+            // Single-sample LSB, the offset and bias do not change the noise
+            double x = filter_result(result) / (double) samples;
+            sum += x;
+            sum2 += x * x;
+        }
+        double t_on = (sim_get_stats().t_adc_on - before.t_adc_on) / RESULTS;
+        double mean = sum / RESULTS;
+        double noise = sqrt(fmax(sum2 / RESULTS - mean * mean, 0.0));
+        double expected = expected_noise(samples);
+
+        printf("%7d  %8.1f us  %10.3f uJ  %11.3f  %8.3f\n", samples, t_on * 1e6, t_on * AWAKE_MA * 1e-3 * VDD * 1e6,
+               noise, expected);
+        #if (FILTER_MEDIAN > 1) && (FILTER_IIR_SHIFT > 0)
+            CHECK(noise < 1.05 * expected, "%d samples: noise %.3f LSB, more than %.3f of the IIR alone", samples,
+                  noise, expected);
+        #else
+            CHECK(fabs(noise / expected - 1.0) < 0.05, "%d samples: noise %.3f LSB, expected %.3f", samples, noise,
+                  expected);
+        #endif
+    }
+
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.noise_lsb = FILTER_NOISE_LSB;
+    cfg.end_time = 100.0;
+    sim_init(cfg);
+    int errors = sim_run(test_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    return TEST_RESULT();
+}
@@ -0,0 +1,168 @@
+/*
+ * fixtostr() of analog-current-sensing against snprintf(), for every value
+ * from -200000 to 200000 and for 1000000 random values with 0 to 9
+ * decimals, and for the edge cases (INT32_MIN, INT32_MAX, powers of 10 and
+ * their neighbours). Also compares the cost with the intToStr()/rev_str()
+ * formatter it replaced, which needs one 32-bit division per digit on a
+ * CPU without a divider: the number of digit steps (subtractions) against
+ * the number of divisions, and the host time of both (a relative figure
+ * only, the simulator does not count the CPU time of calculations; use
+ * PHASE_TRACE on the device)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "bench.h"
+#include "test.h"
+
+#include <limits.h>
+#include <random>
+#include <string.h>
+
+static long divisions = 0;
+
+// The formatter of the original example, for integers (ftostr() used it twice per value)
+static void rev_str(char *str, int len)
+{
+    int i = 0, j = len - 1, temp;
+
+    while (i < j)
+    {
+        temp = str[i];
+        str[i] = str[j];
+        str[j] = temp;
+        i++;
+        j--;
+    }
+}
+
+static int intToStr(int x, char str[], int d)
+{
+    int i = 0;
+    while (x)
+    {
+        str[i++] = (x % 10) + '0';
+        x = x / 10;
+        divisions++;
+    }
+    while (i < d)
+    {
+        str[i++] = '0';
+    }
+    rev_str(str, i);
+    str[i] = '\0';
+    return i;
+}
+
+// Expected text: sign, integer part, and for decimals > 0 a dot and the decimals
+static void reference(int32_t n, uint8_t decimals, char *out, size_t size)
+{
+    uint32_t u = (n < 0) ? 0U - (uint32_t) n : (uint32_t) n;
+    const char *sign = (n < 0) ? "-" : "";
+
+    if (decimals == 0)
+    {
+        snprintf(out, size, "%s%lu", sign, (unsigned long) u);
+    }
+    else
+    {
+        uint32_t p = pow10_table[9 - decimals];
+        snprintf(out, size, "%s%lu.%0*lu", sign, (unsigned long) (u / p), (int) decimals, (unsigned long) (u % p));
+    }
+}
+
+static long failures = 0;
+
+static void compare(int32_t n, uint8_t decimals)
+{
+    char res[16];
+    char ref[32];
+
+    memset(res, 'x', sizeof(res));
+    fixtostr(n, res, decimals);
+    reference(n, decimals, ref, sizeof(ref));
+    if (strcmp(res, ref) != 0 || strlen(res) > 12)
+    {
+        if (failures++ < 10)
+        {
+            fprintf(stderr, "fixtostr(%ld, %u): \"%s\", snprintf: \"%s\"\n", (long) n, decimals, res, ref);
+        }
+    }
+}
+
+// Digit steps of fixtostr() for n: one per position and one per subtraction
+static long digit_steps(int32_t n)
+{
+    uint32_t u = (n < 0) ? 0U - (uint32_t) n : (uint32_t) n;
+    long steps = 0;
+
+    for (int i = 0; i < 10; i++)
+    {
+        steps += 1 + u / pow10_table[i];
+        u %= pow10_table[i];
+    }
+    return steps;
+}
+
+int main(void)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int32_t> any(INT32_MIN, INT32_MAX);
+
+    for (uint8_t d = 0; d <= 9; d++)
+    {
+        for (int32_t n = -200000; n <= 200000; n++)
+        {
+            compare(n, d);
+        }
+        for (int i = 0; i < 100000; i++)
+        {
+            compare(any(rng), d);
+        }
+        compare(INT32_MIN, d);
+        compare(INT32_MAX, d);
+        compare(INT32_MIN + 1, d);
+        for (int i = 0; i < 10; i++)
+        {
+            int32_t p = (int32_t) pow10_table[i];
+            compare(p, d);
+            compare(p - 1, d);
+            compare(-p, d);
+            compare(-p + 1, d);
+            if (p < INT32_MAX)
+            {
+                compare(p + 1, d);
+                compare(-p - 1, d);
+            }
+        }
+    }
+    CHECK(failures == 0, "%ld values differ from snprintf", failures);
+
+    // Cost per value for the current in 0.1 uA (decimals 1), over 0 ... 99.9 uA
+    char buf[16];
+    long steps = 0;
+    long max_steps = 0;
+    divisions = 0;
+    for (int32_t n = 0; n < 1000; n++)
+    {
+        long s = digit_steps(n);
+        steps += s;
+        max_steps = (s > max_steps) ? s : max_steps;
+        int i = intToStr(n / 10, buf, 0);       // The old ftostr(): integer part, then the decimal
+        intToStr(n % 10, buf + i + 1, 1);
+    }
+    printf("0 ... 99.9 uA, per value: fixtostr %.1f digit steps (max %ld), intToStr %.2f divisions\n",
+           steps / 1000.0, max_steps, divisions / 1000.0);
+
+    double t_fix = bench_ns(0, 999, [&](long n) { fixtostr((int32_t) n, buf, 1); bench_keep(buf[0]); });
+    double t_int = bench_ns(0, 999, [&](long n) {
+        int i = intToStr((int) n / 10, buf, 0);
+        intToStr((int) n % 10, buf + i + 1, 1);
+        bench_keep(buf[0]);
+    });
+    double t_printf = bench_ns(0, 999, [&](long n) { reference((int32_t) n, 1, buf, sizeof(buf)); bench_keep(buf[0]); });
+    printf("host time per value: fixtostr %.1f ns, intToStr %.1f ns, snprintf %.1f ns\n", t_fix, t_int, t_printf);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,212 @@
+/*
+ * Parser and file of ingestd: the ASCII output of analog-current-sensing
+ * split at every position gives the same records, other and damaged lines
+ * are counted. Records written to a file come back the same, from the index
+ * and, without the footer, from the block headers. Time-range queries give
+ * the records of the range and skip the other blocks
+ */
+#include "ingest.h"
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_NAME "ingest_format.bin"
+#define FILE_RECORDS 100000L
+
+static bool same(const ingest_record &a, const ingest_record &b)
+{
+    return (a.t_us == b.t_us) && (a.device == b.device) && (a.voltage_uv == b.voltage_uv) &&
+           (a.current_na == b.current_na);
+}
+
+static void check_numbers(void)
+{
+    static const struct
+    {
+        const char *text;
+        int decimals;
+        bool ok;
+        int32_t value;
+    } cases[] =
+    {
+        {"0.0476", 6, true, 47600},
+        {"4.8", 3, true, 4800},
+        {"-0.1", 3, true, -100},
+        {"12", 3, true, 12000},
+        {"7.", 3, true, 7000},
+        {"1.23456789", 6, true, 1234568},
+        {"-1.0004", 3, true, -1000},
+        {"2147.483647", 6, true, 2147483647},
+        {"2147.483648", 6, false, 0},
+        {"", 3, false, 0},
+        {"-", 3, false, 0},
+        {".", 3, false, 0},
+        {"1.2.3", 3, false, 0},
+        {"1e3", 3, false, 0},
+        {" 1", 3, false, 0},
+    };
+
+    for (const auto &c : cases)
+    {
+        int32_t value = 0;
+        bool ok = ingest_parse_fixed(c.text, c.text + strlen(c.text), c.decimals, value);
+
+        CHECK((ok == c.ok) && (!ok || (value == c.value)), "\"%s\": %s %ld", c.text, ok ? "ok" : "wrong",
+              (long) value);
+    }
+}
+
+static void check_parser(void)
+{
+    std::string stream = "Let's go! \nSettling time: 48us\n";
+    std::vector<ingest_record> expected;
+    char buffer[INGEST_LINE_MAX + 4096];
+
+    for (int k = 0; k < 40; k++)
+    {
+        char text[80];
+
+        snprintf(text, sizeof(text), "Measured voltage: %d.%04dV\nMeasured current: %s%d.%duA\n", k / 10,
+                 k * 37 % 10000, (k % 3) ? "" : "-", k * 7, k % 10);
+        stream += text;
+        expected.push_back({0, 5, k / 10 * 1000000 + k * 37 % 10000 * 100,
+                            ((k % 3) ? 1 : -1) * (k * 7 * 1000 + k % 10 * 100)});
+        if (k == 10)
+        {
+            stream += "Measured voltage: 1.0000V\r\nMeasured current: 2.5uA\r\n";       // From a terminal
+            expected.push_back({0, 5, 1000000, 2500});
+        }
+        if (k == 20)
+        {
+            stream += std::string(200, '#') + "\n";                                     // Noise on the line
+            stream += "Measured current: 1.0uA\n";                                      // Lost voltage line
+            stream += "Measured voltage: 0.12x4V\n";
+        }
+    }
+
+    // Read sizes of 1 to all bytes
+    for (size_t size = 1; size <= stream.size(); size++)
+    {
+        ingest_parser parser(5);
+        std::vector<ingest_record> records;
+        bool equal = true;
+
+        for (size_t at = 0; at < stream.size(); at += size)
+        {
+            size_t n = std::min(size, stream.size() - at);
+            size_t carried = parser.carry(buffer);
+
+            memcpy(buffer + carried, stream.data() + at, n);
+            parser.parse(buffer, carried + n, at, records);
+        }
+        for (size_t i = 0; (i < records.size()) && (i < expected.size()); i++)
+        {
+            equal &= (records[i].device == 5) && (records[i].voltage_uv == expected[i].voltage_uv) &&
+                     (records[i].current_na == expected[i].current_na);
+        }
+        const ingest_counts &c = parser.counts();
+        CHECK(equal && (records.size() == expected.size()), "read size %zu: %zu records, %zu expected", size,
+              records.size(), expected.size());
+        CHECK((c.bytes == (long) stream.size()) && (c.unknown == 2) && (c.unpaired == 1) && (c.bad == 2),
+              "read size %zu: %ld bytes, %ld other, %ld unpaired, %ld bad", size, c.bytes, c.unknown, c.unpaired,
+              c.bad);
+        // The record time is that of the read with the end of the current line
+        CHECK(records.empty() || (records[0].t_us <= (int64_t) stream.find("uA\n") + 2), "read size %zu: time %lld",
+              size, (long long) records[0].t_us);
+    }
+}
+
+static std::vector<ingest_record> file_records(void)
+{
+    std::vector<ingest_record> records;
+    int64_t t = 1700000000000000LL;
+
+    srand(1);
+    for (long i = 0; i < FILE_RECORDS; i++)
+    {
+        t += rand() % 2000;
+        if (i == FILE_RECORDS / 2)
+        {
+            t += 2 * INGEST_BLOCK_SPAN_US;      // Gap of two hours
+        }
+        // Records of one read may come a little out of order between ports
+        records.push_back({t - rand() % 100, (uint16_t) (i % 3), (int32_t) (rand() % 4000000 - 1000000),
+                           (int32_t) (rand() % 2000000 - 100)});
+    }
+    return records;
+}
+
+static void check_file(void)
+{
+    std::vector<ingest_record> records = file_records();
+    std::vector<std::string> ports = {"/dev/ttyACM0", "/dev/ttyACM1", "/dev/pts/7"};
+    ingest_writer writer;
+    ingest_reader reader;
+    std::vector<ingest_record> all;
+
+    CHECK(writer.open(FILE_NAME, ports), "can not write " FILE_NAME);
+    for (const ingest_record &r : records)
+    {
+        writer.add(r);
+    }
+    CHECK(writer.close(), "write error");
+
+    CHECK(reader.open(FILE_NAME), "can not read " FILE_NAME);
+    CHECK(reader.indexed(), "no index");
+    CHECK(reader.devices() == ports, "%zu ports", reader.devices().size());
+    size_t blocks = (FILE_RECORDS / 2 + INGEST_BLOCK_RECORDS - 1) / INGEST_BLOCK_RECORDS * 2;
+    CHECK(reader.blocks().size() == blocks, "%zu data blocks, %zu expected", reader.blocks().size(), blocks);
+    reader.query(INT64_MIN, INT64_MAX, -1, all);
+    CHECK(all.size() == records.size(), "%zu records read, %zu written", all.size(), records.size());
+    for (size_t i = 0; i < all.size() && i < records.size(); i++)
+    {
+        if (!same(all[i], records[i]))
+        {
+            CHECK(false, "record %zu differs", i);
+            break;
+        }
+    }
+
+    // Ranges against all records
+    for (int i = 0; i < 200; i++)
+    {
+        int64_t from_us = records[rand() % records.size()].t_us;
+        int64_t to_us = from_us + (i % 2 ? 100000 : 50000000);
+        int device = (i % 4 == 3) ? i % 3 : -1;
+        std::vector<ingest_record> range;
+        size_t expected = 0;
+        size_t read = reader.query(from_us, to_us, device, range);
+
+        for (const ingest_record &r : records)
+        {
+            expected += (r.t_us >= from_us) && (r.t_us < to_us) && ((device < 0) || (r.device == device));
+        }
+        CHECK(range.size() == expected, "query %d: %zu records, %zu expected", i, range.size(), expected);
+        CHECK(read <= ((i % 2) ? 3u : 30u), "query %d: %zu blocks read", i, read);
+    }
+
+    // Without the footer and with a last block that is cut off: the complete blocks
+    FILE *f = fopen(FILE_NAME, "rb");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    CHECK(!truncate(FILE_NAME, size - 16 - (16 + 32 * blocks) - 1000), "truncate");     // Footer, index, 1000 bytes
+    ingest_reader scanned;
+    std::vector<ingest_record> left;
+    CHECK(scanned.open(FILE_NAME) && !scanned.indexed(), "truncated file");
+    scanned.query(INT64_MIN, INT64_MAX, -1, left);
+    CHECK(scanned.blocks().size() == blocks - 1, "%zu blocks after truncation", scanned.blocks().size());
+    CHECK(left.size() == records.size() - FILE_RECORDS / 2 % INGEST_BLOCK_RECORDS, "%zu records after truncation",
+          left.size());
+    remove(FILE_NAME);
+}
+
+int main(void)
+{
+    check_numbers();
+    check_parser();
+    check_file();
+    return TEST_RESULT();
+}
@@ -0,0 +1,138 @@
+/*
+ * NVM_LOG on the simulator flash: LAPS laps of the ring from erased flash
+ * take one erase/write for every NVM_LOG_RECORDS results, the same number
+ * on every log page and none outside the log. Then the power fails halfway
+ * through the write of page TORN_PAGE: after nvm_log_init() only that page
+ * fails its CRC, the page before it is found as the newest, and logging
+ * continues on the torn page
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define LAPS 3
+#define TORN_PAGE (NVM_LOG_PAGES / 2)
+
+static uint8_t saved[PROGMEM_SIZE];
+static long added;
+
+// Restart of the firmware: the flash as it was saved, the log state as after reset
+static void restart(void)
+{
+    memcpy(sim_flash(), saved, sizeof(saved));
+    nvm_log_page = 0;
+    nvm_log_seq = 0;
+    nvm_log_count = 0;
+}
+
+static int laps_main(void)
+{
+    long writes_wrong = 0;
+
+    nvm_log_init();
+    for (long i = 0; i < LAPS * NVM_LOG_PAGES * NVM_LOG_RECORDS; i++)
+    {
+        nvm_log_add(i);
+        writes_wrong += sim_get_stats().flash_writes != (i + 1) / NVM_LOG_RECORDS;
+    }
+    CHECK(writes_wrong == 0, "%ld results with another number of flash writes than results / %d", writes_wrong,
+          NVM_LOG_RECORDS);
+    sim_finish();
+    return 0;
+}
+
+// Adds results until the power fails
+static int torn_main(void)
+{
+    restart();
+    nvm_log_init();
+    CHECK((nvm_log_page == 0) && (nvm_log_seq == LAPS * NVM_LOG_PAGES), "after %d laps: page %u, seq %u", LAPS,
+          nvm_log_page, nvm_log_seq);
+    for (added = 0;; added++)
+    {
+        nvm_log_add(added);
+    }
+    return 0;
+}
+
+static int recovered_main(void)
+{
+    unsigned invalid = 0;
+
+    restart();
+    nvm_log_init();
+    for (unsigned i = 0; i < NVM_LOG_PAGES; i++)
+    {
+        bool valid = nvm_log_valid(NVM_LOG_PAGE(i));
+
+        CHECK(valid == (i != TORN_PAGE), "page %u is %s", i, valid ? "valid" : "invalid");
+        invalid += !valid;
+    }
+    printf("%u of %d pages invalid after the power fail\n", invalid, NVM_LOG_PAGES);
+    CHECK((nvm_log_page == TORN_PAGE) && (nvm_log_seq == LAPS * NVM_LOG_PAGES + TORN_PAGE),
+          "newest page %u, seq %u, expected page %d, seq %d", (nvm_log_page + NVM_LOG_PAGES - 1) % NVM_LOG_PAGES,
+          nvm_log_seq - 1, TORN_PAGE - 1, LAPS * NVM_LOG_PAGES + TORN_PAGE - 1);
+
+    for (long i = 0; i < NVM_LOG_RECORDS; i++)
+    {
+        nvm_log_add(i);
+    }
+    CHECK(nvm_log_valid(NVM_LOG_PAGE(TORN_PAGE)), "torn page not written again");
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    sim_config cfg;
+    int errors;
+
+    cfg.end_time = 1000;
+    printf("%d pages of %d records from 0x%04lX\n", NVM_LOG_PAGES, NVM_LOG_RECORDS, (unsigned long) NVM_LOG_START);
+
+    sim_init(cfg);
+    errors = sim_run(laps_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    long outside = 0;
+    long most = 0;
+    long least = LONG_MAX;
+    for (uint32_t a = 0; a < PROGMEM_SIZE; a += PROGMEM_PAGE_SIZE)
+    {
+        long erases = sim_flash_erases(a);
+
+        if (a < NVM_LOG_START)
+        {
+            outside += erases;
+            continue;
+        }
+        most = (erases > most) ? erases : most;
+        least = (erases < least) ? erases : least;
+    }
+    printf("%d laps: %ld flash writes, %ld to %ld erases per log page\n", LAPS, sim_get_stats().flash_writes, least,
+           most);
+    CHECK((least == LAPS) && (most == LAPS), "%ld to %ld erases per page, expected %d", least, most, LAPS);
+    CHECK(outside == 0, "%ld erases outside the log", outside);
+    memcpy(saved, sim_flash(), sizeof(saved));
+
+    // The power fails during the write of the page after TORN_PAGE pages
+    cfg.power_fail_write = TORN_PAGE + 1;
+    sim_init(cfg);
+    errors = sim_run(torn_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    CHECK(sim_get_stats().flash_writes == TORN_PAGE + 1, "%ld flash writes", sim_get_stats().flash_writes);
+    CHECK(added == (TORN_PAGE + 1) * NVM_LOG_RECORDS - 1, "power fail at result %ld", added);
+    memcpy(saved, sim_flash(), sizeof(saved));
+
+    cfg.power_fail_write = 0;
+    sim_init(cfg);
+    errors = sim_run(recovered_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,67 @@
+/*
+ * NVM_LOG with WINDOW_MONITOR on the simulator: the PIT interrupt is not
+ * used, so the record times must come from the RTC counter and heartbeats.
+ * The current leaves and enters the window at known times, and every
+ * record must hold the time of its wake-up: window events within a second
+ * (one PIT event per conversion) and heartbeats exactly
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <algorithm>
+#include <math.h>
+
+int main(void)
+{
+    const double steps[] = { 7.5, 31.5, 52.5, 77.5 };         // Current leaves or enters the window
+    sim_config cfg;
+
+    cfg.end_time = 100.5;
+    // The bias measured at start-up includes the current, so it is 0 until the monitor runs
+    double current = 5000;                                      // Inside the window of 4000 to 6000 nA
+    cfg.current_na.add(0, 0);
+    cfg.current_na.add(0.499, 0);
+    cfg.current_na.add(0.5, current);
+    for (double t : steps)
+    {
+        cfg.current_na.add(t - 0.001, current);
+        current = (current == 5000) ? 8000 : 5000;
+        cfg.current_na.add(t, current);
+    }
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    // Window events at each step, heartbeats every MONITOR_HEARTBEAT seconds
+    std::vector<double> expected(steps, steps + 4);
+    for (int t = MONITOR_HEARTBEAT; t < cfg.end_time; t += MONITOR_HEARTBEAT)
+    {
+        expected.push_back(t);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    CHECK(nvm_log_count == expected.size(), "%u records, expected %u", nvm_log_count, (unsigned) expected.size());
+    for (unsigned i = 0; (i < nvm_log_count) && (i < expected.size()); i++)
+    {
+        const uint8_t *record = &nvm_log_buffer[4 + NVM_LOG_RECORD_SIZE * i];
+        uint16_t time = record[0] | (record[1] << 8);
+        bool heartbeat = fmod(expected[i], MONITOR_HEARTBEAT) == 0;
+
+        printf("record %u: %u s, expected %.1f s (%s)\n", i, time, expected[i], heartbeat ? "heartbeat" : "window");
+        if (heartbeat)
+        {
+            CHECK(time == expected[i], "record %u at %u s, heartbeat at %.0f s", i, time, expected[i]);
+        }
+        else
+        {
+            CHECK(time >= expected[i] - 1 && time <= expected[i] + 1, "record %u at %u s, current stepped at %.1f s",
+                  i, time, expected[i]);
+        }
+    }
+
+    return TEST_RESULT();
+}
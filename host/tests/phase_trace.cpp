@@ -0,0 +1,99 @@
+/*
+ * PHASE_TRACE of analog-current-sensing on the simulator: each trace must
+ * hold all phases in order, the burst (phase 2 to 3) must match the model
+ * time sent with the trace, and the USART1 phase must only hold the report,
+ * not the trace of the previous measurement.
+ * With CLOCK_SCALING, TRACE_TICK_US and TRACE_ADC_MHZ are the tick and the
+ * ADC0 clock of CLOCK_MEASURE. The burst must then take the time of the
+ * model at that ADC0 clock: the same time in 1 us ticks with
+ * CLOCK_MIN_ENERGY, less than half the model time with CLOCK_MIN_LATENCY
+ */
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+int firmware_main(void);
+
+#ifndef TRACE_TICK_US
+    #define TRACE_TICK_US 0.2                                   // CLK_PER / 2 at 10 MHz
+#endif
+#ifndef TRACE_ADC_MHZ
+    #define TRACE_ADC_MHZ 1.0                                   // F_CPU / ADC_PRESC_DIV
+#endif
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = 65.0;
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    std::string text = sim_uart_text();
+    double tick_us = 2.0 / 10.0;                                    // Model and USART1 phase ticks, 10 MHz
+    double byte_us = 10.0 * 1e6 / 115200;
+    // Model burst at TRACE_ADC_MHZ: ADC_SAMPDUR 12, 16 samples, PGA on (MODEL_PGA_NS 3 us)
+    double burst_us = ((12 + 2) * 16 + 14) / TRACE_ADC_MHZ + 16 * 3.0;
+    double shortest_us = 1e9;
+    int traces = 0;
+
+    for (size_t pos = text.find("Trace:"); pos != std::string::npos; pos = text.find("Trace:", pos + 1))
+    {
+        std::string line = text.substr(pos, text.find('\n', pos) - pos);
+        long ticks[8];
+        int phases = 0;
+        long model_init = 0;
+        long model_burst = 0;
+        const char *p = line.c_str() + 6;
+        char *end;
+
+        traces++;
+        while (phases < 8)
+        {
+            long phase = strtol(p, &end, 10);
+            if ((end == p) || (*end != ':') || (phase != phases))
+            {
+                break;
+            }
+            ticks[phases++] = strtol(end + 1, &end, 10);
+            p = end;
+        }
+        CHECK(phases == 8, "%d phases in \"%s\"", phases, line.c_str());
+        CHECK(sscanf(p, " model %ld,%ld", &model_init, &model_burst) == 2, "no model in \"%s\"", line.c_str());
+        if (phases < 8)
+        {
+            continue;
+        }
+        for (int i = 1; i < 8; i++)
+        {
+            CHECK(ticks[i] >= ticks[i - 1], "phase %d before phase %d in \"%s\"", i, i - 1, line.c_str());
+        }
+        double measured_us = (ticks[3] - ticks[2]) * TRACE_TICK_US;
+        CHECK(fabs(measured_us - burst_us) <= burst_us / 20 + 1, "burst %ld ticks (%.1f us), model %.1f us at %.0f MHz",
+              ticks[3] - ticks[2], measured_us, burst_us, TRACE_ADC_MHZ);
+        if (TRACE_ADC_MHZ == 1.0)
+        {
+            CHECK(fabs(measured_us - model_burst * tick_us) <= model_burst * tick_us / 20 + 1,
+                  "burst %.1f us, model %ld ticks", measured_us, model_burst);
+        }
+        else
+        {
+            CHECK(2 * measured_us < model_burst * tick_us, "burst %.1f us, not shorter than the model %ld ticks",
+                  measured_us, model_burst);
+        }
+        shortest_us = (measured_us < shortest_us) ? measured_us : shortest_us;
+
+        // The report is about 50 bytes. The USART1 phase must not hold the
+        // about 60 bytes of a trace as well
+        double uart_us = (ticks[7] - ticks[5]) * tick_us;
+        CHECK(uart_us < 60 * byte_us, "USART1 phase %.0f us (%.0f bytes)", uart_us, uart_us / byte_us);
+    }
+    printf("%d traces, shortest burst %.1f us (%.1f us ticks), model %.1f us\n", traces, shortest_us, TRACE_TICK_US,
+           burst_us);
+    CHECK(traces >= 5, "%d traces", traces);
+    return TEST_RESULT();
+}
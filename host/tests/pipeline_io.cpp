@@ -0,0 +1,66 @@
+/*
+ * PIPELINE with NVM_LOG on the simulator, one measurement per second:
+ * - no USART1 byte and no flash page write overlaps an ADC0 conversion,
+ *   the report and a full log page wait until the burst is done. Built with
+ *   ADC_SLEEP, so interrupts, and with them USART1, run during the burst
+ * - each result is logged with the time it was measured, not with the time
+ *   of the next wake-up, when it is processed
+ * - with SW0 held, the last result is processed after its burst, so
+ *   nothing is left in the pipeline when the measurements stop
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+int main(void)
+{
+    const double sw0_time = 35.5;
+    sim_config cfg;
+
+    cfg.end_time = 36.5;
+    cfg.sw0.add(0, 0);
+    cfg.sw0.add(sw0_time - 0.001, 0);
+    cfg.sw0.add(sw0_time, 1);
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+
+    const sim_stats &s = sim_get_stats();
+    printf("%ld bytes sent, %ld while converting; %ld flash writes, %ld while converting\n", s.uart_bytes,
+           s.uart_bytes_converting, s.flash_writes, s.flash_writes_converting);
+    CHECK(s.uart_bytes > 0 && s.flash_writes > 0, "nothing sent or written");
+    CHECK(s.uart_bytes_converting == 0, "%ld bytes sent while ADC0 converts", s.uart_bytes_converting);
+    CHECK(s.flash_writes_converting == 0, "%ld flash writes while ADC0 converts", s.flash_writes_converting);
+
+    // All records, the written pages and the page in SRAM, in order
+    std::vector<uint16_t> times;
+    for (int p = 0; p < NVM_LOG_PAGES; p++)
+    {
+        const uint8_t *page = NVM_LOG_PAGE(p);
+        if (nvm_log_valid(page))
+        {
+            for (int i = 0; i < page[3]; i++)
+            {
+                times.push_back(page[4 + NVM_LOG_RECORD_SIZE * i] | (page[5 + NVM_LOG_RECORD_SIZE * i] << 8));
+            }
+        }
+    }
+    for (int i = 0; i < nvm_log_count; i++)
+    {
+        times.push_back(nvm_log_buffer[4 + NVM_LOG_RECORD_SIZE * i] | (nvm_log_buffer[5 + NVM_LOG_RECORD_SIZE * i] << 8));
+    }
+
+    // One measurement per PIT second from the first wake-up on, the last one with SW0 held
+    unsigned expected = (unsigned) cfg.end_time;
+    CHECK(times.size() == expected, "%u records, %u measurements", (unsigned) times.size(), expected);
+    CHECK(!pipe_valid, "a result is still in the pipeline with SW0 held");
+    for (unsigned i = 0; i < times.size(); i++)
+    {
+        CHECK(times[i] == i + 1, "record %u at %u s, measured at %u s", i, times[i], i + 1);
+    }
+
+    return TEST_RESULT();
+}
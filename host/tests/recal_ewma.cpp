@@ -0,0 +1,92 @@
+/*
+ * RECALIBRATE offset and bias tracking of analog-current-sensing on the
+ * simulator, without noise. An estimate that starts the same distance
+ * above and below the converted value must end the same distance from it
+ * on both sides, less than half an EWMA step (1/2^RECAL_EWMA_SHIFT)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+_Static_assert(RECAL_Q >= RECAL_EWMA_SHIFT, "converted() needs RECAL_Q >= RECAL_EWMA_SHIFT");
+
+#define START_DISTANCE (200 * (1 << RECAL_Q) + 5)          // Q4, not a multiple of the EWMA step
+
+// Estimate after many offset (phase 0) or bias (phase 1) conversions from start
+static int32_t converge(int32_t *est, uint8_t phase, int32_t start)
+{
+    *est = start;
+    for (int i = 0; i < 200; i++)
+    {
+        recal_phase = phase;
+        recal_count = RECAL_RATIO - 1;
+        recal_step();
+    }
+    return *est;
+}
+
+// Converted value (Q4) of an offset or bias conversion: with all estimates 0, one step
+// moves the estimate to value / 2^RECAL_EWMA_SHIFT, exactly as RECAL_Q >= RECAL_EWMA_SHIFT
+static int32_t converted(int32_t *est, uint8_t phase)
+{
+    recal_offset_est = 0;
+    recal_center_est = 0;
+    recal_phase = phase;
+    recal_count = RECAL_RATIO - 1;
+    recal_step();
+    return *est * (1 << RECAL_EWMA_SHIFT);
+}
+
+static void check_symmetric(const char *name, int32_t *est, uint8_t phase, int32_t target)
+{
+    int32_t above = converge(est, phase, target + START_DISTANCE) - target;
+    int32_t below = converge(est, phase, target - START_DISTANCE) - target;
+
+    printf("%s: target %ld, from above %+ld, from below %+ld (1/%d code)\n", name, (long) target, (long) above,
+           (long) below, 1 << RECAL_Q);
+    CHECK(above == -below, "%s: %+ld from above, %+ld from below", name, (long) above, (long) below);
+    CHECK(above >= 0 && above < (1 << RECAL_EWMA_SHIFT) / 2, "%s: %+ld from above", name, (long) above);
+}
+
+static int test_main(void)
+{
+    int32_t offset;
+    int32_t bias;
+
+    init_clock();
+    init_PORT();
+    init_VREF();
+    init_DAC0();
+    init_ADC0();
+    measure_offset_bias();
+    recal_reset();
+    set_DAC0_output();
+    DAC0.CTRLA = DAC_CTRLA_ON;
+    ADC0.CTRLA = ADC_CTRLA_ON;
+
+    _delay_us(1000);                                        // PGA settled after it is enabled
+    offset = converted(&recal_offset_est, 0);
+    bias = converted(&recal_center_est, 1) - offset;            // The bias conversion is offset + bias
+
+    check_symmetric("offset", &recal_offset_est, 0, offset);
+    recal_offset_est = offset;
+    check_symmetric("bias", &recal_center_est, 1, bias);
+
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.noise_lsb = 0;
+    cfg.end_time = 10.0;
+    sim_init(cfg);
+    int errors = sim_run(test_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    return TEST_RESULT();
+}
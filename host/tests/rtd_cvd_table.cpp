@@ -0,0 +1,122 @@
+/*
+ * RTD_CVD_TABLE of analog-voltage-sensing against the exact inverse of the
+ * Callendar-Van Dusen equation, for every accumulated result from -200 to
+ * 850 C, and the clamping outside that range. Checks the table size and the
+ * maximum error (rounded up to 0.01 C) against the RTD_CVD_X_SHIFT row of
+ * the table in the README (README_PATH), in the PT100 or PT1000 column
+ * (CVD_COLUMN)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "test.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// Exact temperature for resistance r, by bisection of the equation
+static double cvd_temperature(double r)
+{
+    double lo = -250;
+    double hi = 900;
+
+    for (int i = 0; i < 100; i++)
+    {
+        double mid = (lo + hi) / 2;
+        if (RTD_CVD_R(mid) < r)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo + hi) / 2;
+}
+
+// Cells of the README table row that starts with "|<shift> |"
+static bool readme_row(int shift, std::vector<std::string> &cells)
+{
+    FILE *f = fopen(README_PATH, "r");
+    char line[512];
+    std::string start = "|" + std::to_string(shift) + " |";
+
+    if (!f)
+    {
+        return false;
+    }
+    while (fgets(line, sizeof(line), f))
+    {
+        std::string s(line);
+        if (s.compare(0, start.size(), start) != 0)
+        {
+            continue;
+        }
+        cells.clear();
+        size_t pos = 1;
+        size_t bar;
+        while ((bar = s.find('|', pos)) != std::string::npos)
+        {
+            cells.push_back(s.substr(pos, bar - pos));
+            pos = bar + 1;
+        }
+        cells.push_back(s.substr(pos));
+        fclose(f);
+        return true;
+    }
+    fclose(f);
+    return false;
+}
+
+int main(void)
+{
+    const double x_full = RTD_X_FULL;
+    const long x_min = (long) ceil(RTD_CVD_XF(RTD_CVD_T_MIN));
+    const long x_max = (long) floor(RTD_CVD_XF(RTD_CVD_T_MAX));
+    double max_error = 0;
+    double max_error_t = 0;
+    double step = 0;
+
+    for (long x = x_min; x <= x_max; x++)
+    {
+        double t = cvd_temperature(RTD_R_FIXED * x / (x_full - x));
+        double error = fabs(rtd_cvd_temperature((uint16_t) x) / 100.0 - t);
+        double next = cvd_temperature(RTD_R_FIXED * (x + 1) / (x_full - x - 1));
+
+        if (error > max_error)
+        {
+            max_error = error;
+            max_error_t = t;
+        }
+        step = (next - t > step) ? next - t : step;
+    }
+    CHECK(rtd_cvd_temperature(0) == RTD_CVD_T_MIN * 100, "x = 0: %ld", (long) rtd_cvd_temperature(0));
+    CHECK(rtd_cvd_temperature(32767) == RTD_CVD_T_MAX * 100, "x = 32767: %ld", (long) rtd_cvd_temperature(32767));
+    CHECK(sizeof(rtdCvdTable) / sizeof(rtdCvdTable[0]) == RTD_CVD_COUNT, "%d entries",
+          (int) (sizeof(rtdCvdTable) / sizeof(rtdCvdTable[0])));
+
+    printf("RTD_R0 %.0f, RTD_GAIN %d, RTD_CVD_X_SHIFT %d: x %ld ... %ld, %d entries, %d bytes\n", RTD_R0, RTD_GAIN,
+           RTD_CVD_X_SHIFT, x_min, x_max, (int) RTD_CVD_COUNT, (int) sizeof(rtdCvdTable));
+    printf("max error %.4f C at %.1f C, largest step of x %.3f C\n", max_error, max_error_t, step);
+
+    std::vector<std::string> cells;
+    CHECK(readme_row(RTD_CVD_X_SHIFT, cells) && cells.size() >= 5, "no README row for RTD_CVD_X_SHIFT %d",
+          RTD_CVD_X_SHIFT);
+    if (cells.size() >= 5)
+    {
+        int entries = atoi(cells[1].c_str());
+        int bytes = atoi(cells[2].c_str());
+        double readme_error = atof(cells[3 + CVD_COLUMN].c_str());
+
+        CHECK(entries == RTD_CVD_COUNT, "README: %d entries, table: %d", entries, (int) RTD_CVD_COUNT);
+        CHECK(bytes == (int) sizeof(rtdCvdTable), "README: %d bytes, table: %d", bytes, (int) sizeof(rtdCvdTable));
+        // The README gives the maximum error rounded up to 0.01 C
+        CHECK(readme_error >= max_error && readme_error - max_error < 0.01, "README: max error %.2f C, table: %.4f C",
+              readme_error, max_error);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,80 @@
+/*
+ * FIXED_POINT resistance and temperature of analog-voltage-sensing against
+ * the float code and a double reference, for every accumulated result from
+ * 0 to the ADC0 limit of 16 x 2047. Prints the error and the host time of
+ * both conversions (a relative cost only, the AVR has no FPU and no divider)
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "bench.h"
+#include "test.h"
+
+#include <math.h>
+
+struct error_stats
+{
+    double max = 0;
+    double sum = 0;
+    long count = 0;
+
+    void add(double error)
+    {
+        error = fabs(error);
+        max = (error > max) ? error : max;
+        sum += error;
+        count++;
+    }
+    double mean() const { return sum / count; }
+};
+
+// The float code of main(), 32-bit float as on the AVR
+static float float_resistance(int32_t x)
+{
+    float xAverage = ((float) x)/16.0f;
+    return (xAverage * 1800.0f)/((float) (0.992*RTD_GAIN*2048.0) - xAverage);
+}
+
+int main(void)
+{
+    const double x_full = 0.992 * RTD_GAIN * 2048.0 * 16.0;
+    error_stats r_fix, t_fix, r_float, t_float;
+
+    for (int32_t x = 0; x <= 16 * 2047; x++)
+    {
+        double r = x * RTD_R_FIXED / (x_full - x);
+        double t = (r - RTD_R0) / RTD_ALPHA;
+        uint32_t r_q6 = rtd_resistance(x);
+        float rf = float_resistance(x);
+
+        r_fix.add(r_q6 / 64.0 - r);
+        t_fix.add(rtd_temperature(r_q6) / 100.0 - t);
+        r_float.add(rf - r);
+        t_float.add((rf - 100.0f) / 0.385f - t);
+    }
+
+    printf("accumulated result 0 ... %d, RTD_GAIN %d\n", 16 * 2047, RTD_GAIN);
+    printf("                 max error  mean error\n");
+    printf("fixed   mOhm   %11.3f %11.3f\n", r_fix.max * 1e3, r_fix.mean() * 1e3);
+    printf("fixed   mC     %11.3f %11.3f\n", t_fix.max * 1e3, t_fix.mean() * 1e3);
+    printf("float   mOhm   %11.3f %11.3f\n", r_float.max * 1e3, r_float.mean() * 1e3);
+    printf("float   mC     %11.3f %11.3f\n", t_float.max * 1e3, t_float.mean() * 1e3);
+
+    double fix_ns = bench_ns(0, 16 * 2047, [](long x) {
+        bench_keep(rtd_temperature(rtd_resistance(x)));
+    });
+    double float_ns = bench_ns(0, 16 * 2047, [](long x) {
+        bench_keep((float_resistance(x) - 100.0f) / 0.385f);
+    });
+    printf("host time per result: fixed %.2f ns, float %.2f ns\n", fix_ns, float_ns);
+
+    // Resistance: rounding to 1/64 Ohm, plus the rounding of RTD_X_FULL (below
+    // 0.5) at the largest x. Temperature: that, plus rounding to 1/100 C and
+    // of RTD_T_SCALE
+    double r_bound = 0.5 / 64 + 0.5 * 16 * 2047 * RTD_R_FIXED / ((x_full - 16 * 2047) * (x_full - 16 * 2047));
+    double t_bound = r_bound / RTD_ALPHA + 0.005 + 0.5 / (1L << RTD_T_SHIFT) * r_fix.max / RTD_ALPHA;
+    CHECK(r_fix.max <= r_bound, "resistance error %.4f Ohm, bound %.4f Ohm", r_fix.max, r_bound);
+    CHECK(t_fix.max <= t_bound + 0.01, "temperature error %.4f C, bound %.4f C", t_fix.max, t_bound + 0.01);
+    return TEST_RESULT();
+}
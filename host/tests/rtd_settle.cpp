@@ -0,0 +1,65 @@
+/*
+ * SETTLE_CAL of analog-voltage-sensing on the simulator, for PGA time
+ * constants from 1 to 300 us:
+ * - the calibrated settling time grows with the time constant, and it is
+ *   at most two RTC ticks longer than the time the PGA error of the model
+ *   needs to get within SETTLE_TOL LSB
+ * - the last burst result is within SETTLE_TOL LSB (mean of 16 samples)
+ *   plus one LSB of noise of the settled result
+ * - the CPU sleeps during the calibration and the waits: it is awake for
+ *   less than 1% of the run
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+#define TICK_S (1.0 / 32768)
+
+int main(void)
+{
+    const double taus_us[] = { 1, 3, 10, 30, 100, 200, 300 };
+    uint8_t last_ticks = 0;
+
+    for (double tau : taus_us)
+    {
+        sim_config cfg;
+        cfg.board = SIM_BOARD_RTD;
+        cfg.pga_tau_us = tau;
+        cfg.end_time = 3.0;
+        cfg.temp_c.set(25.0);
+        sim_init(cfg);
+        int errors = sim_run(firmware_main);
+        const sim_stats &s = sim_get_stats();
+        CHECK(errors == 0, "tau %.0f us: %d simulator errors", tau, errors);
+
+        // Time until the PGA error at the ADC0 input is within SETTLE_TOL LSB, VREFA is the DAC output
+        double error_lsb = cfg.pga_error_v * RTD_GAIN / (RTD_DAC_DATA * cfg.vdd / 1024) * 2048;
+        double t_model = (error_lsb > SETTLE_TOL) ? tau * 1e-6 * log(error_lsb / SETTLE_TOL) : 0;
+        int bound = (int) ceil(t_model / TICK_S) + 2;
+        bound = (bound < SETTLE_MIN_TICKS + 1) ? SETTLE_MIN_TICKS + 1 : bound;
+
+        // Settled burst as in voltage_sensing_run, the example does not chop
+        double r = sim_rtd_ohm(25.0);
+        double x = 16 * (RTD_GAIN * 2048.0 * r / (r + cfg.rtd_fixed) + cfg.offset_lsb + cfg.residual_lsb);
+        int32_t result = (int32_t) sim_ADC0.RESULT.raw;
+
+        printf("tau %5.1f us: settled after %2u ticks (%4.0f us), model %4.0f us; last burst %+.2f LSB; "
+               "%.2f ms awake in %.0f s\n", tau, settleTicks, settleTicks * TICK_S * 1e6, t_model * 1e6,
+               (result - x) / 16, s.t_active * 1e3, cfg.end_time);
+        CHECK(settleTicks >= last_ticks, "tau %.0f us: %u ticks, less than %u with a shorter tau", tau, settleTicks,
+              last_ticks);
+        CHECK(settleTicks <= bound, "tau %.0f us: %u ticks, model needs %u at most", tau, settleTicks, bound);
+        CHECK(fabs(result - x) <= (SETTLE_TOL + 1) * 16, "tau %.0f us: last burst %.2f LSB from the settled result",
+              tau, (result - x) / 16);
+        CHECK(s.t_active < 0.01 * cfg.end_time, "tau %.0f us: awake %.2f ms", tau, s.t_active * 1e3);
+        last_ticks = settleTicks;
+    }
+    CHECK(last_ticks > SETTLE_MIN_TICKS + 1, "the slowest PGA settles within the shortest wait");
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,118 @@
+/*
+ * SETTLE_CAL on the simulator, for PGA time constants from 1 to 300 us:
+ * - the calibrated settling time grows with the time constant, and it is
+ *   at most two RTC ticks longer than the time the PGA error of the model
+ *   needs to get within SETTLE_TOL LSB
+ * - bursts after the calibrated wait are within SETTLE_TOL LSB (mean of
+ *   16 samples) of a settled burst, plus 3 sigma of the noise of the
+ *   difference of two such means: the calibration may stop at a try that
+ *   noise brought within the tolerance
+ * - the CPU sleeps during the calibration, it is only awake for the bursts
+ * Built with and without ADC_SLEEP: the waits with ADC0 on are in standby
+ * or in idle, the waits with the analog chain off always in standby
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+#define TICK_S (1.0 / 32768)
+#define TRIES 8
+#define NOISE_LSB (3 * 0.5 * 1.414 / 4)                     // 3 sigma, two means of 16 samples of 0.5 LSB noise
+
+static int32_t max_diff;
+static double t_calibrate;
+static double t_awake;
+static double t_asleep;
+static double t_standby;
+
+static int test_main(void)
+{
+    init_clock();
+    init_PORT();
+    init_VREF();
+    init_DAC0();
+    init_ADC0();
+    measure_offset_bias();                                  // Leaves ADC0 on the measurement inputs, as in main()
+    set_DAC0_output();
+    init_RTC_PIT();
+
+    sim_stats before = sim_get_stats();
+    double start = sim_time();
+    settle_calibrate();
+    const sim_stats &after = sim_get_stats();
+    t_calibrate = sim_time() - start;
+    t_awake = after.t_active - before.t_active;
+    t_asleep = after.t_idle + after.t_standby - before.t_idle - before.t_standby;
+    t_standby = after.t_standby - before.t_standby;
+
+    // Settled burst, then bursts after the calibrated wait as in do_ADC0_measurement()
+    ADC0.CTRLF = ADC_CHOPPING_bm | ADC_SAMPNUM_ACC16_gc;
+    DAC0.CTRLA = DAC_CTRLA_ON;
+    ADC0.CTRLA = ADC_CTRLA_ON;
+    settle_wait(SETTLE_MAX_TICKS * 4);
+    int32_t settled = settle_sample();
+    max_diff = 0;
+    for (int i = 0; i < TRIES; i++)
+    {
+        ADC0.CTRLA = 0;
+        DAC0.CTRLA = 0;
+        settle_wait(SETTLE_OFF_TICKS);
+        DAC0.CTRLA = DAC_CTRLA_ON;
+        ADC0.CTRLA = ADC_CTRLA_ON;
+        settle_wait(settle_ticks);
+        int32_t diff = labs(settle_sample() - settled);
+        max_diff = (diff > max_diff) ? diff : max_diff;
+    }
+
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    const double taus_us[] = { 1, 3, 10, 30, 100, 200, 300 };
+    uint8_t last_ticks = 0;
+
+    for (double tau : taus_us)
+    {
+        sim_config cfg;
+        cfg.pga_tau_us = tau;
+        cfg.end_time = 10.0;
+        sim_init(cfg);
+        int errors = sim_run(test_main);
+        CHECK(errors == 0, "tau %.0f us: %d simulator errors", tau, errors);
+
+        // Time until the PGA error at the ADC0 input is within SETTLE_TOL LSB
+        double error_lsb = cfg.pga_error_v * ADC_GAIN / ADC_REF * 2048;
+        double t_model = (error_lsb > SETTLE_TOL) ? tau * 1e-6 * log(error_lsb / SETTLE_TOL) : 0;
+        int bound = (int) ceil(t_model / TICK_S) + 2;
+        bound = (bound < SETTLE_MIN_TICKS + 1) ? SETTLE_MIN_TICKS + 1 : bound;
+
+        printf("tau %5.1f us: settled after %2u ticks (%4.0f us), model %4.0f us; max burst error %.2f LSB; "
+               "calibration %.0f ms, %.2f ms awake, %.0f ms in standby\n", tau, settle_ticks,
+               settle_ticks * TICK_S * 1e6, t_model * 1e6, max_diff / 16.0, t_calibrate * 1e3, t_awake * 1e3,
+               t_standby * 1e3);
+        CHECK(settle_ticks >= last_ticks, "tau %.0f us: %u ticks, less than %u with a shorter tau", tau,
+              settle_ticks, last_ticks);
+        CHECK(settle_ticks <= bound, "tau %.0f us: %u ticks, model needs %u at most", tau, settle_ticks, bound);
+        CHECK(max_diff <= (SETTLE_TOL + NOISE_LSB) * 16, "tau %.0f us: burst %.2f LSB from the settled burst", tau,
+              max_diff / 16.0);
+        CHECK(t_awake < 0.05 * t_calibrate, "tau %.0f us: awake %.2f ms of %.0f ms", tau, t_awake * 1e3,
+              t_calibrate * 1e3);
+        CHECK(t_asleep > 0.95 * t_calibrate, "tau %.0f us: asleep %.2f ms of %.0f ms", tau, t_asleep * 1e3,
+              t_calibrate * 1e3);
+#ifdef ADC_SLEEP
+        CHECK(t_standby > 0.95 * t_calibrate, "tau %.0f us: %.2f ms of %.0f ms in standby", tau, t_standby * 1e3,
+              t_calibrate * 1e3);
+#endif
+        last_ticks = settle_ticks;
+    }
+    CHECK(last_ticks > SETTLE_MIN_TICKS + 1, "the slowest PGA settles within the shortest wait");
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,104 @@
+/*
+ * WINDOW_STATS statistics of analog-current-sensing against a double
+ * reference: min, max, the Q8 mean of stats_mean() and the Q8 standard
+ * deviation from stats_variance() and stats_sqrt(), for constant, ramp,
+ * noisy, negative, 17-bit and AUTO_RANGE (22-bit) results and windows of
+ * 2 to 65534 results. Built with STATS_WINDOW 65535, so a sequence never
+ * ends the window and the statistics can be read after the last stats_add()
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "test.h"
+
+#include <math.h>
+#include <random>
+#include <vector>
+
+static double max_mean_error = 0;
+static double max_stddev_error = 0;
+
+// Add the results to a new window and compare with the double reference, errors in ADC codes
+static void check_window(const char *name, const std::vector<int32_t> &x)
+{
+    double sum = 0;
+    int32_t lo = x[0];
+    int32_t hi = x[0];
+
+    stats_count = 0;
+    for (int32_t v : x)
+    {
+        stats_add(v);
+        sum += v;
+        lo = (v < lo) ? v : lo;
+        hi = (v > hi) ? v : hi;
+    }
+    double mean = sum / x.size();
+    double m2 = 0;
+    for (int32_t v : x)
+    {
+        m2 += (v - mean) * (v - mean);
+    }
+    double stddev = sqrt(m2 / (x.size() - 1));
+
+    double q8_mean = stats_mean() / 256.0;
+    double q8_stddev = stats_sqrt(stats_variance()) / 256.0;
+    double mean_error = fabs(q8_mean - mean);
+    double stddev_error = fabs(q8_stddev - stddev);
+
+    printf("%-22s n %5u mean %12.4f error %.5f, stddev %10.4f error %.5f\n", name, stats_count, mean,
+           mean_error, stddev, stddev_error);
+    CHECK(stats_count == x.size(), "%s: %u results counted, %u added", name, stats_count, (unsigned) x.size());
+    CHECK(stats_min == lo && stats_max == hi, "%s: min %ld max %ld, expected %ld %ld", name, (long) stats_min,
+          (long) stats_max, (long) lo, (long) hi);
+    // The sums are exact, only the Q8 mean is rounded and the Q8 stddev rounded down
+    CHECK(mean_error <= 0.5 / 256 + 1e-9, "%s: mean error %.5f codes", name, mean_error);
+    CHECK(stddev_error <= 1.0 / 256 + 1e-9, "%s: stddev error %.5f codes", name, stddev_error);
+    max_mean_error = (mean_error > max_mean_error) ? mean_error : max_mean_error;
+    max_stddev_error = (stddev_error > max_stddev_error) ? stddev_error : max_stddev_error;
+}
+
+int main(void)
+{
+    std::mt19937 rng(18);
+    const unsigned sizes[] = { 2, 3, 60, 1000, 65534 };
+
+    for (unsigned n : sizes)
+    {
+        std::vector<int32_t> constant(n, 31000);
+        std::vector<int32_t> ramp(n);
+        std::vector<int32_t> steps(n);
+        std::vector<int32_t> small(n);
+        std::vector<int32_t> noisy(n);
+        std::vector<int32_t> negative(n);
+        std::vector<int32_t> large(n);
+        std::vector<int32_t> swing(n);
+        std::normal_distribution<double> small_noise(31000.3, 0.4);
+        std::normal_distribution<double> noise(20000.0, 30.0);
+        std::normal_distribution<double> negative_noise(-1500.0, 200.0);
+        std::normal_distribution<double> large_noise(130000.0, 2.0);
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            ramp[i] = (int32_t) (i % 4096) - 2048;
+            steps[i] = (i < n / 2) ? 0 : 65535;
+            small[i] = (int32_t) lround(small_noise(rng));
+            noisy[i] = (int32_t) lround(noise(rng));
+            negative[i] = (int32_t) lround(negative_noise(rng));
+            large[i] = (int32_t) lround(large_noise(rng));
+            swing[i] = (i & 1) ? (1L << 21) - 1 : -(1L << 21);
+        }
+        check_window("constant", constant);
+        check_window("ramp", ramp);
+        check_window("step 0 to 65535", steps);
+        check_window("noise 0.4 codes", small);
+        check_window("noise 30 codes", noisy);
+        check_window("negative", negative);
+        check_window("17-bit, noise 2 codes", large);
+        check_window("AUTO_RANGE full swing", swing);
+    }
+    printf("max error: mean %.5f codes, stddev %.5f codes\n", max_mean_error, max_stddev_error);
+
+    return TEST_RESULT();
+}
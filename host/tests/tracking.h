@@ -0,0 +1,89 @@
+/*
+ * Tracking error of a measurement schedule: between two measurements the
+ * last result is held, so the error at time t is the change of the signal
+ * since the last measurement. The ADC0 error is left out, so schedules of
+ * the simulator and fixed ones can be compared
+ */
+#ifndef HOST_TRACKING_H
+#define HOST_TRACKING_H
+
+#include "sim.h"
+
+#include <math.h>
+#include <vector>
+
+#define TRACKING_STEP_S 0.01
+
+// Measurement times from the ADC0 conversion log: conversions closer than gap_s
+// to the one before belong to the same measurement, the time is that of the last
+static inline std::vector<double> tracking_measurements(double from_s, double gap_s)
+{
+    std::vector<double> times;
+
+    for (const sim_adc_result &r : sim_adc_log())
+    {
+        double t = r.time_ps * 1e-12;
+
+        if (t < from_s)
+        {
+            continue;
+        }
+        if (!times.empty() && (t - times.back() < gap_s))
+        {
+            times.back() = t;
+        }
+        else
+        {
+            times.push_back(t);
+        }
+    }
+    return times;
+}
+
+// Every interval_s from first_s up to end_s
+static inline std::vector<double> tracking_fixed(double first_s, double interval_s, double end_s)
+{
+    std::vector<double> times;
+
+    for (double t = first_s; t < end_s; t += interval_s)
+    {
+        times.push_back(t);
+    }
+    return times;
+}
+
+// Largest error from from_s to to_s, with the result of the last measurement before
+static inline double tracking_worst(const sim_signal &signal, const std::vector<double> &times, double from_s, double to_s)
+{
+    double worst = 0;
+    size_t next = 0;
+    double held = NAN;
+
+    for (double t = from_s; t < to_s; t += TRACKING_STEP_S)
+    {
+        for (; (next < times.size()) && (times[next] <= t); next++)
+        {
+            held = signal.value(times[next]);
+        }
+        if (!isnan(held))
+        {
+            double error = fabs(signal.value(t) - held);
+            worst = (error > worst) ? error : worst;
+        }
+    }
+    return worst;
+}
+
+// Number of measurements from from_s to to_s
+static inline long tracking_count(const std::vector<double> &times, double from_s, double to_s)
+{
+    long n = 0;
+
+    for (double t : times)
+    {
+        n += (t >= from_s) && (t < to_s);
+    }
+    return n;
+}
+
+#endif
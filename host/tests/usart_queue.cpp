@@ -0,0 +1,112 @@
+/*
+ * USART1 transmit queue of analog-current-sensing on the simulated USART1:
+ * ordering over many wraparounds of the ring buffer, dropped bytes when
+ * the queue is full, back-to-back transmission, idle sleep while sending
+ * and USART1 power-down after the last byte
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+
+// Sleep until the queue is sent and USART1 is powered down
+static void wait_sent(void)
+{
+    cli();
+    while (usart1_tx_busy)
+    {
+        sei();
+        sleep_cpu();
+        cli();
+    }
+    sei();
+}
+
+static int test_main(void)
+{
+    const int long_count = USART_TX_BUFFER_SIZE * 10 + 7;
+    const int full_count = USART_TX_BUFFER_SIZE + 10;
+    double byte_s = 10.0 * 16 * USART_BAUD_VALUE / (64.0 * F_CPU);
+
+    init_clock();
+    init_PORT();
+    init_USART1();
+    SLPCTRL.CTRLA = SLEEP_MODE_PWR_DOWN | SLPCTRL_SEN_bm;
+    sei();
+
+    // Ordering: a counter pattern, ten times the queue size, wraps head and tail
+    for (int i = 0; i < long_count; i++)
+    {
+        usart1_putc_wait((uint8_t) (i * 7));
+    }
+    double t_queued = sim_time();
+    wait_sent();
+    const std::vector<sim_uart_byte> &sent = sim_uart();
+    CHECK((int) sent.size() == long_count, "%d bytes sent, %d queued", (int) sent.size(), long_count);
+    int wrong = 0;
+    for (int i = 0; i < (int) sent.size(); i++)
+    {
+        wrong += sent[i].data != (uint8_t) (i * 7);
+    }
+    CHECK(wrong == 0, "%d bytes out of order", wrong);
+    CHECK(usart1_tx_overflow == 0, "%d bytes dropped", usart1_tx_overflow);
+    // Back to back: no gaps between the bytes
+    double span = (sent.back().time_ps - sent.front().time_ps) * 1e-12;
+    CHECK(fabs(span - (long_count - 1) * byte_s) < byte_s, "%.6f s for %d bytes", span, long_count);
+    // The CPU sleeps while the queue drains, and wakes once per byte at most
+    const sim_stats &s = sim_get_stats();
+    CHECK(s.t_idle > 0.9 * long_count * byte_s, "idle %.6f s", s.t_idle);
+    CHECK(s.wakeups <= long_count + 2, "%ld wake-ups", s.wakeups);
+    // The last queued byte is followed by the rest of the queue only
+    CHECK(sim_time() - t_queued < (USART_TX_BUFFER_SIZE + 1) * byte_s, "%.6f s after the last byte was queued",
+          sim_time() - t_queued);
+    CHECK(USART1.CTRLB == 0, "USART1 not powered down");
+    CHECK((SLPCTRL.CTRLA & SLPCTRL_SMODE_gm) == SLEEP_MODE_PWR_DOWN, "sleep mode not power-down");
+
+    // Overflow: with interrupts disabled nothing is sent, so the queue fills
+    // up after USART_TX_BUFFER_SIZE - 1 bytes and the rest is dropped
+    sim_uart_clear();
+    int accepted = 0;
+    cli();
+    for (int i = 0; i < full_count; i++)
+    {
+        accepted += usart1_putc((uint8_t) i);
+    }
+    sei();
+    wait_sent();
+    CHECK(accepted == USART_TX_BUFFER_SIZE - 1, "%d bytes accepted", accepted);
+    CHECK(usart1_tx_overflow == full_count - accepted, "%d bytes counted as dropped", usart1_tx_overflow);
+    CHECK((int) sim_uart().size() == accepted, "%d bytes sent", (int) sim_uart().size());
+    wrong = 0;
+    for (int i = 0; i < (int) sim_uart().size(); i++)
+    {
+        wrong += sim_uart()[i].data != (uint8_t) i;
+    }
+    CHECK(wrong == 0, "%d bytes wrong after overflow", wrong);
+
+    // A queue that runs empty and is refilled before TXC starts up again
+    sim_uart_clear();
+    usart1_sendString("abc");
+    wait_sent();
+    usart1_sendString("defg");
+    wait_sent();
+    CHECK(sim_uart_text() == "abcdefg", "sent \"%s\"", sim_uart_text().c_str());
+
+    sim_finish();
+    return 0;
+}
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = 10.0;
+    sim_init(cfg);
+    int errors = sim_run(test_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    return TEST_RESULT();
+}
@@ -0,0 +1,36 @@
+/*
+ * Run analog-voltage-sensing for 10 s at 25 C and check the last burst
+ * result, the number of measurements and the time spent in power-down
+ */
+#include "sim.h"
+#include "test.h"
+
+#include <avr/io.h>
+#include <math.h>
+
+int firmware_main(void);
+
+int main(void)
+{
+    sim_config cfg;
+
+    cfg.board = SIM_BOARD_RTD;
+    cfg.end_time = 10.0;
+    cfg.temp_c.set(25.0);
+    sim_init(cfg);
+    int errors = sim_run(firmware_main);
+    const sim_stats &s = sim_get_stats();
+    sim_print_stats(stdout);
+
+    // x = 16 samples * (gain 16 * 2048 * R / (R + R_FIXED) + offset), VREFA
+    // cancels. The example does not chop, so the full ADC0 offset remains
+    double r = sim_rtd_ohm(25.0);
+    double x = 16 * (16 * 2048.0 * r / (r + cfg.rtd_fixed) + cfg.offset_lsb + cfg.residual_lsb);
+    int32_t result = (int32_t) sim_ADC0.RESULT.raw;
+
+    CHECK(errors == 0, "%d simulator errors", errors);
+    CHECK(fabs(result - x) < 16, "RESULT %d, expected %.0f", (int) result, x);
+    CHECK((s.conversions >= 19) && (s.conversions <= 20), "%ld conversions in 10 s", s.conversions);
+    CHECK(s.t_power_down > 0.99 * cfg.end_time, "power-down %.3f s", s.t_power_down);
+    return TEST_RESULT();
+}
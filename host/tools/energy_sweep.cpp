@@ -0,0 +1,630 @@
+/*
+ * energy_sweep: average supply current of analog-current-sensing against
+ * resolution and reporting latency
+ *
+ *   energy_sweep [--all] [--no-check] [--noise L] [--calc-us T] [--vdd V]
+ *                [--current NAME=UA ...]
+ *
+ * The tool includes main.c, so the settings that are not swept, the
+ * t_init and t_conv formulas (MODEL_*) and the baud rate formula
+ * (USART_BAUD_REG) are those of the firmware. For each combination of
+ *   F_CPU          20 MHz OSCHF / 2, 4, 6, 8, 10 or 16
+ *   ADC_PRESC_DIV  all ADC0 prescaler settings
+ *   ADC_SAMPLES    1 to 1024
+ *   PGA            off, or on with bias 100%, 75%, 50% or 25%
+ *   WAKEUP_TIME    1 to 60 s
+ *   BAUD_RATE      9600 to 460800
+ * that meets the f_CLK_ADC and baud rate limits, the model gives the time
+ * of each phase of one measurement period (a sim_stats), and the charge
+ * is the sum of the phase times multiplied by the phase currents:
+ *   I_avg = (sum I_phase * t_phase) / WAKEUP_TIME
+ * The noise of a result is the noise of the adc_enob test (--noise LSB
+ * per sample, rounding and the scaling of adc0_wait_result()), referred
+ * to the input current through R_SENSE. The reporting latency is the
+ * longest time from a change of the current to the end of its report:
+ * WAKEUP_TIME plus t_init, the bursts, the calculations and the report.
+ *
+ * The table lists the settings on the Pareto front of average current,
+ * noise and latency (no other setting is better in one and not worse in
+ * the others), or all settings with --all.
+ *
+ * The check runs the firmware of this build on the simulator for ten
+ * measurement periods after the start-up, and compares the phase times
+ * and the average current with the model for the settings of the build.
+ * It also times bursts on the simulated ADC0 for each PGA bias at several
+ * main clocks and prescalers. The simulator counts no CPU time for the
+ * calculations, so the check uses --calc-us 0. The exit code is 1 if a
+ * check fails
+ */
+#define main firmware_main
+#include FIRMWARE_SOURCE
+#undef main
+
+#include "sim.h"
+#include "test.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifndef ENERGY_TABLE
+    #define ENERGY_TABLE 1                  // 0: the check only, for the builds with other settings
+#endif
+
+#define OSCHF_HZ 20000000UL
+#define CHECK_PERIODS 10
+
+// CPU cycles of the register accesses and interrupts that the simulator counts for each part of a
+// measurement period, from its phase times. The calculations are not included (--calc-us)
+#define CYCLES_WAKEUP 25                    // PIT interrupt and the wake-up test in main(), each second
+#define CYCLES_MEASURE 48                   // do_ADC0_measurement() without the bursts, and the TXC interrupt
+#define CYCLES_ANALOG 2                     // ADC0 on, besides t_init and the bursts
+#define CYCLES_BURST 6                      // Start a burst and read its result
+#define CYCLES_ADC_ISR 33                   // Wake-up from ISR(ADC0_RESRDY_vect), with ADC_SLEEP
+#define CYCLES_DAC 4                        // DAC0 on before and after ADC0
+#define CYCLES_LED 8                        // LED0 on before and after the measurement, with LED_ON
+#define CYCLES_QUEUE 12                     // Queue a byte of the report
+#define CYCLES_DRE 27                       // Send a byte from ISR(USART1_DRE_vect)
+#define CYCLES_USART 30                     // USART1 on before the first byte and after the last one
+#define CYCLES_TXC 16                       // ISR(USART1_TXC_vect), USART1 on and the CPU awake
+
+#ifdef BINARY_OUTPUT
+    #define REPORT_BYTES 8                  // Measurement frame, COBS coded with the delimiter
+#else
+    #define REPORT_BYTES 50                 // "Measured voltage: 0.0476V\nMeasured current: 4.8uA\n"
+#endif
+
+// Supply current of each phase in uA at 3.3 V, typical values of the data sheet (--current NAME=UA)
+struct phase_current
+{
+    const char *name;
+    double ua;
+};
+
+static phase_current currents[] =
+{
+    { "active", 300.0 },                    // CPU active, per MHz of CLK_PER
+    { "idle", 100.0 },                      // CPU in idle, per MHz of CLK_PER
+    { "standby", 0.7 },                     // Standby, RTC on OSC32K
+    { "power_down", 0.7 },                  // Power-down, RTC PIT on OSC32K
+    { "adc", 250.0 },                       // ADC0 on, with VREF
+    { "pga", 25.0 },                        // PGA on at bias 100%, less at a lower bias
+    { "dac", 100.0 },                       // DAC0 output on
+    { "usart", 5.0 },                       // USART1 TX on
+    { "led", 1000.0 },                      // LED0 on (with LED_ON)
+};
+enum { I_ACTIVE, I_IDLE, I_STANDBY, I_POWER_DOWN, I_ADC, I_PGA, I_DAC, I_USART, I_LED };
+
+// PGA bias: ADCPGASAMPDUR and the highest f_CLK_ADC of the data sheet. Bias 0 is the PGA off
+struct pga_bias
+{
+    int percent;
+    uint8_t bias_sel;
+    uint64_t sample_ns;
+    uint32_t max_clk_adc;
+};
+
+static const pga_bias biases[] =
+{
+    { 0, 0, 0, 6000000 },
+    { 100, ADC_PGABIASSEL_100PCT_gc, 3000, 6000000 },
+    { 75, ADC_PGABIASSEL_75PCT_gc, 4000, 4500000 },
+    { 50, ADC_PGABIASSEL_50PCT_gc, 6000, 3000000 },
+    { 25, ADC_PGABIASSEL_25PCT_gc, 12000, 1500000 },
+};
+
+struct prescaler
+{
+    int div;
+    uint8_t sel;
+};
+
+static const prescaler main_prescalers[] =
+{
+    { 2, CLKCTRL_PDIV_DIV2_gc }, { 4, CLKCTRL_PDIV_DIV4_gc }, { 6, CLKCTRL_PDIV_DIV6_gc },
+    { 8, CLKCTRL_PDIV_DIV8_gc }, { 10, CLKCTRL_PDIV_DIV10_gc }, { 16, CLKCTRL_PDIV_DIV16_gc },
+};
+
+static const prescaler adc_prescalers[] =
+{
+    { 2, ADC_PRESC_DIV2_gc }, { 4, ADC_PRESC_DIV4_gc }, { 6, ADC_PRESC_DIV6_gc }, { 8, ADC_PRESC_DIV8_gc },
+    { 10, ADC_PRESC_DIV10_gc }, { 12, ADC_PRESC_DIV12_gc }, { 14, ADC_PRESC_DIV14_gc },
+    { 16, ADC_PRESC_DIV16_gc }, { 20, ADC_PRESC_DIV20_gc }, { 24, ADC_PRESC_DIV24_gc },
+    { 28, ADC_PRESC_DIV28_gc }, { 32, ADC_PRESC_DIV32_gc }, { 40, ADC_PRESC_DIV40_gc },
+    { 48, ADC_PRESC_DIV48_gc }, { 56, ADC_PRESC_DIV56_gc }, { 64, ADC_PRESC_DIV64_gc },
+};
+
+static const int wakeup_times[] = { 1, 2, 5, 10, 30, 60 };
+static const uint32_t baud_rates[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800 };
+
+struct setting
+{
+    uint32_t f_cpu;
+    int presc;
+    int samples;
+    const pga_bias *pga;
+    int wakeup;
+    uint32_t baud;
+};
+
+struct point
+{
+    setting s;
+    double ua;                              // Average supply current
+    double uj;                              // Energy per result
+    double noise_na;                        // Input-referred rms noise of a result
+    double enob;
+    double latency;                         // Seconds
+};
+
+static double noise_lsb = 0.5;
+static double calc_s = 0.0;
+static double vdd = 3.3;
+
+// Burst of ADC_SAMPLES (MODEL_T_CONV_NS) for these settings
+static uint64_t conv_ns(const setting &s)
+{
+    uint64_t clk_hz = s.f_cpu / s.presc;
+
+    if (s.pga->percent)
+    {
+        return MODEL_CONV_PGA_NS(ADC_SAMPDUR, (uint64_t) s.samples, clk_hz, s.pga->sample_ns);
+    }
+    return MODEL_CONV_ADC_NS(ADC_SAMPDUR, (uint64_t) s.samples, clk_hz);
+}
+
+static double report_time(const setting &s)
+{
+    #ifdef USART_ON
+        double baud = 64.0 * s.f_cpu / (16.0 * USART_BAUD_REG(s.f_cpu, s.baud));
+        return REPORT_BYTES * 10.0 / baud;                  // Start, 8 data and stop bit
+    #else
+        (void) s;
+        return 0;
+    #endif
+}
+
+// Phase times of one measurement period, in the fields of the simulator statistics
+static sim_stats model(const setting &s)
+{
+    sim_stats m;
+    const int bursts = 1 << ADC_DECIMATE_SHIFT;
+    double cycle = 1.0 / s.f_cpu;
+    double t_init = (s.pga->percent ? MODEL_T_INIT_PGA_NS : MODEL_T_INIT_ADC_NS) * 1e-9;
+    double t_burst = (conv_ns(s) << ADC_DECIMATE_SHIFT) * 1e-9;
+    long cpu = s.wakeup * CYCLES_WAKEUP + CYCLES_MEASURE + (bursts - 1) * CYCLES_BURST;
+    long analog = CYCLES_ANALOG + bursts * CYCLES_BURST;
+
+    #ifdef ADC_SLEEP
+        cpu += bursts * CYCLES_ADC_ISR;
+        analog += bursts * CYCLES_ADC_ISR;
+        m.t_standby = t_burst;
+        m.t_active = t_init;
+    #else
+        m.t_active = t_init + t_burst;
+    #endif
+    m.t_adc_on = t_init + t_burst + analog * cycle;
+    m.t_pga_on = s.pga->percent ? m.t_adc_on : 0;
+    m.t_dac_on = m.t_adc_on + CYCLES_DAC * cycle;
+    #ifdef USART_ON
+        cpu += REPORT_BYTES * (CYCLES_QUEUE + CYCLES_DRE);
+        m.t_usart_on = report_time(s) + (REPORT_BYTES * CYCLES_QUEUE + CYCLES_USART) * cycle;
+        m.t_idle = m.t_usart_on - (REPORT_BYTES * (CYCLES_QUEUE + CYCLES_DRE) + CYCLES_TXC) * cycle;
+        m.uart_bytes = REPORT_BYTES;
+    #endif
+    #ifdef LED_ON
+        cpu += CYCLES_LED;
+        m.t_led_on = m.t_dac_on + (CYCLES_LED + m.uart_bytes * CYCLES_QUEUE) * cycle + calc_s;
+    #endif
+    m.t_active += cpu * cycle + calc_s;
+    m.t_power_down = s.wakeup - m.t_active - m.t_idle - m.t_standby;
+    m.wakeups = s.wakeup;
+    m.conversions = bursts;
+    m.samples = (long) s.samples * bursts;
+    return m;
+}
+
+// Charge in uA*s of the phase times t, with the phase currents
+static double charge(const sim_stats &t, const setting &s)
+{
+    double mhz = s.f_cpu * 1e-6;
+
+    return t.t_active * currents[I_ACTIVE].ua * mhz + t.t_idle * currents[I_IDLE].ua * mhz
+         + t.t_standby * currents[I_STANDBY].ua + t.t_power_down * currents[I_POWER_DOWN].ua
+         + t.t_adc_on * currents[I_ADC].ua + t.t_pga_on * currents[I_PGA].ua * s.pga->percent / 100.0
+         + t.t_dac_on * currents[I_DAC].ua + t.t_usart_on * currents[I_USART].ua + t.t_led_on * currents[I_LED].ua;
+}
+
+// Rms noise of a result in LSB of ADC_SCALE_SAMPLES samples, as in the adc_enob test
+static double result_noise(int samples, int scale)
+{
+    double sample = sqrt(noise_lsb * noise_lsb + 1.0 / 12.0);
+    double result = sample * sqrt((double) samples) * scale / samples / sqrt((double) (1 << ADC_DECIMATE_SHIFT));
+
+    return (samples > scale) ? sqrt(result * result + 1.0 / 12.0) : result;
+}
+
+static point evaluate(const setting &s)
+{
+    point p;
+    int scale = (s.samples > 32) ? 32 : s.samples;          // ADC_SCALE_SAMPLES
+    int gain = s.pga->percent ? ADC_GAIN : 1;               // FP_GAIN
+    double noise = result_noise(s.samples, scale);
+
+    p.s = s;
+    p.uj = charge(model(s), s) * vdd;
+    p.ua = p.uj / vdd / s.wakeup;
+    p.noise_na = noise * ADC_REF / (2048.0 * scale * gain) / R_SENSE * 1e9;
+    p.enob = log2(2.0 * 2048.0 * scale / (sqrt(12.0) * noise));
+    p.latency = s.wakeup + (s.pga->percent ? MODEL_T_INIT_PGA_NS : MODEL_T_INIT_ADC_NS) * 1e-9
+              + (conv_ns(s) << ADC_DECIMATE_SHIFT) * 1e-9 + calc_s + report_time(s);
+    return p;
+}
+
+// Settings within the limits that main.c checks at compile time
+static bool valid(const setting &s)
+{
+    uint32_t clk_hz = s.f_cpu / s.presc;
+
+    if (clk_hz > s.pga->max_clk_adc)
+    {
+        return false;
+    }
+    #ifdef USART_ON
+        uint32_t reg = USART_BAUD_REG(s.f_cpu, s.baud);
+        uint32_t actual = (64UL * s.f_cpu) / (16UL * reg);
+        if ((reg < 64) || (actual * 1000 / s.baud > 1020) || (actual * 1000 / s.baud < 980))
+        {
+            return false;
+        }
+    #endif
+    return true;
+}
+
+static bool dominates(const point &a, const point &b)
+{
+    return (a.ua <= b.ua) && (a.noise_na <= b.noise_na) && (a.latency <= b.latency)
+        && ((a.ua < b.ua) || (a.noise_na < b.noise_na) || (a.latency < b.latency));
+}
+
+static void print_point(const point &p)
+{
+    char pga[8];
+
+    snprintf(pga, sizeof(pga), p.s.pga->percent ? "%d%%" : "off", p.s.pga->percent);
+    printf("%6.2f MHz %4d %5d %5s %4d s %7lu  %9.3f %10.3f %9.4f %5.1f %10.3f\n", p.s.f_cpu * 1e-6, p.s.presc,
+           p.s.samples, pga, p.s.wakeup, (unsigned long) p.s.baud, p.ua, p.uj, p.noise_na, p.enob, p.latency);
+}
+
+static void sweep(bool all)
+{
+    std::vector<point> points;
+
+    for (const prescaler &m : main_prescalers)
+    {
+        for (const prescaler &a : adc_prescalers)
+        {
+            for (int samples = 1; samples <= 1024; samples *= 2)
+            {
+                for (const pga_bias &b : biases)
+                {
+                    for (int w : wakeup_times)
+                    {
+                        for (uint32_t baud : baud_rates)
+                        {
+                            setting s = { (uint32_t) (OSCHF_HZ / m.div), a.div, samples, &b, w, baud };
+                            if (valid(s))
+                            {
+                                points.push_back(evaluate(s));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<point> front;
+    for (const point &p : points)
+    {
+        bool dominated = false;
+        for (const point &q : points)
+        {
+            if (dominates(q, p))
+            {
+                dominated = true;
+                break;
+            }
+        }
+        if (all || !dominated)
+        {
+            front.push_back(p);
+        }
+    }
+    std::sort(front.begin(), front.end(), [](const point &a, const point &b)
+              { return (a.latency != b.latency) ? (a.latency < b.latency) : (a.ua < b.ua); });
+
+    printf("%zu settings, %zu %s\n", points.size(), front.size(), all ? "listed" : "on the Pareto front");
+    printf("     F_CPU PRESC SAMPLES PGA WAKEUP    BAUD  I_avg (uA) uJ/result noise (nA) ENOB latency (s)\n");
+    for (const point &p : front)
+    {
+        print_point(p);
+    }
+}
+
+/*
+ * Check: phase times of the firmware of this build on the simulator
+ */
+// The firmware keeps its state in globals, so each run is in a new process
+static sim_stats run_firmware(double end_time)
+{
+    sim_stats s;
+    int fds[2];
+
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        exit(2);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        sim_config cfg;
+        cfg.end_time = end_time;
+        sim_init(cfg);
+        sim_run(firmware_main);
+        s = sim_get_stats();
+        _exit((write(fds[1], &s, sizeof(s)) == (ssize_t) sizeof(s)) ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = (pid > 0) && (read(fds[0], &s, sizeof(s)) == (ssize_t) sizeof(s));
+    close(fds[0]);
+    if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    CHECK(ok, "simulator run to %.1f s failed", end_time);
+    CHECK(s.errors == 0, "%ld simulator errors", s.errors);
+    return s;
+}
+
+static void check_time(const char *name, double simulated, double modelled)
+{
+    printf("  %-12s %12.2f us %12.2f us\n", name, simulated * 1e6, modelled * 1e6);
+    CHECK(fabs(simulated - modelled) <= 0.02 * modelled + 2e-6, "%s: %.6f s simulated, %.6f s from the model",
+          name, simulated, modelled);
+}
+
+static void check_period(void)
+{
+    setting s = { F_CPU, ADC_PRESC_DIV, ADC_SAMPLES, &biases[0], WAKEUP_TIME, BAUD_RATE };
+    #ifdef PGA_ON
+        s.pga = &biases[1];                                 // Bias 100%, as in init_ADC0()
+    #endif
+
+    // Ten periods after the start-up, between two run ends in the middle of a period
+    double start = 2.5 * WAKEUP_TIME;
+    sim_stats a = run_firmware(start);
+    sim_stats b = run_firmware(start + CHECK_PERIODS * WAKEUP_TIME);
+    sim_stats d;
+    d.t_active = (b.t_active - a.t_active) / CHECK_PERIODS;
+    d.t_idle = (b.t_idle - a.t_idle) / CHECK_PERIODS;
+    d.t_standby = (b.t_standby - a.t_standby) / CHECK_PERIODS;
+    d.t_power_down = (b.t_power_down - a.t_power_down) / CHECK_PERIODS;
+    d.t_adc_on = (b.t_adc_on - a.t_adc_on) / CHECK_PERIODS;
+    d.t_pga_on = (b.t_pga_on - a.t_pga_on) / CHECK_PERIODS;
+    d.t_dac_on = (b.t_dac_on - a.t_dac_on) / CHECK_PERIODS;
+    d.t_usart_on = (b.t_usart_on - a.t_usart_on) / CHECK_PERIODS;
+    d.t_led_on = (b.t_led_on - a.t_led_on) / CHECK_PERIODS;
+
+    sim_stats m = model(s);
+    printf("Check: F_CPU %lu Hz, ADC_PRESC_DIV %d, ADC_SAMPLES %d, PGA %s, WAKEUP_TIME %d s, BAUD_RATE %lu\n",
+           (unsigned long) s.f_cpu, s.presc, s.samples, s.pga->percent ? "100%" : "off", s.wakeup,
+           (unsigned long) s.baud);
+    printf("  phase per period  simulated        model\n");
+    check_time("CPU active", d.t_active, m.t_active);
+    check_time("CPU idle", d.t_idle, m.t_idle);
+    check_time("CPU standby", d.t_standby, m.t_standby);
+    check_time("ADC0 on", d.t_adc_on, m.t_adc_on);
+    check_time("PGA on", d.t_pga_on, m.t_pga_on);
+    check_time("DAC0 on", d.t_dac_on, m.t_dac_on);
+    check_time("USART1 on", d.t_usart_on, m.t_usart_on);
+    check_time("LED on", d.t_led_on, m.t_led_on);
+    CHECK(b.wakeups - a.wakeups >= CHECK_PERIODS * WAKEUP_TIME, "%ld wake-ups in %d periods", b.wakeups - a.wakeups,
+          CHECK_PERIODS);
+    CHECK(b.conversions - a.conversions == CHECK_PERIODS * m.conversions, "%ld conversions in %d periods",
+          b.conversions - a.conversions, CHECK_PERIODS);
+    CHECK(b.uart_bytes - a.uart_bytes == CHECK_PERIODS * m.uart_bytes, "%ld bytes in %d periods",
+          b.uart_bytes - a.uart_bytes, CHECK_PERIODS);
+
+    double q_sim = charge(d, s);
+    double q_model = charge(m, s);
+    printf("  average current %.4f uA simulated, %.4f uA from the model\n", q_sim / s.wakeup, q_model / s.wakeup);
+    CHECK(fabs(q_sim - q_model) <= 0.01 * q_model, "average current %.4f uA simulated, %.4f uA from the model",
+          q_sim / s.wakeup, q_model / s.wakeup);
+}
+
+/*
+ * Check: t_init and t_conv of the model against bursts on the simulated ADC0
+ */
+static int burst_checks;
+
+static int burst_main(void)
+{
+    static const int samples[] = { 1, 16, 256 };
+
+    init_clock();
+    init_PORT();
+    init_VREF();
+    init_DAC0();
+    init_ADC0();
+    measure_offset_bias();
+    DAC0.CTRLA = DAC_CTRLA_ON;
+
+    for (const prescaler &m : main_prescalers)
+    {
+        _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, m.sel | CLKCTRL_PEN_bm);
+        for (const prescaler &a : adc_prescalers)
+        {
+            if ((a.div != 2) && (a.div != 10) && (a.div != 64))
+            {
+                continue;
+            }
+            for (const pga_bias &b : biases)
+            {
+                setting s = { (uint32_t) (OSCHF_HZ / m.div), a.div, 1, &b, 1, BAUD_RATE };
+                if ((s.f_cpu / s.presc) > b.max_clk_adc)
+                {
+                    continue;
+                }
+                ADC0.CTRLB = a.sel;
+                ADC0.PGACTRL = b.percent ? (ADC_PGAEN_bm | ADC_GAIN_SEL | b.bias_sel) : 0;
+                ADC0.MUXPOS = (ADC0.MUXPOS & ~ADC_VIA_gm) | (b.percent ? ADC_VIA_PGA_gc : ADC_VIA_ADC_gc);
+                ADC0.MUXNEG = (ADC0.MUXNEG & ~ADC_VIA_gm) | (b.percent ? ADC_VIA_PGA_gc : ADC_VIA_ADC_gc);
+
+                // Ready time after enable, polled as in do_ADC0_measurement()
+                double t0 = sim_time();
+                ADC0.CTRLA = ADC_CTRLA_ON;
+                while (ADC0.STATUS > 0)
+                    ;
+                double t_init = (b.percent ? MODEL_T_INIT_PGA_NS : MODEL_T_INIT_ADC_NS) * 1e-9;
+                double poll = 2 * SIM_ACCESS_CYCLES / sim_clk_per();
+                CHECK(fabs(sim_time() - t0 - t_init) <= poll, "%.2f MHz, bias %d%%: ready after %.3f us, model %.3f us",
+                      s.f_cpu * 1e-6, b.percent, (sim_time() - t0) * 1e6, t_init * 1e6);
+
+                for (int n : samples)
+                {
+                    s.samples = n;
+                    uint8_t sampnum = 0;
+                    while ((1 << sampnum) < n)
+                    {
+                        sampnum++;
+                    }
+                    // Started and polled without adc0_start() and adc0_wait_result(), which sleep with ADC_SLEEP
+                    ADC0.CTRLF = sampnum;
+                    ADC0.INTFLAGS = ADC_RESRDY_bm;
+                    ADC0.COMMAND = ADC_DIFF_bm | ADC_MODE_BURST_gc | ADC_START_IMMEDIATE_gc;
+                    t0 = sim_time();
+                    while (!(ADC0.INTFLAGS & ADC_RESRDY_bm))
+                        ;
+                    double measured = sim_time() - t0;
+                    double t_burst = conv_ns(s) * 1e-9;
+                    (void) ADC0.RESULT;
+                    // f_CLK_ADC = F_CPU / ADC_PRESC_DIV is rounded down to Hz as in main.c, so the model is longer
+                    // by up to 1 / f_CLK_ADC of t_conv
+                    double clk_hz = (double) (s.f_cpu / s.presc);
+                    CHECK(measured >= t_burst * (1 - 1 / clk_hz) - 1e-9 && measured <= t_burst + poll,
+                          "%.2f MHz / %d, bias %d%%, %d samples: burst %.3f us, model %.3f us", s.f_cpu * 1e-6,
+                          s.presc, b.percent, n, measured * 1e6, t_burst * 1e6);
+                    burst_checks++;
+                }
+                ADC0.CTRLA = 0;
+            }
+        }
+    }
+
+    sim_finish();
+    return 0;
+}
+
+static void check_bursts(void)
+{
+    sim_config cfg;
+
+    cfg.end_time = 100.0;
+    sim_init(cfg);
+    int errors = sim_run(burst_main);
+    CHECK(errors == 0, "%d simulator errors", errors);
+    printf("  %d bursts of 1, 16 and 256 samples within the model, for each main clock and PGA bias\n", burst_checks);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [--all] [--no-check] [--noise L] [--calc-us T] [--vdd V] [--current NAME=UA ...]\n"
+                    "  --all          all settings, not only the Pareto front\n"
+                    "  --no-check     no check of the model on the simulator\n"
+                    "  --noise L      ADC0 noise of a sample in LSB rms (default 0.5)\n"
+                    "  --calc-us T    CPU time of the calculations per measurement (default 0, as simulated)\n"
+                    "  --vdd V        supply voltage for the energy per result (default 3.3)\n"
+                    "  --current N=U  phase current in uA:", argv0);
+    for (const phase_current &c : currents)
+    {
+        fprintf(stderr, " %s=%g", c.name, c.ua);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool all = false;
+    bool check = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (!strcmp(argv[i], "--all"))
+        {
+            all = true;
+        }
+        else if (!strcmp(argv[i], "--no-check"))
+        {
+            check = false;
+        }
+        else if (!strcmp(argv[i], "--noise") && has_value)
+        {
+            noise_lsb = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--calc-us") && has_value)
+        {
+            calc_s = atof(argv[++i]) * 1e-6;
+        }
+        else if (!strcmp(argv[i], "--vdd") && has_value)
+        {
+            vdd = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--current") && has_value)
+        {
+            const char *arg = argv[++i];
+            const char *eq = strchr(arg, '=');
+            bool found = false;
+            for (phase_current &c : currents)
+            {
+                if (eq && (strlen(c.name) == (size_t) (eq - arg)) && !strncmp(c.name, arg, eq - arg))
+                {
+                    c.ua = atof(eq + 1);
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (ENERGY_TABLE)
+    {
+        sweep(all);
+    }
+    if (check)
+    {
+        double calc = calc_s;
+        calc_s = 0;
+        check_period();
+        check_bursts();
+        calc_s = calc;
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,171 @@
+/*
+ * frame_decode: print the BINARY_OUTPUT frames of analog-current-sensing
+ *
+ *   frame_decode [--rtd-fixed OHM] [--rtd-r0 OHM] [--raw] [file]
+ *
+ * Reads a captured USART1 byte stream from the file or stdin and prints
+ * one line for each result in V, uA and C. Corrupt and lost frames are
+ * reported on stderr with a summary at the end. The exit code is 1 if
+ * there were corrupt or lost frames
+ */
+#include "frames.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static frame_rtd rtd;
+static bool print_raw = false;
+
+static void print_current(const char *prefix, int32_t raw, const frame_calibration &cal)
+{
+    printf("%s", prefix);
+    if (print_raw || !cal.valid)
+    {
+        printf(" raw=%ld", (long) raw);
+    }
+    if (cal.valid)
+    {
+        printf(" voltage=%.6fV current=%.4fuA", cal.volt(raw), cal.microamp(raw));
+    }
+    printf("\n");
+}
+
+static void print_frame(const uint8_t *p, size_t len, const frame_calibration &cal)
+{
+    char prefix[64];
+
+    switch (p[0])
+    {
+    case FRAME_TYPE_CALIBRATION:
+        printf("calibration next_seq=%u offset=%d center=%d ref=%umV gain=%u samples=%u r_sense=%luOhm\n",
+               cal.next_seq, cal.offset, cal.center, cal.ref_mv, cal.gain, cal.samples, (unsigned long) cal.r_sense);
+        break;
+    case FRAME_TYPE_MEASUREMENT:
+        snprintf(prefix, sizeof(prefix), "measurement seq=%u", p[1]);
+        print_current(prefix, frame_i24(p + 2), cal);
+        break;
+    case FRAME_TYPE_TRACE:
+        printf("trace");
+        for (int i = 0; i < p[1]; i++)
+        {
+            printf(" %u:%u", p[2 + 3 * i], frame_u16(p + 3 + 3 * i));
+        }
+        printf(" model=%u,%u\n", frame_u16(p + len - 4), frame_u16(p + len - 2));
+        break;
+    case FRAME_TYPE_BATCH:
+        for (int i = 0; i < p[1]; i++)
+        {
+            snprintf(prefix, sizeof(prefix), "batch time=%us", frame_u16(p + 2 + 5 * i));
+            print_current(prefix, frame_i24(p + 4 + 5 * i), cal);
+        }
+        break;
+    case FRAME_TYPE_RTD:
+        printf("rtd seq=%u", p[1]);
+        if (print_raw)
+        {
+            printf(" raw=%ld", (long) frame_i24(p + 2));
+        }
+        printf(" resistance=%.3fOhm temperature=%.2fC\n", rtd.ohm(frame_i24(p + 2)), rtd.celsius(frame_i24(p + 2)));
+        break;
+    case FRAME_TYPE_STATS:
+        printf("stats count=%u", frame_u16(p + 1));
+        if (cal.valid)
+        {
+            double ua = cal.microamp(1 + cal.offset + cal.center);          // uA per LSB
+
+            printf(" min=%.4fuA max=%.4fuA mean=%.4fuA stddev=%.4fuA\n",
+                   cal.microamp(frame_i24(p + 3) + cal.offset + cal.center),
+                   cal.microamp(frame_i24(p + 6) + cal.offset + cal.center),
+                   (int32_t) frame_u32(p + 9) / 256.0 * ua, frame_u32(p + 13) / 256.0 * ua);
+        }
+        else
+        {
+            printf(" min=%ld max=%ld mean=%.2f stddev=%.2f\n", (long) frame_i24(p + 3), (long) frame_i24(p + 6),
+                   (int32_t) frame_u32(p + 9) / 256.0, frame_u32(p + 13) / 256.0);
+        }
+        break;
+    case FRAME_TYPE_LOG:
+        for (int i = 0; i < p[3]; i++)
+        {
+            snprintf(prefix, sizeof(prefix), "log page=%u time=%us", frame_u16(p + 1), frame_u16(p + 4 + 5 * i));
+            print_current(prefix, frame_i24(p + 6 + 5 * i), cal);
+        }
+        break;
+    case FRAME_TYPE_CAPTURE:
+        printf("capture seq=%u samples=%u trigger=%u period=%luns lost=%u\n",
+               p[1], frame_u16(p + 2), frame_u16(p + 4), (unsigned long) frame_u32(p + 6), p[10]);
+        break;
+    case FRAME_TYPE_CAPTURE_DATA:
+        for (size_t i = 4, n = frame_u16(p + 2); i + 3 <= len; i += 3, n += 2)
+        {
+            // Two 12-bit single conversions in 3 bytes, scaled to the accumulated result
+            int32_t s0 = (int32_t) ((uint32_t) (p[i] | (p[i + 1] << 8)) << 20) >> 20;
+            int32_t s1 = (int32_t) ((uint32_t) ((p[i + 1] >> 4) | (p[i + 2] << 4)) << 20) >> 20;
+
+            snprintf(prefix, sizeof(prefix), "capture seq=%u sample=%zu", p[1], n);
+            print_current(prefix, s0 * cal.samples, cal);
+            snprintf(prefix, sizeof(prefix), "capture seq=%u sample=%zu", p[1], n + 1);
+            print_current(prefix, s1 * cal.samples, cal);
+        }
+        break;
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--rtd-fixed OHM] [--rtd-r0 OHM] [--raw] [file]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    FILE *in = stdin;
+    uint8_t buffer[4096];
+    size_t n;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--raw"))
+        {
+            print_raw = true;
+        }
+        else if (!strcmp(argv[i], "--rtd-fixed") && (i + 1 < argc))
+        {
+            rtd.r_fixed = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--rtd-r0") && (i + 1 < argc))
+        {
+            rtd.r0 = atof(argv[++i]);
+            rtd.alpha = rtd.r0 * 0.00385;
+        }
+        else if ((argv[i][0] == '-') || path)
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (path && !(in = fopen(path, "rb")))
+    {
+        fprintf(stderr, "%s: can not read %s\n", argv[0], path);
+        return 2;
+    }
+
+    frame_decoder decoder(print_frame, [](const char *what) { fprintf(stderr, "error: %s\n", what); });
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        decoder.feed(buffer, n);
+    }
+
+    const frame_counts &c = decoder.counts();
+    fprintf(stderr, "%ld bytes, %ld frames, %ld corrupt, %ld lost\n", c.bytes, c.frames, c.corrupt, c.lost);
+    if (c.uncalibrated)
+    {
+        fprintf(stderr, "%ld frames before the first calibration frame, results are raw\n", c.uncalibrated);
+    }
+    return (c.corrupt || c.lost) ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Decoder for the BINARY_OUTPUT frames of analog-current-sensing
+ */
+#include "frames.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+double frame_calibration::volt(int32_t raw) const
+{
+    return adjusted(raw) * (ref_mv * 1e-3) / (2048.0 * samples * gain);
+}
+
+double frame_calibration::microamp(int32_t raw) const
+{
+    return volt(raw) / r_sense * 1e6;
+}
+
+double frame_rtd::ohm(int32_t raw) const
+{
+    double x_full = 0.992 * gain * 2048.0 * samples;
+
+    return raw * r_fixed / (x_full - raw);
+}
+
+double frame_rtd::celsius(int32_t raw) const
+{
+    return (ohm(raw) - r0) / alpha;
+}
+
+uint8_t frame_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+bool frame_cobs_decode(const uint8_t *in, size_t len, std::vector<uint8_t> &out)
+{
+    size_t i = 0;
+
+    out.clear();
+    while (i < len)
+    {
+        uint8_t code = in[i++];
+
+        if ((code == 0) || (i + code - 1 > len))
+        {
+            return false;
+        }
+        out.insert(out.end(), in + i, in + i + code - 1);
+        i += code - 1;
+        if ((code < 0xFF) && (i < len))
+        {
+            out.push_back(0);
+        }
+    }
+    return true;
+}
+
+frame_decoder::frame_decoder(handler on_frame, error_handler on_error)
+    : on_frame(on_frame), on_error(on_error)
+{
+}
+
+void frame_decoder::feed(const uint8_t *data, size_t len)
+{
+    count.bytes += len;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (data[i] == 0)
+        {
+            frame_end();
+        }
+        else
+        {
+            raw.push_back(data[i]);
+        }
+    }
+}
+
+void frame_decoder::error(const char *fmt, ...)
+{
+    char text[160];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (on_error)
+    {
+        on_error(text);
+    }
+}
+
+void frame_decoder::frame_end(void)
+{
+    std::vector<uint8_t> payload;
+
+    if (raw.empty())
+    {
+        return;                                 // Idle 0x00 bytes
+    }
+    if (!frame_cobs_decode(raw.data(), raw.size(), payload) || (payload.size() < 2))
+    {
+        count.corrupt++;
+        error("frame of %zu bytes: wrong COBS coding", raw.size() + 1);
+    }
+    else if (frame_crc8(payload.data(), payload.size() - 1) != payload.back())
+    {
+        count.corrupt++;
+        error("frame type 0x%02x of %zu bytes: wrong CRC", payload[0], raw.size() + 1);
+    }
+    else
+    {
+        check(payload.data(), payload.size() - 1);
+    }
+    raw.clear();
+}
+
+// Count the frames missing between the last and this sequence number
+void frame_decoder::sequence(int &last, int seq, int modulo, const char *name)
+{
+    if (last >= 0)
+    {
+        int missing = (seq - last - 1 + modulo) % modulo;
+
+        if (missing)
+        {
+            count.lost += missing;
+            error("%d %s frame(s) lost before sequence number %d", missing, name, seq);
+        }
+    }
+    last = seq;
+}
+
+void frame_decoder::check(const uint8_t *p, size_t len)
+{
+    // Payload length for each type: fixed, or header + n records
+    static const struct
+    {
+        uint8_t type;
+        uint8_t header;
+        uint8_t record;                         // 0 = fixed length
+        int8_t count_at;                        // Index of the record count, or -1
+    } layout[] =
+    {
+        {FRAME_TYPE_CALIBRATION, 15, 0, -1},
+        {FRAME_TYPE_MEASUREMENT, 5, 0, -1},
+        {FRAME_TYPE_TRACE, 6, 3, 1},
+        {FRAME_TYPE_BATCH, 2, 5, 1},
+        {FRAME_TYPE_RTD, 5, 0, -1},
+        {FRAME_TYPE_STATS, 17, 0, -1},
+        {FRAME_TYPE_LOG, 4, 5, 3},
+        {FRAME_TYPE_CAPTURE, 11, 0, -1},
+        {FRAME_TYPE_CAPTURE_DATA, 4, 3, -1},
+    };
+    size_t expected = 0;
+
+    for (const auto &l : layout)
+    {
+        if (l.type == p[0])
+        {
+            expected = l.header;
+            if (l.count_at >= 0)
+            {
+                expected += (len > (size_t) l.count_at) ? l.record * p[l.count_at] : 0;
+            }
+            else if (l.record)
+            {
+                expected = len - (len - l.header) % l.record;   // Any number of records
+            }
+        }
+    }
+    if (!expected || (len != expected))
+    {
+        count.corrupt++;
+        error("frame type 0x%02x: %zu bytes, expected %zu", p[0], len, expected);
+        return;
+    }
+    count.frames++;
+
+    switch (p[0])
+    {
+    case FRAME_TYPE_CALIBRATION:
+        cal.valid = true;
+        cal.next_seq = p[1];
+        cal.offset = (int16_t) frame_u16(p + 2);
+        cal.center = (int16_t) frame_u16(p + 4);
+        cal.ref_mv = frame_u16(p + 6);
+        cal.gain = p[8];
+        cal.samples = frame_u16(p + 9);
+        cal.r_sense = frame_u32(p + 11);
+        break;
+    case FRAME_TYPE_MEASUREMENT:
+        sequence(last_measurement, p[1], 256, "measurement");
+        break;
+    case FRAME_TYPE_RTD:
+        sequence(last_rtd, p[1], 256, "RTD");
+        break;
+    case FRAME_TYPE_LOG:
+        if (frame_u16(p + 1) != last_log_page)      // A page may be sent in several frames
+        {
+            sequence(last_log_page, frame_u16(p + 1), 65536, "log page");
+        }
+        break;
+    }
+    if (!cal.valid && (p[0] != FRAME_TYPE_TRACE) && (p[0] != FRAME_TYPE_RTD))
+    {
+        count.uncalibrated++;
+    }
+    on_frame(p, len, cal);
+}
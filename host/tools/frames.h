@@ -0,0 +1,104 @@
+/*
+ * Decoder for the BINARY_OUTPUT frames of analog-current-sensing
+ *
+ * The byte stream is split on 0x00, each frame is COBS decoded and its
+ * CRC-8 (polynomial 0x07) checked. Valid frames are passed to the handler
+ * with the last calibration frame, so results can be converted to
+ * engineering units. Lost frames are found from the sequence numbers of
+ * the measurement and RTD frames, and the page numbers of log frames.
+ * See the frame table in analog-current-sensing/README.md
+ */
+#ifndef HOST_FRAMES_H
+#define HOST_FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#define FRAME_TYPE_CALIBRATION 0x01
+#define FRAME_TYPE_MEASUREMENT 0x02
+#define FRAME_TYPE_TRACE 0x03
+#define FRAME_TYPE_BATCH 0x04
+#define FRAME_TYPE_RTD 0x05
+#define FRAME_TYPE_STATS 0x06
+#define FRAME_TYPE_LOG 0x07
+#define FRAME_TYPE_CAPTURE 0x08
+#define FRAME_TYPE_CAPTURE_DATA 0x09
+
+struct frame_calibration
+{
+    bool valid = false;
+    uint8_t next_seq = 0;                       // Sequence number of the next measurement frame
+    int16_t offset = 0;                         // adc_offset
+    int16_t center = 0;                         // adc_center
+    uint16_t ref_mv = 0;
+    uint8_t gain = 1;
+    uint16_t samples = 16;
+    uint32_t r_sense = 0;
+
+    int32_t adjusted(int32_t raw) const { return raw - offset - center; }
+    double volt(int32_t raw) const;             // Raw accumulated result --> V
+    double microamp(int32_t raw) const;         // Raw accumulated result --> uA
+};
+
+// RTD circuit of MULTI_CHANNEL (not in the calibration frame)
+struct frame_rtd
+{
+    double r_fixed = 1800.0;
+    double r0 = 100.0;
+    double alpha = 0.385;
+    int gain = 16;
+    int samples = 16;
+
+    double ohm(int32_t raw) const;
+    double celsius(int32_t raw) const;          // Linear, as the firmware
+};
+
+struct frame_counts
+{
+    long bytes = 0;
+    long frames = 0;                            // Valid frames
+    long corrupt = 0;                           // Wrong COBS coding, CRC or length
+    long lost = 0;                              // Missing frames, from sequence numbers
+    long uncalibrated = 0;                      // Results before the first calibration frame
+};
+
+class frame_decoder
+{
+public:
+    // Called for each valid frame, payload without the CRC
+    typedef std::function<void(const uint8_t *payload, size_t len, const frame_calibration &cal)> handler;
+    // Called for each problem, with a description
+    typedef std::function<void(const char *what)> error_handler;
+
+    frame_decoder(handler on_frame, error_handler on_error = nullptr);
+    void feed(const uint8_t *data, size_t len);
+    const frame_counts &counts() const { return count; }
+
+private:
+    void frame_end(void);
+    void check(const uint8_t *payload, size_t len);
+    void error(const char *fmt, ...);
+    void sequence(int &last, int seq, int modulo, const char *name);
+
+    handler on_frame;
+    error_handler on_error;
+    std::vector<uint8_t> raw;                   // Bytes since the last 0x00
+    frame_calibration cal;
+    frame_counts count;
+    int last_measurement = -1;
+    int last_rtd = -1;
+    int last_log_page = -1;
+};
+
+uint8_t frame_crc8(const uint8_t *data, size_t len);
+// COBS decode, false if the coding is wrong
+bool frame_cobs_decode(const uint8_t *in, size_t len, std::vector<uint8_t> &out);
+
+// Little endian fields
+static inline uint16_t frame_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t frame_u32(const uint8_t *p) { return frame_u16(p) | ((uint32_t) frame_u16(p + 2) << 16); }
+static inline int32_t frame_i24(const uint8_t *p) { return (int32_t) ((frame_u16(p) | ((uint32_t) p[2] << 16)) << 8) >> 8; }
+
+#endif
@@ -0,0 +1,471 @@
+/*
+ * Ingest of the ASCII output of analog-current-sensing from many ports
+ */
+#include "ingest.h"
+
+#include <string.h>
+
+#define DATA_HEADER 24
+#define DATA_RECORD 14                          // u32 time, u16 device, i32 voltage, i32 current
+#define INDEX_HEADER 16
+#define INDEX_ENTRY 32
+#define FOOTER 16
+
+static const char magic[8] = {'A', 'V', 'R', 'I', 'N', 'G', 'S', 'T'};
+
+bool ingest_parse_fixed(const char *p, const char *end, int decimals, int32_t &value)
+{
+    bool negative = (p < end) && (*p == '-');
+    int64_t x = 0;
+    int digits = 0;
+    int fraction = -1;                          // Decimals so far, -1 before the point
+    bool round_up = false;
+
+    for (p += negative; p < end; p++)
+    {
+        if ((*p == '.') && (fraction < 0))
+        {
+            fraction = 0;
+            continue;
+        }
+        if ((*p < '0') || (*p > '9'))
+        {
+            return false;
+        }
+        digits++;
+        if (fraction < decimals)
+        {
+            x = x * 10 + (*p - '0');
+            fraction += (fraction >= 0);
+        }
+        else if (fraction == decimals)
+        {
+            round_up = (*p >= '5');             // Only the first digit that is not kept
+            fraction++;
+        }
+        if (x > INT32_MAX)
+        {
+            return false;
+        }
+    }
+    for (fraction = (fraction < 0) ? 0 : fraction; fraction < decimals; fraction++)
+    {
+        x *= 10;
+    }
+    x += round_up;
+    if (!digits || (x > INT32_MAX))
+    {
+        return false;
+    }
+    value = (int32_t) (negative ? -x : x);
+    return true;
+}
+
+size_t ingest_parser::carry(char *buffer) const
+{
+    memcpy(buffer, tail, tail_len);
+    return tail_len;
+}
+
+void ingest_parser::parse(const char *buffer, size_t len, int64_t t_us, std::vector<ingest_record> &out)
+{
+    const char *p = buffer;
+    const char *end = buffer + len;
+    const char *newline;
+
+    count.bytes += len - tail_len;
+    while ((newline = (const char *) memchr(p, '\n', end - p)))
+    {
+        if (skip)
+        {
+            skip = false;                       // End of a line that was too long
+        }
+        else
+        {
+            line(p, newline, t_us, out);
+        }
+        p = newline + 1;
+    }
+
+    // Keep the start of the next line
+    tail_len = 0;
+    if (!skip && (end - p >= INGEST_LINE_MAX))
+    {
+        skip = true;
+        count.bad++;
+    }
+    if (!skip)
+    {
+        tail_len = end - p;
+        memcpy(tail, p, tail_len);
+    }
+}
+
+void ingest_parser::line(const char *p, const char *end, int64_t t_us, std::vector<ingest_record> &out)
+{
+    static const size_t prefix = sizeof("Measured voltage: ") - 1;
+    int32_t value;
+
+    if ((end > p) && (end[-1] == '\r'))
+    {
+        end--;
+    }
+    if (end - p > INGEST_LINE_MAX)
+    {
+        count.bad++;
+    }
+    else if ((end - p > (ptrdiff_t) prefix + 1) && !memcmp(p, "Measured voltage: ", prefix) && (end[-1] == 'V'))
+    {
+        if (!ingest_parse_fixed(p + prefix, end - 1, 6, value))
+        {
+            count.bad++;
+            return;
+        }
+        count.unpaired += have_voltage;
+        have_voltage = true;
+        voltage_uv = value;
+    }
+    else if ((end - p > (ptrdiff_t) prefix + 2) && !memcmp(p, "Measured current: ", prefix) &&
+             (end[-2] == 'u') && (end[-1] == 'A'))
+    {
+        if (!ingest_parse_fixed(p + prefix, end - 2, 3, value))
+        {
+            count.bad++;
+        }
+        else if (!have_voltage)
+        {
+            count.unpaired++;
+        }
+        else
+        {
+            out.push_back({t_us, device, voltage_uv, value});
+            count.records++;
+        }
+        have_voltage = false;
+    }
+    else if (end > p)
+    {
+        count.unknown++;
+    }
+}
+
+ingest_writer::~ingest_writer()
+{
+    if (file)
+    {
+        close();
+    }
+}
+
+bool ingest_writer::open(const char *path, const std::vector<std::string> &devices)
+{
+    std::vector<uint8_t> header(magic, magic + sizeof(magic));
+
+    if (!(file = fopen(path, "wb")))
+    {
+        return false;
+    }
+    ingest_put32(header, INGEST_VERSION);
+    ingest_put32(header, devices.size());
+    for (const std::string &name : devices)
+    {
+        ingest_put16(header, name.size());
+        header.insert(header.end(), name.begin(), name.end());
+    }
+    return write(header);
+}
+
+void ingest_writer::add(const ingest_record &r)
+{
+    // The time offsets in a block are u32 us
+    if (!time.empty() && ((r.t_us - t_min > INGEST_BLOCK_SPAN_US) || (t_max - r.t_us > INGEST_BLOCK_SPAN_US)))
+    {
+        flush();
+    }
+    if (time.empty() || (r.t_us < t_min))
+    {
+        t_min = r.t_us;
+    }
+    if (time.empty() || (r.t_us > t_max))
+    {
+        t_max = r.t_us;
+    }
+    time.push_back(r.t_us);
+    device.push_back(r.device);
+    voltage.push_back(r.voltage_uv);
+    current.push_back(r.current_na);
+    if (time.size() == INGEST_BLOCK_RECORDS)
+    {
+        flush();
+    }
+}
+
+bool ingest_writer::flush(void)
+{
+    std::vector<uint8_t> block;
+    size_t n = time.size();
+
+    if (!n)
+    {
+        return ok;
+    }
+    block.reserve(DATA_HEADER + DATA_RECORD * n);
+    ingest_put32(block, INGEST_TAG_DATA);
+    ingest_put32(block, n);
+    ingest_put64(block, t_min);
+    ingest_put64(block, t_max);
+    for (int64_t t : time)
+    {
+        ingest_put32(block, t - t_min);
+    }
+    for (uint16_t d : device)
+    {
+        ingest_put16(block, d);
+    }
+    for (int32_t v : voltage)
+    {
+        ingest_put32(block, v);
+    }
+    for (int32_t c : current)
+    {
+        ingest_put32(block, c);
+    }
+    unindexed.push_back({offset, t_min, t_max, (uint32_t) n});
+    written += n;
+    time.clear();
+    device.clear();
+    voltage.clear();
+    current.clear();
+
+    write(block);
+    if (unindexed.size() == INGEST_INDEX_BLOCKS)
+    {
+        write_index();
+    }
+    if (fflush(file))
+    {
+        ok = false;
+    }
+    return ok;
+}
+
+bool ingest_writer::write_index(void)
+{
+    std::vector<uint8_t> index;
+
+    if (unindexed.empty())
+    {
+        return ok;
+    }
+    ingest_put32(index, INGEST_TAG_INDEX);
+    ingest_put32(index, unindexed.size());
+    ingest_put64(index, last_index);
+    for (const ingest_block &b : unindexed)
+    {
+        ingest_put64(index, b.offset);
+        ingest_put64(index, b.t_min);
+        ingest_put64(index, b.t_max);
+        ingest_put32(index, b.records);
+        ingest_put32(index, 0);
+    }
+    last_index = offset;
+    unindexed.clear();
+    return write(index);
+}
+
+bool ingest_writer::write(const std::vector<uint8_t> &data)
+{
+    if (fwrite(data.data(), 1, data.size(), file) != data.size())
+    {
+        ok = false;
+    }
+    offset += data.size();
+    return ok;
+}
+
+bool ingest_writer::close(void)
+{
+    std::vector<uint8_t> footer;
+
+    flush();
+    write_index();
+    ingest_put32(footer, INGEST_TAG_END);
+    ingest_put32(footer, 0);
+    ingest_put64(footer, last_index);
+    write(footer);
+    if (fclose(file))
+    {
+        ok = false;
+    }
+    file = nullptr;
+    return ok;
+}
+
+ingest_reader::~ingest_reader()
+{
+    if (file)
+    {
+        fclose(file);
+    }
+}
+
+static bool read_at(FILE *file, uint64_t at, size_t len, std::vector<uint8_t> &out)
+{
+    out.resize(len);
+    return !fseeko(file, at, SEEK_SET) && (fread(out.data(), 1, len, file) == len);
+}
+
+bool ingest_reader::open(const char *path)
+{
+    uint64_t at = sizeof(magic) + 8;
+
+    if (!(file = fopen(path, "rb")) || fseeko(file, 0, SEEK_END))
+    {
+        return false;
+    }
+    size = ftello(file);
+    if (!read_at(file, 0, at, raw) || memcmp(raw.data(), magic, sizeof(magic)) ||
+        (ingest_u32(&raw[8]) != INGEST_VERSION))
+    {
+        return false;
+    }
+    for (uint32_t i = 0, n = ingest_u32(&raw[12]); i < n; i++)
+    {
+        if (!read_at(file, at, 2, raw))
+        {
+            return false;
+        }
+        size_t len = ingest_u16(raw.data());
+        if (!read_at(file, at + 2, len, raw))
+        {
+            return false;
+        }
+        names.emplace_back(raw.begin(), raw.end());
+        at += 2 + len;
+    }
+
+    // The index from the footer, or the block headers
+    if ((size >= at + FOOTER) && read_at(file, size - FOOTER, FOOTER, raw) && (ingest_u32(&raw[0]) == INGEST_TAG_END))
+    {
+        has_footer = read_index(ingest_u64(&raw[8]));
+    }
+    if (!has_footer)
+    {
+        data_blocks.clear();
+        return scan(at);
+    }
+    return true;
+}
+
+bool ingest_reader::read_index(uint64_t at)
+{
+    std::vector<std::vector<ingest_block>> chain;   // Last index block first
+
+    while (at)
+    {
+        if (!read_at(file, at, INDEX_HEADER, raw) || (ingest_u32(&raw[0]) != INGEST_TAG_INDEX))
+        {
+            return false;
+        }
+        uint32_t entries = ingest_u32(&raw[4]);
+        uint64_t previous = ingest_u64(&raw[8]);
+        if ((previous >= at) || !read_at(file, at + INDEX_HEADER, (size_t) entries * INDEX_ENTRY, raw))
+        {
+            return false;
+        }
+        chain.emplace_back();
+        for (uint32_t i = 0; i < entries; i++)
+        {
+            const uint8_t *e = &raw[i * INDEX_ENTRY];
+
+            chain.back().push_back({ingest_u64(e), (int64_t) ingest_u64(e + 8), (int64_t) ingest_u64(e + 16),
+                                    ingest_u32(e + 24)});
+        }
+        at = previous;
+    }
+    for (auto i = chain.rbegin(); i != chain.rend(); ++i)
+    {
+        data_blocks.insert(data_blocks.end(), i->begin(), i->end());
+    }
+    return true;
+}
+
+bool ingest_reader::scan(uint64_t at)
+{
+    while (read_at(file, at, INDEX_HEADER, raw))
+    {
+        uint32_t n = ingest_u32(&raw[4]);
+
+        if (ingest_u32(&raw[0]) == INGEST_TAG_DATA)
+        {
+            uint64_t len = DATA_HEADER + (uint64_t) DATA_RECORD * n;
+
+            if ((at + len > size) || !read_at(file, at, DATA_HEADER, raw))
+            {
+                break;                          // Block not written completely
+            }
+            data_blocks.push_back({at, (int64_t) ingest_u64(&raw[8]), (int64_t) ingest_u64(&raw[16]), n});
+            at += len;
+        }
+        else if (ingest_u32(&raw[0]) == INGEST_TAG_INDEX)
+        {
+            at += INDEX_HEADER + (uint64_t) INDEX_ENTRY * n;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+bool ingest_reader::read(const ingest_block &b, std::vector<ingest_record> &out)
+{
+    size_t n = b.records;
+
+    if (!read_at(file, b.offset, DATA_HEADER + DATA_RECORD * n, raw) || (ingest_u32(&raw[0]) != INGEST_TAG_DATA) ||
+        (ingest_u32(&raw[4]) != n))
+    {
+        return false;
+    }
+    const uint8_t *time = &raw[DATA_HEADER];
+    const uint8_t *device = time + 4 * n;
+    const uint8_t *voltage = device + 2 * n;
+    const uint8_t *current = voltage + 4 * n;
+    int64_t t_min = (int64_t) ingest_u64(&raw[8]);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        out.push_back({t_min + ingest_u32(time + 4 * i), ingest_u16(device + 2 * i),
+                       (int32_t) ingest_u32(voltage + 4 * i), (int32_t) ingest_u32(current + 4 * i)});
+    }
+    return true;
+}
+
+size_t ingest_reader::query(int64_t from_us, int64_t to_us, int device, std::vector<ingest_record> &out)
+{
+    std::vector<ingest_record> block;
+    size_t read_blocks = 0;
+
+    for (const ingest_block &b : data_blocks)
+    {
+        if ((b.t_max < from_us) || (b.t_min >= to_us))
+        {
+            continue;
+        }
+        block.clear();
+        if (!read(b, block))
+        {
+            continue;
+        }
+        read_blocks++;
+        for (const ingest_record &r : block)
+        {
+            if ((r.t_us >= from_us) && (r.t_us < to_us) && ((device < 0) || (r.device == device)))
+            {
+                out.push_back(r);
+            }
+        }
+    }
+    return read_blocks;
+}
@@ -0,0 +1,186 @@
+/*
+ * Ingest of the ASCII output of analog-current-sensing from many ports
+ *
+ * ingest_parser splits the bytes read from one port into lines where they
+ * were read, without copying them, and turns each pair of lines
+ *
+ *   Measured voltage: 0.0476V
+ *   Measured current: 4.8uA
+ *
+ * into one record. Only a line that is cut by the end of a read is kept,
+ * and put in front of the next read. Other lines ("Let's go!", "Settling
+ * time: ...") are counted and skipped.
+ *
+ * ingest_writer appends the records to a columnar file, with the receive
+ * time, and ingest_reader finds the blocks of a time range from its index
+ * blocks. The file, all values little endian:
+ *
+ *   header  "AVRINGST", u32 version, u32 devices,
+ *           for each device: u16 length, name (the port it was read from)
+ *   data    u32 INGEST_TAG_DATA, u32 records n, i64 t_min, i64 t_max (us),
+ *           u32 time[n] (us after t_min), u16 device[n],
+ *           i32 voltage[n] (uV), i32 current[n] (nA)
+ *   index   u32 INGEST_TAG_INDEX, u32 entries, u64 offset of the previous
+ *           index block (0 = none), for each data block since that block:
+ *           u64 offset, i64 t_min, i64 t_max, u32 records, u32 0
+ *   footer  u32 INGEST_TAG_END, u32 0, u64 offset of the last index block
+ *
+ * A data block holds up to INGEST_BLOCK_RECORDS records, and an index block
+ * is written after every INGEST_INDEX_BLOCKS data blocks and when the file
+ * is closed. A file without the footer, after a crash or while it is being
+ * written, is read by scanning the block headers
+ */
+#ifndef HOST_INGEST_H
+#define HOST_INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define INGEST_VERSION 1
+#define INGEST_BLOCK_RECORDS 4096
+#define INGEST_BLOCK_SPAN_US 3600000000LL       // Longest time in one block, the time offsets are u32
+#define INGEST_INDEX_BLOCKS 64
+#define INGEST_LINE_MAX 64                      // Longer lines are skipped
+
+#define INGEST_TAG_DATA 0x41544144              // "DATA"
+#define INGEST_TAG_INDEX 0x58444E49             // "INDX"
+#define INGEST_TAG_END 0x4C494154               // "TAIL"
+
+struct ingest_record
+{
+    int64_t t_us;                               // Receive time of the current line, us since the epoch
+    uint16_t device;
+    int32_t voltage_uv;
+    int32_t current_na;
+};
+
+struct ingest_counts
+{
+    long bytes = 0;
+    long records = 0;
+    long unknown = 0;                           // Other lines
+    long unpaired = 0;                          // Voltage without current or current without voltage
+    long bad = 0;                               // Lines longer than INGEST_LINE_MAX, or wrong numbers
+};
+
+class ingest_parser
+{
+public:
+    explicit ingest_parser(uint16_t device = 0) : device(device) {}
+
+    // Read the port to buffer + carry(buffer): the partial line of the last
+    // read is copied to the start of the buffer
+    size_t carry(char *buffer) const;
+    // Parse buffer[0..len), the carried bytes and the new bytes. Records are
+    // appended to out with the time t_us
+    void parse(const char *buffer, size_t len, int64_t t_us, std::vector<ingest_record> &out);
+    const ingest_counts &counts() const { return count; }
+
+private:
+    void line(const char *p, const char *end, int64_t t_us, std::vector<ingest_record> &out);
+
+    uint16_t device;
+    char tail[INGEST_LINE_MAX];
+    size_t tail_len = 0;
+    bool skip = false;                          // In a line that is too long
+    bool have_voltage = false;
+    int32_t voltage_uv = 0;
+    ingest_counts count;
+};
+
+// "0.0476" --> 47600 with 6 decimals. false if it is not a number or does not fit
+bool ingest_parse_fixed(const char *p, const char *end, int decimals, int32_t &value);
+
+struct ingest_block
+{
+    uint64_t offset;
+    int64_t t_min;
+    int64_t t_max;
+    uint32_t records;
+};
+
+class ingest_writer
+{
+public:
+    ~ingest_writer();
+    // Create the file, false with errno set if it can not be written
+    bool open(const char *path, const std::vector<std::string> &devices);
+    void add(const ingest_record &r);
+    // Write the records so far as a data block
+    bool flush(void);
+    // Write the last index block and the footer
+    bool close(void);
+    size_t buffered() const { return time.size(); }
+    long records() const { return written; }
+
+private:
+    bool write(const std::vector<uint8_t> &data);
+    bool write_index(void);
+
+    FILE *file = nullptr;
+    bool ok = true;
+    uint64_t offset = 0;
+    uint64_t last_index = 0;
+    long written = 0;
+    std::vector<ingest_block> unindexed;        // Data blocks since the last index block
+    // Columns of the data block being filled
+    int64_t t_min = 0;
+    int64_t t_max = 0;
+    std::vector<int64_t> time;
+    std::vector<uint16_t> device;
+    std::vector<int32_t> voltage;
+    std::vector<int32_t> current;
+};
+
+class ingest_reader
+{
+public:
+    ~ingest_reader();
+    // Read the header and the index, false if it is not an ingest file
+    bool open(const char *path);
+    const std::vector<std::string> &devices() const { return names; }
+    const std::vector<ingest_block> &blocks() const { return data_blocks; }
+    bool indexed() const { return has_footer; }
+    // Append the records of one data block
+    bool read(const ingest_block &b, std::vector<ingest_record> &out);
+    // Append the records with from_us <= t_us < to_us of one device, or all
+    // devices if device < 0, in file order. Returns the number of data blocks
+    // read, the other blocks are skipped from their times in the index
+    size_t query(int64_t from_us, int64_t to_us, int device, std::vector<ingest_record> &out);
+
+private:
+    bool read_index(uint64_t at);
+    bool scan(uint64_t at);
+
+    FILE *file = nullptr;
+    uint64_t size = 0;
+    bool has_footer = false;
+    std::vector<std::string> names;
+    std::vector<ingest_block> data_blocks;
+    std::vector<uint8_t> raw;
+};
+
+// Little endian fields
+static inline void ingest_put16(std::vector<uint8_t> &v, uint16_t x)
+{
+    v.push_back(x & 0xFF);
+    v.push_back(x >> 8);
+}
+static inline void ingest_put32(std::vector<uint8_t> &v, uint32_t x)
+{
+    ingest_put16(v, x & 0xFFFF);
+    ingest_put16(v, x >> 16);
+}
+static inline void ingest_put64(std::vector<uint8_t> &v, uint64_t x)
+{
+    ingest_put32(v, x & 0xFFFFFFFF);
+    ingest_put32(v, x >> 32);
+}
+static inline uint16_t ingest_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t ingest_u32(const uint8_t *p) { return ingest_u16(p) | ((uint32_t) ingest_u16(p + 2) << 16); }
+static inline uint64_t ingest_u64(const uint8_t *p) { return ingest_u32(p) | ((uint64_t) ingest_u32(p + 4) << 32); }
+
+#endif
@@ -0,0 +1,350 @@
+/*
+ * ingest_load: load test of ingestd with many simulated boards on PTYs
+ *
+ *   ingest_load [--ports N] [--rate HZ] [--time S] [--out FILE] [--ingestd PATH]
+ *
+ * Opens N PTYs (2000) and starts ingestd on their slave sides. Each port
+ * then sends "Let's go! " and a voltage and current report RATE times per
+ * second (10) for S seconds (5), with values that differ for each port and
+ * report. The reports of all ports are spread evenly over the period. A
+ * report that does not fit in the PTY is sent when it has room again.
+ *
+ * When ingestd has parsed all reports it is stopped, and the file is read
+ * back: every record must be there once, in order for each port, with the
+ * values that were sent. Prints the records per second that ingestd
+ * handled, and the latency of a record from the time its report was due
+ * to the receive time in the file, so time spent waiting for room in a
+ * PTY is included. Then a time-range query with the index is checked
+ * against all records. The exit code is 1 if a check fails
+ */
+#include "ingest.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+struct pty
+{
+    int master;
+    std::string slave;
+    std::string pending;                        // Not yet written
+};
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(int64_t t_us)
+{
+    struct timespec ts = {(time_t) (t_us / 1000000), (long) (t_us % 1000000) * 1000};
+
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        ;
+}
+
+// Values of report k of a port, 0.1 mV and 0.1 uA steps as the firmware prints them
+static int32_t voltage_uv(long port, long k) { return (port * 7919 + k * 104729) % 30000 * 100; }
+static int32_t current_na(long port, long k) { return ((port * 31 + k * 17) % 20000 - 100) * 100; }
+
+static void report(std::string &out, long port, long k)
+{
+    char text[80];
+    int32_t v = voltage_uv(port, k);
+    int32_t c = current_na(port, k);
+
+    snprintf(text, sizeof(text), "%sMeasured voltage: %d.%04dV\nMeasured current: %s%d.%duA\n",
+             k ? "" : "Let's go! \n", v / 1000000, v / 100 % 10000, (c < 0) ? "-" : "", abs(c) / 1000,
+             abs(c) / 100 % 10);
+    out += text;
+}
+
+// Ask ingestd for its counts, the number of reports parsed
+static long ingestd_records(pid_t pid, FILE *from)
+{
+    char line[256];
+    long records = -1;
+
+    kill(pid, SIGUSR1);
+    while ((records < 0) && fgets(line, sizeof(line), from))
+    {
+        sscanf(line, "ingestd: %ld records", &records);
+    }
+    return records;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--ports N] [--rate HZ] [--time S] [--out FILE] [--ingestd PATH]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    long ports = 2000;
+    double rate = 10.0;
+    double seconds = 5.0;
+    const char *out = "ingest_load.bin";
+    std::string ingestd = argv[0];
+    std::vector<pty> pts;
+    struct rlimit files;
+    int pipe_fd[2];
+    char line[256];
+
+    ingestd = ingestd.substr(0, ingestd.rfind('/') + 1) + "ingestd";
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--ports") && (i + 1 < argc))
+        {
+            ports = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--rate") && (i + 1 < argc))
+        {
+            rate = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--time") && (i + 1 < argc))
+        {
+            seconds = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--out") && (i + 1 < argc))
+        {
+            out = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--ingestd") && (i + 1 < argc))
+        {
+            ingestd = argv[++i];
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if ((ports < 1) || (ports > 65536) || (rate <= 0) || (seconds <= 0))
+    {
+        usage(argv[0]);
+    }
+
+    if (!getrlimit(RLIMIT_NOFILE, &files) && (files.rlim_cur < files.rlim_max))
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    for (long i = 0; i < ports; i++)
+    {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+        if ((fd < 0) || grantpt(fd) || unlockpt(fd))
+        {
+            fprintf(stderr, "%s: can not open PTY %ld: %s\n", argv[0], i, strerror(errno));
+            return 2;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        pts.push_back({fd, ptsname(fd), ""});
+    }
+
+    // ingestd on the slave sides, its output to a pipe
+    std::vector<const char *> args = {ingestd.c_str(), "--out", out, "--flush", "0.2"};
+    for (const pty &p : pts)
+    {
+        args.push_back(p.slave.c_str());
+    }
+    args.push_back(nullptr);
+    if (pipe2(pipe_fd, O_CLOEXEC))
+    {
+        return 2;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(pipe_fd[1], STDOUT_FILENO);
+        execv(args[0], (char **) args.data());
+        fprintf(stderr, "%s: can not run %s: %s\n", argv[0], args[0], strerror(errno));
+        _exit(2);
+    }
+    close(pipe_fd[1]);
+    FILE *from = fdopen(pipe_fd[0], "r");
+    if (!fgets(line, sizeof(line), from) || strncmp(line, "ingestd: ", 9))
+    {
+        fprintf(stderr, "%s: ingestd did not start\n", argv[0]);
+        return 2;
+    }
+
+    // Report i is report i / ports of port i % ports
+    const long total = (long) (ports * rate * seconds);
+    const double step_us = 1e6 / (rate * ports);
+    const int64_t t0 = now_us() + 100000;
+    std::vector<long> waiting;                  // Ports with bytes pending
+    long next = 0;
+    long delayed = 0;
+    auto due_us = [&](long i) { return t0 + (int64_t) (i * step_us); };
+
+    printf("%ld ports, %.1f reports/s each, %ld reports in %.1f s: %.0f reports/s\n", ports, rate, total, seconds,
+           ports * rate);
+    while ((next < total) || !waiting.empty())
+    {
+        int64_t now = now_us();
+
+        for (; (next < total) && (due_us(next) <= now); next++)
+        {
+            pty &p = pts[next % ports];
+
+            if (p.pending.empty())
+            {
+                waiting.push_back(next % ports);
+            }
+            else
+            {
+                delayed++;
+            }
+            report(p.pending, next % ports, next / ports);
+        }
+        for (size_t i = 0; i < waiting.size();)
+        {
+            pty &p = pts[waiting[i]];
+            ssize_t n = write(p.master, p.pending.data(), p.pending.size());
+
+            if ((n < 0) && (errno != EAGAIN))
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], p.slave.c_str(), strerror(errno));
+                return 2;
+            }
+            p.pending.erase(0, (n > 0) ? n : 0);
+            if (p.pending.empty())
+            {
+                waiting[i] = waiting.back();
+                waiting.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+        if (!waiting.empty())
+        {
+            sleep_until_us(now + 200);          // Room in the PTYs
+        }
+        else if (next < total)
+        {
+            sleep_until_us(due_us(next));
+        }
+    }
+
+    // Wait until ingestd has parsed everything
+    long records;
+    int64_t progress = now_us();
+    for (long last = -1; (records = ingestd_records(pid, from)) < total; last = records)
+    {
+        if (records != last)
+        {
+            progress = now_us();
+        }
+        else if ((records < 0) || (now_us() - progress > 5000000))
+        {
+            break;
+        }
+        sleep_until_us(now_us() + 20000);
+    }
+    kill(pid, SIGTERM);
+    while (fgets(line, sizeof(line), from))
+    {
+        fputs(line, stdout);                    // The final counts
+    }
+    int status;
+    struct rusage usage_ingestd, usage_load;
+    wait4(pid, &status, 0, &usage_ingestd);
+    getrusage(RUSAGE_SELF, &usage_load);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0), "ingestd ended with status %d", status);
+    for (const pty &p : pts)
+    {
+        close(p.master);
+    }
+
+    // Read back and check each record
+    ingest_reader reader;
+    std::vector<ingest_record> all;
+    std::vector<long> seen(ports, 0);
+    std::vector<int64_t> latency;
+    long wrong = 0;
+
+    if (!reader.open(out))
+    {
+        fprintf(stderr, "%s: can not read %s\n", argv[0], out);
+        return 1;
+    }
+    CHECK(reader.indexed(), "%s has no index", out);
+    reader.query(INT64_MIN, INT64_MAX, -1, all);
+    for (const ingest_record &r : all)
+    {
+        long k = seen[r.device]++;
+
+        if ((r.voltage_uv != voltage_uv(r.device, k)) || (r.current_na != current_na(r.device, k)))
+        {
+            wrong++;
+        }
+        latency.push_back(r.t_us - due_us(k * ports + r.device));
+    }
+    CHECK((long) all.size() == total, "%zu records in %s, %ld sent", all.size(), out, total);
+    CHECK(wrong == 0, "%ld records with other values than sent", wrong);
+    for (long i = 0; i < ports; i++)
+    {
+        long sent = total / ports + (i < total % ports);
+
+        CHECK(seen[i] == sent, "%s: %ld records, %ld sent", pts[i].slave.c_str(), seen[i], sent);
+    }
+    if (all.empty())
+    {
+        return TEST_RESULT();
+    }
+
+    int64_t first = all.front().t_us;
+    int64_t last = all.front().t_us;
+    for (const ingest_record &r : all)
+    {
+        first = std::min(first, r.t_us);
+        last = std::max(last, r.t_us);
+    }
+    double mean = 0;
+    for (int64_t l : latency)
+    {
+        mean += l / (double) latency.size();
+    }
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&](double p) {
+        return (long) latency[std::min(latency.size() - 1, (size_t) (p * latency.size()))];
+    };
+    printf("%zu records in %.3f s: %.0f records/s, %ld reports sent late\n", all.size(), (last - t0) * 1e-6,
+           all.size() / ((last - t0) * 1e-6), delayed);
+    auto cpu_s = [](const struct rusage &u) {
+        return u.ru_utime.tv_sec + u.ru_stime.tv_sec + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) * 1e-6;
+    };
+    printf("CPU time: ingestd %.3f s, %.2f us per record, ingest_load %.3f s\n", cpu_s(usage_ingestd),
+           cpu_s(usage_ingestd) * 1e6 / all.size(), cpu_s(usage_load));
+    printf("latency: mean %.0f us, median %ld us, 99%% %ld us, 99.9%% %ld us, max %ld us\n", mean, percentile(0.5),
+           percentile(0.99), percentile(0.999), (long) latency.back());
+
+    // The middle third with the index, against all records
+    int64_t from_us = first + (last - first) / 3;
+    int64_t to_us = first + 2 * (last - first) / 3;
+    std::vector<ingest_record> range;
+    size_t blocks = reader.query(from_us, to_us, -1, range);
+    long expected = std::count_if(all.begin(), all.end(),
+                                  [&](const ingest_record &r) { return (r.t_us >= from_us) && (r.t_us < to_us); });
+    printf("query of %.3f s: %zu records, %zu of %zu blocks read\n", (to_us - from_us) * 1e-6, range.size(), blocks,
+           reader.blocks().size());
+    CHECK((long) range.size() == expected, "query: %zu records, %ld in the range", range.size(), expected);
+
+    return TEST_RESULT();
+}
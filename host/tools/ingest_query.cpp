@@ -0,0 +1,118 @@
+/*
+ * ingest_query: print the records of an ingestd file
+ *
+ *   ingest_query [--from T] [--to T] [--port N|NAME] [--count] file
+ *
+ * Prints one line for each record from T (included) to T (excluded), as
+ * "<time> <port> <voltage>V <current>uA". A time is in seconds since the
+ * epoch, or after the first record of the file with a leading '+'. Only
+ * the data blocks of the time range are read, found with the index blocks
+ * or, if the file has no footer, with the block headers. --count prints
+ * only the number of records. The blocks read are reported on stderr
+ */
+#include "ingest.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int64_t parse_time(const char *text, int64_t start_us)
+{
+    int64_t t_us = (int64_t) (atof(text + (text[0] == '+')) * 1e6);
+
+    return (text[0] == '+') ? start_us + t_us : t_us;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--from T] [--to T] [--port N|NAME] [--count] file\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *from = nullptr;
+    const char *to = nullptr;
+    const char *port = nullptr;
+    const char *path = nullptr;
+    bool count_only = false;
+    ingest_reader reader;
+    std::vector<ingest_record> records;
+    int device = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--from") && (i + 1 < argc))
+        {
+            from = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--to") && (i + 1 < argc))
+        {
+            to = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--port") && (i + 1 < argc))
+        {
+            port = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--count"))
+        {
+            count_only = true;
+        }
+        else if ((argv[i][0] == '-') || path)
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (!path)
+    {
+        usage(argv[0]);
+    }
+    if (!reader.open(path))
+    {
+        fprintf(stderr, "%s: %s is not an ingest file\n", argv[0], path);
+        return 2;
+    }
+
+    const std::vector<std::string> &names = reader.devices();
+    for (size_t i = 0; port && (i < names.size()); i++)
+    {
+        if ((names[i] == port) || (strspn(port, "0123456789") == strlen(port) && (size_t) atol(port) == i))
+        {
+            device = i;
+        }
+    }
+    if (port && (device < 0))
+    {
+        fprintf(stderr, "%s: no port %s in %s\n", argv[0], port, path);
+        return 2;
+    }
+    int64_t start_us = INT64_MAX;
+    for (const ingest_block &b : reader.blocks())
+    {
+        start_us = (b.t_min < start_us) ? b.t_min : start_us;
+    }
+    int64_t from_us = from ? parse_time(from, start_us) : INT64_MIN;
+    int64_t to_us = to ? parse_time(to, start_us) : INT64_MAX;
+
+    size_t blocks = reader.query(from_us, to_us, device, records);
+    if (count_only)
+    {
+        printf("%zu\n", records.size());
+    }
+    for (size_t i = 0; !count_only && (i < records.size()); i++)
+    {
+        const ingest_record &r = records[i];
+        int32_t v = r.voltage_uv;
+        int32_t c = r.current_na;
+
+        printf("%lld.%06lld %s %s%d.%06dV %s%d.%03duA\n", (long long) (r.t_us / 1000000),
+               (long long) (r.t_us % 1000000), (r.device < names.size()) ? names[r.device].c_str() : "?",
+               (v < 0) ? "-" : "", abs(v) / 1000000, abs(v) % 1000000, (c < 0) ? "-" : "", abs(c) / 1000, abs(c) % 1000);
+    }
+    fprintf(stderr, "%zu records, %zu of %zu blocks read%s\n", records.size(), blocks, reader.blocks().size(),
+            reader.indexed() ? "" : ", no index");
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * ingestd: collect the ASCII output of analog-current-sensing from many
+ * serial ports into one ingest file
+ *
+ *   ingestd [--out FILE] [--baud RATE] [--flush S] port...
+ *
+ * Each port (a serial device or a PTY) is opened non-blocking in raw mode
+ * and waited for with one epoll set. The bytes of a read are parsed where
+ * they are, in one buffer for all ports; only a line cut by the end of a
+ * read is kept for the next read of that port. Each record gets the time
+ * of the read that completed it and is appended to FILE (ingest.bin), see
+ * tools/ingest.h. The buffered records are written as a block at least
+ * every --flush seconds (1).
+ *
+ * Prints "ingestd: N ports" when all ports are open, and its counts on
+ * SIGUSR1 and at the end. Runs until SIGINT or SIGTERM, or until all ports
+ * are closed. A port is closed when it hangs up. The exit code is 1 if the
+ * file could not be written
+ */
+#include "ingest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_SIZE 65536
+#define MAX_EVENTS 256
+
+struct port
+{
+    int fd;
+    ingest_parser parser;
+};
+
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t report = 0;
+
+static void on_signal(int sig)
+{
+    if (sig == SIGUSR1)
+    {
+        report = 1;
+    }
+    else
+    {
+        stop = 1;
+    }
+}
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static speed_t baud_speed(long baud)
+{
+    switch (baud)
+    {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    default: return B0;
+    }
+}
+
+static int open_port(const char *path, speed_t speed)
+{
+    struct termios tio;
+    int fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if ((fd >= 0) && !tcgetattr(fd, &tio))
+    {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static void print_counts(const std::vector<port> &ports, int open, const ingest_writer &writer)
+{
+    ingest_counts c;
+
+    for (const port &p : ports)
+    {
+        c.bytes += p.parser.counts().bytes;
+        c.records += p.parser.counts().records;
+        c.unknown += p.parser.counts().unknown;
+        c.unpaired += p.parser.counts().unpaired;
+        c.bad += p.parser.counts().bad;
+    }
+    printf("ingestd: %ld records, %ld bytes, %d ports open, %ld written, %ld other lines, %ld unpaired, %ld bad\n",
+           c.records, c.bytes, open, writer.records() + (long) writer.buffered(), c.unknown, c.unpaired, c.bad);
+    fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--out FILE] [--baud RATE] [--flush S] port...\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *out = "ingest.bin";
+    speed_t speed = B115200;
+    double flush_s = 1.0;
+    std::vector<std::string> paths;
+    std::vector<port> ports;
+    std::vector<ingest_record> records;
+    ingest_writer writer;
+    static char buffer[INGEST_LINE_MAX + READ_SIZE];
+    struct epoll_event events[MAX_EVENTS];
+    struct rlimit files;
+    struct sigaction sa;
+    sigset_t block, unblocked;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--out") && (i + 1 < argc))
+        {
+            out = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+        {
+            if ((speed = baud_speed(atol(argv[++i]))) == B0)
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(argv[i], "--flush") && (i + 1 < argc))
+        {
+            flush_s = atof(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty() || (paths.size() > 65536))
+    {
+        usage(argv[0]);
+    }
+
+    // One descriptor for each port
+    if (!getrlimit(RLIMIT_NOFILE, &files) && (files.rlim_cur < files.rlim_max))
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    // The signals only arrive in epoll_pwait(), so none is missed between the checks and the wait
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGUSR1, &sa, nullptr);
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &block, &unblocked);
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        struct epoll_event ev;
+        int fd = open_port(paths[i].c_str(), speed);
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "%s: can not open %s: %s\n", argv[0], paths[i].c_str(), strerror(errno));
+            return 2;
+        }
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+        ports.push_back({fd, ingest_parser(i)});
+    }
+    if (!writer.open(out, paths))
+    {
+        fprintf(stderr, "%s: can not write %s: %s\n", argv[0], out, strerror(errno));
+        return 2;
+    }
+    int open_ports = ports.size();
+    printf("ingestd: %d ports\n", open_ports);
+    fflush(stdout);
+
+    int64_t flushed = now_us();
+    while (!stop && open_ports)
+    {
+        int n = epoll_pwait(ep, events, MAX_EVENTS, (int) (flush_s * 1000), &unblocked);
+
+        for (int i = 0; i < n; i++)
+        {
+            port &p = ports[events[i].data.u32];
+            size_t carried = p.parser.carry(buffer);
+            ssize_t len = read(p.fd, buffer + carried, READ_SIZE);
+
+            if (len > 0)
+            {
+                records.clear();
+                p.parser.parse(buffer, carried + len, now_us(), records);
+                for (const ingest_record &r : records)
+                {
+                    writer.add(r);
+                }
+            }
+            else if ((len == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+            {
+                // Hung up: EOF, or EIO from a PTY without master
+                epoll_ctl(ep, EPOLL_CTL_DEL, p.fd, nullptr);
+                close(p.fd);
+                p.fd = -1;
+                open_ports--;
+            }
+        }
+        if (report)
+        {
+            report = 0;
+            print_counts(ports, open_ports, writer);
+        }
+        if (writer.buffered() && (now_us() - flushed >= flush_s * 1e6))
+        {
+            writer.flush();
+            flushed = now_us();
+        }
+    }
+
+    bool ok = writer.close();
+    print_counts(ports, open_ports, writer);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: can not write %s: %s\n", argv[0], out, strerror(errno));
+    }
+    return ok ? 0 : 1;
+}